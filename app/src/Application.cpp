@@ -2,9 +2,13 @@
 
 #include <cassert>
 
+#include <QtCore/QFileInfo>
 #include <QtWidgets/QMessageBox>
+#include <QtWidgets/QProgressDialog>
 
 #include "Config.hpp"
+#include "IoReactor.hpp"
+#include "UnixSocket.hpp"
 
 Application* Application::m_instance = nullptr;
 QSharedMemory* Application::m_sharedMem = nullptr;
@@ -34,6 +38,10 @@ Application* Application::Instance(int &argc, char* argv[]) {
         return nullptr;
     }
 
+    // Before any socket is created, the reactor starts with the first one
+    UnixSocket::setDefaultBackend(Config::getSocketBackend());
+    IoReactor::setThreadCount(Config::getIoThreadCount());
+
     m_sharedMem = new QSharedMemory("virtual-slides.lock");
     m_sharedMem->attach(QSharedMemory::ReadOnly);
     m_sharedMem->detach();
@@ -65,27 +73,74 @@ void Application::CleanUp() {
     m_sharedMem = nullptr;
 }
 
-PresentationWindow* Application::addWindow(QString presentationPath) {
-    Presentation* presentation;
-    try {
-        presentation = new Presentation(presentationPath);
+PresentationLoader* Application::addWindow(QString presentationPath) {
+    // Everything else is found out by the loader and reported with failed()
+    if(!QFileInfo::exists(presentationPath)) {
+        QMessageBox::critical(nullptr,
+            "Fatal Error",
+            "Failed to load presentation.\n\n"
+            "No such file or directory: " + presentationPath,
+            QMessageBox::Ok
+        );
+        return nullptr;
     }
-    catch(PresentationException &e){
+
+    PresentationLoader* loader = new PresentationLoader(presentationPath);
+
+    QProgressDialog* progressDialog = new QProgressDialog("Opening presentation...",
+        QString(), 0, PresentationLoader::StageCount);
+    progressDialog->setWindowTitle("Virtual Slides");
+    progressDialog->setAttribute(Qt::WA_DeleteOnClose);
+    progressDialog->setMinimumDuration(500);
+
+    connect(loader, &PresentationLoader::stageStarted, progressDialog,
+        [progressDialog](PresentationLoader::Stage stage) {
+            progressDialog->setLabelText(PresentationLoader::stageDescription(stage));
+            progressDialog->setValue(stage);
+        }
+    );
+
+    connect(loader, &PresentationLoader::firstSlideReady, this, [loader](Presentation* presentation) {
+        PresentationWindow* win = new PresentationWindow(presentation, loader);
+        win->setAttribute(Qt::WA_DeleteOnClose);
+        win->showNormal();
+        win->showFullScreen();
+    });
+    // Closed after the window is shown, so the application doesn't quit
+    connect(loader, &PresentationLoader::firstSlideReady, progressDialog, &QProgressDialog::close);
+
+    connect(loader, &PresentationLoader::failed, progressDialog, &QProgressDialog::close);
+    connect(loader, &PresentationLoader::failed, this, [loader](QString cause) {
+        // After the first slide the window would stay open without the rest of the deck
+        QWidget* win = qobject_cast<QWidget*>(loader->parent());
+        if(win) {
+            QMessageBox::critical(win,
+                "Virtual Slides",
+                "Failed to load presentation."
+                "\n\n"
+                + cause +
+                "\n\n"
+                "The presentation will be closed.",
+                QMessageBox::Ok
+            );
+            // Deleted on close, which cancels the loader and frees the presentation
+            win->close();
+            return;
+        }
+
         QMessageBox msgBox(QMessageBox::Critical,
                            "Fatal Error",
                            "Failed to load presentation."
                            "\n\n"
-                           + e.cause(),
+                           + cause,
                            QMessageBox::Ok
         );
         msgBox.exec();
-        return nullptr;
-    }
+        loader->deleteLater();
+        Application::exit(1);
+    });
 
-    PresentationWindow* win = new PresentationWindow(presentation);
-    win->setAttribute(Qt::WA_DeleteOnClose);
-    win->showNormal();
-    win->showFullScreen();
+    loader->start();
 
-    return win;
+    return loader;
 }
\ No newline at end of file
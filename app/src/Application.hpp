@@ -5,6 +5,7 @@
 #include <QtCore/QSharedMemory>
 
 #include "PresentationWindow.hpp"
+#include "PresentationLoader.hpp"
 
 class Application : public QApplication
 {
@@ -14,7 +15,12 @@ public:
     static Application* Instance();
     static Application* Instance(int &argc, char* argv[]);
 
-    PresentationWindow* addWindow(QString presentationPath);
+    /*
+     * Opens the presentation asynchronously, the window is shown once the
+     * first slide is ready. The presentation is an archive or an unpacked
+     * directory. Returns nullptr if it doesn't exist.
+     */
+    PresentationLoader* addWindow(QString presentationPath);
     
     static void CleanUp();
 private:
@@ -0,0 +1,55 @@
+#include "ArchiveManifest.hpp"
+
+#include <QtCore/QDir>
+
+QString ArchiveManifest::normalizePath(const QString& path) {
+    if(path.isEmpty())
+        return QString();
+
+    QString cleanPath = QDir::cleanPath(QDir::fromNativeSeparators(path));
+
+    if(QDir::isAbsolutePath(cleanPath) || cleanPath == ".")
+        return QString();
+    if(cleanPath == ".." || cleanPath.startsWith("../"))
+        return QString();
+
+    return cleanPath;
+}
+
+bool ArchiveManifest::insert(const QString& path, const ArchiveEntry& entry) {
+    QString key = normalizePath(path);
+    if(key.isNull())
+        return false;
+
+    m_entries.insert(key, entry);
+
+    // Archives don't have to contain entries for parent directories
+    qsizetype slash;
+    while((slash = key.lastIndexOf('/')) > 0) {
+        key.truncate(slash);
+        if(m_entries.contains(key))
+            break;
+
+        ArchiveEntry dirEntry;
+        dirEntry.isDir = true;
+        m_entries.insert(key, dirEntry);
+    }
+
+    return true;
+}
+
+bool ArchiveManifest::contains(const QString& path) const {
+    QString key = normalizePath(path);
+    return !key.isNull() && m_entries.contains(key);
+}
+
+const ArchiveEntry* ArchiveManifest::entry(const QString& path) const {
+    QString key = normalizePath(path);
+    if(key.isNull())
+        return nullptr;
+
+    auto it = m_entries.constFind(key);
+    if(it == m_entries.constEnd())
+        return nullptr;
+    return &it.value();
+}
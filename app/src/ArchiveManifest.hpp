@@ -0,0 +1,42 @@
+#ifndef ARCHIVEMANIFEST_HPP
+#define ARCHIVEMANIFEST_HPP
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+struct ArchiveEntry {
+    quint64 index = 0; // Index in the zip's central directory
+    qint64 size = 0;
+    qint64 compressedSize = 0;
+    quint32 crc = 0;
+    bool isDir = false;
+};
+
+/*
+ * Index of a presentation archive, built once from the zip's central
+ * directory. Paths are normalised, so lookups don't touch the filesystem
+ * and paths escaping the archive (absolute or "../") never resolve.
+ */
+class ArchiveManifest
+{
+public:
+    /* Returns a normalised relative path, or a null string if it would escape the archive */
+    static QString normalizePath(const QString& path);
+
+    /* Returns false if the path is not safe to be extracted */
+    bool insert(const QString& path, const ArchiveEntry& entry);
+    void clear() { m_entries.clear(); }
+    void reserve(qsizetype size) { m_entries.reserve(size); }
+
+    bool contains(const QString& path) const;
+    /* Returns nullptr if the entry does not exist */
+    const ArchiveEntry* entry(const QString& path) const;
+
+    QStringList paths() const { return m_entries.keys(); }
+    qsizetype count() const { return m_entries.count(); }
+private:
+    QHash<QString, ArchiveEntry> m_entries;
+};
+
+#endif // ARCHIVEMANIFEST_HPP
@@ -18,6 +18,17 @@ size_t Config::m_guestMemSize = 256;
 size_t Config::m_guestProcCount = 2;
 QString Config::m_guestKernelPath = nullptr;
 
+size_t Config::m_slidePrefetchDistance = 1;
+
+UnixSocket::Backend Config::m_socketBackend = UnixSocket::Reactor;
+size_t Config::m_ioThreadCount = 1;
+size_t Config::m_ioStatsInterval = 0;
+size_t Config::m_consoleBufferSize = 1024 * 1024;
+UnixSocket::OverflowPolicy Config::m_terminalOverflowPolicy = UnixSocket::DropOldest;
+bool Config::m_vsockSharedMemory = true;
+bool Config::m_consoleSplice = true;
+bool Config::m_vsockMultiplex = false;
+
 #ifdef Q_PROCESSOR_X86_64
 bool Config::m_kvmEnabled = true;
 #else
@@ -152,6 +163,121 @@ void Config::Initializate(QString configJsonPath) {
 #endif
     } 
 
+    if(configJson.contains("slidePrefetchDistance")){
+        json prefetchDistance = configJson["slidePrefetchDistance"];
+        
+        if(!prefetchDistance.is_number_unsigned()){
+            QString exceptionStr = "Failed to parse \"" + configJsonPath + "\": ";
+            exceptionStr += "Field \"slidePrefetchDistance\" exists, but it's of a wrong type";
+            throw ConfigException(exceptionStr);   
+        }
+        m_slidePrefetchDistance = prefetchDistance;
+    } 
+
+    if(configJson.contains("socketBackend")){
+        json socketBackend = configJson["socketBackend"];
+        
+        if(socketBackend == "reactor"){
+            m_socketBackend = UnixSocket::Reactor;
+        }
+        else if(socketBackend == "notifier"){
+            m_socketBackend = UnixSocket::Notifier;
+        }
+        else if(socketBackend == "io_uring"){
+            m_socketBackend = UnixSocket::Uring;
+        }
+        else{
+            QString exceptionStr = "Failed to parse \"" + configJsonPath + "\": ";
+            exceptionStr += "Field \"socketBackend\" exists, but it's not one of \"reactor\", \"notifier\" or \"io_uring\"";
+            throw ConfigException(exceptionStr);   
+        }
+    } 
+
+    if(configJson.contains("ioThreads")){
+        json ioThreads = configJson["ioThreads"];
+        
+        if(!ioThreads.is_number_unsigned() || ioThreads < 1){
+            QString exceptionStr = "Failed to parse \"" + configJsonPath + "\": ";
+            exceptionStr += "Field \"ioThreads\" exists, but it's of a wrong type, or lesser than 1";
+            throw ConfigException(exceptionStr);   
+        }
+        m_ioThreadCount = ioThreads;
+    } 
+
+    if(configJson.contains("ioStatsInterval")){
+        json ioStatsInterval = configJson["ioStatsInterval"];
+        
+        if(!ioStatsInterval.is_number_unsigned()){
+            QString exceptionStr = "Failed to parse \"" + configJsonPath + "\": ";
+            exceptionStr += "Field \"ioStatsInterval\" exists, but it's of a wrong type";
+            throw ConfigException(exceptionStr);   
+        }
+        m_ioStatsInterval = ioStatsInterval;
+    } 
+
+    if(configJson.contains("consoleBufferSize")){
+        json consoleBufferSize = configJson["consoleBufferSize"];
+        
+        if(!consoleBufferSize.is_number_unsigned() || consoleBufferSize < 1){
+            QString exceptionStr = "Failed to parse \"" + configJsonPath + "\": ";
+            exceptionStr += "Field \"consoleBufferSize\" exists, but it's of a wrong type, or lesser than 1";
+            throw ConfigException(exceptionStr);   
+        }
+        m_consoleBufferSize = (size_t)consoleBufferSize * 1024;
+    } 
+
+    if(configJson.contains("terminalOverflowPolicy")){
+        json terminalOverflowPolicy = configJson["terminalOverflowPolicy"];
+        
+        if(terminalOverflowPolicy == "drop"){
+            m_terminalOverflowPolicy = UnixSocket::DropOldest;
+        }
+        else if(terminalOverflowPolicy == "disconnect"){
+            m_terminalOverflowPolicy = UnixSocket::Disconnect;
+        }
+        else if(terminalOverflowPolicy == "block"){
+            m_terminalOverflowPolicy = UnixSocket::Block;
+        }
+        else{
+            QString exceptionStr = "Failed to parse \"" + configJsonPath + "\": ";
+            exceptionStr += "Field \"terminalOverflowPolicy\" exists, but it's not one of \"drop\", \"disconnect\" or \"block\"";
+            throw ConfigException(exceptionStr);   
+        }
+    } 
+
+    if(configJson.contains("vsockSharedMemory")){
+        json vsockSharedMemory = configJson["vsockSharedMemory"];
+        
+        if(!vsockSharedMemory.is_boolean()){
+            QString exceptionStr = "Failed to parse \"" + configJsonPath + "\": ";
+            exceptionStr += "Field \"vsockSharedMemory\" exists, but it's of a wrong type";
+            throw ConfigException(exceptionStr);   
+        }
+        m_vsockSharedMemory = vsockSharedMemory;
+    } 
+
+    if(configJson.contains("consoleSplice")){
+        json consoleSplice = configJson["consoleSplice"];
+        
+        if(!consoleSplice.is_boolean()){
+            QString exceptionStr = "Failed to parse \"" + configJsonPath + "\": ";
+            exceptionStr += "Field \"consoleSplice\" exists, but it's of a wrong type";
+            throw ConfigException(exceptionStr);   
+        }
+        m_consoleSplice = consoleSplice;
+    } 
+
+    if(configJson.contains("vsockMultiplex")){
+        json vsockMultiplex = configJson["vsockMultiplex"];
+        
+        if(!vsockMultiplex.is_boolean()){
+            QString exceptionStr = "Failed to parse \"" + configJsonPath + "\": ";
+            exceptionStr += "Field \"vsockMultiplex\" exists, but it's of a wrong type";
+            throw ConfigException(exceptionStr);   
+        }
+        m_vsockMultiplex = vsockMultiplex;
+    } 
+
     m_initializated = true;
 }
 
@@ -181,9 +307,54 @@ bool Config::getKvmEnabled() {
     return m_kvmEnabled;
 }
 
+size_t Config::getSlidePrefetchDistance() {
+    assert(m_initializated == true);
+    return m_slidePrefetchDistance;
+}
+
 void Config::CleanUp() {
     for(auto diskImage : m_diskImages){
         delete diskImage;
     }
     m_initializated = false;
+}
+
+UnixSocket::Backend Config::getSocketBackend() {
+    assert(m_initializated == true);
+    return m_socketBackend;
+}
+
+size_t Config::getIoThreadCount() {
+    assert(m_initializated == true);
+    return m_ioThreadCount;
+}
+
+size_t Config::getIoStatsInterval() {
+    assert(m_initializated == true);
+    return m_ioStatsInterval;
+}
+
+size_t Config::getConsoleBufferSize() {
+    assert(m_initializated == true);
+    return m_consoleBufferSize;
+}
+
+UnixSocket::OverflowPolicy Config::getTerminalOverflowPolicy() {
+    assert(m_initializated == true);
+    return m_terminalOverflowPolicy;
+}
+
+bool Config::getVsockSharedMemory() {
+    assert(m_initializated == true);
+    return m_vsockSharedMemory;
+}
+
+bool Config::getConsoleSplice() {
+    assert(m_initializated == true);
+    return m_consoleSplice;
+}
+
+bool Config::getVsockMultiplex() {
+    assert(m_initializated == true);
+    return m_vsockMultiplex;
 }
\ No newline at end of file
@@ -7,6 +7,8 @@
 
 #include <exception>
 
+#include "UnixSocket.hpp"
+
 class ConfigException : std::exception
 {
 public:
@@ -35,6 +37,20 @@ public:
     static size_t getGuestProcCount();
     static QString getGuestKernelPath();
     static bool getKvmEnabled();
+    static size_t getSlidePrefetchDistance();
+    static UnixSocket::Backend getSocketBackend();
+    static size_t getIoThreadCount();
+    /* Seconds between the dumps of the VMs' I/O statistics, 0 if disabled */
+    static size_t getIoStatsInterval();
+    /* Bytes queued for a console client (or the console) before its overflow policy kicks in */
+    static size_t getConsoleBufferSize();
+    static UnixSocket::OverflowPolicy getTerminalOverflowPolicy();
+    /* Whether QEMU offers shared memory rings for the vsock-user connections */
+    static bool getVsockSharedMemory();
+    /* Whether the console is relayed with splice() rather than through the GUI process' buffers */
+    static bool getConsoleSplice();
+    /* Whether QEMU carries the guest's vsock-user connections over one socket instead of one each */
+    static bool getVsockMultiplex();
 private:
     static bool m_initializated;
     static QMap<QString, DiskImage*> m_diskImages;
@@ -43,6 +59,15 @@ private:
     static size_t m_guestProcCount;
     static QString m_guestKernelPath;
     static bool m_kvmEnabled;
+    static size_t m_slidePrefetchDistance;
+    static UnixSocket::Backend m_socketBackend;
+    static size_t m_ioThreadCount;
+    static size_t m_ioStatsInterval;
+    static size_t m_consoleBufferSize;
+    static UnixSocket::OverflowPolicy m_terminalOverflowPolicy;
+    static bool m_vsockSharedMemory;
+    static bool m_consoleSplice;
+    static bool m_vsockMultiplex;
 };
 
 #endif // CONFIG_HPP
\ No newline at end of file
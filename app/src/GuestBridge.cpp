@@ -1,12 +1,18 @@
 #include "GuestBridge.hpp"
 
+#include <QtCore/QFile>
+#include <QtCore/QPointer>
+#include <QtCore/QScopedValueRollback>
 #include <QtWidgets/QMessageBox>
 
+#include "GuestBridgeServer.hpp"
 #include "VSockUser.hpp"
-#include "VSockUserServer.hpp"
 
 const static QByteArray _downloadTest(384*1024*1024, 'a');
 
+/* Queued on a connection before a streamed response waits for bytesWritten() */
+#define BRIDGE_WRITE_QUEUE_LIMIT (256 * 1024)
+
 using namespace nlohmann;
 
 
@@ -17,63 +23,110 @@ GuestBridge::GuestBridge(VirtualMachine* vm) : QObject(vm), m_vm(vm)
 
 GuestBridge::~GuestBridge() {
     stop();
+    qDeleteAll(m_payloadResponses);
+    m_payloadResponses.clear();
 }
 
 bool GuestBridge::start() {
     if(m_started)
         return true;
 
-    m_server = new VSockUserServer(this);
-
-    if(!m_server->listen(m_vm->m_vsockUserHostServerPath, VSockUserServer::Host, m_vm->m_cid)) {
-        qWarning() << "VSockUserServer failed:" << m_server->errorString();
+    GuestBridgeServer* server = GuestBridgeServer::instance();
+    if(!server || !server->registerBridge(m_vm->m_cid, this)) {
+        qWarning() << "GuestBridgeServer failed to register cid" << m_vm->m_cid;
         return false;
     }
 
-    connect(m_server, &VSockUserServer::newConnection, this, [this] {
-        VSockUser* sock = m_server->nextPendingConnection();
-        connect(sock, &VSockUser::readyRead, [sock, this] {
-            handleVmSockReadReady(sock);
-        });
-        connect(sock, &VSockUser::errorOccurred, [sock] {
-            qWarning() << "An error occurred on VSockUser:" << sock->errorString();
-            sock->close();
-            sock->deleteLater();
-        });
-        connect(sock, &VSockUser::disconnected, [sock] {
-            sock->deleteLater();
-        });
-    });
-
     m_started = true;
     return true;
 }
 
+void GuestBridge::addConnection(VSockUser* sock) {
+    sock->setParent(this);
+    m_sockets.insert(sock);
+    connect(sock, &VSockUser::readyRead, [sock, this] {
+        handleVmSockReadReady(sock);
+    });
+    connect(sock, &VSockUser::bytesWritten, this, [sock, this] {
+        writePayloads(sock);
+    });
+    connect(sock, &VSockUser::errorOccurred, [sock] {
+        qWarning() << "An error occurred on VSockUser:" << sock->errorString();
+        sock->close();
+        sock->deleteLater();
+    });
+    connect(sock, &VSockUser::disconnected, this, [sock, this] {
+        if(m_sockets.remove(sock))
+            m_closedStatistics += sock->statistics();
+        sock->deleteLater();
+    });
+    connect(sock, &QObject::destroyed, this, [sock, this] {
+        m_sockets.remove(sock);
+        m_pendingRequests.remove(sock);
+        delete m_payloadResponses.take(sock);
+    });
+}
+
+SocketStatistics GuestBridge::statistics() const {
+    SocketStatistics stats = m_closedStatistics;
+    for(VSockUser* sock : m_sockets)
+        stats += sock->statistics();
+    return stats;
+}
+
 bool GuestBridge::isListening() {
-    return m_started;
+    GuestBridgeServer* server = GuestBridgeServer::instance();
+    return m_started && server && server->isListening();
 }
 
 void GuestBridge::stop() {
     if (!m_started)
         return;
     
-    m_server->close();
-    if (m_server) {
-        m_server->deleteLater();
-        m_server = nullptr;
-    }
+    if(GuestBridgeServer* server = GuestBridgeServer::instance())
+        server->unregisterBridge(m_vm->m_cid, this);
+    // The server used to take them along when it was the bridge's own
+    for (VSockUser* sock : QSet<VSockUser*>(m_sockets))
+        sock->close();
     m_started = false;
 }
 
-static json installFileToJson(InstallFile* installFile){
+/* Appends bytes as the elements of a JSON array of numbers */
+static void appendJsonBytes(QByteArray& out, QByteArrayView data, bool& first) {
+    out.reserve(out.size() + data.size() * 4);
+    for (char c : data) {
+        uchar byte = c;
+        if (!first)
+            out += ',';
+        first = false;
+
+        if (byte >= 100)
+            out += char('0' + byte / 100);
+        if (byte >= 10)
+            out += char('0' + byte / 10 % 10);
+        out += char('0' + byte % 10);
+    }
+}
+
+/* The install file's object up to its content, which is appended as the last member */
+static QByteArray installFileHeader(const InstallFile& installFile) {
     json json;
-    json["content"] = installFile->content;
-    json["path"] = installFile->vmPath.toStdString();
-    json["uid"] = installFile->owner;
-    json["gid"] = installFile->group;
-    json["perm"] = installFile->perm;
+    json["path"] = installFile.vmPath.toStdString();
+    json["uid"] = installFile.owner;
+    json["gid"] = installFile.group;
+    json["perm"] = installFile.perm;
 
-    return json;
+    std::string header = json.dump();
+    header.back() = ',';
+    return QByteArray::fromStdString(header);
+}
+
+static bool payloadsAvailable(const QList<Payload>& payloads) {
+    for (auto &payload : payloads) {
+        if (payload.isFile() && !QFile::exists(payload.path()))
+            return false;
+    }
+    return true;
 }
 
 void GuestBridge::parseRequest(VSockUser* sock, QString request) {
@@ -107,24 +160,38 @@ void GuestBridge::parseRequest(VSockUser* sock, QString request) {
         response["hostname"] = m_vm->m_hostname.toStdString();
         response.update(statusResponse(ResponseStatus::Ok));
     }
-    else if (requestType == "getInstallFiles") {
-        std::vector<json> installFiles;
-        for (auto &installFile : m_vm->m_installFiles)
-            installFiles.push_back(installFileToJson(&installFile));
-        
-        response["installFiles"] = installFiles;
-        response.update(statusResponse(ResponseStatus::Ok));
-    }
-    else if (requestType == "getInitScripts") {
-        std::vector<json> initScripts;
-        for (auto &initScript : m_vm->m_initScripts) {
-            json json;
-            json["content"] = initScript.content;
-            initScripts.push_back(json);
+    else if (requestType == "getInstallFiles" || requestType == "getInitScripts") {
+        // Payloads are streamed straight from the extracted files instead of being serialised at once
+        bool installFiles = requestType == "getInstallFiles";
+        QList<Payload> payloads;
+        if (installFiles) {
+            for (auto &installFile : m_vm->m_installFiles)
+                payloads += installFile.content;
+        }
+        else {
+            for (auto &initScript : m_vm->m_initScripts)
+                payloads += initScript.content;
         }
 
-        response["initScripts"] = initScripts;
-        response.update(statusResponse(ResponseStatus::Ok));
+        if (payloadsAvailable(payloads)) {
+            PayloadResponse* payloadResponse = new PayloadResponse;
+            payloadResponse->payloads = payloads;
+            for (qsizetype i = 0; i < payloads.size(); ++i) {
+                QByteArray prefix = i > 0 ? "," : "";
+                prefix += installFiles ? installFileHeader(m_vm->m_installFiles[i]) : QByteArray("{");
+                payloadResponse->prefixes += prefix + "\"content\":[";
+            }
+
+            sock->write(installFiles ? "{\"status\":\"ok\",\"installFiles\":["
+                : "{\"status\":\"ok\",\"initScripts\":[");
+            m_payloadResponses.insert(sock, payloadResponse);
+            writePayloads(sock);
+            return;
+        }
+
+        response.update(statusResponse(ResponseStatus::Err,
+            "Payload of an " + std::string(installFiles ? "install file" : "init script")
+            + " is no longer available"));
     }
     else if (requestType == "getTasks") {
         std::vector<json> tasks;
@@ -177,15 +244,71 @@ void GuestBridge::parseRequest(VSockUser* sock, QString request) {
     sock->write(jsonResponseStr);
 }
 
+void GuestBridge::writePayloads(VSockUser* sock) {
+    PayloadResponse* response = m_payloadResponses.value(sock);
+    // A socket's write() may emit bytesWritten() right away
+    if (!response || m_writingPayloads)
+        return;
+    QScopedValueRollback<bool> writing(m_writingPayloads, true);
+
+    // A chunk at a time, the rest follows bytesWritten()
+    while (sock->isOpen() && sock->bytesToWrite() < BRIDGE_WRITE_QUEUE_LIMIT) {
+        if (!response->reader) {
+            if (response->index == response->payloads.size()) {
+                sock->write("]}\x1e");
+                delete m_payloadResponses.take(sock);
+
+                // Requests that came during the response were held back
+                QPointer<VSockUser> guard = sock;
+                QMetaObject::invokeMethod(this, [this, guard] {
+                    if (guard)
+                        handleVmSockReadReady(guard);
+                }, Qt::QueuedConnection);
+                return;
+            }
+            sock->write(response->prefixes[response->index]);
+            response->reader.reset(new PayloadReader(response->payloads[response->index]));
+            response->first = true;
+        }
+
+        QByteArrayView chunk;
+        QString error;
+        if (!response->reader->next(&chunk, &error)) {
+            qWarning() << "Failed to read" << response->payloads[response->index].path() << ":" << error;
+            // Part of the document is out, the guest would wait for the rest of it
+            delete m_payloadResponses.take(sock);
+            sock->close();
+            return;
+        }
+        if (chunk.isEmpty()) {
+            sock->write("]}");
+            response->reader.reset();
+            response->index++;
+            continue;
+        }
+
+        QByteArray out;
+        appendJsonBytes(out, chunk, response->first);
+        sock->write(out);
+    }
+}
+
 void GuestBridge::handleVmSockReadReady(VSockUser* sock) {
-    requestStr += sock->readAll();
+    // Only removed once the socket is destroyed, so it outlives parseRequest()
+    PendingRequest& pending = m_pendingRequests[sock];
+    pending.data += sock->readAll();
 
-    while (requestStr.contains("\x1e") != false) {
-        QString request = requestStr;
-        request.truncate(requestStr.indexOf("\x1e"));
-        parseRequest(sock, request);
-        requestStr.remove(0, request.length() + 1);
+    // Only the newly received bytes are searched for the separator
+    qsizetype begin = 0;
+    qsizetype end;
+    while (!m_payloadResponses.contains(sock)
+        && (end = pending.data.indexOf('\x1e', qMax(begin, pending.scanned))) >= 0) {
+        parseRequest(sock, QString::fromUtf8(pending.data.constData() + begin, end - begin));
+        begin = end + 1;
     }
+    pending.data.remove(0, begin);
+    // Held back behind a streamed response, searched again once it's done
+    pending.scanned = m_payloadResponses.contains(sock) ? 0 : pending.data.size();
 }
 
 json GuestBridge::statusResponse(ResponseStatus status, std::string errStr) {
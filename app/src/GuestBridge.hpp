@@ -2,6 +2,10 @@
 #define GUESTBRIDGE_HPP
 
 #include <QtCore/QObject>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+
+#include <memory>
 
 class GuestBridge;
 
@@ -10,7 +14,6 @@ class GuestBridge;
 #include "third-party/nlohmann/json.hpp"
 
 class VSockUser;
-class VSockUserServer;
 
 class GuestBridge : public QObject {
     Q_OBJECT
@@ -20,8 +23,16 @@ public:
     
     bool isListening();
 
+    /* Registers the VM's cid with the GuestBridgeServer */
     bool start();
+    /* Unregisters it and closes the bridge's connections */
     void stop();
+
+    /* Takes over a connection the GuestBridgeServer routed to the VM */
+    void addConnection(VSockUser* sock);
+
+    /* Summed over the bridge's connections, closed ones included */
+    SocketStatistics statistics() const;
 private:
     enum ResponseStatus {
         Ok,
@@ -29,6 +40,8 @@ private:
     };
     void parseRequest(VSockUser* sock, QString request);
     nlohmann::json statusResponse(ResponseStatus status, std::string errStr = "");
+    /* Continues the connection's streamed response while its write queue is short */
+    void writePayloads(VSockUser* sock);
 private slots:
     void handleVmSockReadReady(VSockUser* sock);
 private:
@@ -36,9 +49,33 @@ private:
 
     VirtualMachine* m_vm = nullptr;
     
-    VSockUserServer* m_server = nullptr;
+    QSet<VSockUser*> m_sockets;
+    SocketStatistics m_closedStatistics;
 
-    QString requestStr;
+    /* Received but not yet terminated requests, per connection */
+    struct PendingRequest {
+        QByteArray data;
+        /* data before this has been searched for the separator already */
+        qsizetype scanned = 0;
+    };
+    QHash<VSockUser*, PendingRequest> m_pendingRequests;
+
+    /*
+     * A getInstallFiles or getInitScripts response being written, one chunk
+     * of a payload at a time. Requests after it wait until it's complete.
+     */
+    struct PayloadResponse {
+        /* Written before each payload's byte array */
+        QList<QByteArray> prefixes;
+        QList<Payload> payloads;
+        qsizetype index = 0;
+        /* Of payloads[index], null until its array is opened */
+        std::unique_ptr<PayloadReader> reader;
+        /* No byte of the array written yet */
+        bool first = true;
+    };
+    QHash<VSockUser*, PayloadResponse*> m_payloadResponses;
+    bool m_writingPayloads = false;
 };
 
 #endif // GUESTBRIDGE_HPP
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "GuestBridgeServer.hpp"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QUuid>
+
+#include "GuestBridge.hpp"
+#include "VSockUser.hpp"
+#include "VSockUserServer.hpp"
+
+GuestBridgeServer* GuestBridgeServer::instance() {
+    static QPointer<GuestBridgeServer> server;
+    // Not brought back by the VMs destroyed after the application
+    if(!server && QCoreApplication::instance() && !QCoreApplication::closingDown())
+        server = new GuestBridgeServer(QCoreApplication::instance());
+    return server;
+}
+
+GuestBridgeServer::GuestBridgeServer(QObject* parent) : QObject(parent) {
+    m_server = new VSockUserServer(this);
+    // Guests the server has no bridge for are refused, like with no listener at all
+    m_server->setConnectionFilter([this](uint32_t, uint32_t hostPort, uint32_t vmCid, uint32_t) {
+        return hostPort == vmCid && m_bridges.value(vmCid);
+    });
+    connect(m_server, &VSockUserServer::newConnection, this, &GuestBridgeServer::handleNewConnection);
+    listen();
+}
+
+bool GuestBridgeServer::listen() {
+    QString path = QFileInfo(QDir::tempPath() + "/" + QUuid::createUuid().toString(QUuid::WithoutBraces)).absoluteFilePath();
+    if(!m_server->listen(path, VSockUserServer::Host, VSockUserServer::Any)) {
+        qWarning() << "GuestBridgeServer: VSockUserServer failed:" << m_server->errorString();
+        return false;
+    }
+    return true;
+}
+
+bool GuestBridgeServer::isListening() const {
+    return m_server->isListening();
+}
+
+QString GuestBridgeServer::fullServerName() const {
+    return m_server->fullServerName();
+}
+
+QString GuestBridgeServer::errorString() const {
+    return m_server->errorString();
+}
+
+bool GuestBridgeServer::registerBridge(uint32_t cid, GuestBridge* bridge) {
+    // Retried on a new path, only VMs started from now on get it
+    if(!isListening() && !listen())
+        return false;
+
+    QPointer<GuestBridge> registered = m_bridges.value(cid);
+    if(registered && registered != bridge)
+        return false;
+    m_bridges.insert(cid, bridge);
+    return true;
+}
+
+void GuestBridgeServer::unregisterBridge(uint32_t cid, GuestBridge* bridge) {
+    if(m_bridges.value(cid) == bridge)
+        m_bridges.remove(cid);
+}
+
+void GuestBridgeServer::handleNewConnection() {
+    while(VSockUser* sock = m_server->nextPendingConnection()) {
+        // Unregistered since the filter let it through
+        GuestBridge* bridge = m_bridges.value(sock->vmCid());
+        if(!bridge) {
+            sock->close();
+            sock->deleteLater();
+            continue;
+        }
+        bridge->addConnection(sock);
+    }
+}
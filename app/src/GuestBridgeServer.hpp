@@ -0,0 +1,42 @@
+#ifndef GUESTBRIDGESERVER_HPP
+#define GUESTBRIDGESERVER_HPP
+
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QPointer>
+
+class GuestBridge;
+class VSockUserServer;
+
+/*
+ * The host's end of every VM's guest bridge: a single vsock-user server
+ * all QEMU processes connect to, instead of one per VM. A connection goes
+ * to the bridge registered for the key's vm_cid, guests connect to the
+ * host port of their own cid. QEMU only lets a guest use its own cid.
+ */
+class GuestBridgeServer : public QObject {
+    Q_OBJECT
+public:
+    /* Listens on first use, lives as long as the application, nullptr after it */
+    static GuestBridgeServer* instance();
+
+    bool isListening() const;
+    /* The host-uds-path of the VMs' virtio-vsock devices */
+    QString fullServerName() const;
+    QString errorString() const;
+
+    /* Returns false if another bridge has the cid or the server can't listen */
+    bool registerBridge(uint32_t cid, GuestBridge* bridge);
+    /* Established connections stay with the bridge */
+    void unregisterBridge(uint32_t cid, GuestBridge* bridge);
+private:
+    GuestBridgeServer(QObject* parent);
+
+    bool listen();
+    void handleNewConnection();
+private:
+    VSockUserServer* m_server = nullptr;
+    QHash<uint32_t, QPointer<GuestBridge>> m_bridges;
+};
+
+#endif // GUESTBRIDGESERVER_HPP
@@ -0,0 +1,77 @@
+#include "HtmlBoxWidget.hpp"
+
+#include <QtGui/QAbstractTextDocumentLayout>
+#include <QtGui/QPainter>
+#include <QtGui/QPixmapCache>
+
+#include <atomic>
+#include <cassert>
+
+static std::atomic<quint64> documentIdCounter { 0 };
+
+HtmlDocument::HtmlDocument(const QString& html) : m_id(documentIdCounter++) {
+    m_document.setHtml(html);
+}
+
+const QTextDocument* HtmlDocument::layout(int width, const QFont& font) {
+    QString key = QString::number(width) + ":" + font.key();
+    QTextDocument* doc = m_layouts.object(key);
+    if(doc)
+        return doc;
+
+    // Cloning doesn't parse the HTML again
+    doc = m_document.clone();
+    doc->setDefaultFont(font);
+    doc->setTextWidth(width);
+    doc->size(); // forces the layout
+    m_layouts.insert(key, doc);
+
+    return doc;
+}
+
+QPixmap HtmlDocument::render(QSize size, qreal devicePixelRatio, const QPalette& palette, const QFont& font) {
+    // The same box is on slides with different colors and fonts
+    QString key = QStringLiteral("vs-html-box:%1:%2x%3@%4:%5:%6:%7:%8")
+        .arg(m_id).arg(size.width()).arg(size.height()).arg(devicePixelRatio)
+        .arg(palette.color(QPalette::Text).rgba()).arg(palette.color(QPalette::WindowText).rgba())
+        .arg(palette.color(QPalette::Link).rgba()).arg(font.key());
+
+    QPixmap pixmap;
+    if(QPixmapCache::find(key, &pixmap))
+        return pixmap;
+
+    const QTextDocument* doc = layout(size.width(), font);
+
+    pixmap = QPixmap(size * devicePixelRatio);
+    pixmap.setDevicePixelRatio(devicePixelRatio);
+    pixmap.fill(Qt::transparent);
+
+    // Vertically centered, like a QLabel with default alignment
+    qreal offsetY = qMax<qreal>(0, (size.height() - doc->size().height()) / 2);
+
+    QPainter painter(&pixmap);
+    painter.translate(0, offsetY);
+
+    QAbstractTextDocumentLayout::PaintContext ctx;
+    ctx.palette = palette;
+    ctx.clip = QRectF(0, -offsetY, size.width(), size.height());
+    doc->documentLayout()->draw(&painter, ctx);
+    painter.end();
+
+    QPixmapCache::insert(key, pixmap);
+    return pixmap;
+}
+
+HtmlBoxWidget::HtmlBoxWidget(QSharedPointer<HtmlDocument> document, QWidget* parent)
+    : QWidget(parent), m_document(document)
+{
+    assert(m_document);
+}
+
+void HtmlBoxWidget::paintEvent(QPaintEvent *event) {
+    if(width() <= 0 || height() <= 0)
+        return;
+
+    QPainter painter(this);
+    painter.drawPixmap(0, 0, m_document->render(size(), devicePixelRatioF(), palette(), font()));
+}
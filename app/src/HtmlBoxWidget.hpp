@@ -0,0 +1,43 @@
+#ifndef HTMLBOXWIDGET_HPP
+#define HTMLBOXWIDGET_HPP
+
+#include <QtCore/QCache>
+#include <QtCore/QSharedPointer>
+#include <QtGui/QTextDocument>
+#include <QtGui/QPixmap>
+#include <QtWidgets/QWidget>
+
+/*
+ * HTML content of a <box><html> element, parsed once at load time.
+ * It's shared by every box with the same content. Layouts are cached per
+ * text width and font, and rendered boxes are cached in QPixmapCache along
+ * with the colors they were drawn in, so resizing or repainting a slide
+ * doesn't lay out the whole document again.
+ */
+class HtmlDocument
+{
+public:
+    HtmlDocument(const QString& html);
+
+    /* Returns the document laid out for the given width, in font where the HTML doesn't set one */
+    const QTextDocument* layout(int width, const QFont& font);
+    QPixmap render(QSize size, qreal devicePixelRatio, const QPalette& palette, const QFont& font);
+private:
+    const quint64 m_id;
+
+    QTextDocument m_document;
+    QCache<QString, QTextDocument> m_layouts = QCache<QString, QTextDocument>(4);
+};
+
+class HtmlBoxWidget : public QWidget
+{
+    Q_OBJECT
+public:
+    HtmlBoxWidget(QSharedPointer<HtmlDocument> document, QWidget* parent = nullptr);
+protected:
+    void paintEvent(QPaintEvent *event) override;
+private:
+    QSharedPointer<HtmlDocument> m_document;
+};
+
+#endif // HTMLBOXWIDGET_HPP
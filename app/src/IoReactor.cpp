@@ -0,0 +1,172 @@
+#include "IoReactor.hpp"
+
+#include <QtCore/QDebug>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <cassert>
+#include <cstring>
+
+#define REACTOR_MAX_EVENTS 64
+/* Low bits of a token select the thread, 0 is the wakeup eventfd */
+#define REACTOR_THREAD_BITS 8
+#define REACTOR_WAKEUP_TOKEN 0
+
+int IoReactor::s_threadCount = 1;
+
+IoReactor* IoReactor::instance() {
+    static IoReactor reactor(s_threadCount);
+    return &reactor;
+}
+
+void IoReactor::setThreadCount(int count) {
+    s_threadCount = qBound(1, count, 1 << REACTOR_THREAD_BITS);
+}
+
+int IoReactor::threadCount() {
+    return s_threadCount;
+}
+
+IoReactor::IoReactor(int threadCount) {
+    for(int i = 0; i < threadCount; i++) {
+        ReactorThread* reactorThread = new ReactorThread();
+        reactorThread->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        reactorThread->wakeupFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if(reactorThread->epollFd < 0 || reactorThread->wakeupFd < 0) {
+            qFatal("IoReactor: failed to create epoll instance: %s", strerror(errno));
+        }
+
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = REACTOR_WAKEUP_TOKEN;
+        epoll_ctl(reactorThread->epollFd, EPOLL_CTL_ADD, reactorThread->wakeupFd, &event);
+
+        reactorThread->thread = QThread::create([this, reactorThread] { run(reactorThread); });
+        reactorThread->thread->setObjectName(QString("vs-io-reactor-%1").arg(i));
+        reactorThread->thread->start();
+        m_threads.append(reactorThread);
+    }
+}
+
+IoReactor::~IoReactor() {
+    m_stopping = true;
+    for(ReactorThread* reactorThread : m_threads) {
+        uint64_t one = 1;
+        ssize_t rc = ::write(reactorThread->wakeupFd, &one, sizeof(one));
+        Q_UNUSED(rc);
+        reactorThread->thread->wait();
+        delete reactorThread->thread;
+
+        ::close(reactorThread->wakeupFd);
+        ::close(reactorThread->epollFd);
+        delete reactorThread;
+    }
+    m_threads.clear();
+}
+
+IoReactor::ReactorThread* IoReactor::threadOf(quint64 token) const {
+    return m_threads.value(token & ((1 << REACTOR_THREAD_BITS) - 1), nullptr);
+}
+
+bool IoReactor::applyEvents(ReactorThread* reactorThread, quint64 token,
+    Registration& registration)
+{
+    uint32_t events = registration.handler->reactorEvents();
+    if(registration.events == events)
+        return true;
+
+    // Hangups are reported even with an empty mask, so a paused fd leaves the epoll set
+    int rc;
+    if(events == 0) {
+        rc = epoll_ctl(reactorThread->epollFd, EPOLL_CTL_DEL, registration.fd, nullptr);
+    }
+    else {
+        struct epoll_event event = {};
+        event.events = events;
+        event.data.u64 = token;
+        int op = registration.events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        rc = epoll_ctl(reactorThread->epollFd, op, registration.fd, &event);
+    }
+    if(rc < 0)
+        return false;
+
+    registration.events = events;
+    return true;
+}
+
+quint64 IoReactor::add(int fd, Handler* handler) {
+    assert(handler != nullptr);
+
+    quint64 id = m_nextToken++;
+    quint64 token = (id << REACTOR_THREAD_BITS) | (id % m_threads.size());
+    ReactorThread* reactorThread = threadOf(token);
+
+    QMutexLocker locker(&reactorThread->mutex);
+    Registration registration = { fd, 0, handler };
+    if(!applyEvents(reactorThread, token, registration))
+        return 0;
+
+    reactorThread->registrations.insert(token, registration);
+    return token;
+}
+
+bool IoReactor::update(quint64 token) {
+    ReactorThread* reactorThread = threadOf(token);
+    if(!reactorThread)
+        return false;
+
+    QMutexLocker locker(&reactorThread->mutex);
+    auto it = reactorThread->registrations.find(token);
+    if(it == reactorThread->registrations.end())
+        return false;
+    return applyEvents(reactorThread, token, *it);
+}
+
+void IoReactor::remove(quint64 token) {
+    ReactorThread* reactorThread = threadOf(token);
+    if(!reactorThread)
+        return;
+
+    QMutexLocker locker(&reactorThread->mutex);
+    auto it = reactorThread->registrations.find(token);
+    if(it == reactorThread->registrations.end())
+        return;
+
+    if(it->events != 0)
+        epoll_ctl(reactorThread->epollFd, EPOLL_CTL_DEL, it->fd, nullptr);
+    reactorThread->registrations.erase(it);
+}
+
+void IoReactor::run(ReactorThread* reactorThread) {
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    while(!m_stopping) {
+        int count = epoll_wait(reactorThread->epollFd, events, REACTOR_MAX_EVENTS, -1);
+        if(count < 0) {
+            if(errno != EINTR)
+                qWarning() << "[IoReactor]: epoll_wait() failed:" << strerror(errno);
+            continue;
+        }
+
+        for(int i = 0; i < count; i++) {
+            quint64 token = events[i].data.u64;
+            if(token == REACTOR_WAKEUP_TOKEN) {
+                uint64_t value;
+                ssize_t rc = ::read(reactorThread->wakeupFd, &value, sizeof(value));
+                Q_UNUSED(rc);
+                continue;
+            }
+
+            // The registration might have been removed since epoll_wait() returned
+            QMutexLocker locker(&reactorThread->mutex);
+            auto it = reactorThread->registrations.find(token);
+            if(it == reactorThread->registrations.end())
+                continue;
+
+            it->handler->reactorEvent(events[i].events);
+            applyEvents(reactorThread, token, *it);
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef IOREACTOR_HPP
+#define IOREACTOR_HPP
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+
+#include <atomic>
+#include <cstdint>
+
+/*
+ * epoll threads that poll the host side sockets outside the GUI thread.
+ * Sockets register a Handler, which is called on the reactor thread with
+ * the ready events and is then asked for the events it waits for next.
+ * Handlers do the I/O themselves and wake up their owner with a queued call only
+ * when there is something for it, so a flood of data costs one event
+ * loop wakeup per batch instead of one per read.
+ */
+class IoReactor
+{
+public:
+    class Handler {
+    public:
+        virtual ~Handler() = default;
+        /* Runs on a reactor thread, it must not call into the reactor */
+        virtual void reactorEvent(uint32_t events) = 0;
+        /* Returns the epoll events the handler waits for, 0 takes the fd out of the epoll set */
+        virtual uint32_t reactorEvents() = 0;
+    };
+
+    /* Starts the threads on first use */
+    static IoReactor* instance();
+    /* Has to be called before the first instance() call */
+    static void setThreadCount(int count);
+    static int threadCount();
+
+    /* Returns a registration token, or 0 with errno set */
+    quint64 add(int fd, Handler* handler);
+    /* Applies the handler's current reactorEvents() */
+    bool update(quint64 token);
+    /* After it returns the handler isn't running and won't be called again */
+    void remove(quint64 token);
+private:
+    IoReactor(int threadCount);
+    ~IoReactor();
+
+    struct Registration {
+        int fd;
+        uint32_t events;
+        Handler* handler;
+    };
+    struct ReactorThread {
+        int epollFd = -1;
+        int wakeupFd = -1;
+        QThread* thread = nullptr;
+        /* Held while a handler runs, so remove() can wait for it */
+        QMutex mutex;
+        QHash<quint64, Registration> registrations;
+    };
+
+    void run(ReactorThread* reactorThread);
+    static bool applyEvents(ReactorThread* reactorThread, quint64 token,
+        Registration& registration);
+    ReactorThread* threadOf(quint64 token) const;
+private:
+    QList<ReactorThread*> m_threads;
+    std::atomic<quint64> m_nextToken { 1 };
+    std::atomic<bool> m_stopping { false };
+
+    static int s_threadCount;
+};
+
+#endif // IOREACTOR_HPP
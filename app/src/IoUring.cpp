@@ -0,0 +1,419 @@
+#include "IoUring.hpp"
+
+#ifdef HAVE_LIBURING
+
+#include <QtCore/QDebug>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+
+#include <liburing.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#define RING_ENTRIES 256
+/* Provided buffers shared by all the multishot receives */
+#define RING_BUFFER_COUNT 256
+#define RING_BUFFER_SZ (16 * 1024)
+#define RING_BUFFER_GROUP 0
+/* user_data is the token shifted by RING_OP_BITS plus the Op, 0 is ignored */
+#define RING_OP_BITS 2
+
+static inline quint64 userData(quint64 token, IoUring::Op op) {
+    return (token << RING_OP_BITS) | op;
+}
+
+class IoUring::Private {
+public:
+    struct Registration {
+        int fd;
+        Handler* handler;
+        /* A request is in the kernel */
+        bool receiving = false;
+        bool accepting = false;
+        bool sending = false;
+        /* Re-armed when the multishot request ends */
+        bool wantReceive = false;
+        bool wantAccept = false;
+        bool cancelling = false;
+        bool removing = false;
+
+        bool busy() const { return receiving || accepting || sending; }
+    };
+
+    bool init();
+    void run();
+    void complete(struct io_uring_cqe* cqe);
+    void recycle(int bufferId);
+    struct io_uring_sqe* getSqe();
+    bool armReceive(quint64 token, Registration& registration);
+    bool armAccept(quint64 token, Registration& registration);
+    void cancel(quint64 data);
+
+    struct io_uring ring;
+    bool ringInitialized = false;
+    struct io_uring_buf_ring* bufRing = nullptr;
+    char* buffers = nullptr;
+
+    QThread* thread = nullptr;
+    std::atomic<bool> stopping { false };
+    /* Guards the submission queue and the registrations, held while a handler runs */
+    QMutex mutex;
+    /* Signalled when a removed registration has no requests left */
+    QWaitCondition idle;
+    QHash<quint64, Registration> registrations;
+    quint64 nextToken = 1;
+};
+
+bool IoUring::Private::init() {
+    if(io_uring_queue_init(RING_ENTRIES, &ring, 0) < 0)
+        return false;
+    ringInitialized = true;
+
+    // Multishot receive came in 6.0 together with zero copy send, which can be probed for
+    struct io_uring_probe* probe = io_uring_get_probe_ring(&ring);
+    bool supported = probe && io_uring_opcode_supported(probe, IORING_OP_SEND_ZC);
+    if(probe)
+        io_uring_free_probe(probe);
+    if(!supported)
+        return false;
+
+    int rc;
+    bufRing = io_uring_setup_buf_ring(&ring, RING_BUFFER_COUNT, RING_BUFFER_GROUP, 0, &rc);
+    if(!bufRing)
+        return false;
+
+    buffers = new char[RING_BUFFER_COUNT * RING_BUFFER_SZ];
+    int mask = io_uring_buf_ring_mask(RING_BUFFER_COUNT);
+    for(int i = 0; i < RING_BUFFER_COUNT; i++)
+        io_uring_buf_ring_add(bufRing, buffers + i * RING_BUFFER_SZ, RING_BUFFER_SZ, i, mask, i);
+    io_uring_buf_ring_advance(bufRing, RING_BUFFER_COUNT);
+
+    thread = QThread::create([this] { run(); });
+    thread->setObjectName("vs-io-uring");
+    thread->start();
+    return true;
+}
+
+IoUring* IoUring::instance() {
+    static IoUring ioUring;
+    return ioUring.d ? &ioUring : nullptr;
+}
+
+IoUring::IoUring() {
+    d = new Private();
+    if(d->init())
+        return;
+
+    if(d->bufRing)
+        io_uring_free_buf_ring(&d->ring, d->bufRing, RING_BUFFER_COUNT, RING_BUFFER_GROUP);
+    if(d->ringInitialized)
+        io_uring_queue_exit(&d->ring);
+    delete[] d->buffers;
+    delete d;
+    d = nullptr;
+}
+
+IoUring::~IoUring() {
+    if(!d)
+        return;
+
+    d->stopping = true;
+    {
+        QMutexLocker locker(&d->mutex);
+        struct io_uring_sqe* sqe = d->getSqe();
+        if(sqe) {
+            io_uring_prep_nop(sqe);
+            io_uring_sqe_set_data64(sqe, 0);
+            io_uring_submit(&d->ring);
+        }
+    }
+    d->thread->wait();
+    delete d->thread;
+
+    io_uring_free_buf_ring(&d->ring, d->bufRing, RING_BUFFER_COUNT, RING_BUFFER_GROUP);
+    io_uring_queue_exit(&d->ring);
+    delete[] d->buffers;
+    delete d;
+}
+
+struct io_uring_sqe* IoUring::Private::getSqe() {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+    if(!sqe) {
+        // The queue is full, hand it over to the kernel first
+        io_uring_submit(&ring);
+        sqe = io_uring_get_sqe(&ring);
+    }
+    return sqe;
+}
+
+bool IoUring::Private::armReceive(quint64 token, Registration& registration) {
+    struct io_uring_sqe* sqe = getSqe();
+    if(!sqe)
+        return false;
+
+    io_uring_prep_recv_multishot(sqe, registration.fd, nullptr, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RING_BUFFER_GROUP;
+    io_uring_sqe_set_data64(sqe, userData(token, Recv));
+    registration.receiving = true;
+    registration.cancelling = false;
+    return true;
+}
+
+bool IoUring::Private::armAccept(quint64 token, Registration& registration) {
+    struct io_uring_sqe* sqe = getSqe();
+    if(!sqe)
+        return false;
+
+    io_uring_prep_multishot_accept(sqe, registration.fd, nullptr, nullptr,
+        SOCK_NONBLOCK | SOCK_CLOEXEC);
+    io_uring_sqe_set_data64(sqe, userData(token, Accept));
+    registration.accepting = true;
+    registration.cancelling = false;
+    return true;
+}
+
+void IoUring::Private::cancel(quint64 data) {
+    struct io_uring_sqe* sqe = getSqe();
+    if(!sqe)
+        return;
+    io_uring_prep_cancel64(sqe, data, 0);
+    io_uring_sqe_set_data64(sqe, 0);
+}
+
+void IoUring::Private::recycle(int bufferId) {
+    if(bufferId < 0)
+        return;
+    io_uring_buf_ring_add(bufRing, buffers + bufferId * RING_BUFFER_SZ, RING_BUFFER_SZ,
+        bufferId, io_uring_buf_ring_mask(RING_BUFFER_COUNT), 0);
+    io_uring_buf_ring_advance(bufRing, 1);
+}
+
+void IoUring::Private::complete(struct io_uring_cqe* cqe) {
+    quint64 data = io_uring_cqe_get_data64(cqe);
+    Op op = Op(data & ((1 << RING_OP_BITS) - 1));
+    quint64 token = data >> RING_OP_BITS;
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+    int result = cqe->res;
+
+    int bufferId = -1;
+    const char* buffer = nullptr;
+    if(cqe->flags & IORING_CQE_F_BUFFER) {
+        bufferId = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        buffer = buffers + bufferId * RING_BUFFER_SZ;
+    }
+
+    auto it = registrations.find(token);
+    if(data == 0 || it == registrations.end()) {
+        recycle(bufferId);
+        if(op == Accept && result >= 0)
+            ::close(result);
+        return;
+    }
+    Registration& registration = *it;
+
+    // Running out of buffers and our own cancels just end a multishot request
+    bool quiet = registration.removing || result == -ENOBUFS || result == -ECANCELED;
+
+    switch(op) {
+    case Recv:
+        if(!more)
+            registration.receiving = false;
+        if(!quiet && (!registration.handler->ringCompletion(Recv, result, buffer) || result <= 0))
+            registration.wantReceive = false;
+        recycle(bufferId);
+
+        if(registration.receiving && !registration.wantReceive && !registration.cancelling
+            && !registration.removing)
+        {
+            cancel(data);
+            registration.cancelling = true;
+        }
+        else if(!registration.receiving && registration.wantReceive) {
+            armReceive(token, registration);
+        }
+        break;
+    case Accept:
+        if(!more)
+            registration.accepting = false;
+        if(quiet) {
+            if(result >= 0)
+                ::close(result);
+        }
+        else if(!registration.handler->ringCompletion(Accept, result, nullptr)) {
+            registration.wantAccept = false;
+        }
+
+        if(registration.accepting && !registration.wantAccept && !registration.cancelling
+            && !registration.removing)
+        {
+            cancel(data);
+            registration.cancelling = true;
+        }
+        else if(!registration.accepting && registration.wantAccept) {
+            armAccept(token, registration);
+        }
+        break;
+    case Send:
+        registration.sending = false;
+        if(!registration.removing)
+            registration.handler->ringCompletion(Send, result, nullptr);
+        break;
+    }
+
+    if(registration.removing && !registration.busy())
+        idle.wakeAll();
+}
+
+void IoUring::Private::run() {
+    while(!stopping) {
+        struct io_uring_cqe* cqe;
+        int rc = io_uring_wait_cqe(&ring, &cqe);
+        if(rc < 0) {
+            if(rc != -EINTR)
+                qWarning() << "[IoUring]: io_uring_wait_cqe() failed:" << strerror(-rc);
+            continue;
+        }
+
+        QMutexLocker locker(&mutex);
+        unsigned head;
+        unsigned count = 0;
+        io_uring_for_each_cqe(&ring, head, cqe) {
+            complete(cqe);
+            count++;
+        }
+        io_uring_cq_advance(&ring, count);
+
+        // The re-arms and cancels of the whole batch go out with one io_uring_enter()
+        if(io_uring_sq_ready(&ring) > 0)
+            io_uring_submit(&ring);
+    }
+}
+
+quint64 IoUring::add(int fd, Handler* handler) {
+    QMutexLocker locker(&d->mutex);
+    quint64 token = d->nextToken++;
+    Private::Registration registration;
+    registration.fd = fd;
+    registration.handler = handler;
+    d->registrations.insert(token, registration);
+    return token;
+}
+
+bool IoUring::receive(quint64 token) {
+    QMutexLocker locker(&d->mutex);
+    auto it = d->registrations.find(token);
+    if(it == d->registrations.end() || it->removing)
+        return false;
+
+    it->wantReceive = true;
+    // Still armed, or re-armed once the cancelled request ends
+    if(it->receiving)
+        return true;
+    if(!d->armReceive(token, *it))
+        return false;
+
+    int rc = io_uring_submit(&d->ring);
+    if(rc < 0) {
+        errno = -rc;
+        return false;
+    }
+    return true;
+}
+
+bool IoUring::accept(quint64 token) {
+    QMutexLocker locker(&d->mutex);
+    auto it = d->registrations.find(token);
+    if(it == d->registrations.end() || it->removing)
+        return false;
+
+    it->wantAccept = true;
+    if(it->accepting)
+        return true;
+    if(!d->armAccept(token, *it))
+        return false;
+
+    int rc = io_uring_submit(&d->ring);
+    if(rc < 0) {
+        errno = -rc;
+        return false;
+    }
+    return true;
+}
+
+bool IoUring::send(quint64 token, const struct msghdr* msg, bool waitWritable) {
+    QMutexLocker locker(&d->mutex);
+    auto it = d->registrations.find(token);
+    if(it == d->registrations.end() || it->removing || it->sending)
+        return false;
+
+    // A linked pair can't be split between two submissions
+    if(io_uring_sq_space_left(&d->ring) < 2)
+        io_uring_submit(&d->ring);
+
+    if(waitWritable) {
+        struct io_uring_sqe* poll = io_uring_get_sqe(&d->ring);
+        if(!poll)
+            return false;
+        io_uring_prep_poll_add(poll, it->fd, POLLOUT);
+        io_uring_sqe_set_data64(poll, 0);
+        poll->flags |= IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+    }
+
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&d->ring);
+    if(!sqe)
+        return false;
+    // MSG_NOSIGNAL, so a closed peer doesn't kill us with SIGPIPE
+    io_uring_prep_sendmsg(sqe, it->fd, msg, MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe, userData(token, Send));
+    it->sending = true;
+
+    int rc = io_uring_submit(&d->ring);
+    if(rc < 0) {
+        errno = -rc;
+        return false;
+    }
+    return true;
+}
+
+void IoUring::remove(quint64 token) {
+    QMutexLocker locker(&d->mutex);
+    auto it = d->registrations.find(token);
+    if(it == d->registrations.end())
+        return;
+
+    it->removing = true;
+    it->wantReceive = false;
+    it->wantAccept = false;
+    if(it->busy()) {
+        struct io_uring_sqe* sqe = d->getSqe();
+        if(sqe) {
+            io_uring_prep_cancel_fd(sqe, it->fd, IORING_ASYNC_CANCEL_ALL);
+            io_uring_sqe_set_data64(sqe, 0);
+        }
+        io_uring_submit(&d->ring);
+    }
+
+    // The kernel may still use the handler's buffers until the requests complete
+    while((it = d->registrations.find(token))->busy())
+        d->idle.wait(&d->mutex);
+    d->registrations.erase(it);
+}
+
+#else
+
+IoUring* IoUring::instance() { return nullptr; }
+quint64 IoUring::add(int, Handler*) { return 0; }
+bool IoUring::receive(quint64) { return false; }
+bool IoUring::accept(quint64) { return false; }
+bool IoUring::send(quint64, const struct msghdr*, bool) { return false; }
+void IoUring::remove(quint64) { }
+
+#endif // HAVE_LIBURING
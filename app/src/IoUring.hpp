@@ -0,0 +1,61 @@
+#ifndef IOURING_HPP
+#define IOURING_HPP
+
+#include <QtCore/QtGlobal>
+
+#include <cstdint>
+
+struct msghdr;
+
+/*
+ * io_uring alternative to the IoReactor, one thread completing the
+ * requests of every registered socket. Receives and accepts are multishot,
+ * received data lands in a ring of provided buffers, so a socket costs no
+ * syscalls once it's armed. Only built when liburing is found, instance()
+ * returns nullptr when it isn't or the kernel lacks the features.
+ */
+class IoUring
+{
+public:
+    enum Op {
+        Recv = 1,
+        Send,
+        Accept
+    };
+
+    class Handler {
+    public:
+        virtual ~Handler() = default;
+        /*
+         * Runs on the ring thread, it must not call into the ring. result is
+         * the byte count, the accepted fd, 0 on EOF or -errno. Received data
+         * is only valid during the call. Returning false stops a multishot
+         * receive or accept.
+         */
+        virtual bool ringCompletion(Op op, int result, const char* data) = 0;
+    };
+
+    static IoUring* instance();
+    static bool isAvailable() { return instance() != nullptr; }
+
+    /* Returns a registration token, or 0 */
+    quint64 add(int fd, Handler* handler);
+    /* Keep receiving (accepting) until the handler returns false */
+    bool receive(quint64 token);
+    bool accept(quint64 token);
+    /*
+     * msg has to stay valid until the Send completion. waitWritable polls
+     * for POLLOUT first, for resubmitting after -EAGAIN.
+     */
+    bool send(quint64 token, const struct msghdr* msg, bool waitWritable = false);
+    /* Cancels the requests, after it returns the handler won't be called again */
+    void remove(quint64 token);
+private:
+    IoUring();
+    ~IoUring();
+
+    class Private;
+    Private* d = nullptr;
+};
+
+#endif // IOURING_HPP
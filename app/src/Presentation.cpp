@@ -2,10 +2,14 @@
 
 #include <QtCore/QDebug>
 #include <QtCore/QFile>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QDirIterator>
+#include <QtCore/QSet>
 #include <QtGui/QResizeEvent>
 
 #include <string>
-#include <sstream>
+#include <iterator>
 
 #include <zip.h>
 #include "third-party/RapidXml/rapidxml.hpp"
@@ -14,6 +18,7 @@
 #include "VirtualMachine.hpp"
 #include "Network.hpp"
 #include "VirtualMachineWidget.hpp"
+#include "HtmlBoxWidget.hpp"
 
 #define BUFFOR_SZ 1024 // Unzip buffor size
 
@@ -21,7 +26,7 @@ using namespace rapidxml;
 using namespace nlohmann;
 
 
-static void parseXmlDimensions(xml_node<char>* xmlNode, PresentationElement* e) {
+static void parseXmlDimensions(xml_node<char>* xmlNode, ElementDescription& e) {
     auto getDim = [=](QByteArray dimName) -> qreal {
         xml_attribute<char>* attrib = nullptr;
         QString dimStr = nullptr;
@@ -48,10 +53,74 @@ static void parseXmlDimensions(xml_node<char>* xmlNode, PresentationElement* e)
         return dim;
     };
 
-    e->setX(getDim("x"));
-    e->setY(getDim("y"));
-    e->setWidth(getDim("width"));
-    e->setHeight(getDim("height"));
+    e.x = getDim("x");
+    e.y = getDim("y");
+    e.width = getDim("width");
+    e.height = getDim("height");
+}
+
+static bool parseXmlElement(xml_node<char>* node, ElementDescription& e) {
+    QString type(node->name());
+    type = type.toLower();
+    if(type == "box") {
+        xml_node<char>* textNode = node->first_node("text", 0UL, false);
+        xml_node<char>* htmlNode = node->first_node("html", 0UL, false);
+        if(textNode) {
+            e.type = ElementDescription::Text;
+            e.content = QString(textNode->value());
+        }
+        else if(htmlNode) {
+            std::string text;
+            rapidxml::print(std::back_inserter(text), *htmlNode, print_no_indenting);
+            e.type = ElementDescription::Html;
+            e.content = QString::fromStdString(text);
+        }
+        else {
+            qWarning() << "box node contains neither \"text\", nor \"html\" subnode.";
+            return false;
+        }
+    }
+    else if(type == "image") {
+        e.type = ElementDescription::Image;
+
+        xml_attribute<char>* srcAttr = node->first_attribute("src", 0UL, false);
+        if(srcAttr == nullptr)
+            qWarning() << "Image node does not contain \"src\" attribute";
+        else
+            e.content = QString(srcAttr->value());
+    }
+    else if(type == "vm") {
+        e.type = ElementDescription::Vm;
+
+        xml_attribute<char>* vmIdAttr = node->first_attribute("id", 0UL, false);
+        if(vmIdAttr)
+            e.content = QString(vmIdAttr->value());
+    }
+    else {
+        qWarning() << "Unknown node type: <" + type + ">. Ignoring.";
+        return false;
+    }
+
+    parseXmlDimensions(node, e);
+    return true;
+}
+
+static SlideDescription parseXmlSlide(xml_node<char>* node) {
+    SlideDescription slide;
+
+    xml_attribute<char>* bgAttribute = node->first_attribute("bg", 0UL, false);
+    if(bgAttribute)
+        slide.background = QString(bgAttribute->value());
+
+    xml_node<char>* elementNode = node->first_node(nullptr, 0UL, false);
+    while(elementNode) {
+        ElementDescription element;
+        if(parseXmlElement(elementNode, element))
+            slide.elements.append(element);
+        elementNode = elementNode->next_sibling(nullptr, 0UL, false);
+    }
+
+    return slide;
 }
 
 void PresentationElement::recalculateRealDim() {
@@ -98,97 +167,73 @@ void PresentationElement::setWidget(QWidget* w) {
     w->show();
 }
 
-PresentationElement* PresentationElement::create(xml_node<char>* node,
+PresentationElement* PresentationElement::create(const ElementDescription& description,
     PresentationSlide* slide, Presentation* pres)
 {
-    PresentationElement* presentationElement = nullptr;
-    QString type(node->name());
-    type = type.toLower();
-    if(type == "box") {
-        xml_node<char>* textNode = node->first_node("text", 0UL, false);
-        xml_node<char>* htmlNode = node->first_node("html", 0UL, false);
-        if(textNode) {
-            QLabel* w = new QLabel(slide);
-            w->setTextFormat(Qt::TextFormat::PlainText);
-            w->setText(textNode->value());
-
-            presentationElement = new PresentationElement();
-            parseXmlDimensions(node, presentationElement);
-            presentationElement->setWidget(w);
-        }
-        else if(htmlNode) {
-            std::string text = (std::stringstream() << *htmlNode).str();
-            QLabel* w = new QLabel(slide);
-            w->setTextFormat(Qt::TextFormat::RichText);
-            w->setText(QString::fromStdString(text));
-
-            presentationElement = new PresentationElement();
-            parseXmlDimensions(node, presentationElement);
-            presentationElement->setWidget(w);
-        }
-        else
-            qWarning() << "box node contains neither \"text\", nor \"html\" subnode.";
+    QWidget* w = nullptr;
+    switch(description.type) {
+    case ElementDescription::Text: {
+        QLabel* label = new QLabel(slide);
+        label->setTextFormat(Qt::TextFormat::PlainText);
+        label->setText(description.content);
+        w = label;
+        break;
     }
-    else if(type == "image") {
-        QLabel* w = new QLabel(slide);
-        w->setScaledContents(true);
-        
-        QPixmap img;
-        xml_attribute<char>* srcAttr = node->first_attribute("src", 0UL, false);
-        if(srcAttr == nullptr)
-            qWarning() << "Image node does not contain \"src\" attribute";
-        else if(pres->isFileValid(srcAttr->value()))
-            img = QPixmap(pres->getFilePath(srcAttr->value()));
-        else
-            qWarning() << "Image src: \"" + QString(srcAttr->value()) + "\" is not valid";
-        w->setPixmap(img);
+    case ElementDescription::Html:
+        w = new HtmlBoxWidget(pres->getHtmlDocument(description.content), slide);
+        break;
+    case ElementDescription::Image: {
+        QLabel* label = new QLabel(slide);
+        label->setScaledContents(true);
 
-        presentationElement = new PresentationElement();
-        parseXmlDimensions(node, presentationElement);
-        presentationElement->setWidget(w);
+        QPixmap img;
+        if(pres->isFileValid(description.content))
+            img = QPixmap(pres->getFilePath(description.content));
+        else if(!description.content.isNull())
+            qWarning() << "Image src: \"" + description.content + "\" is not valid";
+        label->setPixmap(img);
+        w = label;
+        break;
     }
-    else if(type == "vm") {
-        xml_attribute<char>* vmIdAttr = node->first_attribute("id", 0UL, false);
-        QString vmId = vmIdAttr ? vmIdAttr->value() : nullptr; 
-        VirtualMachine* vm = pres->getVirtualMachine(vmId);
-
-        if(vm) {
-            VirtualMachineWidget* w = new VirtualMachineWidget(vm, slide);
-            
-            presentationElement = new PresentationElement();
-            presentationElement->setWidget(w);
-            parseXmlDimensions(node, presentationElement);
-        }
-        else
+    case ElementDescription::Vm: {
+        VirtualMachine* vm = pres->getVirtualMachine(description.content);
+        if(vm == nullptr) {
             qWarning() << "vm node does not contain \"id\" attribute.";
+            return nullptr;
+        }
+        w = new VirtualMachineWidget(vm, slide);
+        break;
     }
-    else
-        qWarning() << "Unknown node type: <" + type + ">. Ignoring.";
+    }
+
+    PresentationElement* presentationElement = new PresentationElement();
+    presentationElement->setX(description.x);
+    presentationElement->setY(description.y);
+    presentationElement->setWidth(description.width);
+    presentationElement->setHeight(description.height);
+    presentationElement->setWidget(w);
 
     return presentationElement;
 }
 
-PresentationSlide::PresentationSlide(xml_node<char>* node, Presentation* pres) {
+PresentationSlide::PresentationSlide(const SlideDescription& description, Presentation* pres) {
     setAutoFillBackground(true);
     setScaledContents(true);
     setFocusPolicy(Qt::FocusPolicy::ClickFocus);
 
-    xml_attribute<char>* bgAttribute = node->first_attribute("bg", 0UL, false);
     setPalette(QPalette(QColor("white")));
-    if(bgAttribute) {
-        if(pres->isFileValid(bgAttribute->value()))
-            setPixmap(QPixmap(pres->getFilePath(bgAttribute->value())));
-        else if(QColor::isValidColorName(bgAttribute->value()))
-            setPalette(QPalette(QColor(bgAttribute->value())));
+    if(!description.background.isEmpty()) {
+        if(pres->isFileValid(description.background))
+            setPixmap(QPixmap(pres->getFilePath(description.background)));
+        else if(QColor::isValidColorName(description.background))
+            setPalette(QPalette(QColor(description.background)));
     }
-     
-    xml_node<char>* elementNode = node->first_node(nullptr, 0UL, false);
-    while(elementNode) {
-        PresentationElement* presentationElement = PresentationElement::create(elementNode, this, pres);
+
+    for(auto &element : description.elements) {
+        PresentationElement* presentationElement = PresentationElement::create(element, this, pres);
         if(presentationElement)
             m_elements.append(presentationElement);
-        elementNode = elementNode->next_sibling(nullptr, 0UL, false);
-    }    
+    }
 }
 
 PresentationSlide::~PresentationSlide() {
@@ -202,6 +247,13 @@ void PresentationSlide::resizeEvent(QResizeEvent *event) {
 }
 
 void Presentation::decompressArchive(QString path) {
+    path = QFileInfo(path).absoluteFilePath();
+
+    if(QFileInfo(path).isDir()) {
+        indexDirectory(path);
+        return;
+    }
+
     zip_t* zipArchive = nullptr;
     zip_file_t* zf;
     zip_stat_t zStat;
@@ -217,9 +269,11 @@ void Presentation::decompressArchive(QString path) {
         throw PresentationException(exceptionString);
     }
 
-    QDir tmpDir(m_tmpDir.path());
+    QDir tmpDir(m_rootPath);
 
     size_t zEntriesCount = zip_get_num_entries(zipArchive, 0);
+    m_manifest.clear();
+    m_manifest.reserve(zEntriesCount);
     for(size_t i = 0; i < zEntriesCount; ++i) {
         if(zip_stat_index(zipArchive, i, 0, &zStat) == -1) {
             zip_error_t* error = zip_get_error(zipArchive);
@@ -229,15 +283,31 @@ void Presentation::decompressArchive(QString path) {
             throw PresentationException(exceptionString);
         }
         QString fileName = QString(zStat.name);
-        if(fileName[fileName.length() - 1] == '/') {
+
+        ArchiveEntry entry;
+        entry.index = zStat.index;
+        entry.size = zStat.size;
+        entry.compressedSize = zStat.comp_size;
+        entry.crc = zStat.crc;
+        entry.isDir = fileName.endsWith('/');
+        if(!m_manifest.insert(fileName, entry)) {
+            zip_close(zipArchive);
+            throw PresentationException("Failed to decompress '" + path + "': "
+                + "entry \"" + fileName + "\" points outside of the archive");
+        }
+        fileName = ArchiveManifest::normalizePath(fileName);
+
+        if(entry.isDir) {
             if(!tmpDir.mkpath(fileName)) {
                 zip_close(zipArchive);
                 throw PresentationException("Failed to decompress '" + path + "'");
             }
         }
         else {
-            QFile file(m_tmpDir.path() + "/" + fileName);
-            if(file.open(QIODevice::WriteOnly) == false) {
+            QFile file(m_rootPath + "/" + fileName);
+            if(!tmpDir.mkpath(QFileInfo(fileName).path())
+                || file.open(QIODevice::WriteOnly) == false)
+            {
                 zip_close(zipArchive);
                 throw PresentationException("Failed to decompress '" + path + "': " + file.errorString());
             }
@@ -263,19 +333,23 @@ void Presentation::decompressArchive(QString path) {
         }
     }
     zip_close(zipArchive);
+
+    m_archivePath = path;
+    loadIndex();
 }
 
-void Presentation::parseRootXml() {
+void Presentation::readRootXml(QString& title, QList<SlideDescription>& slides) const {
     QFile rootXml(getFilePath("root.xml"));
 
     if(rootXml.open(QIODevice::ReadOnly) == false)
         throw PresentationException("File root.xml does not exists inside the archive");
     
-    QByteArray ba = rootXml.readAll();
+    QByteArray rootXmlData = rootXml.readAll();
+    rootXml.close();
     
     xml_document<char> xmlDoc;
     try {
-        xmlDoc.parse<parse_trim_whitespace | parse_normalize_whitespace>(ba.data());
+        xmlDoc.parse<parse_trim_whitespace | parse_normalize_whitespace>(rootXmlData.data());
     }
     catch(parse_error& e) {
         throw PresentationException("Failed to parse root.xml: " + QString(e.what()));
@@ -289,25 +363,352 @@ void Presentation::parseRootXml() {
     }
 
     xml_attribute<char>* titleAttribute = rootNode->first_attribute("title", 0UL, false);
-    if(titleAttribute != nullptr)
-        m_title = QString(titleAttribute->value());
-
+    title = titleAttribute ? QString(titleAttribute->value()) : QString();
 
+    slides.clear();
     xml_node<char>* slideNode = rootNode->first_node("Slide", 0UL, false);
-    if(slideNode == nullptr) {
+    while(slideNode) {
+        slides.append(parseXmlSlide(slideNode));
+        slideNode = slideNode->next_sibling("Slide", 0UL, false);
+    }
+
+    if(slides.isEmpty()) {
         QString exceptionStr = "Failed to parse root.xml: ";
         exceptionStr += "\"<Presentation>\" node have to contain at least one \"<Slide>\" node";
         throw PresentationException(exceptionStr);
     }
+}
 
-    while(slideNode) {
-        PresentationSlide* slide = new PresentationSlide(slideNode, this);
-        m_slides.append(slide);
+void Presentation::parseRootXml() {
+    if(m_indexLoaded) {
+        m_title = m_index.title;
+        m_slideDescriptions = m_index.slides;
+    }
+    else
+        readRootXml(m_title, m_slideDescriptions);
 
-        slideNode = slideNode->next_sibling("Slide", 0UL, false);
+    if(m_slideDescriptions.isEmpty())
+        throw PresentationException("Presentation index does not contain any slide");
+
+    // Unpacked presentations change all the time, there's nothing worth caching
+    if(!m_indexLoaded && !m_unpacked)
+        saveIndex();
+}
+
+bool Presentation::buildNextSlide() {
+    if(m_nextSlide >= m_slideDescriptions.size())
+        return false;
+
+    PresentationSlide* slide = new PresentationSlide(m_slideDescriptions[m_nextSlide++], this);
+    m_slides.append(slide);
+
+    if(m_nextSlide == m_slideDescriptions.size() && !m_unpacked) {
+        // Every slide is built, the descriptions are no longer needed
+        m_slideDescriptions.clear();
+        m_nextSlide = 0;
     }
 
-    rootXml.close();
+    return true;
+}
+
+void Presentation::indexDirectory(QString path) {
+    QDir root(path);
+    m_manifest.clear();
+
+    QDirIterator it(path, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden,
+        QDirIterator::Subdirectories);
+    while(it.hasNext()) {
+        it.next();
+        QFileInfo fileInfo = it.fileInfo();
+
+        ArchiveEntry entry;
+        entry.isDir = fileInfo.isDir();
+        entry.size = entry.isDir ? 0 : fileInfo.size();
+        m_manifest.insert(root.relativeFilePath(fileInfo.filePath()), entry);
+    }
+
+    m_rootPath = path;
+    m_archivePath = path;
+    m_unpacked = true;
+}
+
+static bool slideDependsOn(const SlideDescription& slide,
+    const QSet<QString>& changedPaths, const QSet<QString>& changedVms)
+{
+    if(changedPaths.contains(ArchiveManifest::normalizePath(slide.background)))
+        return true;
+
+    for(auto &element : slide.elements) {
+        if(element.type == ElementDescription::Image
+            && changedPaths.contains(ArchiveManifest::normalizePath(element.content)))
+            return true;
+        if(element.type == ElementDescription::Vm && changedVms.contains(element.content))
+            return true;
+    }
+    return false;
+}
+
+void Presentation::reload(const QSet<QString>& changedPaths) {
+    assert(m_unpacked);
+
+    indexDirectory(m_rootPath);
+
+    // Parsed before anything is touched, so a broken root.xml leaves the presentation intact
+    QString title = m_title;
+    QList<SlideDescription> descriptions = m_slideDescriptions;
+    if(changedPaths.contains("root.xml"))
+        readRootXml(title, descriptions);
+
+    QSet<QString> changedVms;
+    QList<VirtualMachine*> retiredVms;
+    reloadVirtualMachines(changedPaths, changedVms, retiredVms);
+
+    // Slides that didn't change are kept, even if they moved
+    QList<PresentationSlide*> oldSlides = m_slides;
+    QList<PresentationSlide*> slides;
+    for(auto &description : descriptions) {
+        PresentationSlide* slide = nullptr;
+        if(!slideDependsOn(description, changedPaths, changedVms)) {
+            for(qsizetype i = 0; i < oldSlides.size(); ++i) {
+                if(oldSlides[i] && m_slideDescriptions[i] == description) {
+                    slide = oldSlides[i];
+                    oldSlides[i] = nullptr;
+                    break;
+                }
+            }
+        }
+
+        if(slide == nullptr)
+            slide = new PresentationSlide(description, this);
+        slides.append(slide);
+    }
+
+    for(auto slide : oldSlides)
+        delete slide;
+
+    m_title = title;
+    m_slides = slides;
+    m_slideDescriptions = descriptions;
+    m_nextSlide = descriptions.size();
+
+    for(auto vm : retiredVms)
+        vm->deleteLater();
+}
+
+void Presentation::reloadVirtualMachines(const QSet<QString>& changedPaths,
+    QSet<QString>& changedVms, QList<VirtualMachine*>& retiredVms)
+{
+    QSet<QString> changedFiles;
+    for(auto &path : changedPaths)
+        changedFiles += m_rootPath + "/" + path;
+
+    auto payloadsChanged = [&changedFiles](VirtualMachine* vm) {
+        for(auto &installFile : vm->m_installFiles) {
+            if(installFile.content.isFile() && changedFiles.contains(installFile.content.path()))
+                return true;
+        }
+        for(auto &initScript : vm->m_initScripts) {
+            if(initScript.content.isFile() && changedFiles.contains(initScript.content.path()))
+                return true;
+        }
+        return false;
+    };
+    auto isGateway = [](VirtualMachine* vm) {
+        return vm->net() && vm->net()->vm() == vm;
+    };
+
+    if(!changedPaths.contains("virt-env.jsonc")) {
+        for(auto vm : m_virtualMachines) {
+            if(vm->m_definition.is_null() || !payloadsChanged(vm))
+                continue;
+
+            json definition = vm->m_definition;
+            try {
+                vm->updateDefinition(definition, true);
+                changedVms += vm->m_id;
+            }
+            catch(VirtualMachineException &e) {
+                qWarning("virt-env.jsonc: reloading virtual machine %s failed: %s", vm->m_id.toUtf8().data(), e.what());
+            }
+        }
+        return;
+    }
+
+    json virtEnv = json::object();
+    if(isFileValid("virt-env.jsonc")) {
+        QFile jsonFile(getFilePath("virt-env.jsonc"));
+        if(jsonFile.open(QIODevice::ReadOnly) == false)
+            throw PresentationException("Failed to open virt-env.jsonc");
+
+        try {
+            virtEnv = json::parse(jsonFile.readAll().data(), nullptr, true, true);
+        }
+        catch(json::exception &e) {
+            QString exceptionStr = "Failed to parse \"virt-env.jsonc\": ";
+            exceptionStr += e.what();
+            throw PresentationException(exceptionStr);
+        }
+    }
+
+    json networks = virtEnv.contains("networks") ? virtEnv["networks"] : json();
+    if(networks != m_networksDefinition)
+        qWarning("virt-env.jsonc: networks changed, reopen the presentation to apply the change");
+
+    QSet<QString> ids;
+    for(auto &vmObj : virtEnv["virtualMachines"]) {
+        try {
+            QString id = QString::fromStdString(vmObj["id"]);
+            if(id.isEmpty() || ids.contains(id))
+                continue;
+            ids += id;
+
+            VirtualMachine* vm = getVirtualMachine(id);
+            if(vm) {
+                bool changed = payloadsChanged(vm);
+                if(vm->m_definition == vmObj && !changed)
+                    continue;
+                if(vm->updateDefinition(vmObj, changed)) {
+                    changedVms += id;
+                    continue;
+                }
+                if(isGateway(vm)) {
+                    qWarning("virt-env.jsonc: virtual machine %s is a network's gateway, reopen the presentation to apply the change", id.toUtf8().data());
+                    continue;
+                }
+            }
+
+            // Image or network changed, the virtual machine has to be recreated
+            VirtualMachine* newVm = new VirtualMachine(vmObj, this);
+            Network* net = getNetwork(newVm->m_netId);
+            if(net)
+                newVm->setNet(net);
+            else if(newVm->m_netId != nullptr) {
+                qWarning("virt-env.jsonc: vm %s: network %s does not exist", id.toUtf8().data(), newVm->m_netId.toUtf8().data());
+                delete newVm;
+                continue;
+            }
+            newVm->prepareImage();
+            newVm->setImageReady();
+
+            if(vm)
+                retiredVms += vm;
+            m_virtualMachines[id] = newVm;
+            changedVms += id;
+        }
+        catch(VirtualMachineException &e) {
+            qWarning("virt-env.jsonc: reloading virtual machine object failed: %s. Keeping the previous one...", e.what());
+        }
+        catch(json::exception &e) {
+            qWarning("virt-env.jsonc: reloading virtual machine object failed: %s. Keeping the previous one...", e.what());
+        }
+    }
+
+    for(auto vm : m_virtualMachines) {
+        if(vm->m_definition.is_null() || ids.contains(vm->m_id))
+            continue;
+        if(isGateway(vm)) {
+            qWarning("virt-env.jsonc: virtual machine %s is a network's gateway, reopen the presentation to remove it", vm->m_id.toUtf8().data());
+            continue;
+        }
+
+        retiredVms += vm;
+        changedVms += vm->m_id;
+    }
+    for(auto vm : retiredVms) {
+        if(m_virtualMachines.value(vm->m_id) == vm)
+            m_virtualMachines.remove(vm->m_id);
+    }
+}
+
+SourceFingerprint Presentation::sourceFingerprint(QString path) const {
+    SourceFingerprint fingerprint;
+    const ArchiveEntry* entry = m_manifest.entry(path);
+    if(entry && !entry->isDir) {
+        fingerprint.crc = entry->crc;
+        fingerprint.size = entry->size;
+    }
+    return fingerprint;
+}
+
+QString Presentation::indexCachePath() const {
+    QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if(cacheDir.isEmpty() || m_archivePath.isEmpty())
+        return QString();
+
+    QByteArray key = QCryptographicHash::hash(m_archivePath.toUtf8(), QCryptographicHash::Sha1);
+    return cacheDir + "/indexes/" + key.toHex() + ".vsidx";
+}
+
+void Presentation::loadIndex() {
+    SourceFingerprint rootXml = sourceFingerprint("root.xml");
+    SourceFingerprint virtEnvJsonc = sourceFingerprint("virt-env.jsonc");
+
+    // The index embedded in the archive takes precedence over the cached one
+    QStringList candidates;
+    if(isFileValid(PRESENTATION_INDEX_ENTRY))
+        candidates += getFilePath(PRESENTATION_INDEX_ENTRY);
+    QString cachePath = indexCachePath();
+    if(!cachePath.isNull())
+        candidates += cachePath;
+
+    for(auto &candidate : candidates) {
+        PresentationIndex index;
+        if(!index.load(candidate))
+            continue;
+        if(index.rootXml != rootXml || index.virtEnvJsonc != virtEnvJsonc)
+            continue;
+
+        m_index = index;
+        m_indexLoaded = true;
+        return;
+    }
+}
+
+void Presentation::saveIndex() {
+    m_index.rootXml = sourceFingerprint("root.xml");
+    m_index.virtEnvJsonc = sourceFingerprint("virt-env.jsonc");
+    m_index.title = m_title;
+    m_index.slides = m_slideDescriptions;
+    m_index.virtEnv = m_virtEnvCbor;
+
+    QString cachePath = indexCachePath();
+    if(!cachePath.isNull() && !m_index.save(cachePath))
+        qWarning() << "Failed to save presentation index to" << cachePath;
+}
+
+void Presentation::embedIndex(QString path) {
+    path = QFileInfo(path).absoluteFilePath();
+
+    int zipErrorCode = 0;
+    zip_t* zipArchive = zip_open(path.toUtf8().data(), 0, &zipErrorCode);
+    if(zipArchive == nullptr) {
+        zip_error_t error;
+        zip_error_init_with_code(&error, zipErrorCode);
+        QString exceptionString = "Failed to open '" + path + "': "
+            + zip_error_strerror(&error);
+        zip_error_fini(&error);
+        throw PresentationException(exceptionString);
+    }
+
+    // libzip reads the buffer in zip_close()
+    QByteArray data = m_index.serialize();
+    zip_source_t* source = zip_source_buffer(zipArchive, data.constData(), data.size(), 0);
+    if(source == nullptr
+        || zip_file_add(zipArchive, PRESENTATION_INDEX_ENTRY, source, ZIP_FL_OVERWRITE) < 0)
+    {
+        QString exceptionString = "Failed to write index to '" + path + "': "
+            + zip_strerror(zipArchive);
+        zip_source_free(source);
+        zip_discard(zipArchive);
+        throw PresentationException(exceptionString);
+    }
+
+    if(zip_close(zipArchive) < 0) {
+        QString exceptionString = "Failed to write index to '" + path + "': "
+            + zip_strerror(zipArchive);
+        zip_discard(zipArchive);
+        throw PresentationException(exceptionString);
+    }
 }
 
 void Presentation::parseVirtualMachines(json &vmsObj) {
@@ -367,24 +768,37 @@ void Presentation::parseNetworks(json &networksObj) {
 }
 
 void Presentation::parseVirtEnvJsonc() {
-    if(!isFileValid("virt-env.jsonc"))
-        return;
-
-    QFile jsonFile(getFilePath("virt-env.jsonc"));
-
-    if(jsonFile.open(QIODevice::ReadOnly) == false) {
-        throw PresentationException("Failed to open virt-env.jsonc inside the archive");
-    }
-    
-    QByteArray ba = jsonFile.readAll();
     json virtEnv;
-    
+
     try {
-        virtEnv = json::parse(ba.data(), nullptr, true, true);
+        if(m_indexLoaded) {
+            if(m_index.virtEnv.isEmpty())
+                return;
+            virtEnv = json::from_cbor(m_index.virtEnv.cbegin(), m_index.virtEnv.cend());
+        }
+        else {
+            if(!isFileValid("virt-env.jsonc"))
+                return;
+
+            QFile jsonFile(getFilePath("virt-env.jsonc"));
+
+            if(jsonFile.open(QIODevice::ReadOnly) == false) {
+                throw PresentationException("Failed to open virt-env.jsonc inside the archive");
+            }
+            
+            QByteArray ba = jsonFile.readAll();
+            virtEnv = json::parse(ba.data(), nullptr, true, true);
+
+            std::vector<uint8_t> cbor = json::to_cbor(virtEnv);
+            m_virtEnvCbor = QByteArray(reinterpret_cast<const char*>(cbor.data()), cbor.size());
+        }
+
         if(virtEnv.contains("virtualMachines"))
             parseVirtualMachines(virtEnv["virtualMachines"]);
-        if(virtEnv.contains("networks"))
+        if(virtEnv.contains("networks")) {
             parseNetworks(virtEnv["networks"]);
+            m_networksDefinition = virtEnv["networks"];
+        }
     }
     catch(json::exception &e) {
         QString exceptionStr = "Failed to parse \"virt-env.jsonc\": ";
@@ -413,11 +827,8 @@ void Presentation::parseVirtEnvJsonc() {
         if(net) {
             vm->setNet(net);
 
-            if(net->vm() == vm){
+            if(net->vm() == vm)
                 vm->m_wan = net->hasWan();
-
-                vm->start();
-            }
         }
         else if(vm->m_netId != nullptr) {
             QString exceptionStr = "virt-env.jsonc: vm \"" + vm->m_id + "\": ";
@@ -428,18 +839,45 @@ void Presentation::parseVirtEnvJsonc() {
     
 }
 
-Presentation::Presentation(QString path) {
-    path = QFileInfo(path).absoluteFilePath();
+void Presentation::prepareVirtualMachines() {
+    // const, so the hash isn't detached under getVirtualMachine() on the GUI thread
+    for(auto vm : std::as_const(m_virtualMachines)) {
+        try {
+            vm->prepareImage();
+        }
+        catch(VirtualMachineException &e) {
+            throw PresentationException("Failed to prepare virtual machine \"" + vm->m_id + "\": " + e.what());
+        }
+    }
+}
+
+void Presentation::startVirtualMachines() {
+    for(auto vm : m_virtualMachines) {
+        vm->setImageReady();
+
+        // Routers are started together with the presentation
+        if(vm->net() && vm->net()->vm() == vm)
+            vm->start();
+    }
+}
+
+Presentation::Presentation() {
     m_tmpDir.setAutoRemove(false);
 
     if(!m_tmpDir.isValid()) {
         throw PresentationException(m_tmpDir.errorString());
     }
+    m_rootPath = QFileInfo(m_tmpDir.path()).absoluteFilePath();
+}
 
+Presentation::Presentation(QString path) : Presentation() {
     try {
         decompressArchive(path);
         parseVirtEnvJsonc();
         parseRootXml();
+        while(buildNextSlide());
+        prepareVirtualMachines();
+        startVirtualMachines();
     }
     catch(PresentationException &e){
         m_tmpDir.remove();
@@ -460,27 +898,23 @@ Presentation::~Presentation() {
         net->deleteLater();
 }
 
-bool Presentation::isFileValid(QString path) {
-    assert(m_tmpDir.isValid() == true);
-
-    path = m_tmpDir.path() + "/" + path;
-    QFileInfo fi(path);
-    if(fi.exists() == false)
-        return false;
-
-    QString absoluteTmpDirPath = m_tmpDir.path();
-    absoluteTmpDirPath = QFileInfo(absoluteTmpDirPath).absoluteFilePath();
-    if(fi.absoluteFilePath().contains(absoluteTmpDirPath) == false)
-        return false;
+QSharedPointer<HtmlDocument> Presentation::getHtmlDocument(const QString& html) {
+    QSharedPointer<HtmlDocument> doc = m_htmlDocuments.value(html);
+    if(doc.isNull()) {
+        doc = QSharedPointer<HtmlDocument>::create(html);
+        m_htmlDocuments.insert(html, doc);
+    }
+    return doc;
+}
 
-    return true;
+bool Presentation::isFileValid(QString path) const {
+    return m_manifest.contains(path);
 }
 
-QString Presentation::getFilePath(QString path) {
+QString Presentation::getFilePath(QString path) const {
+    path = ArchiveManifest::normalizePath(path);
     if(isFileValid(path) == false)
         return nullptr;
 
-    QFileInfo fi(m_tmpDir.path() + "/" + path);
-
-    return fi.absoluteFilePath();
+    return m_rootPath + "/" + path;
 }
\ No newline at end of file
@@ -5,16 +5,22 @@
 #include <QtWidgets/QWidget>
 #include <QtWidgets/QLabel>
 #include <QtCore/QTemporaryDir>
+#include <QtCore/QHash>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QSet>
 
 #include <exception>
 
 #include "third-party/nlohmann/json.hpp"
-#include "third-party/RapidXml/rapidxml.hpp"
+
+#include "ArchiveManifest.hpp"
+#include "PresentationIndex.hpp"
 
 class VirtualMachine;
 class Network;
 class Presentation;
 class PresentationSlide;
+class HtmlDocument;
 
 class PresentationException : public std::exception
 {
@@ -41,7 +47,7 @@ class PresentationElement : public QObject
     Q_PROPERTY(qreal height READ height WRITE setHeight NOTIFY sizeChanged);
     Q_PROPERTY(QSizeF size READ size WRITE setSize NOTIFY sizeChanged);
 public:
-    static PresentationElement* create(rapidxml::xml_node<char>* node,
+    static PresentationElement* create(const ElementDescription& description,
         PresentationSlide *slide, Presentation* pres
     );
 
@@ -82,7 +88,7 @@ class PresentationSlide : public QLabel
 {
     Q_OBJECT
 public:
-    PresentationSlide(rapidxml::xml_node<char>* node, Presentation* parent);
+    PresentationSlide(const SlideDescription& description, Presentation* parent);
     ~PresentationSlide();
 signals:
     void resize(int w, int h);
@@ -98,18 +104,66 @@ protected:
 
 struct Presentation {
 public:
+    /* Loads the whole presentation synchronously */
     Presentation(QString path);
+    /* Creates an empty presentation, that has to be loaded stage by stage */
+    Presentation();
     ~Presentation();
 
-    bool isFileValid(QString path);
-    QString getFilePath(QString path);
+    /* Both are lookups in the archive's manifest and don't touch the filesystem */
+    bool isFileValid(QString path) const;
+    QString getFilePath(QString path) const;
+    const ArchiveManifest& manifest() const { return m_manifest; }
 
     VirtualMachine* getVirtualMachine(QString id) const { return m_virtualMachines.value(id, nullptr); }
     Network* getNetwork(QString id) const { return m_networks.value(id, nullptr); }
-private:
+
+    /* Returns a shared, pre-parsed document for the given HTML */
+    QSharedPointer<HtmlDocument> getHtmlDocument(const QString& html);
+
+    /*
+     * Loading stages, in the order they have to be called.
+     * Stages marked as thread-safe don't touch any QObject and
+     * may be run outside of the GUI thread.
+     */
+    /* Thread-safe, also loads the presentation's index if it's up to date */
     void decompressArchive(QString path);
-    void parseRootXml();
+    /* Both use the index if it was loaded, otherwise they parse the text sources and cache the index */
     void parseVirtEnvJsonc();
+    void parseRootXml();
+    /* Builds the next slide. Returns false if all slides have already been built */
+    bool buildNextSlide();
+    /*
+     * Copies the disk images, may be run in a worker thread. Until it returns
+     * the virtual machines must not be added, removed or redefined; looking
+     * them up with getVirtualMachine() is fine.
+     */
+    void prepareVirtualMachines();
+    void startVirtualMachines();
+
+    /* Stores the index in the archive, so it doesn't have to be built on the first open */
+    void embedIndex(QString path);
+
+    /* True if the presentation was opened from a directory instead of an archive */
+    bool isUnpacked() const { return m_unpacked; }
+    QString rootPath() const { return m_rootPath; }
+    /*
+     * Applies changes of an unpacked presentation. Only slides whose description,
+     * images or virtual machines changed are rebuilt, virtual machines are
+     * updated in place where possible. Paths are relative to rootPath().
+     */
+    void reload(const QSet<QString>& changedPaths);
+private:
+    void indexDirectory(QString path);
+    void readRootXml(QString& title, QList<SlideDescription>& slides) const;
+    void reloadVirtualMachines(const QSet<QString>& changedPaths,
+        QSet<QString>& changedVms, QList<VirtualMachine*>& retiredVms);
+
+    SourceFingerprint sourceFingerprint(QString path) const;
+    QString indexCachePath() const;
+    void loadIndex();
+    void saveIndex();
+
     void parseVirtualMachines(nlohmann::json &vmsObj);
     void parseNetworks(nlohmann::json &networksObj);
 public:
@@ -117,8 +171,24 @@ public:
     QList<PresentationSlide*> m_slides;
 private:
     QTemporaryDir m_tmpDir;
+    /* Absolute path of m_tmpDir */
+    QString m_rootPath;
+    ArchiveManifest m_manifest;
+
+    QString m_archivePath;
+    bool m_unpacked = false;
+
+    PresentationIndex m_index;
+    bool m_indexLoaded = false;
+    QByteArray m_virtEnvCbor;
+
+    QList<SlideDescription> m_slideDescriptions;
+    qsizetype m_nextSlide = 0;
+
     QMap<QString, VirtualMachine*> m_virtualMachines;
     QMap<QString, Network*> m_networks;
+    nlohmann::json m_networksDefinition;
+    QHash<QString, QSharedPointer<HtmlDocument>> m_htmlDocuments;
 };
 
 #endif // PRESENTATION_HPP
\ No newline at end of file
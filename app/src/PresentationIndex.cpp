@@ -0,0 +1,91 @@
+#include "PresentationIndex.hpp"
+
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+
+#define INDEX_MAGIC 0x56534958 // "VSIX"
+#define INDEX_VERSION 1
+
+QDataStream& operator<<(QDataStream& stream, const ElementDescription& element) {
+    return stream << quint8(element.type) << element.x << element.y
+        << element.width << element.height << element.content;
+}
+
+QDataStream& operator>>(QDataStream& stream, ElementDescription& element) {
+    quint8 type;
+    stream >> type >> element.x >> element.y >> element.width >> element.height >> element.content;
+
+    if(type > ElementDescription::Vm)
+        stream.setStatus(QDataStream::ReadCorruptData);
+    element.type = ElementDescription::Type(type);
+    return stream;
+}
+
+QDataStream& operator<<(QDataStream& stream, const SlideDescription& slide) {
+    return stream << slide.background << slide.elements;
+}
+
+QDataStream& operator>>(QDataStream& stream, SlideDescription& slide) {
+    return stream >> slide.background >> slide.elements;
+}
+
+static QDataStream& operator<<(QDataStream& stream, const SourceFingerprint& fingerprint) {
+    return stream << fingerprint.crc << fingerprint.size;
+}
+
+static QDataStream& operator>>(QDataStream& stream, SourceFingerprint& fingerprint) {
+    return stream >> fingerprint.crc >> fingerprint.size;
+}
+
+QByteArray PresentationIndex::serialize() const {
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+
+    stream << quint32(INDEX_MAGIC) << quint32(INDEX_VERSION);
+    stream.setVersion(QDataStream::Qt_6_5);
+
+    stream << rootXml << virtEnvJsonc << title << slides << virtEnv;
+    return data;
+}
+
+bool PresentationIndex::deserialize(const QByteArray& data) {
+    QDataStream stream(data);
+
+    quint32 magic, version;
+    stream >> magic >> version;
+    if(stream.status() != QDataStream::Ok || magic != INDEX_MAGIC || version != INDEX_VERSION)
+        return false;
+    stream.setVersion(QDataStream::Qt_6_5);
+
+    stream >> rootXml >> virtEnvJsonc >> title >> slides >> virtEnv;
+    return stream.status() == QDataStream::Ok && stream.atEnd();
+}
+
+bool PresentationIndex::load(const QString& path) {
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly) || file.size() == 0)
+        return false;
+
+    // Mapped instead of read, only the strings are copied out of it
+    uchar* data = file.map(0, file.size());
+    if(data == nullptr)
+        return false;
+
+    bool ok = deserialize(QByteArray::fromRawData(reinterpret_cast<const char*>(data), file.size()));
+    file.unmap(data);
+    return ok;
+}
+
+bool PresentationIndex::save(const QString& path) const {
+    if(!QDir().mkpath(QFileInfo(path).path()))
+        return false;
+
+    // Written atomically, so an interrupted write never leaves a corrupted index
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+
+    file.write(serialize());
+    return file.commit();
+}
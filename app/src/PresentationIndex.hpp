@@ -0,0 +1,89 @@
+#ifndef PRESENTATIONINDEX_HPP
+#define PRESENTATIONINDEX_HPP
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDataStream>
+#include <QtCore/QList>
+#include <QtCore/QString>
+
+#define PRESENTATION_INDEX_ENTRY "index.vsidx" // Name of the index embedded in the archive
+
+/* Element of a slide, as described in root.xml */
+struct ElementDescription
+{
+    enum Type : quint8 {
+        Text = 0,
+        Html,
+        Image,
+        Vm
+    };
+
+    Type type = Text;
+    /* Center and size, relative to the slide's size */
+    qreal x = 0.0;
+    qreal y = 0.0;
+    qreal width = 0.0;
+    qreal height = 0.0;
+    /* Text, HTML, image path or VM's id, depending on the type */
+    QString content;
+
+    bool operator==(const ElementDescription& other) const {
+        return type == other.type && x == other.x && y == other.y && width == other.width
+            && height == other.height && content == other.content;
+    }
+};
+
+struct SlideDescription
+{
+    /* Image path or a color name, may be empty */
+    QString background;
+    QList<ElementDescription> elements;
+
+    bool operator==(const SlideDescription& other) const {
+        return background == other.background && elements == other.elements;
+    }
+};
+
+/* Identifies the version of a source file by its central directory entry */
+struct SourceFingerprint
+{
+    quint32 crc = 0;
+    qint64 size = -1; // -1 if the file does not exist
+
+    bool operator==(const SourceFingerprint& other) const {
+        return crc == other.crc && size == other.size;
+    }
+    bool operator!=(const SourceFingerprint& other) const { return !(*this == other); }
+};
+
+/*
+ * Compiled form of root.xml and virt-env.jsonc. Slides are stored as
+ * descriptions and virt-env.jsonc as CBOR, so reopening a presentation
+ * doesn't parse any text. The fingerprints of the sources it was built from
+ * tell whether the index is stale.
+ */
+class PresentationIndex
+{
+public:
+    /* Returns false if the file can't be read, is corrupted or of another version */
+    bool load(const QString& path);
+    bool save(const QString& path) const;
+
+    QByteArray serialize() const;
+    bool deserialize(const QByteArray& data);
+public:
+    SourceFingerprint rootXml;
+    SourceFingerprint virtEnvJsonc;
+
+    QString title;
+    QList<SlideDescription> slides;
+    /* virt-env.jsonc as CBOR, empty if the archive doesn't contain it */
+    QByteArray virtEnv;
+};
+
+QDataStream& operator<<(QDataStream& stream, const ElementDescription& element);
+QDataStream& operator>>(QDataStream& stream, ElementDescription& element);
+QDataStream& operator<<(QDataStream& stream, const SlideDescription& slide);
+QDataStream& operator>>(QDataStream& stream, SlideDescription& slide);
+
+#endif // PRESENTATIONINDEX_HPP
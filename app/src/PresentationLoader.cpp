@@ -0,0 +1,203 @@
+#include "PresentationLoader.hpp"
+
+#include <QtCore/QDebug>
+
+#include <cassert>
+#include <exception>
+
+#include "Presentation.hpp"
+
+PresentationLoader::PresentationLoader(QString path, QObject* parent)
+    : QObject(parent), m_path(path)
+{
+    m_slideTimer.setInterval(0);
+    connect(&m_slideTimer, &QTimer::timeout, this, &PresentationLoader::buildNextSlide);
+}
+
+PresentationLoader::~PresentationLoader() {
+    cancel();
+
+    if(!m_presentationHandedOver && m_presentation) {
+        delete m_presentation;
+        m_presentation = nullptr;
+    }
+}
+
+QString PresentationLoader::stageDescription(Stage stage) {
+    switch(stage) {
+    case IndexArchive:
+        return "Extracting archive...";
+    case ParseManifest:
+        return "Parsing virtual environment...";
+    case BuildFirstSlide:
+        return "Building first slide...";
+    case PrepareVirtualMachines:
+        return "Preparing virtual machines...";
+    case BuildRemainingSlides:
+        return "Building slides...";
+    default:
+        return QString();
+    }
+}
+
+void PresentationLoader::start() {
+    // Deferred, so the caller can connect to signals and errors are reported from the event loop
+    QTimer::singleShot(0, this, [this] {
+        try {
+            m_presentation = new Presentation();
+        }
+        catch(std::exception &e) {
+            fail(e.what());
+            return;
+        }
+
+        runStage(IndexArchive, [this] {
+            m_presentation->decompressArchive(m_path);
+        }, [this] {
+            runStage(ParseManifest, [this] {
+                m_presentation->parseVirtEnvJsonc();
+            }, [this] { buildFirstSlide(); });
+        }, true);
+    });
+}
+
+void PresentationLoader::cancel() {
+    m_cancelled = true;
+    m_slideTimer.stop();
+
+    if(m_worker) {
+        m_worker->disconnect(this);
+        m_worker->wait();
+        delete m_worker;
+        m_worker = nullptr;
+    }
+}
+
+void PresentationLoader::runStage(Stage stage, std::function<void()> work,
+    std::function<void()> next, bool inWorkerThread)
+{
+    if(m_cancelled)
+        return;
+
+    emit stageStarted(stage);
+    m_stageTimers[stage].start();
+
+    if(!inWorkerThread) {
+        try {
+            work();
+        }
+        catch(std::exception &e) {
+            fail(e.what());
+            return;
+        }
+        finishStage(stage);
+
+        // Let the event loop breathe between stages
+        QTimer::singleShot(0, this, [this, next] {
+            if(!m_cancelled)
+                next();
+        });
+        return;
+    }
+
+    assert(m_worker == nullptr);
+    m_workerError = QString();
+    m_worker = QThread::create([this, work] {
+        try {
+            work();
+        }
+        catch(std::exception &e) {
+            m_workerError = QString::fromUtf8(e.what());
+        }
+    });
+    connect(m_worker, &QThread::finished, this, [this, stage, next] {
+        m_worker->wait();
+        m_worker->deleteLater();
+        m_worker = nullptr;
+
+        if(m_cancelled)
+            return;
+        if(!m_workerError.isNull()) {
+            fail(m_workerError);
+            return;
+        }
+        finishStage(stage);
+        next();
+    });
+    m_worker->start();
+}
+
+void PresentationLoader::finishStage(Stage stage) {
+    m_stageElapsed[stage] = m_stageTimers[stage].nsecsElapsed();
+
+    qInfo().noquote() << "[PresentationLoader]:" << stageDescription(stage)
+        << "took" << m_stageElapsed[stage] / 1000000.0 << "ms";
+    emit stageFinished(stage, m_stageElapsed[stage]);
+}
+
+void PresentationLoader::fail(QString cause) {
+    m_cancelled = true;
+    m_slideTimer.stop();
+
+    if(!m_presentationHandedOver && m_presentation) {
+        delete m_presentation;
+        m_presentation = nullptr;
+    }
+
+    emit failed(cause);
+}
+
+void PresentationLoader::buildFirstSlide() {
+    runStage(BuildFirstSlide, [this] {
+        m_presentation->parseRootXml();
+        m_presentation->buildNextSlide();
+    }, [this] {
+        m_presentationHandedOver = true;
+        emit firstSlideReady(m_presentation);
+        emit slideBuilt(0);
+
+        prepareVirtualMachines();
+
+        if(m_cancelled)
+            return;
+        emit stageStarted(BuildRemainingSlides);
+        m_stageTimers[BuildRemainingSlides].start();
+        m_slideTimer.start();
+    });
+}
+
+void PresentationLoader::buildNextSlide() {
+    try {
+        if(m_presentation->buildNextSlide()) {
+            emit slideBuilt(m_presentation->m_slides.size() - 1);
+            return;
+        }
+    }
+    catch(std::exception &e) {
+        fail(e.what());
+        return;
+    }
+
+    m_slideTimer.stop();
+    finishStage(BuildRemainingSlides);
+    m_slidesBuilt = true;
+    checkFinished();
+}
+
+void PresentationLoader::prepareVirtualMachines() {
+    runStage(PrepareVirtualMachines, [this] {
+        m_presentation->prepareVirtualMachines();
+    }, [this] {
+        m_presentation->startVirtualMachines();
+        m_vmsPrepared = true;
+        checkFinished();
+    }, true);
+}
+
+void PresentationLoader::checkFinished() {
+    if(!m_vmsPrepared || !m_slidesBuilt || m_finished)
+        return;
+
+    m_finished = true;
+    emit finished();
+}
@@ -0,0 +1,85 @@
+#ifndef PRESENTATIONLOADER_HPP
+#define PRESENTATIONLOADER_HPP
+
+#include <QtCore/QObject>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtCore/QList>
+
+#include <functional>
+
+struct Presentation;
+
+/*
+ * Opens a presentation without blocking the GUI thread.
+ * Loading is split into stages, archive extraction and disk image
+ * copying run in a worker thread. firstSlideReady() is emitted as soon
+ * as the first slide can be displayed, the remaining slides are built
+ * one per event loop iteration while the virtual machines are prepared
+ * in the background. Building slides only looks the virtual machines up,
+ * and the presentation isn't reloaded before finished().
+ */
+class PresentationLoader : public QObject
+{
+    Q_OBJECT
+public:
+    enum Stage {
+        IndexArchive = 0,
+        ParseManifest,
+        BuildFirstSlide,
+        PrepareVirtualMachines,
+        BuildRemainingSlides,
+        StageCount
+    };
+    Q_ENUM(Stage)
+
+    PresentationLoader(QString path, QObject* parent = nullptr);
+    ~PresentationLoader();
+
+    void start();
+    /* Stops loading and waits for the worker thread to finish */
+    void cancel();
+
+    bool isFinished() const { return m_finished; }
+    /* Returns stage's duration in nanoseconds, or -1 if the stage didn't finish */
+    qint64 stageElapsed(Stage stage) const { return m_stageElapsed[stage]; }
+    static QString stageDescription(Stage stage);
+signals:
+    void stageStarted(PresentationLoader::Stage stage);
+    void stageFinished(PresentationLoader::Stage stage, qint64 nsecs);
+    /* The receiver takes ownership of the presentation */
+    void firstSlideReady(Presentation* presentation);
+    void slideBuilt(size_t index);
+    void finished();
+    void failed(QString cause);
+private slots:
+    void buildNextSlide();
+private:
+    void runStage(Stage stage, std::function<void()> work,
+        std::function<void()> next, bool inWorkerThread = false);
+    void finishStage(Stage stage);
+    void fail(QString cause);
+
+    void buildFirstSlide();
+    void prepareVirtualMachines();
+    void checkFinished();
+private:
+    QString m_path;
+    Presentation* m_presentation = nullptr;
+    bool m_presentationHandedOver = false;
+
+    QThread* m_worker = nullptr;
+    QString m_workerError;
+    QTimer m_slideTimer = QTimer(this);
+
+    QElapsedTimer m_stageTimers[StageCount];
+    QList<qint64> m_stageElapsed = QList<qint64>(StageCount, -1);
+
+    bool m_cancelled = false;
+    bool m_finished = false;
+    bool m_vmsPrepared = false;
+    bool m_slidesBuilt = false;
+};
+
+#endif // PRESENTATIONLOADER_HPP
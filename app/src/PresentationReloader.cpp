@@ -0,0 +1,97 @@
+#include "PresentationReloader.hpp"
+
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QDirIterator>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QSet>
+
+#include <exception>
+
+#include "Presentation.hpp"
+
+#define RELOAD_DELAY_MS 100 // Time to wait for further changes
+
+PresentationReloader::PresentationReloader(Presentation* presentation, QObject* parent)
+    : QObject(parent), m_presentation(presentation)
+{
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(RELOAD_DELAY_MS);
+
+    connect(&m_timer, &QTimer::timeout, this, &PresentationReloader::reload);
+    connect(&m_watcher, &QFileSystemWatcher::fileChanged, &m_timer, qOverload<>(&QTimer::start));
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged, &m_timer, qOverload<>(&QTimer::start));
+
+    m_files = scan();
+    watch();
+}
+
+QHash<QString, PresentationReloader::FileState> PresentationReloader::scan() const {
+    QHash<QString, FileState> files;
+    QDir root(m_presentation->rootPath());
+
+    QDirIterator it(root.path(), QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+    while(it.hasNext()) {
+        it.next();
+        QFileInfo fileInfo = it.fileInfo();
+        files.insert(root.relativeFilePath(fileInfo.filePath()),
+            FileState { fileInfo.size(), fileInfo.lastModified() });
+    }
+    return files;
+}
+
+void PresentationReloader::watch() {
+    QStringList paths = { m_presentation->rootPath() };
+    for(auto it = m_files.constBegin(); it != m_files.constEnd(); ++it)
+        paths += m_presentation->rootPath() + "/" + it.key();
+
+    QDirIterator it(m_presentation->rootPath(), QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden,
+        QDirIterator::Subdirectories);
+    while(it.hasNext())
+        paths += it.next();
+
+    // Editors often replace files instead of writing them, which drops the watch
+    QStringList watched = m_watcher.files() + m_watcher.directories();
+    for(auto &path : watched)
+        paths.removeAll(path);
+    if(!paths.isEmpty())
+        m_watcher.addPaths(paths);
+}
+
+void PresentationReloader::reload() {
+    QHash<QString, FileState> files = scan();
+
+    QSet<QString> changedPaths;
+    for(auto it = files.constBegin(); it != files.constEnd(); ++it) {
+        auto old = m_files.constFind(it.key());
+        if(old == m_files.constEnd() || old.value() != it.value())
+            changedPaths += it.key();
+    }
+    for(auto it = m_files.constBegin(); it != m_files.constEnd(); ++it) {
+        if(!files.contains(it.key()))
+            changedPaths += it.key();
+    }
+
+    m_files = files;
+    watch();
+
+    if(changedPaths.isEmpty())
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    emit aboutToReload();
+    try {
+        m_presentation->reload(changedPaths);
+    }
+    catch(std::exception &e) {
+        qWarning().noquote() << "[PresentationReloader]: reload failed:" << e.what();
+        emit reloadFailed(QString::fromUtf8(e.what()));
+        return;
+    }
+
+    qInfo().noquote() << "[PresentationReloader]:" << changedPaths.size() << "changed file(s) applied in"
+        << timer.nsecsElapsed() / 1000000.0 << "ms";
+    emit reloaded(timer.nsecsElapsed());
+}
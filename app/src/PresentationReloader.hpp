@@ -0,0 +1,52 @@
+#ifndef PRESENTATIONRELOADER_HPP
+#define PRESENTATIONRELOADER_HPP
+
+#include <QtCore/QObject>
+#include <QtCore/QDateTime>
+#include <QtCore/QFileSystemWatcher>
+#include <QtCore/QHash>
+#include <QtCore/QTimer>
+
+struct Presentation;
+
+/*
+ * Development mode for presentations opened from a directory. Watches the
+ * deck and applies changes without reopening it, see Presentation::reload().
+ * Events are coalesced, so an editor saving several files at once causes
+ * a single reload.
+ */
+class PresentationReloader : public QObject
+{
+    Q_OBJECT
+public:
+    PresentationReloader(Presentation* presentation, QObject* parent = nullptr);
+signals:
+    /* Emitted right before slides are replaced, nothing may reference them afterwards */
+    void aboutToReload();
+    void reloaded(qint64 nsecs);
+    void reloadFailed(QString cause);
+private slots:
+    void reload();
+private:
+    struct FileState {
+        qint64 size;
+        QDateTime lastModified;
+
+        bool operator==(const FileState& other) const {
+            return size == other.size && lastModified == other.lastModified;
+        }
+        bool operator!=(const FileState& other) const { return !(*this == other); }
+    };
+
+    /* Returns the state of every file of the deck, keyed by its relative path */
+    QHash<QString, FileState> scan() const;
+    void watch();
+private:
+    Presentation* m_presentation = nullptr;
+
+    QFileSystemWatcher m_watcher = QFileSystemWatcher(this);
+    QTimer m_timer = QTimer(this);
+    QHash<QString, FileState> m_files;
+};
+
+#endif // PRESENTATIONRELOADER_HPP
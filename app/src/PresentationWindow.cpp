@@ -1,18 +1,48 @@
 #include "PresentationWindow.hpp"
 
 #include <QtCore/QPropertyAnimation>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QDebug>
 
 #include <QtGui/QResizeEvent>
 
 #include <QtWidgets/QGraphicsOpacityEffect>
 
-PresentationWindow::PresentationWindow(Presentation* presentation)
-    : QMainWindow(), m_presentation(presentation)
+#include "Config.hpp"
+#include "SlidePrefetcher.hpp"
+#include "PresentationLoader.hpp"
+#include "PresentationReloader.hpp"
+
+PresentationWindow::PresentationWindow(Presentation* presentation, PresentationLoader* loader)
+    : QMainWindow(), m_presentation(presentation), m_loader(loader)
 {
     presentation->m_slides[0]->setParent(this);
     presentation->m_slides[0]->setFixedSize(size());
     presentation->m_slides[0]->show();
 
+    m_transitionLabel->hide();
+
+    m_prefetcher = new SlidePrefetcher(m_presentation, this);
+    m_prefetcher->setDistance(Config::getSlidePrefetchDistance());
+    m_prefetcher->schedule(m_currentSlideIndex);
+
+    if(m_loader) {
+        m_loader->setParent(this);
+        connect(m_loader, &PresentationLoader::slideBuilt, this, [this](size_t index) {
+            size_t distance = index > m_currentSlideIndex ? index - m_currentSlideIndex : m_currentSlideIndex - index;
+            if(distance <= m_prefetcher->distance())
+                m_prefetcher->schedule(m_currentSlideIndex);
+        });
+    }
+
+    // Unpacked presentations are reloaded on change, once they're fully loaded
+    if(m_presentation->isUnpacked()) {
+        if(m_loader && !m_loader->isFinished())
+            connect(m_loader, &PresentationLoader::finished, this, &PresentationWindow::startReloader);
+        else
+            startReloader();
+    }
+
     setWindowTitle("Virtual Slides - " + m_presentation->m_title);
 
     m_nextSlideAction->setShortcuts(QList<QKeySequence>() 
@@ -55,6 +85,12 @@ PresentationWindow::~PresentationWindow() {
         m_toggleFullScreenAction = nullptr;
     }
 
+    // The loader may still use the presentation in its worker thread
+    if(m_loader) {
+        m_loader->cancel();
+        m_loader = nullptr;
+    }
+
     if(m_presentation) {
         delete m_presentation;
         m_presentation = nullptr;
@@ -63,6 +99,8 @@ PresentationWindow::~PresentationWindow() {
 
 void PresentationWindow::resizeEvent(QResizeEvent *e) {
     m_presentation->m_slides[m_currentSlideIndex]->setFixedSize(e->size());
+    m_transitionLabel->setGeometry(QRect(QPoint(0, 0), e->size()));
+    m_prefetcher->invalidate();
 
     QMainWindow::resizeEvent(e);
 }
@@ -70,19 +108,45 @@ void PresentationWindow::resizeEvent(QResizeEvent *e) {
 void PresentationWindow::setSlide(size_t index) {
     if(m_presentation->m_slides.size() <= index)
         return;
+    if(index == m_currentSlideIndex)
+        return;
+
+    QElapsedTimer switchTimer;
+    switchTimer.start();
+
+    finishTransition();
+
     size_t newIndex = index;
     size_t oldIndex = m_currentSlideIndex;
+    PresentationSlide* newSlide = m_presentation->m_slides[newIndex];
+    QPixmap snapshot = m_prefetcher->snapshot(newIndex);
 
     // slide set-up
-    m_presentation->m_slides[newIndex]->setParent(this);
-    m_presentation->m_slides[newIndex]->setFixedSize(size());
-    m_presentation->m_slides[newIndex]->show();
-    m_presentation->m_slides[newIndex]->raise();
-
+    if(newSlide->parentWidget() != this)
+        newSlide->setParent(this);
+    newSlide->setFixedSize(size());
+
+    /* 
+     * If the slide was prefetched, fade in its snapshot and show the slide itself
+     * when the transition finishes, so the opacity effect doesn't have to
+     * render the whole widget tree on every animation frame.
+     */
+    QWidget* fadingWidget = newSlide;
+    if(!snapshot.isNull()) {
+        m_transitionLabel->setPixmap(snapshot);
+        m_transitionLabel->setGeometry(rect());
+        m_transitionLabel->show();
+        m_transitionLabel->raise();
+        fadingWidget = m_transitionLabel;
+    }
+    else {
+        newSlide->show();
+        newSlide->raise();
+    }
 
     QGraphicsOpacityEffect *effect = new QGraphicsOpacityEffect();
     effect->setOpacity(1.0f);
-    m_presentation->m_slides[newIndex]->setGraphicsEffect(effect);
+    fadingWidget->setGraphicsEffect(effect);
 
     QPropertyAnimation *a = new QPropertyAnimation(effect, "opacity");
     a->setDuration(200);
@@ -90,12 +154,77 @@ void PresentationWindow::setSlide(size_t index) {
     a->setEndValue(1.0f);
     a->setEasingCurve(QEasingCurve::Type::InBack);
 
-    connect(a, &QPropertyAnimation::finished, this, [this, oldIndex]() {
-        m_presentation->m_slides[oldIndex]->hide();
-    });
+    connect(a, &QPropertyAnimation::finished, this, &PresentationWindow::finishTransition);
+    m_transition = a;
     a->start(QPropertyAnimation::DeleteWhenStopped);
 
+    m_previousSlideIndex = oldIndex;
     m_currentSlideIndex = newIndex;
+
+    m_prefetcher->schedule(newIndex);
+
+    m_lastSlideSwitchNsecs = switchTimer.nsecsElapsed();
+#if DEBUG_BUILD
+    qDebug() << "[PresentationWindow]: switched to slide" << newIndex
+        << (snapshot.isNull() ? "(not prefetched)" : "(prefetched)")
+        << "in" << m_lastSlideSwitchNsecs / 1000 << "us";
+#endif
+    emit slideChanged(newIndex, m_lastSlideSwitchNsecs);
+}
+
+void PresentationWindow::finishTransition() {
+    if(m_transition.isNull())
+        return;
+
+    QPropertyAnimation* a = m_transition;
+    m_transition = nullptr;
+    // Stopping doesn't emit finished(), the animation deletes itself
+    if(a->state() != QAbstractAnimation::Stopped)
+        a->stop();
+
+    PresentationSlide* currentSlide = m_presentation->m_slides[m_currentSlideIndex];
+    currentSlide->setGraphicsEffect(nullptr);
+    currentSlide->show();
+    currentSlide->raise();
+
+    m_transitionLabel->setGraphicsEffect(nullptr);
+    m_transitionLabel->hide();
+    m_transitionLabel->setPixmap(QPixmap());
+
+    if(m_previousSlideIndex != m_currentSlideIndex)
+        m_presentation->m_slides[m_previousSlideIndex]->hide();
+}
+
+void PresentationWindow::startReloader() {
+    if(m_reloader)
+        return;
+
+    m_reloader = new PresentationReloader(m_presentation, this);
+    connect(m_reloader, &PresentationReloader::aboutToReload, this, &PresentationWindow::finishTransition);
+    connect(m_reloader, &PresentationReloader::reloaded, this, &PresentationWindow::handleReloaded);
+}
+
+void PresentationWindow::handleReloaded() {
+    if(m_currentSlideIndex >= (size_t)m_presentation->m_slides.size())
+        m_currentSlideIndex = m_presentation->m_slides.size() - 1;
+    m_previousSlideIndex = m_currentSlideIndex;
+
+    for(qsizetype i = 0; i < m_presentation->m_slides.size(); ++i) {
+        PresentationSlide* slide = m_presentation->m_slides[i];
+        if((size_t)i != m_currentSlideIndex) {
+            slide->hide();
+            continue;
+        }
+
+        if(slide->parentWidget() != this)
+            slide->setParent(this);
+        slide->setFixedSize(size());
+        slide->show();
+        slide->raise();
+    }
+
+    setWindowTitle("Virtual Slides - " + m_presentation->m_title);
+    m_prefetcher->invalidate();
 }
 
 void PresentationWindow::toggleFullScreen() {
@@ -2,22 +2,47 @@
 #define PRESENTATIONWINDOW_HPP
 
 #include <QtWidgets/QMainWindow>
+#include <QtWidgets/QLabel>
+#include <QtCore/QPropertyAnimation>
+#include <QtCore/QPointer>
 #include <QtGui/QAction>
 
 #include "Presentation.hpp"
 
+class SlidePrefetcher;
+class PresentationLoader;
+class PresentationReloader;
+
 class PresentationWindow : public QMainWindow
 {
     Q_OBJECT
 public:
-    explicit PresentationWindow(Presentation* presentation);
+    /* If the presentation is still being loaded, the window takes ownership of the loader */
+    explicit PresentationWindow(Presentation* presentation, PresentationLoader* loader = nullptr);
     ~PresentationWindow();
 
     void toggleFullScreen();
+
+    /* Duration of the last synchronous slide switch in nanoseconds */
+    qint64 lastSlideSwitchNsecs() const { return m_lastSlideSwitchNsecs; }
+signals:
+    void slideChanged(size_t index, qint64 switchNsecs);
+private:
+    void finishTransition();
+    void startReloader();
+    void handleReloaded();
 private:
     Presentation* m_presentation = nullptr;
+    SlidePrefetcher* m_prefetcher = nullptr;
+    PresentationLoader* m_loader = nullptr;
+    PresentationReloader* m_reloader = nullptr;
 
     quint64 m_currentSlideIndex = 0;
+    quint64 m_previousSlideIndex = 0;
+    qint64 m_lastSlideSwitchNsecs = 0;
+
+    QLabel* m_transitionLabel = new QLabel(this);
+    QPointer<QPropertyAnimation> m_transition;
     QAction* m_nextSlideAction = new QAction(this);
     QAction* m_previousSlideAction = new QAction(this);
     QAction* m_toggleFullScreenAction = new QAction(this);
@@ -0,0 +1,271 @@
+#include "ShmTransport.hpp"
+
+#include <QtCore/QDeadlineTimer>
+#include <QtCore/QSocketNotifier>
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_TRANSPORT_MAGIC 0x52485356 // "VSHR"
+#define SHM_TRANSPORT_VERSION 1
+/* The rings' data follows the header page, the creator's ring first */
+#define SHM_TRANSPORT_HEADER_SZ 4096
+/* The peer mustn't be able to truncate the memfd under our mapping */
+#define SHM_TRANSPORT_SEALS (F_SEAL_SHRINK | F_SEAL_GROW)
+
+/* Indices are free-running, each one is written by a single side */
+struct ShmTransportRing {
+    std::atomic<uint32_t> head; // producer
+    char pad0[60];
+    std::atomic<uint32_t> tail; // consumer
+    /* Set by the producer when it ran out of space, the consumer rings it after reading */
+    std::atomic<uint32_t> producerWaiting;
+    char pad1[56];
+};
+
+struct ShmTransportHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ringSize;
+    char pad[52];
+    /* Indexed by the producing Side */
+    ShmTransportRing rings[2];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+    "The rings are shared with QEMU, which uses plain uint32_t");
+static_assert(sizeof(ShmTransportRing) == 128 && sizeof(ShmTransportHeader) == 320
+    && sizeof(ShmTransportHeader) <= SHM_TRANSPORT_HEADER_SZ, "Layout differs from virtio-vsock.h");
+
+static void closeFds(const int* fds, int count) {
+    for(int i = 0; i < count; i++) {
+        if(fds[i] >= 0)
+            ::close(fds[i]);
+    }
+}
+
+static inline bool isPowerOfTwo(quint32 value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+bool ShmTransport::createFds(int fds[SHM_TRANSPORT_FD_COUNT], quint32 ringSize) {
+    for(int i = 0; i < SHM_TRANSPORT_FD_COUNT; i++)
+        fds[i] = -1;
+    if(!isPowerOfTwo(ringSize)) {
+        errno = EINVAL;
+        return false;
+    }
+
+    const uint32_t info[3] = { SHM_TRANSPORT_MAGIC, SHM_TRANSPORT_VERSION, ringSize };
+    fds[0] = memfd_create("vs-shm-transport", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(fds[0] < 0
+        || ftruncate(fds[0], SHM_TRANSPORT_HEADER_SZ + 2 * (off_t)ringSize) < 0
+        || pwrite(fds[0], info, sizeof(info), 0) != sizeof(info)
+        || fcntl(fds[0], F_ADD_SEALS, SHM_TRANSPORT_SEALS) < 0
+        || (fds[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0
+        || (fds[2] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+    {
+        int err = errno;
+        closeFds(fds, SHM_TRANSPORT_FD_COUNT);
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+ShmTransport* ShmTransport::attach(Side side, const int fds[SHM_TRANSPORT_FD_COUNT], QObject* parent) {
+    struct stat st;
+    uint32_t info[3];
+    if(fstat(fds[0], &st) < 0
+        || (fcntl(fds[0], F_GET_SEALS) & SHM_TRANSPORT_SEALS) != SHM_TRANSPORT_SEALS
+        || pread(fds[0], info, sizeof(info), 0) != sizeof(info)
+        || info[0] != SHM_TRANSPORT_MAGIC || info[1] != SHM_TRANSPORT_VERSION
+        || !isPowerOfTwo(info[2])
+        || st.st_size != SHM_TRANSPORT_HEADER_SZ + 2 * (off_t)info[2])
+    {
+        closeFds(fds, SHM_TRANSPORT_FD_COUNT);
+        return nullptr;
+    }
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    // The mapping keeps the memory alive
+    ::close(fds[0]);
+    if(map == MAP_FAILED) {
+        closeFds(fds + 1, SHM_TRANSPORT_FD_COUNT - 1);
+        return nullptr;
+    }
+
+    ShmTransport* transport = new ShmTransport(side, parent);
+    transport->m_header = (ShmTransportHeader*)map;
+    transport->m_mapSize = st.st_size;
+    transport->m_ringSize = info[2];
+    char* rings = (char*)map + SHM_TRANSPORT_HEADER_SZ;
+    transport->m_txData = rings + side * transport->m_ringSize;
+    transport->m_rxData = rings + (side == Creator ? Acceptor : Creator) * transport->m_ringSize;
+    transport->m_eventFd = fds[1 + side];
+    transport->m_peerEventFd = fds[side == Creator ? 2 : 1];
+
+    transport->m_notifier = new QSocketNotifier(transport->m_eventFd, QSocketNotifier::Read, transport);
+    connect(transport->m_notifier, &QSocketNotifier::activated, transport, &ShmTransport::handleEvent);
+    return transport;
+}
+
+ShmTransport::~ShmTransport() {
+    delete m_notifier;
+    munmap(m_header, m_mapSize);
+    ::close(m_eventFd);
+    ::close(m_peerEventFd);
+}
+
+qint64 ShmTransport::bytesAvailable() const {
+    const ShmTransportRing& ring = m_header->rings[m_side == Creator ? Acceptor : Creator];
+    uint32_t used = ring.head.load(std::memory_order_acquire) - ring.tail.load(std::memory_order_relaxed);
+    // Don't trust the peer's index
+    return qMin(used, m_ringSize);
+}
+
+qint64 ShmTransport::bytesFree() const {
+    const ShmTransportRing& ring = m_header->rings[m_side];
+    uint32_t used = ring.head.load(std::memory_order_relaxed) - ring.tail.load(std::memory_order_acquire);
+    return m_ringSize - qMin(used, m_ringSize);
+}
+
+qint64 ShmTransport::indexOf(char c) const {
+    const ShmTransportRing& ring = m_header->rings[m_side == Creator ? Acceptor : Creator];
+    uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+    qint64 size = bytesAvailable();
+    uint32_t offset = tail & (m_ringSize - 1);
+    qint64 first = qMin<qint64>(size, m_ringSize - offset);
+
+    const char* found = (const char*)memchr(m_rxData + offset, c, first);
+    if(found)
+        return found - (m_rxData + offset);
+    found = (const char*)memchr(m_rxData, c, size - first);
+    return found ? first + (found - m_rxData) : -1;
+}
+
+qint64 ShmTransport::read(char* data, qint64 maxSize) {
+    ShmTransportRing& ring = m_header->rings[m_side == Creator ? Acceptor : Creator];
+    uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+    qint64 size = qMin(bytesAvailable(), maxSize);
+    if(size <= 0)
+        return 0;
+
+    uint32_t offset = tail & (m_ringSize - 1);
+    qint64 first = qMin<qint64>(size, m_ringSize - offset);
+    memcpy(data, m_rxData + offset, first);
+    memcpy(data + first, m_rxData, size - first);
+
+    consume(tail, size);
+    return size;
+}
+
+QByteArrayView ShmTransport::nextDataBlock() const {
+    const ShmTransportRing& ring = m_header->rings[m_side == Creator ? Acceptor : Creator];
+    uint32_t offset = ring.tail.load(std::memory_order_relaxed) & (m_ringSize - 1);
+    return QByteArrayView(m_rxData + offset, qMin<qint64>(bytesAvailable(), m_ringSize - offset));
+}
+
+qint64 ShmTransport::skip(qint64 maxSize) {
+    const ShmTransportRing& ring = m_header->rings[m_side == Creator ? Acceptor : Creator];
+    qint64 size = qMin(bytesAvailable(), maxSize);
+    if(size <= 0)
+        return 0;
+    consume(ring.tail.load(std::memory_order_relaxed), size);
+    return size;
+}
+
+void ShmTransport::consume(uint32_t tail, qint64 size) {
+    ShmTransportRing& ring = m_header->rings[m_side == Creator ? Acceptor : Creator];
+    ring.tail.store(tail + size, std::memory_order_release);
+    // Pairs with the fence in write(), either we see the flag or the producer sees the space
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(ring.producerWaiting.load(std::memory_order_relaxed)) {
+        ring.producerWaiting.store(0, std::memory_order_relaxed);
+        notifyPeer();
+    }
+}
+
+qint64 ShmTransport::push(const char* data, qint64 size) {
+    ShmTransportRing& ring = m_header->rings[m_side];
+    uint32_t head = ring.head.load(std::memory_order_relaxed);
+    size = qMin(bytesFree(), size);
+    if(size <= 0)
+        return 0;
+
+    uint32_t offset = head & (m_ringSize - 1);
+    qint64 first = qMin<qint64>(size, m_ringSize - offset);
+    memcpy(m_txData + offset, data, first);
+    memcpy(m_txData, data + first, size - first);
+
+    ring.head.store(head + size, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // The consumer had read everything, it may be asleep
+    if(ring.tail.load(std::memory_order_relaxed) == head)
+        notifyPeer();
+    return size;
+}
+
+qint64 ShmTransport::write(const char* data, qint64 size) {
+    ShmTransportRing& ring = m_header->rings[m_side];
+    qint64 written = 0;
+    for(;;) {
+        written += push(data + written, size - written);
+        if(written == size)
+            break;
+
+        ring.producerWaiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // The consumer may have read before seeing the flag
+        if(bytesFree() == 0) {
+            m_wantsSpace = true;
+            break;
+        }
+    }
+    return written;
+}
+
+bool ShmTransport::waitForEvent(int msecs) {
+    QDeadlineTimer deadline(msecs);
+    struct pollfd pfd = { m_eventFd, POLLIN, 0 };
+    int rc;
+    do {
+        if(m_interrupted.exchange(false))
+            return false;
+        rc = ::poll(&pfd, 1, deadline.remainingTime());
+    } while(rc < 0 && errno == EINTR);
+    if(rc <= 0)
+        return false;
+
+    eventfd_t value;
+    eventfd_read(m_eventFd, &value);
+    return !m_interrupted.exchange(false);
+}
+
+void ShmTransport::interruptWait() {
+    m_interrupted = true;
+    eventfd_write(m_eventFd, 1);
+}
+
+void ShmTransport::handleEvent() {
+    eventfd_t value;
+    eventfd_read(m_eventFd, &value);
+
+    if(m_wantsSpace && bytesFree() > 0) {
+        m_wantsSpace = false;
+        emit spaceAvailable();
+    }
+    if(bytesAvailable() > 0)
+        emit readyRead();
+}
+
+void ShmTransport::notifyPeer() {
+    eventfd_write(m_peerEventFd, 1);
+}
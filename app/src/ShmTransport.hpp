@@ -0,0 +1,104 @@
+#ifndef SHMTRANSPORT_HPP
+#define SHMTRANSPORT_HPP
+
+#include <QtCore/QByteArrayView>
+#include <QtCore/QObject>
+
+#include <atomic>
+
+class QSocketNotifier;
+
+/* Size of each ring, QEMU gives the guest as much credit */
+#define SHM_TRANSPORT_RING_SZ (256 * 1024)
+/* The memfd, the creator's eventfd and the acceptor's eventfd, in that order */
+#define SHM_TRANSPORT_FD_COUNT 3
+
+struct ShmTransportHeader;
+
+/*
+ * Byte stream through shared memory: a sealed memfd holding a single
+ * producer, single consumer ring per direction, and an eventfd per side
+ * the peer rings when it has written to an empty ring or freed space the
+ * other side waits for. The creator (QEMU's virtio-vsock) makes the fds
+ * and passes them over the connection's UDS, the acceptor maps them.
+ * Data is copied between the ring and the caller's buffer only, or not at
+ * all with nextDataBlock() and skip(), and no syscall is made while the
+ * consumer keeps up.
+ *
+ * The memory layout is shared with qemu/virtio-vsock.h.
+ */
+class ShmTransport : public QObject
+{
+    Q_OBJECT
+public:
+    enum Side {
+        Creator = 0,
+        Acceptor
+    };
+
+    /* Makes the fds of a new transport, ringSize has to be a power of two */
+    static bool createFds(int fds[SHM_TRANSPORT_FD_COUNT], quint32 ringSize = SHM_TRANSPORT_RING_SZ);
+    /*
+     * Takes ownership of the fds, they are closed on failure. Returns
+     * nullptr if they aren't a transport of a known version, or the memfd
+     * isn't sealed against resizing.
+     */
+    static ShmTransport* attach(Side side, const int fds[SHM_TRANSPORT_FD_COUNT], QObject* parent = nullptr);
+    ~ShmTransport();
+
+    Side side() const { return m_side; }
+    quint32 ringSize() const { return m_ringSize; }
+
+    qint64 bytesAvailable() const;
+    /* Free space in the outgoing ring */
+    qint64 bytesFree() const;
+    /* Returns -1 if c isn't in the incoming ring */
+    qint64 indexOf(char c) const;
+
+    qint64 read(char* data, qint64 maxSize);
+    /* Up to the end of the ring, the rest comes after skip() */
+    QByteArrayView nextDataBlock() const;
+    qint64 skip(qint64 maxSize);
+    /*
+     * Copies as much as fits and returns the number of bytes written. After
+     * a short write spaceAvailable() is emitted once the peer reads.
+     */
+    qint64 write(const char* data, qint64 size);
+
+    /* Blocks until the peer rings, returns false on timeout or interruptWait() */
+    bool waitForEvent(int msecs);
+    /* Wakes up a blocking wait, can be called from any thread */
+    void interruptWait();
+signals:
+    /*
+     * The peer has written to an empty ring. Like with an edge triggered
+     * socket, it isn't repeated for data left unread.
+     */
+    void readyRead();
+    void spaceAvailable();
+private:
+    ShmTransport(Side side, QObject* parent) : QObject(parent), m_side(side) { }
+
+    void handleEvent();
+    void notifyPeer();
+    /* Frees size bytes of the incoming ring from tail on */
+    void consume(uint32_t tail, qint64 size);
+    qint64 push(const char* data, qint64 size);
+private:
+    Side m_side;
+    ShmTransportHeader* m_header = nullptr;
+    size_t m_mapSize = 0;
+    quint32 m_ringSize = 0;
+    char* m_rxData = nullptr;
+    char* m_txData = nullptr;
+
+    /* Rung by the peer */
+    int m_eventFd = -1;
+    int m_peerEventFd = -1;
+    QSocketNotifier* m_notifier = nullptr;
+
+    bool m_wantsSpace = false;
+    std::atomic<bool> m_interrupted { false };
+};
+
+#endif // SHMTRANSPORT_HPP
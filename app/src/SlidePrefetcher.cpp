@@ -0,0 +1,104 @@
+#include "SlidePrefetcher.hpp"
+
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtWidgets/QWidget>
+
+#include "Presentation.hpp"
+
+/*
+ * Delay before prefetching starts after navigation. It's longer than the
+ * slide transition, so the animation doesn't compete with the prefetcher.
+ */
+#define PREFETCH_START_DELAY_MS 250
+
+SlidePrefetcher::SlidePrefetcher(Presentation* presentation, QWidget* window)
+    : QObject(window), m_presentation(presentation), m_window(window)
+{
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, this, &SlidePrefetcher::prefetchNext);
+}
+
+void SlidePrefetcher::schedule(size_t currentIndex) {
+    m_currentIndex = currentIndex;
+    m_queue.clear();
+
+    evictDistantSnapshots();
+
+    // Nearest slides first, the next slide before the previous one
+    for(size_t i = 1; i <= m_distance; ++i) {
+        if(currentIndex + i < (size_t)m_presentation->m_slides.size())
+            m_queue.enqueue(currentIndex + i);
+        if(currentIndex >= i)
+            m_queue.enqueue(currentIndex - i);
+    }
+
+    m_timer.start(PREFETCH_START_DELAY_MS);
+}
+
+void SlidePrefetcher::invalidate() {
+    m_snapshots.clear();
+    schedule(m_currentIndex);
+}
+
+bool SlidePrefetcher::isPrepared(size_t index) const {
+    return !snapshot(index).isNull();
+}
+
+QPixmap SlidePrefetcher::snapshot(size_t index) const {
+    if(index >= (size_t)m_presentation->m_slides.size())
+        return QPixmap();
+
+    QPixmap pixmap = m_snapshots.value(m_presentation->m_slides[index]);
+    if(pixmap.deviceIndependentSize().toSize() != m_window->size())
+        return QPixmap();
+    return pixmap;
+}
+
+void SlidePrefetcher::prefetchNext() {
+    while(!m_queue.isEmpty()) {
+        size_t index = m_queue.dequeue();
+        if(index == m_currentIndex || isPrepared(index))
+            continue;
+
+        prepare(index);
+        break;
+    }
+
+    // Yield to the event loop between slides
+    if(!m_queue.isEmpty())
+        m_timer.start(0);
+}
+
+void SlidePrefetcher::prepare(size_t index) {
+    if(index >= (size_t)m_presentation->m_slides.size())
+        return;
+    PresentationSlide* slide = m_presentation->m_slides[index];
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if(slide->parentWidget() != m_window)
+        slide->setParent(m_window);
+    slide->setFixedSize(m_window->size());
+
+    // Rendering a hidden widget delivers its pending resize events, lays out
+    // all elements and warms up pixmap and text caches
+    m_snapshots[slide] = slide->grab();
+
+#if DEBUG_BUILD
+    qDebug() << "[SlidePrefetcher]: slide" << index << "prepared in"
+        << timer.nsecsElapsed() / 1000 << "us";
+#endif
+}
+
+void SlidePrefetcher::evictDistantSnapshots() {
+    for(auto it = m_snapshots.begin(); it != m_snapshots.end();) {
+        size_t index = m_presentation->m_slides.indexOf(it.key());
+        size_t distance = index > m_currentIndex ? index - m_currentIndex : m_currentIndex - index;
+        if(distance > m_distance)
+            it = m_snapshots.erase(it);
+        else
+            ++it;
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef SLIDEPREFETCHER_HPP
+#define SLIDEPREFETCHER_HPP
+
+#include <QtCore/QObject>
+#include <QtCore/QTimer>
+#include <QtCore/QHash>
+#include <QtCore/QQueue>
+#include <QtGui/QPixmap>
+
+struct Presentation;
+class PresentationSlide;
+
+/*
+ * Prepares slides around the current one while the event loop is idle:
+ * re-parents them to the window, applies the window size (which lays out
+ * all elements) and renders a snapshot that is used for the transition.
+ * Only one slide is prepared per event loop iteration, so user input is
+ * never blocked for longer than it takes to prepare a single slide.
+ */
+class SlidePrefetcher : public QObject
+{
+    Q_OBJECT
+public:
+    SlidePrefetcher(Presentation* presentation, QWidget* window);
+
+    void setDistance(size_t distance) { m_distance = distance; }
+    size_t distance() const { return m_distance; }
+
+    /* Schedules preparation of slides around currentIndex */
+    void schedule(size_t currentIndex);
+    /* Drops all snapshots, e.g. after the window was resized */
+    void invalidate();
+
+    bool isPrepared(size_t index) const;
+    /* Returns a null pixmap if the slide is not prepared for the current window size */
+    QPixmap snapshot(size_t index) const;
+private slots:
+    void prefetchNext();
+private:
+    void prepare(size_t index);
+    void evictDistantSnapshots();
+private:
+    Presentation* m_presentation = nullptr;
+    QWidget* m_window = nullptr;
+
+    size_t m_currentIndex = 0;
+    size_t m_distance = 1;
+
+    QTimer m_timer = QTimer(this);
+    QQueue<size_t> m_queue;
+    QHash<PresentationSlide*, QPixmap> m_snapshots;
+};
+
+#endif // SLIDEPREFETCHER_HPP
@@ -0,0 +1,299 @@
+#include "SocketBuffer.hpp"
+
+#include <sys/uio.h>
+
+#include <cassert>
+#include <cstring>
+
+#define MAX_FREE_CHUNKS 4
+
+SocketBuffer::Chunk SocketBuffer::newChunk() {
+    Chunk chunk;
+    if(!m_freeChunks.empty()) {
+        chunk.data = std::move(m_freeChunks.back());
+        m_freeChunks.pop_back();
+    }
+    else {
+        chunk.data = QByteArray(m_chunkSize, Qt::Uninitialized);
+    }
+    return chunk;
+}
+
+void SocketBuffer::releaseFront() {
+    if(m_writeChunk == 0) {
+        // Still being written, rewind it instead
+        m_chunks.front().begin = 0;
+        m_chunks.front().end = 0;
+        return;
+    }
+
+    if(m_freeChunks.size() < MAX_FREE_CHUNKS)
+        m_freeChunks.push_back(std::move(m_chunks.front().data));
+    m_chunks.pop_front();
+    m_writeChunk--;
+}
+
+void SocketBuffer::clear() {
+    m_chunks.clear();
+    m_writeChunk = 0;
+    m_size = 0;
+}
+
+int SocketBuffer::reserve(struct iovec* iov, int count) {
+    if(m_chunks.empty()) {
+        m_chunks.push_back(newChunk());
+        m_writeChunk = 0;
+    }
+    if(m_chunks[m_writeChunk].end == m_chunkSize) {
+        if(++m_writeChunk == m_chunks.size())
+            m_chunks.push_back(newChunk());
+    }
+
+    int n = 0;
+    for(size_t i = m_writeChunk; n < count; i++, n++) {
+        if(i == m_chunks.size())
+            m_chunks.push_back(newChunk());
+        Chunk& chunk = m_chunks[i];
+        iov[n].iov_base = chunk.data.data() + chunk.end;
+        iov[n].iov_len = m_chunkSize - chunk.end;
+    }
+    return n;
+}
+
+void SocketBuffer::commit(qint64 size) {
+    m_size += size;
+    while(size > 0) {
+        assert(m_writeChunk < m_chunks.size());
+        Chunk& chunk = m_chunks[m_writeChunk];
+        qint64 len = qMin(size, m_chunkSize - chunk.end);
+        chunk.end += len;
+        size -= len;
+        if(size > 0)
+            m_writeChunk++;
+    }
+}
+
+void SocketBuffer::append(const char* data, qint64 size) {
+    while(size > 0) {
+        struct iovec iov;
+        reserve(&iov, 1);
+        qint64 len = qMin<qint64>(size, iov.iov_len);
+        memcpy(iov.iov_base, data, len);
+        commit(len);
+        data += len;
+        size -= len;
+    }
+}
+
+void SocketBuffer::append(SocketBuffer&& other) {
+    assert(other.m_chunkSize == m_chunkSize);
+    if(other.isEmpty())
+        return;
+
+    // Our empty chunks would end up between the data
+    while(!m_chunks.empty() && m_chunks.back().begin == m_chunks.back().end) {
+        if(m_freeChunks.size() < MAX_FREE_CHUNKS)
+            m_freeChunks.push_back(std::move(m_chunks.back().data));
+        m_chunks.pop_back();
+    }
+
+    for(Chunk& chunk : other.m_chunks) {
+        if(chunk.begin < chunk.end)
+            m_chunks.push_back(std::move(chunk));
+    }
+    m_writeChunk = m_chunks.size() - 1;
+    m_size += other.m_size;
+
+    other.clear();
+}
+
+qint64 SocketBuffer::read(char* data, qint64 maxSize) {
+    qint64 size = qMin(maxSize, m_size);
+    qint64 left = size;
+    while(left > 0) {
+        Chunk& chunk = m_chunks.front();
+        qint64 len = qMin(left, chunk.end - chunk.begin);
+        memcpy(data, chunk.data.constData() + chunk.begin, len);
+        data += len;
+        left -= len;
+
+        chunk.begin += len;
+        m_size -= len;
+        if(chunk.begin == chunk.end)
+            releaseFront();
+    }
+    return size;
+}
+
+QByteArray SocketBuffer::readAll() {
+    if(m_size == 0)
+        return QByteArray();
+
+    Chunk& front = m_chunks.front();
+    if(front.begin == 0 && front.end == m_size && m_size * 2 >= m_chunkSize) {
+        // Hand the chunk over, it's cheaper to allocate a new one than to copy
+        QByteArray data = std::move(front.data);
+        data.truncate(m_size);
+        if(m_writeChunk == 0)
+            front = newChunk();
+        else {
+            m_chunks.pop_front();
+            m_writeChunk--;
+        }
+        m_size = 0;
+        return data;
+    }
+
+    QByteArray data(m_size, Qt::Uninitialized);
+    read(data.data(), data.size());
+    return data;
+}
+
+qint64 SocketBuffer::peek(char* data, qint64 maxSize) const {
+    qint64 size = qMin(maxSize, m_size);
+    qint64 left = size;
+    for(auto it = m_chunks.cbegin(); left > 0; it++) {
+        qint64 len = qMin(left, it->end - it->begin);
+        memcpy(data, it->data.constData() + it->begin, len);
+        data += len;
+        left -= len;
+    }
+    return size;
+}
+
+QByteArray SocketBuffer::peek(qint64 maxSize) const {
+    QByteArray data(qMin(maxSize, m_size), Qt::Uninitialized);
+    peek(data.data(), data.size());
+    return data;
+}
+
+qint64 SocketBuffer::skip(qint64 size) {
+    size = qMin(size, m_size);
+    qint64 left = size;
+    while(left > 0) {
+        Chunk& chunk = m_chunks.front();
+        qint64 len = qMin(left, chunk.end - chunk.begin);
+        left -= len;
+
+        chunk.begin += len;
+        m_size -= len;
+        if(chunk.begin == chunk.end)
+            releaseFront();
+    }
+    return size;
+}
+
+qint64 SocketBuffer::indexOf(char c, qint64 from) const {
+    if(from < 0 || from >= m_size)
+        return -1;
+
+    qint64 offset = 0;
+    for(auto it = m_chunks.cbegin(); offset < m_size; it++) {
+        qint64 len = it->end - it->begin;
+        if(from < offset + len) {
+            qint64 start = qMax<qint64>(0, from - offset);
+            const char* base = it->data.constData() + it->begin;
+            const void* found = memchr(base + start, c, len - start);
+            if(found)
+                return offset + ((const char*)found - base);
+        }
+        offset += len;
+    }
+    return -1;
+}
+
+const char* SocketBuffer::readPointer() const {
+    if(m_size == 0)
+        return nullptr;
+    return m_chunks.front().data.constData() + m_chunks.front().begin;
+}
+
+qint64 SocketBuffer::nextDataBlockSize() const {
+    if(m_size == 0)
+        return 0;
+    return m_chunks.front().end - m_chunks.front().begin;
+}
+
+void SocketWriteQueue::clear() {
+    m_segments.clear();
+    m_offset = 0;
+    m_size = 0;
+}
+
+void SocketWriteQueue::append(const QByteArray& data) {
+    if(data.size() < SOCKET_WRITE_COALESCE_SZ) {
+        append(data.constData(), data.size());
+        return;
+    }
+
+    m_segments.push_back({ data, false });
+    m_size += data.size();
+}
+
+void SocketWriteQueue::append(const char* data, qint64 size) {
+    if(size <= 0)
+        return;
+    m_size += size;
+
+    if(size >= SOCKET_WRITE_COALESCE_SZ) {
+        m_segments.push_back({ QByteArray(data, size), false });
+        return;
+    }
+
+    if(m_segments.empty() || !m_segments.back().coalescing
+        || m_segments.back().data.size() + size > SOCKET_WRITE_COALESCE_SZ)
+    {
+        Segment segment = { QByteArray(), true };
+        segment.data.reserve(SOCKET_WRITE_COALESCE_SZ);
+        m_segments.push_back(std::move(segment));
+    }
+    m_segments.back().data.append(data, size);
+}
+
+void SocketWriteQueue::appendMessage(const QByteArray& data) {
+    if(data.isEmpty())
+        return;
+    m_segments.push_back({ data, false });
+    m_size += data.size();
+}
+
+int SocketWriteQueue::segments(struct iovec* iov, int count) const {
+    int n = 0;
+    qint64 offset = m_offset;
+    for(auto it = m_segments.cbegin(); it != m_segments.cend() && n < count; it++, n++) {
+        iov[n].iov_base = const_cast<char*>(it->data.constData()) + offset;
+        iov[n].iov_len = it->data.size() - offset;
+        offset = 0;
+    }
+    return n;
+}
+
+void SocketWriteQueue::free(qint64 size) {
+    size = qMin(size, m_size);
+    m_size -= size;
+    while(size > 0) {
+        qint64 left = m_segments.front().data.size() - m_offset;
+        if(size < left) {
+            m_offset += size;
+            return;
+        }
+        size -= left;
+        m_segments.pop_front();
+        m_offset = 0;
+    }
+}
+
+qint64 SocketWriteQueue::discard(qint64 size, int keep) {
+    // The rest of a partially sent segment has to follow what already went out
+    if(m_offset > 0)
+        keep = qMax(keep, 1);
+
+    qint64 dropped = 0;
+    auto it = m_segments.begin() + qMin<size_t>(keep, m_segments.size());
+    while(it != m_segments.end() && dropped < size) {
+        dropped += it->data.size();
+        it = m_segments.erase(it);
+    }
+    m_size -= dropped;
+    return dropped;
+}
@@ -0,0 +1,112 @@
+#ifndef SOCKETBUFFER_HPP
+#define SOCKETBUFFER_HPP
+
+#include <QtCore/QByteArray>
+
+#include <deque>
+#include <vector>
+
+struct iovec;
+
+#define SOCKET_BUFFER_CHUNK_SZ (64 * 1024)
+/* Writes smaller than this are copied together into one segment */
+#define SOCKET_WRITE_COALESCE_SZ (4 * 1024)
+
+/*
+ * FIFO byte buffer made of fixed size chunks.
+ * Data is received directly into the chunks (see reserve() and commit()),
+ * consuming it never moves the remaining bytes, and drained chunks are
+ * kept for reuse instead of being freed.
+ */
+class SocketBuffer
+{
+public:
+    SocketBuffer(qint64 chunkSize = SOCKET_BUFFER_CHUNK_SZ) : m_chunkSize(chunkSize) { }
+
+    qint64 size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+    qint64 chunkSize() const { return m_chunkSize; }
+    void clear();
+
+    /*
+     * Fills iov with up to count free segments, in order, and returns the
+     * number of segments. Bytes written there become readable after commit().
+     */
+    int reserve(struct iovec* iov, int count);
+    void commit(qint64 size);
+    void append(const char* data, qint64 size);
+    /* Moves the other buffer's chunks to the end, without copying the data */
+    void append(SocketBuffer&& other);
+
+    qint64 read(char* data, qint64 maxSize);
+    /* Doesn't copy when the data fills most of a single chunk */
+    QByteArray readAll();
+    qint64 peek(char* data, qint64 maxSize) const;
+    QByteArray peek(qint64 maxSize) const;
+    qint64 skip(qint64 size);
+
+    /* Returns -1 if c isn't found */
+    qint64 indexOf(char c, qint64 from = 0) const;
+
+    /* Returns the contiguous block at the front of the buffer */
+    const char* readPointer() const;
+    qint64 nextDataBlockSize() const;
+private:
+    struct Chunk {
+        QByteArray data;
+        qint64 begin = 0;
+        qint64 end = 0;
+    };
+
+    Chunk newChunk();
+    void releaseFront();
+private:
+    qint64 m_chunkSize;
+    qint64 m_size = 0;
+
+    std::deque<Chunk> m_chunks;
+    /* Index of the chunk being written, chunks after it are empty */
+    size_t m_writeChunk = 0;
+    std::vector<QByteArray> m_freeChunks;
+};
+
+/*
+ * Queue of data waiting to be sent.
+ * Queued QByteArrays are shared instead of copied, small writes are
+ * coalesced so they don't need a segment each. Partially sent data is
+ * tracked with an offset into the first segment.
+ */
+class SocketWriteQueue
+{
+public:
+    qint64 size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+    void clear();
+
+    void append(const QByteArray& data);
+    void append(const char* data, qint64 size);
+    /* Always a segment of its own, for sockets that send one message per segment */
+    void appendMessage(const QByteArray& data);
+
+    /* Fills iov with up to count queued segments and returns their count */
+    int segments(struct iovec* iov, int count) const;
+    /* Drops size bytes from the front, after they have been sent */
+    void free(qint64 size);
+    /*
+     * Drops whole unsent segments, oldest first, until at least size bytes
+     * are gone. The first keep segments (being sent) and a partially sent
+     * one stay. Returns the number of bytes dropped.
+     */
+    qint64 discard(qint64 size, int keep = 0);
+private:
+    struct Segment {
+        QByteArray data;
+        bool coalescing;
+    };
+private:
+    std::deque<Segment> m_segments;
+    qint64 m_offset = 0;
+    qint64 m_size = 0;
+};
+
+#endif // SOCKETBUFFER_HPP
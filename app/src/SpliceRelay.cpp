@@ -0,0 +1,297 @@
+#include "SpliceRelay.hpp"
+
+#include <QtCore/QSocketNotifier>
+
+#include <cerrno>
+#include <utility>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+/* Per splice() from the source, a default pipe holds as much */
+#define RELAY_CHUNK_SZ (64 * 1024)
+/* Rounds of pump() before yielding to the event loop */
+#define RELAY_PUMP_ROUNDS 16
+
+static void closePipe(int pipe[2]) {
+    for(int i = 0; i < 2; i++) {
+        if(pipe[i] >= 0)
+            ::close(pipe[i]);
+        pipe[i] = -1;
+    }
+}
+
+static inline bool wouldBlock(int err) {
+    return err == EAGAIN || err == EWOULDBLOCK;
+}
+
+bool SpliceRelay::canRelay(const UnixSocket* socket) {
+    return socket->isOpen() && socket->backend() != UnixSocket::Uring
+        && socket->socketType() == UnixSocket::Stream;
+}
+
+SpliceRelay::SpliceRelay(UnixSocket* source, QObject* parent) : QObject(parent), m_source(source) {
+    if(!canRelay(source) || pipe2(m_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+        return;
+
+    // Notifiers are per fd, the socket may have its own on the original
+    m_sourceFd = fcntl(source->socketDescriptor(), F_DUPFD_CLOEXEC, 0);
+    if(m_sourceFd < 0 || !source->stopReading()) {
+        if(m_sourceFd >= 0)
+            ::close(m_sourceFd);
+        m_sourceFd = -1;
+        closePipe(m_pipe);
+        return;
+    }
+
+    m_readNotifier = new QSocketNotifier(m_sourceFd, QSocketNotifier::Read, this);
+    connect(m_readNotifier, &QSocketNotifier::activated, this, &SpliceRelay::pump);
+    connect(source, &UnixSocket::disconnected, this, &SpliceRelay::releaseSource);
+}
+
+SpliceRelay::~SpliceRelay() {
+    for(Sink* sink : std::exchange(m_sinks, {}))
+        freeSink(sink);
+    // Whatever is left in the pipe goes with it
+    closePipe(m_pipe);
+    if(m_nullFd >= 0)
+        ::close(m_nullFd);
+
+    bool stopped = m_sourceFd >= 0;
+    releaseSource();
+    if(stopped && m_source && m_source->isOpen())
+        m_source->setReadEnabled(true);
+}
+
+bool SpliceRelay::addSink(UnixSocket* socket) {
+    if(!isValid() || !socket->isOpen())
+        return false;
+
+    Sink* sink = new Sink;
+    sink->socket = socket;
+    sink->fd = fcntl(socket->socketDescriptor(), F_DUPFD_CLOEXEC, 0);
+    if(sink->fd < 0) {
+        delete sink;
+        return false;
+    }
+
+    sink->notifier = new QSocketNotifier(sink->fd, QSocketNotifier::Write, this);
+    sink->notifier->setEnabled(false);
+    connect(sink->notifier, &QSocketNotifier::activated, this, [this, sink]() {
+        sink->notifier->setEnabled(false);
+        pump();
+    });
+    // What the socket queued itself goes out first, the relay waits for it
+    connect(socket, &UnixSocket::bytesWritten, this, &SpliceRelay::pump);
+    connect(socket, &UnixSocket::disconnected, this, [this, socket]() { removeSink(socket); });
+    m_sinks.append(sink);
+    return true;
+}
+
+void SpliceRelay::removeSink(UnixSocket* socket) {
+    for(int i = 0; i < m_sinks.size(); i++) {
+        if(m_sinks[i]->socket == socket) {
+            freeSink(m_sinks.takeAt(i));
+            break;
+        }
+    }
+    // A blocking sink may have been all that held the source back
+    if(m_pending > 0)
+        QMetaObject::invokeMethod(this, &SpliceRelay::pump, Qt::QueuedConnection);
+}
+
+void SpliceRelay::pump() {
+    if(m_pumping || !isValid())
+        return;
+    m_pumping = true;
+
+    bool progress = true;
+    for(int round = 0; progress && round < RELAY_PUMP_ROUNDS; round++) {
+        progress = false;
+        // flush() may drop the sink
+        for(Sink* sink : QList<Sink*>(m_sinks))
+            progress = flush(sink) || progress;
+        if(m_pending > 0)
+            progress = distribute() || progress;
+        if(m_pending == 0 && !m_sourceDone)
+            progress = fill() || progress;
+    }
+
+    // Reading waits for the pipe to be empty, that's the backpressure
+    if(m_readNotifier)
+        m_readNotifier->setEnabled(m_pending == 0 && !m_sourceDone);
+    m_pumping = false;
+
+    // Still moving, let the event loop run before the next rounds
+    if(progress)
+        QMetaObject::invokeMethod(this, &SpliceRelay::pump, Qt::QueuedConnection);
+}
+
+bool SpliceRelay::fill() {
+    ssize_t rc;
+    do {
+        rc = splice(m_sourceFd, nullptr, m_pipe[1], nullptr, RELAY_CHUNK_SZ, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+        m_sourceStatistics.syscalls++;
+    } while(rc < 0 && errno == EINTR);
+
+    if(rc > 0) {
+        m_pending = rc;
+        m_sourceStatistics.bytesRead += rc;
+        return true;
+    }
+    if(rc < 0 && wouldBlock(errno)) {
+        m_sourceStatistics.eagain++;
+        return false;
+    }
+
+    // EOF or an error, the socket finds out once it's closed
+    m_sourceDone = true;
+    closeQueued(m_source);
+    return false;
+}
+
+bool SpliceRelay::distribute() {
+    if(m_sinks.isEmpty())
+        return discard(m_pending);
+
+    // The single terminal: straight from the main pipe
+    if(m_sinks.size() == 1 && m_sinks[0]->socket->overflowPolicy() == UnixSocket::Block) {
+        Sink* sink = m_sinks[0];
+        if(sink->pending > 0 || sink->socket->bytesToWrite() > 0)
+            return false;
+        ssize_t rc = moveToSink(sink, m_pipe[0], m_pending);
+        if(rc <= 0)
+            return false;
+        m_pending -= rc;
+        return true;
+    }
+
+    QList<Sink*> ready;
+    for(Sink* sink : m_sinks) {
+        if(sink->pending == 0 && sink->socket->bytesToWrite() == 0)
+            ready.append(sink);
+        else if(sink->socket->overflowPolicy() == UnixSocket::Block)
+            return false;
+    }
+    for(Sink* sink : QList<Sink*>(m_sinks)) {
+        if(ready.contains(sink))
+            continue;
+        if(sink->socket->overflowPolicy() == UnixSocket::Disconnect)
+            dropSink(sink);
+        else
+            m_sinkStatistics.droppedBytes += m_pending;
+    }
+    for(Sink* sink : QList<Sink*>(ready)) {
+        if(sink->pipe[0] < 0 && pipe2(sink->pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+            ready.removeOne(sink);
+            dropSink(sink);
+        }
+    }
+
+    // The sinks' pipes are empty and as large as the main one, so each takes the whole chunk
+    qint64 moved = 0;
+    for(int i = 0; i < ready.size(); i++) {
+        Sink* sink = ready[i];
+        bool last = i == ready.size() - 1;
+        ssize_t rc = last
+            ? splice(m_pipe[0], nullptr, sink->pipe[1], nullptr, m_pending, SPLICE_F_NONBLOCK | SPLICE_F_MOVE)
+            : tee(m_pipe[0], sink->pipe[1], m_pending, SPLICE_F_NONBLOCK);
+        m_sinkStatistics.syscalls++;
+        if(rc < 0)
+            rc = 0;
+        sink->pending = rc;
+        if(last)
+            moved = rc;
+        else
+            m_sinkStatistics.droppedBytes += m_pending - rc;
+    }
+
+    // Missed by the last ready sink, or by all of them
+    m_pending -= moved;
+    if(m_pending > 0) {
+        if(!ready.isEmpty())
+            m_sinkStatistics.droppedBytes += m_pending;
+        discard(m_pending);
+    }
+    return true;
+}
+
+bool SpliceRelay::flush(Sink* sink) {
+    if(sink->pending == 0 || sink->socket->bytesToWrite() > 0)
+        return false;
+    ssize_t rc = moveToSink(sink, sink->pipe[0], sink->pending);
+    if(rc <= 0)
+        return false;
+    sink->pending -= rc;
+    return true;
+}
+
+ssize_t SpliceRelay::moveToSink(Sink* sink, int from, qint64 size) {
+    ssize_t rc;
+    do {
+        rc = splice(from, nullptr, sink->fd, nullptr, size, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+        m_sinkStatistics.syscalls++;
+    } while(rc < 0 && errno == EINTR);
+
+    if(rc >= 0) {
+        m_sinkStatistics.bytesWritten += rc;
+        return rc;
+    }
+    if(wouldBlock(errno)) {
+        m_sinkStatistics.eagain++;
+        sink->notifier->setEnabled(true);
+        return 0;
+    }
+    // The peer is gone
+    dropSink(sink);
+    return -1;
+}
+
+bool SpliceRelay::discard(qint64 size) {
+    if(m_nullFd < 0)
+        m_nullFd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    ssize_t rc = -1;
+    if(m_nullFd >= 0)
+        rc = splice(m_pipe[0], nullptr, m_nullFd, nullptr, size, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+    if(rc < 0) {
+        char scratch[4096];
+        rc = ::read(m_pipe[0], scratch, qMin<qint64>(size, sizeof(scratch)));
+    }
+    if(rc <= 0)
+        return false;
+    m_pending -= rc;
+    return true;
+}
+
+void SpliceRelay::releaseSource() {
+    m_sourceDone = true;
+    delete m_readNotifier;
+    m_readNotifier = nullptr;
+    // The duplicate would keep the connection open
+    if(m_sourceFd >= 0)
+        ::close(m_sourceFd);
+    m_sourceFd = -1;
+}
+
+void SpliceRelay::dropSink(Sink* sink) {
+    QPointer<UnixSocket> socket = sink->socket;
+    m_sinks.removeOne(sink);
+    freeSink(sink);
+    closeQueued(socket);
+}
+
+void SpliceRelay::closeQueued(UnixSocket* socket) {
+    // Not from inside pump(), the owner may remove sinks or delete the relay when it closes
+    if(socket)
+        QMetaObject::invokeMethod(socket, &UnixSocket::close, Qt::QueuedConnection);
+}
+
+void SpliceRelay::freeSink(Sink* sink) {
+    if(sink->socket)
+        disconnect(sink->socket, nullptr, this, nullptr);
+    delete sink->notifier;
+    ::close(sink->fd);
+    closePipe(sink->pipe);
+    delete sink;
+}
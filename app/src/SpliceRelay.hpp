@@ -0,0 +1,87 @@
+#ifndef SPLICERELAY_HPP
+#define SPLICERELAY_HPP
+
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QPointer>
+
+#include "UnixSocket.hpp"
+
+class QSocketNotifier;
+
+/*
+ * Forwards everything read from one socket to a set of others inside the
+ * kernel: the source is splice()d into a pipe, which goes straight to a
+ * single sink, or is tee()d into a pipe per sink for fan-out. The data is
+ * never copied to user space, the pipes are the only buffers.
+ *
+ * A sink's overflow policy applies while its pipe still holds the previous
+ * chunk: Block stops reading the source, DropOldest has the sink miss the
+ * chunk and Disconnect closes it. The sockets' own water marks don't apply.
+ */
+class SpliceRelay : public QObject
+{
+    Q_OBJECT
+public:
+    /* io_uring sockets can't stop reading synchronously, they need the buffered path */
+    static bool canRelay(const UnixSocket* socket);
+
+    /*
+     * Takes over reading source (see UnixSocket::stopReading()). What it had
+     * already received stays in its read buffer for the caller to forward.
+     */
+    SpliceRelay(UnixSocket* source, QObject* parent = nullptr);
+    /* Gives reading back to the source */
+    ~SpliceRelay();
+
+    bool isValid() const { return m_pipe[0] >= 0; }
+
+    /* Sinks are removed when they disconnect, so is the source */
+    bool addSink(UnixSocket* sink);
+    void removeSink(UnixSocket* sink);
+    int sinkCount() const { return m_sinks.size(); }
+
+    /* Moved by the relay, not seen by the sockets' own counters */
+    SocketStatistics sourceStatistics() const { return m_sourceStatistics; }
+    /* All sinks together, including removed ones */
+    SocketStatistics sinkStatistics() const { return m_sinkStatistics; }
+private:
+    struct Sink {
+        QPointer<UnixSocket> socket;
+        int fd = -1;
+        /* For fan-out, created on first use */
+        int pipe[2] = { -1, -1 };
+        /* Bytes in the pipe */
+        qint64 pending = 0;
+        QSocketNotifier* notifier = nullptr;
+    };
+
+    void pump();
+    bool fill();
+    bool distribute();
+    bool flush(Sink* sink);
+    /* splice()s from a pipe to the sink's socket, EAGAIN arms its notifier */
+    ssize_t moveToSink(Sink* sink, int from, qint64 size);
+    bool discard(qint64 size);
+    void releaseSource();
+    void dropSink(Sink* sink);
+    void closeQueued(UnixSocket* socket);
+    void freeSink(Sink* sink);
+private:
+    QPointer<UnixSocket> m_source;
+    int m_sourceFd = -1;
+    int m_pipe[2] = { -1, -1 };
+    /* Bytes in m_pipe */
+    qint64 m_pending = 0;
+    QSocketNotifier* m_readNotifier = nullptr;
+    int m_nullFd = -1;
+
+    QList<Sink*> m_sinks;
+    bool m_pumping = false;
+    bool m_sourceDone = false;
+
+    SocketStatistics m_sourceStatistics;
+    SocketStatistics m_sinkStatistics;
+};
+
+#endif // SPLICERELAY_HPP
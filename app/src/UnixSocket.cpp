@@ -1,14 +1,277 @@
 #include "UnixSocket.hpp"
 
+#include "IoReactor.hpp"
+#include "IoUring.hpp"
+
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
-int UnixSocket::makeSocket(const QString& path, struct sockaddr** addrp) {
+#define READ_IOV_COUNT 2
+#define WRITE_IOV_COUNT 64
+/* Enough chunks of the receive buffer for the largest message */
+#define SEQPACKET_IOV_COUNT (SEQPACKET_MAX_MESSAGE_SZ / SOCKET_BUFFER_CHUNK_SZ + 1)
+/* Descriptors taken by a single read, the kernel closes the ones above it */
+#define RECEIVED_FDS_MAX 16
+
+/* Control message buffers, aligned for cmsghdr */
+union ReceiveControl {
+    char data[CMSG_SPACE(sizeof(int) * RECEIVED_FDS_MAX)];
+    struct cmsghdr header;
+};
+union SendControl {
+    char data[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr header;
+};
+/* The reactor stops reading a socket until its owner takes this much */
+#define REACTOR_READ_LIMIT (1024 * 1024)
+
+std::atomic<UnixSocket::Backend> UnixSocket::s_defaultBackend { UnixSocket::Notifier };
+
+static inline void count(std::atomic<quint64>& counter, quint64 n = 1) {
+    counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+/* Every peak has a single writing thread, no compare-and-swap needed */
+static inline void countPeak(std::atomic<quint64>& peak, quint64 value) {
+    if(value > peak.load(std::memory_order_relaxed))
+        peak.store(value, std::memory_order_relaxed);
+}
+
+/* Sends every segment as a message of its own, returns the bytes sent like sendmsg() */
+static ssize_t sendMessages(int fd, struct iovec* iov, int count) {
+    struct mmsghdr msgs[WRITE_IOV_COUNT] = {};
+    for(int i = 0; i < count; i++) {
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int sent = ::sendmmsg(fd, msgs, count, MSG_NOSIGNAL);
+    if(sent < 0)
+        return -1;
+
+    ssize_t bytes = 0;
+    for(int i = 0; i < sent; i++)
+        bytes += msgs[i].msg_len;
+    return bytes;
+}
+
+/* Moves the descriptors of SCM_RIGHTS messages to fds, returns false if there were none */
+static bool takeFds(struct msghdr* msg, QQueue<int>& fds) {
+    bool received = false;
+    for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for(size_t i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            fds.enqueue(fd);
+        }
+        received = true;
+    }
+    return received;
+}
+
+/* readv() that also takes the passed descriptors */
+static ssize_t receive(int fd, struct iovec* iov, int iovcnt, QQueue<int>& fds, bool* fdsReceived) {
+    ReceiveControl control;
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+
+    ssize_t rc = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    *fdsReceived = rc > 0 && takeFds(&msg, fds);
+    return rc;
+}
+
+SocketStatistics& SocketStatistics::operator+=(const SocketStatistics& other) {
+    bytesRead += other.bytesRead;
+    bytesWritten += other.bytesWritten;
+    syscalls += other.syscalls;
+    eagain += other.eagain;
+    peakReadBuffer = qMax(peakReadBuffer, other.peakReadBuffer);
+    peakWriteQueue = qMax(peakWriteQueue, other.peakWriteQueue);
+    queuedBytes += other.queuedBytes;
+    droppedBytes += other.droppedBytes;
+    return *this;
+}
+
+/*
+ * State of a socket polled by the IoReactor or completed by IoUring,
+ * shared with the reactor or ring thread
+ */
+class UnixSocket::ReactorChannel : public IoReactor::Handler, public IoUring::Handler {
+public:
+    ReactorChannel(UnixSocket* socket, int fd) : m_socket(socket), m_fd(fd) { }
+
+    void reactorEvent(uint32_t events) override;
+    uint32_t reactorEvents() override;
+    bool ringCompletion(IoUring::Op op, int result, const char* data) override;
+private:
+    void notifyOwner();
+
+    UnixSocket* const m_socket;
+    const int m_fd;
+    quint64 m_token = 0;
+
+    std::atomic<bool> m_notifyPending { false };
+
+    QMutex m_mutex;
+    /* Woken up whenever something for the owner arrives */
+    QWaitCondition m_ready;
+    SocketBuffer m_incoming;
+    QQueue<int> m_incomingFds;
+    int m_error = 0;
+    bool m_eof = false;
+    bool m_hangup = false;
+    bool m_readPaused = false;
+    /* setReadEnabled(false), unlike m_readPaused it's only lifted by the owner */
+    bool m_readDisabled = false;
+    bool m_wantWrite = false;
+    bool m_writable = false;
+    /* Result of the finished io_uring send */
+    bool m_sendDone = false;
+    int m_sendResult = 0;
+
+    /* The io_uring send in flight, only touched by the socket's thread */
+    bool m_sending = false;
+    struct msghdr m_sendMsg = {};
+    struct iovec m_sendIov[WRITE_IOV_COUNT];
+    SendControl m_sendControl;
+    bool m_sendFdAttached = false;
+
+    friend class UnixSocket;
+};
+
+void UnixSocket::ReactorChannel::reactorEvent(uint32_t events) {
+    QMutexLocker locker(&m_mutex);
+    Counters& counters = m_socket->m_counters;
+    bool notify = false;
+
+    if(events & (EPOLLHUP | EPOLLERR))
+        m_hangup = true;
+
+    if((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !m_readPaused && !m_readDisabled && !m_eof && !m_error) {
+        forever {
+            struct iovec iov[READ_IOV_COUNT];
+            int iovcnt = m_incoming.reserve(iov, READ_IOV_COUNT);
+            qint64 space = 0;
+            for(int i = 0; i < iovcnt; i++)
+                space += iov[i].iov_len;
+
+            bool fdsReceived = false;
+            ssize_t rc = receive(m_fd, iov, iovcnt, m_incomingFds, &fdsReceived);
+            count(counters.syscalls);
+            if(rc < 0) {
+                if(errno == EINTR)
+                    continue;
+                if(errno != EAGAIN && errno != EWOULDBLOCK)
+                    m_error = errno;
+                else
+                    count(counters.eagain);
+                break;
+            }
+            else if(rc == 0) {
+                m_eof = true;
+                break;
+            }
+            m_incoming.commit(rc);
+            count(counters.bytesRead, rc);
+            notify = true;
+
+            if(m_incoming.size() >= REACTOR_READ_LIMIT) {
+                m_readPaused = true;
+                break;
+            }
+            // A read ends early at the data that came with descriptors
+            if(rc < space && !fdsReceived)
+                break;
+        }
+        notify = notify || m_eof || m_error;
+    }
+
+    if((events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && m_wantWrite) {
+        m_wantWrite = false;
+        m_writable = true;
+        notify = true;
+    }
+
+    if(!notify)
+        return;
+
+    m_ready.wakeAll();
+    locker.unlock();
+    notifyOwner();
+}
+
+bool UnixSocket::ReactorChannel::ringCompletion(IoUring::Op op, int result, const char* data) {
+    QMutexLocker locker(&m_mutex);
+    bool keepReceiving = true;
+
+    if(op == IoUring::Send) {
+        m_sendDone = true;
+        m_sendResult = result;
+    }
+    else if(result > 0) {
+        m_incoming.append(data, result);
+        count(m_socket->m_counters.bytesRead, result);
+        if(m_incoming.size() >= REACTOR_READ_LIMIT) {
+            m_readPaused = true;
+            keepReceiving = false;
+        }
+        else if(m_readDisabled) {
+            keepReceiving = false;
+        }
+    }
+    else if(result == 0) {
+        m_eof = true;
+    }
+    else {
+        m_error = -result;
+    }
+
+    m_ready.wakeAll();
+    locker.unlock();
+    notifyOwner();
+    return keepReceiving;
+}
+
+void UnixSocket::ReactorChannel::notifyOwner() {
+    // One queued call until the owner picks the data up, however much arrives meanwhile
+    if(!m_notifyPending.exchange(true)) {
+        UnixSocket* socket = m_socket;
+        QMetaObject::invokeMethod(socket, [socket] { socket->handleReactorEvents(); },
+            Qt::QueuedConnection);
+    }
+}
+
+uint32_t UnixSocket::ReactorChannel::reactorEvents() {
+    QMutexLocker locker(&m_mutex);
+    if(m_eof || m_error)
+        return 0;
+
+    uint32_t events = 0;
+    if(!m_readPaused && !m_readDisabled)
+        events |= EPOLLIN | EPOLLRDHUP;
+    else if(m_hangup)
+        return 0; // would be reported over and over until reading resumes
+    if(m_wantWrite)
+        events |= EPOLLOUT;
+    return events;
+}
+
+int UnixSocket::makeSocket(const QString& path, struct sockaddr** addrp, SocketType socketType) {
     int sockfd = -1;
 
-    int type = SOCK_STREAM;
+    int type = socketType == SeqPacket ? SOCK_SEQPACKET : SOCK_STREAM;
 #ifdef SOCK_CLOEXEC
     type |= SOCK_CLOEXEC;
 #endif
@@ -45,7 +308,7 @@ bool UnixSocket::connectToServer(const QString& path) {
         return false;
     }
     
-    if((m_sockfd = makeSocket(path, &m_addr)) == -1) {
+    if((m_sockfd = makeSocket(path, &m_addr, m_socketType)) == -1) {
         m_err = errno;
         setErrorString(strerror(m_err));
         return false;
@@ -64,15 +327,42 @@ bool UnixSocket::connectToServer(const QString& path) {
 UnixSocket::~UnixSocket() {
     if(isOpen())
         close();
+
+    if(m_interruptFd >= 0)
+        ::close(m_interruptFd);
 }
 
 void UnixSocket::close() {
     if(!isOpen())
         return;
+
+    if(m_channel) {
+        // Waits for the reactor or ring thread to be done with the channel
+        if(m_backend == Uring)
+            IoUring::instance()->remove(m_channel->m_token);
+        else
+            IoReactor::instance()->remove(m_channel->m_token);
+        for(int fd : m_channel->m_incomingFds)
+            ::close(fd);
+        delete m_channel;
+        m_channel = nullptr;
+    }
         
     ::close(m_sockfd);
     m_sockfd = -1;
 
+    // Nothing is going to send it anymore
+    m_writeQueue.clear();
+    m_writeBufferFull = false;
+    m_sentTotal = 0;
+    for(const PendingFd& pending : m_outgoingFds)
+        ::close(pending.fd);
+    m_outgoingFds.clear();
+    // Nor take the ones received
+    for(int fd : m_receivedFds)
+        ::close(fd);
+    m_receivedFds.clear();
+
     m_readNotifier.setEnabled(false);
     m_readNotifier.setSocket(-1);
     m_writeNotifier.setEnabled(false);
@@ -88,94 +378,627 @@ void UnixSocket::close() {
     emit disconnected();
 }
 
-bool UnixSocket::setFd(int fd) {
+bool UnixSocket::setFd(int fd, bool nonBlocking) {
     m_sockfd = fd;
 
-    if(!setBlocking(false)) {
+    if(!nonBlocking && !setBlocking(false)) {
         close();
         return false;
     }
 
-    m_readNotifier.setSocket(m_sockfd);
-    connect(&m_readNotifier, &QSocketNotifier::activated,
-        this, &UnixSocket::handleReadAvaliable);
-    m_readNotifier.setEnabled(true);
-    
-    m_writeNotifier.setSocket(m_sockfd);
-    connect(&m_writeNotifier, &QSocketNotifier::activated,
-        this, &UnixSocket::handleWriteAvaliable);
-    m_writeNotifier.setEnabled(false);
+    // Not built with liburing, or the kernel is too old
+    if(m_backend == Uring && !IoUring::isAvailable())
+        m_backend = Notifier;
+    // The reactor and the ring receive into a byte stream, losing the message boundaries
+    if(m_socketType == SeqPacket)
+        m_backend = Notifier;
+
+    if(m_backend == Reactor) {
+        m_channel = new ReactorChannel(this, m_sockfd);
+        m_channel->m_readDisabled = !m_readEnabled;
+        m_channel->m_token = IoReactor::instance()->add(m_sockfd, m_channel);
+    }
+    else if(m_backend == Uring) {
+        m_channel = new ReactorChannel(this, m_sockfd);
+        m_channel->m_readDisabled = !m_readEnabled;
+        m_channel->m_token = IoUring::instance()->add(m_sockfd, m_channel);
+        if(m_readEnabled && !IoUring::instance()->receive(m_channel->m_token)) {
+            IoUring::instance()->remove(m_channel->m_token);
+            m_channel->m_token = 0;
+        }
+    }
+
+    if(m_channel && m_channel->m_token == 0) {
+        m_err = errno ? errno : EIO;
+        setErrorString(QString("Failed to register the socket: ") + strerror(m_err));
+        delete m_channel;
+        m_channel = nullptr;
+        ::close(m_sockfd);
+        m_sockfd = -1;
+        return false;
+    }
+
+    if(!m_channel) {
+        m_readNotifier.setSocket(m_sockfd);
+        connect(&m_readNotifier, &QSocketNotifier::activated,
+            this, &UnixSocket::handleReadAvaliable, Qt::UniqueConnection);
+        m_readNotifier.setEnabled(m_readEnabled);
+        
+        m_writeNotifier.setSocket(m_sockfd);
+        connect(&m_writeNotifier, &QSocketNotifier::activated,
+            this, &UnixSocket::handleWriteAvaliable, Qt::UniqueConnection);
+        m_writeNotifier.setEnabled(false);
+    }
 
     emit connected();
 
-    return QIODevice::open(QIODevice::ReadWrite);
+    // Reads are served from m_readBuffer, QIODevice's buffer would be another copy
+    return QIODevice::open(QIODevice::ReadWrite | QIODevice::Unbuffered);
 }
 
 qint64 UnixSocket::readData(char *data, qint64 maxSize) {
     if(!isOpen())
         return -1;
-    qint64 size = qMin<qint64>(maxSize, m_readBuffer.size());
-    memmove(data, m_readBuffer.constData(), size);
-    m_readBuffer.remove(0, size);
+    qint64 size = m_readBuffer.read(data, maxSize);
+    consumeMessages(size);
+    return size;
+}
+
+qint64 UnixSocket::readLineData(char *data, qint64 maxSize) {
+    if(!isOpen())
+        return -1;
+    qint64 newLine = m_readBuffer.indexOf('\n');
+    qint64 size = newLine < 0 ? m_readBuffer.size() : newLine + 1;
+    size = m_readBuffer.read(data, qMin(size, maxSize));
+    consumeMessages(size);
     return size;
 }
 
+qint64 UnixSocket::skipData(qint64 maxSize) {
+    if(!isOpen())
+        return -1;
+    qint64 size = m_readBuffer.skip(maxSize);
+    consumeMessages(size);
+    return size;
+}
+
+QByteArray UnixSocket::readAll() {
+    // Data already moved to QIODevice's buffer (ungetChar(), transactions) comes first
+    if(QIODevice::bytesAvailable() > 0 || isTransactionStarted() || !isReadable())
+        return QIODevice::readAll();
+    m_messageSizes.clear();
+    return m_readBuffer.readAll();
+}
+
+QByteArray UnixSocket::readMessage() {
+    if(m_messageSizes.isEmpty())
+        return QByteArray();
+
+    qint64 size = m_messageSizes.dequeue();
+    QByteArray message(size, Qt::Uninitialized);
+    m_readBuffer.read(message.data(), size);
+    return message;
+}
+
+void UnixSocket::consumeMessages(qint64 size) {
+    while(size > 0 && !m_messageSizes.isEmpty()) {
+        qint64& front = m_messageSizes.head();
+        if(size < front) {
+            front -= size;
+            return;
+        }
+        size -= front;
+        m_messageSizes.dequeue();
+    }
+}
+
+qint64 UnixSocket::peek(char *data, qint64 maxSize) {
+    if(QIODevice::bytesAvailable() > 0 || !isReadable())
+        return QIODevice::peek(data, maxSize);
+    return m_readBuffer.peek(data, maxSize);
+}
+
+QByteArray UnixSocket::peek(qint64 maxSize) {
+    if(QIODevice::bytesAvailable() > 0 || !isReadable())
+        return QIODevice::peek(maxSize);
+    return m_readBuffer.peek(maxSize);
+}
+
+QByteArrayView UnixSocket::nextDataBlock() const {
+    if(QIODevice::bytesAvailable() > 0 || !isReadable())
+        return QByteArrayView();
+    return QByteArrayView(m_readBuffer.readPointer(), m_readBuffer.nextDataBlockSize());
+}
+
 qint64 UnixSocket::writeData(const char *data, qint64 maxSize) {
     if(!isOpen())
         return -1;
-    
-    m_writeBuffer += QByteArray(data, maxSize);
+    if(m_socketType == SeqPacket)
+        return writeMessage(QByteArray(data, maxSize));
+
+    bool wasEmpty = m_writeQueue.isEmpty();
+    m_writeQueue.append(data, maxSize);
+    countPeak(m_counters.peakWriteQueue, m_writeQueue.size());
+    // Otherwise the socket is full and the write notifier is already waiting
+    if(wasEmpty)
+        handleWriteAvaliable();
+
+    return checkHighWaterMark() ? maxSize : -1;
+}
+
+qint64 UnixSocket::write(const QByteArray& data) {
+    if(!isOpen() || !isWritable())
+        return QIODevice::write(data);
+    if(m_socketType == SeqPacket)
+        return writeMessage(data);
+
+    bool wasEmpty = m_writeQueue.isEmpty();
+    m_writeQueue.append(data);
+    countPeak(m_counters.peakWriteQueue, m_writeQueue.size());
+    if(wasEmpty)
+        handleWriteAvaliable();
+
+    return checkHighWaterMark() ? data.size() : -1;
+}
 
-    handleWriteAvaliable();
-    m_writeNotifier.setEnabled(!m_writeBuffer.isEmpty());
+qint64 UnixSocket::writeMessage(const QByteArray& message) {
+    if(m_socketType != SeqPacket)
+        return write(message);
+    if(!isOpen() || !isWritable())
+        return -1;
+    if(message.size() > SEQPACKET_MAX_MESSAGE_SZ) {
+        m_err = EMSGSIZE;
+        setErrorString(strerror(m_err));
+        return -1;
+    }
 
-    return maxSize;
+    bool wasEmpty = m_writeQueue.isEmpty();
+    m_writeQueue.appendMessage(message);
+    countPeak(m_counters.peakWriteQueue, m_writeQueue.size());
+    if(wasEmpty)
+        handleWriteAvaliable();
+
+    return checkHighWaterMark() ? message.size() : -1;
 }
 
 void UnixSocket::handleReadAvaliable() {
-    char cbuf[8] = { 0 };
-    
+    if(m_sockfd < 0)
+        return;
+    if(m_channel) {
+        handleReactorEvents();
+        return;
+    }
+    if(m_socketType == SeqPacket) {
+        handleMessagesAvailable();
+        return;
+    }
+
+    qint64 bytesRead = 0;
+    bool eof = false;
+
+    forever {
+        struct iovec iov[READ_IOV_COUNT];
+        int iovcnt = m_readBuffer.reserve(iov, READ_IOV_COUNT);
+        qint64 space = 0;
+        for(int i = 0; i < iovcnt; i++)
+            space += iov[i].iov_len;
+
+        bool fdsReceived = false;
+        ssize_t rc = receive(m_sockfd, iov, iovcnt, m_receivedFds, &fdsReceived);
+        count(m_counters.syscalls);
+        if(rc < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                count(m_counters.eagain);
+            handleSocketException(errno);
+            break;
+        }
+        else if(rc == 0) {
+            eof = true;
+            break;
+        }
+        m_readBuffer.commit(rc);
+        bytesRead += rc;
+
+        // A short read means the socket has been drained, no need to wait for EAGAIN,
+        // unless it ended early at the data that came with descriptors
+        if(rc < space && !fdsReceived)
+            break;
+    }
+
+    if(bytesRead > 0) {
+        count(m_counters.bytesRead, bytesRead);
+        countPeak(m_counters.peakReadBuffer, m_readBuffer.size());
+        emit readyRead();
+    }
+    if(eof) {
+        close();
+    }
+}
+
+void UnixSocket::handleMessagesAvailable() {
     qint64 bytesRead = 0;
-    qint64 tmpBytesRead = 0;
+    bool eof = false;
 
-    errno = 0;
-    do {
-        tmpBytesRead = ::recv(m_sockfd, cbuf, 8, 0);
-        if(errno == EAGAIN) break;
-        if(tmpBytesRead < 0) {
+    forever {
+        struct iovec iov[SEQPACKET_IOV_COUNT];
+        ReceiveControl control;
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = m_readBuffer.reserve(iov, SEQPACKET_IOV_COUNT);
+        msg.msg_control = control.data;
+        msg.msg_controllen = sizeof(control.data);
+
+        // One message per call, received straight into the buffer's chunks
+        ssize_t rc = ::recvmsg(m_sockfd, &msg, MSG_CMSG_CLOEXEC);
+        count(m_counters.syscalls);
+        if(rc < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                count(m_counters.eagain);
             handleSocketException(errno);
             break;
         }
-        else if (tmpBytesRead == 0) {
-            close();
+        else if(rc == 0) {
+            eof = true;
             break;
         }
-        m_readBuffer.append(cbuf, tmpBytesRead);
-        bytesRead += tmpBytesRead;
-    } while(tmpBytesRead > 0);
+        takeFds(&msg, m_receivedFds);
+        if(msg.msg_flags & MSG_TRUNC) {
+            // The rest of it is gone, the part that fit isn't committed either
+            handleSocketException(EMSGSIZE);
+            if(m_sockfd < 0)
+                return;
+            continue;
+        }
+        m_readBuffer.commit(rc);
+        m_messageSizes.enqueue(rc);
+        bytesRead += rc;
+    }
 
     if(bytesRead > 0) {
+        count(m_counters.bytesRead, bytesRead);
+        countPeak(m_counters.peakReadBuffer, m_readBuffer.size());
         emit readyRead();
     }
+    if(eof) {
+        close();
+    }
 }
 
 bool UnixSocket::handleWriteAvaliable() {
-    if(m_writeBuffer.isEmpty()) {
-        m_writeNotifier.setEnabled(false);
-        return true;
+    if(m_sockfd < 0)
+        return false;
+    if(m_backend == Uring && m_channel) {
+        // waitForBytesWritten() gets here without the queued call, pick up a finished send
+        QMutexLocker locker(&m_channel->m_mutex);
+        bool sent = std::exchange(m_channel->m_sendDone, false);
+        int sendResult = m_channel->m_sendResult;
+        locker.unlock();
+        return sent ? handleRingSent(sendResult) : submitRingSend(false);
     }
-    
-    ssize_t writtenBytes = ::write(m_sockfd, m_writeBuffer.data(), m_writeBuffer.size());
-    
+
+    qint64 writtenBytes = 0;
+    bool ok = true;
+
+    while(!m_writeQueue.isEmpty()) {
+        struct iovec iov[WRITE_IOV_COUNT];
+        struct msghdr msg;
+        SendControl control;
+        bool fdAttached = prepareSend(&msg, iov, control.data);
+
+        qint64 queued = 0;
+        for(size_t i = 0; i < msg.msg_iovlen; i++)
+            queued += iov[i].iov_len;
+
+        // MSG_NOSIGNAL, so a closed peer doesn't kill us with SIGPIPE
+        ssize_t rc = m_socketType == SeqPacket && !fdAttached
+            ? sendMessages(m_sockfd, iov, msg.msg_iovlen)
+            : ::sendmsg(m_sockfd, &msg, MSG_NOSIGNAL);
+        count(m_counters.syscalls);
+        if(rc < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                ok = false;
+                handleSocketException(errno);
+            }
+            else {
+                count(m_counters.eagain);
+            }
+            break;
+        }
+        handleSent(rc, fdAttached);
+        writtenBytes += rc;
+
+        // Data after the next descriptor goes with the next iteration
+        if(rc < queued)
+            break;
+    }
+
+    if(isOpen())
+        setWriteInterest(!m_writeQueue.isEmpty());
     if(writtenBytes > 0) {
-        m_writeBuffer.remove(0, writtenBytes);
+        count(m_counters.bytesWritten, writtenBytes);
+        checkLowWaterMark();
         emit bytesWritten(writtenBytes);
+    }
+    return ok;
+}
+
+void UnixSocket::handleReactorEvents() {
+    if(!m_channel)
+        return;
+    m_channel->m_notifyPending = false;
+
+    QMutexLocker locker(&m_channel->m_mutex);
+    qint64 received = m_channel->m_incoming.size();
+    m_readBuffer.append(std::move(m_channel->m_incoming));
+    while(!m_channel->m_incomingFds.isEmpty())
+        m_receivedFds.enqueue(m_channel->m_incomingFds.dequeue());
+    countPeak(m_counters.peakReadBuffer, m_readBuffer.size());
+    bool resume = std::exchange(m_channel->m_readPaused, false) && !m_channel->m_readDisabled;
+    bool writable = std::exchange(m_channel->m_writable, false);
+    bool sent = std::exchange(m_channel->m_sendDone, false);
+    int sendResult = m_channel->m_sendResult;
+    int error = m_channel->m_error;
+    bool eof = m_channel->m_eof;
+    locker.unlock();
+
+    if(resume) {
+        if(m_backend == Uring)
+            IoUring::instance()->receive(m_channel->m_token);
+        else
+            IoReactor::instance()->update(m_channel->m_token);
+    }
+    if(writable)
+        handleWriteAvaliable();
+    if(sent)
+        handleRingSent(sendResult);
+    // bytesWritten() handlers may have closed the socket already
+    if(!m_channel)
+        return;
+
+    if(received > 0)
+        emit readyRead();
+    // readyRead() handlers may have closed the socket already
+    if(!isOpen())
+        return;
+    // Nothing more is read after an error, the socket is done either way
+    if(error)
+        handleSocketException(error);
+    if(error || eof)
+        close();
+}
+
+bool UnixSocket::submitRingSend(bool waitWritable) {
+    // Writes made while a send is in flight go out together with the next one
+    if(m_channel->m_sending || m_writeQueue.isEmpty())
+        return true;
+
+    m_channel->m_sendFdAttached = prepareSend(&m_channel->m_sendMsg,
+        m_channel->m_sendIov, m_channel->m_sendControl.data);
+    if(!IoUring::instance()->send(m_channel->m_token, &m_channel->m_sendMsg, waitWritable)) {
+        handleSocketException(errno ? errno : EIO);
+        return false;
+    }
+    count(m_counters.syscalls);
+    m_channel->m_sending = true;
+    return true;
+}
+
+bool UnixSocket::handleRingSent(int result) {
+    m_channel->m_sending = false;
+
+    // O_NONBLOCK sockets can fail the send instead of having it wait
+    if(result == -EAGAIN || result == -EWOULDBLOCK || result == -EINTR) {
+        count(m_counters.eagain);
+        return submitRingSend(true);
+    }
+    if(result < 0) {
+        handleSocketException(-result);
+        return false;
+    }
+
+    handleSent(result, m_channel->m_sendFdAttached);
+    count(m_counters.bytesWritten, result);
+    bool ok = submitRingSend(false);
+    if(result > 0) {
+        checkLowWaterMark();
+        emit bytesWritten(result);
+    }
+    return ok;
+}
+
+bool UnixSocket::prepareSend(struct msghdr* msg, struct iovec* iov, char* control) {
+    *msg = {};
+    msg->msg_iov = iov;
+    msg->msg_iovlen = m_writeQueue.segments(iov, WRITE_IOV_COUNT);
+    if(m_outgoingFds.isEmpty())
+        return false;
+
+    // A descriptor goes with the first byte sent by a sendmsg(),
+    // so the data before the next one can't be sent together with it
+    bool attach = m_outgoingFds.head().position == m_sentTotal;
+    qint64 limit = m_writeQueue.size();
+    if(!attach)
+        limit = m_outgoingFds.head().position - m_sentTotal;
+    else if(m_outgoingFds.size() > 1)
+        limit = m_outgoingFds.at(1).position - m_sentTotal;
+    // With SeqPacket it goes with a single message
+    if(attach && m_socketType == SeqPacket)
+        msg->msg_iovlen = 1;
+
+    qint64 total = 0;
+    size_t n = 0;
+    for(; n < msg->msg_iovlen && total < limit; n++) {
+        iov[n].iov_len = qMin<qint64>(iov[n].iov_len, limit - total);
+        total += iov[n].iov_len;
+    }
+    msg->msg_iovlen = n;
+
+    if(attach) {
+        msg->msg_control = control;
+        msg->msg_controllen = CMSG_SPACE(sizeof(int));
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &m_outgoingFds.head().fd, sizeof(int));
+    }
+    return attach;
+}
+
+void UnixSocket::handleSent(qint64 size, bool fdAttached) {
+    if(size <= 0)
+        return;
+    m_writeQueue.free(size);
+    m_sentTotal += size;
+    // The peer has its own copy now
+    if(fdAttached)
+        ::close(m_outgoingFds.dequeue().fd);
+}
+
+bool UnixSocket::sendFd(int fd, const QByteArray& data) {
+    if(!isOpen() || !isWritable() || data.isEmpty()) {
+        m_err = EINVAL;
+        setErrorString("A descriptor needs an open socket and some data to go with");
+        return false;
+    }
+
+    int dupFd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if(dupFd < 0) {
+        m_err = errno;
+        setErrorString(strerror(m_err));
+        return false;
+    }
+    m_outgoingFds.enqueue({ dupFd, m_sentTotal + m_writeQueue.size() });
+
+    if(m_socketType == SeqPacket)
+        return writeMessage(data) >= 0;
+    return write(data) >= 0;
+}
+
+int UnixSocket::receiveFd() {
+    return m_receivedFds.isEmpty() ? -1 : m_receivedFds.dequeue();
+}
+
+bool UnixSocket::checkHighWaterMark() {
+    if(m_highWaterMark <= 0 || m_writeQueue.size() <= m_highWaterMark)
+        return true;
+
+    switch(m_overflowPolicy) {
+    case Block:
+        if(!m_writeBufferFull) {
+            m_writeBufferFull = true;
+            emit highWaterMarkReached();
+        }
+        return true;
+    case DropOldest: {
+        // Dropping would move the data the queued descriptors go with
+        if(!m_outgoingFds.isEmpty())
+            return true;
+        // The segments of an io_uring send in flight are still in use
+        int inFlight = m_channel && m_channel->m_sending ? m_channel->m_sendMsg.msg_iovlen : 0;
+        qint64 dropped = m_writeQueue.discard(m_writeQueue.size() - m_lowWaterMark, inFlight);
+        count(m_counters.droppedBytes, dropped);
         return true;
     }
-    else if(writtenBytes < 0) {
-        handleSocketException(errno);
+    case Disconnect:
+        m_err = ENOBUFS;
+        setErrorString("Write buffer overflow, the peer doesn't keep up");
+        emit errorOccurred(m_err);
+        close();
+        return false;
+    }
+    return true;
+}
+
+void UnixSocket::checkLowWaterMark() {
+    if(m_writeBufferFull && (m_highWaterMark == 0 || m_writeQueue.size() <= m_lowWaterMark)) {
+        m_writeBufferFull = false;
+        emit lowWaterMarkReached();
+    }
+}
+
+void UnixSocket::setWriteBufferLimits(qint64 highWater, qint64 lowWater) {
+    m_highWaterMark = qMax<qint64>(highWater, 0);
+    m_lowWaterMark = lowWater < 0 ? m_highWaterMark / 2 : qMin(lowWater, m_highWaterMark);
+    checkLowWaterMark();
+}
+
+void UnixSocket::setReadEnabled(bool enabled) {
+    if(m_readEnabled == enabled)
+        return;
+    m_readEnabled = enabled;
+    if(!isOpen())
+        return;
+
+    if(!m_channel) {
+        m_readNotifier.setEnabled(enabled);
+        return;
+    }
+
+    QMutexLocker locker(&m_channel->m_mutex);
+    m_channel->m_readDisabled = !enabled;
+    bool paused = m_channel->m_readPaused;
+    locker.unlock();
+
+    // A disabled io_uring receive stops with its next completion
+    if(m_backend == Uring) {
+        if(enabled && !paused)
+            IoUring::instance()->receive(m_channel->m_token);
+    }
+    else {
+        IoReactor::instance()->update(m_channel->m_token);
+    }
+}
+
+bool UnixSocket::stopReading() {
+    if(!isOpen() || m_backend == Uring)
+        return false;
+
+    setReadEnabled(false);
+    if(m_channel) {
+        // The reactor checks the flag under the lock, it's done reading
+        QMutexLocker locker(&m_channel->m_mutex);
+        m_readBuffer.append(std::move(m_channel->m_incoming));
+        while(!m_channel->m_incomingFds.isEmpty())
+            m_receivedFds.enqueue(m_channel->m_incomingFds.dequeue());
+        countPeak(m_counters.peakReadBuffer, m_readBuffer.size());
+    }
+    return true;
+}
+
+void UnixSocket::setWriteInterest(bool enabled) {
+    if(!m_channel) {
+        m_writeNotifier.setEnabled(enabled);
+        return;
     }
-    return false;
+
+    QMutexLocker locker(&m_channel->m_mutex);
+    if(m_channel->m_wantWrite == enabled)
+        return;
+    m_channel->m_wantWrite = enabled;
+    locker.unlock();
+
+    // Not under the channel's lock, the reactor takes them in the opposite order
+    IoReactor::instance()->update(m_channel->m_token);
+}
+
+SocketStatistics UnixSocket::statistics() const {
+    SocketStatistics stats;
+    stats.bytesRead = m_counters.bytesRead.load(std::memory_order_relaxed);
+    stats.bytesWritten = m_counters.bytesWritten.load(std::memory_order_relaxed);
+    stats.syscalls = m_counters.syscalls.load(std::memory_order_relaxed);
+    stats.eagain = m_counters.eagain.load(std::memory_order_relaxed);
+    stats.peakReadBuffer = m_counters.peakReadBuffer.load(std::memory_order_relaxed);
+    stats.peakWriteQueue = m_counters.peakWriteQueue.load(std::memory_order_relaxed);
+    stats.queuedBytes = m_writeQueue.size();
+    stats.droppedBytes = m_counters.droppedBytes.load(std::memory_order_relaxed);
+    return stats;
 }
 
 qint64 UnixSocket::bytesAvailable() const {
@@ -183,38 +1006,122 @@ qint64 UnixSocket::bytesAvailable() const {
 }
 
 qint64 UnixSocket::bytesToWrite() const {
-    return m_writeBuffer.size() + QIODevice::bytesToWrite();
+    return m_writeQueue.size() + QIODevice::bytesToWrite();
 }
 
 bool UnixSocket::canReadLine() const {
-    return m_readBuffer.contains('\n') || QIODevice::canReadLine();
+    return m_readBuffer.indexOf('\n') >= 0 || QIODevice::canReadLine();
+}
+
+bool UnixSocket::waitForEvents(short events, const QDeadlineTimer& deadline) {
+    if(m_channel && ((events & POLLIN) || m_backend == Uring)) {
+        // The reactor or ring thread does the I/O, wait for it to hand something over
+        QMutexLocker locker(&m_channel->m_mutex);
+        forever {
+            if(m_waitInterrupted.exchange(false))
+                return false;
+            if(m_channel->m_error)
+                return true;
+            if((events & POLLIN) && (!m_channel->m_incoming.isEmpty() || m_channel->m_eof))
+                return true;
+            if((events & POLLOUT) && m_channel->m_sendDone)
+                return true;
+            if(!m_channel->m_ready.wait(&m_channel->m_mutex, deadline))
+                return false;
+        }
+    }
+
+    int interruptFd = m_interruptFd;
+    if(interruptFd < 0) {
+        interruptFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        m_interruptFd = interruptFd;
+    }
+
+    if(m_waitInterrupted.exchange(false))
+        return false;
+
+    struct pollfd fds[2] = {
+        { .fd = m_sockfd, .events = events, .revents = 0 },
+        { .fd = interruptFd, .events = POLLIN, .revents = 0 }
+    };
+    // Without the eventfd the wait still works, it just can't be interrupted
+    nfds_t nfds = interruptFd >= 0 ? 2 : 1;
+
+    forever {
+        struct timespec timeout;
+        if(!deadline.isForever()) {
+            qint64 nsecs = qMax<qint64>(0, deadline.remainingTimeNSecs());
+            timeout.tv_sec = nsecs / 1000000000;
+            timeout.tv_nsec = nsecs % 1000000000;
+        }
+
+        int rc = ::ppoll(fds, nfds, deadline.isForever() ? nullptr : &timeout, nullptr);
+        if(rc < 0) {
+            if(errno == EINTR)
+                continue;
+            handleSocketException(errno);
+            return false;
+        }
+        if(rc == 0)
+            return false;
+
+        if(fds[1].revents & POLLIN) {
+            uint64_t count;
+            while(::read(interruptFd, &count, sizeof(count)) > 0);
+            if(m_waitInterrupted.exchange(false))
+                return false;
+            // A leftover wakeup from an interrupt that was already handled
+            if(!fds[0].revents)
+                continue;
+        }
+        // Errors and hangups are reported by the read and write handlers
+        return true;
+    }
+}
+
+void UnixSocket::interruptWait() {
+    m_waitInterrupted = true;
+
+    ReactorChannel* channel = m_channel;
+    if(channel) {
+        QMutexLocker locker(&channel->m_mutex);
+        channel->m_ready.wakeAll();
+    }
+
+    int interruptFd = m_interruptFd;
+    if(interruptFd >= 0) {
+        uint64_t one = 1;
+        ssize_t rc = ::write(interruptFd, &one, sizeof(one));
+        Q_UNUSED(rc);
+    }
 }
 
 bool UnixSocket::waitForReadyRead(int msecs) {
     QDeadlineTimer deadline(msecs);
 
-    qint64 bytesRead;
-
-    do {
+    forever {
         handleReadAvaliable();
-        bytesRead = bytesAvailable();
-    } while(isOpen() && bytesRead == 0 && deadline.remainingTime());
-
-    return bytesRead > 0;
+        if(bytesAvailable() > 0)
+            return true;
+        if(!isOpen() || !waitForEvents(POLLIN, deadline))
+            return false;
+    }
 }
 
 bool UnixSocket::waitForBytesWritten(int msecs) {
-    if(m_writeBuffer.isEmpty())
+    if(m_writeQueue.isEmpty())
        return true;
     
     QDeadlineTimer deadline(msecs);
 
-    do{
+    forever {
         if(!handleWriteAvaliable())
             return false;
-    } while(isOpen() && m_writeBuffer.size() > 0 && deadline.remainingTime());
-
-    return true;
+        if(m_writeQueue.isEmpty())
+            return true;
+        if(!isOpen() || !waitForEvents(POLLOUT, deadline))
+            return false;
+    }
 }
 
 bool UnixSocket::isBlocking(int fd) {
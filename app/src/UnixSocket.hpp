@@ -4,36 +4,195 @@
 #include <QtCore/QtCore>
 #include <QtCore/QSocketNotifier>
 
+#include "SocketBuffer.hpp"
+
+#include <atomic>
+
+/* Largest message a SeqPacket UnixSocket sends or receives */
+#define SEQPACKET_MAX_MESSAGE_SZ (128 * 1024)
+
 struct sockaddr;
+struct msghdr;
 class UnixSocketServer;
 
+/* Snapshot of a socket's I/O counters, or their sum over several sockets */
+struct SocketStatistics {
+    quint64 bytesRead = 0;
+    quint64 bytesWritten = 0;
+    /* Reads and writes made on the socket, an io_uring submission counts as one */
+    quint64 syscalls = 0;
+    /* Reads that found the socket drained and writes that found it full */
+    quint64 eagain = 0;
+    quint64 peakReadBuffer = 0;
+    quint64 peakWriteQueue = 0;
+    /* In the write queue when the snapshot was taken */
+    quint64 queuedBytes = 0;
+    /* Discarded by the DropOldest overflow policy */
+    quint64 droppedBytes = 0;
+
+    /* Sums the counters, peaks are the larger of the two */
+    SocketStatistics& operator+=(const SocketStatistics& other);
+};
+
 class UnixSocket : public QIODevice {
     Q_OBJECT
 public:
-    UnixSocket(QObject *parent = nullptr) : QIODevice(parent) { }
+    /*
+     * How the socket is polled. Notifier uses QSocketNotifiers on the
+     * socket's thread, Reactor reads on an IoReactor thread and hands the
+     * data over in batches. Uring does the same with multishot io_uring
+     * requests and falls back to Notifier where io_uring isn't available.
+     */
+    enum Backend {
+        Notifier = 0,
+        Reactor,
+        Uring
+    };
+    Q_ENUM(Backend)
+
+    /*
+     * What happens once the write queue grows past the high water mark.
+     * Block keeps everything and emits highWaterMarkReached(), the producer
+     * is expected to pause its source until lowWaterMarkReached().
+     * DropOldest discards unsent data down to the low water mark,
+     * Disconnect fails the socket with ENOBUFS.
+     */
+    enum OverflowPolicy {
+        Block = 0,
+        DropOldest,
+        Disconnect
+    };
+    Q_ENUM(OverflowPolicy)
+
+    /*
+     * SeqPacket keeps message boundaries: every write() is sent as one
+     * message and readMessage() returns them whole, while the usual
+     * QIODevice reads still see a byte stream. SeqPacket sockets are
+     * always read by the notifier, whatever the backend.
+     */
+    enum SocketType {
+        Stream = 0,
+        SeqPacket
+    };
+    Q_ENUM(SocketType)
+
+    UnixSocket(QObject *parent = nullptr) : QIODevice(parent), m_backend(s_defaultBackend) { }
     ~UnixSocket();
 
+    /* Takes effect on the next connectToServer(), backend() then tells the one in use */
+    void setBackend(Backend backend) { m_backend = backend; }
+    Backend backend() const { return m_backend; }
+    /* Backend of sockets created after the call, also used by UnixSocketServer */
+    static void setDefaultBackend(Backend backend) { s_defaultBackend = backend; }
+    static Backend defaultBackend() { return s_defaultBackend; }
+
+    /* Takes effect on the next connectToServer() */
+    void setSocketType(SocketType type) { m_socketType = type; }
+    SocketType socketType() const { return m_socketType; }
+
     bool connectToServer(const QString& path);
     void close() override;
 
     qint64 bytesAvailable() const override;
     qint64 bytesToWrite() const override;
     bool canReadLine() const override;
+    bool isSequential() const override { return true; }
 
+    /* Both block in poll(), they return false on timeout or after interruptWait() */
     bool waitForReadyRead(int msecs) override;
     bool waitForBytesWritten(int msecs) override;
+    /* Wakes up a blocking wait, can be called from any thread */
+    void interruptWait();
     
     qint64 readData(char *data, qint64 maxSize) override;
     qint64 writeData(const char *data, qint64 maxSize) override;
 
+    /*
+     * Same as in QIODevice, but served straight from the receive buffer.
+     * readAll() hands over the received chunk without copying when possible.
+     */
+    QByteArray readAll();
+    qint64 peek(char *data, qint64 maxSize);
+    QByteArray peek(qint64 maxSize);
+    /*
+     * The contiguous block at the front of the receive buffer, to be consumed
+     * with skip() without copying. Empty when there's nothing to read or the
+     * data is in QIODevice's buffer, read() gets it then.
+     */
+    QByteArrayView nextDataBlock() const;
+
+    using QIODevice::write;
+    /* Queues the data without copying it */
+    qint64 write(const QByteArray& data);
+
+    /* SeqPacket only. Returns the next whole message, or an empty QByteArray if there's none */
+    QByteArray readMessage();
+    bool hasPendingMessages() const { return !m_messageSizes.isEmpty(); }
+    /* Returns -1 if there's no message */
+    qint64 pendingMessageSize() const { return m_messageSizes.isEmpty() ? -1 : m_messageSizes.head(); }
+    /*
+     * Same as write(), messages above SEQPACKET_MAX_MESSAGE_SZ fail with
+     * EMSGSIZE. Empty messages aren't sent, the peer would take them for EOF.
+     */
+    qint64 writeMessage(const QByteArray& message);
+
+    /*
+     * Passes a duplicate of fd to the peer along with data, which can't be
+     * empty: descriptors travel with the first byte (or SeqPacket message)
+     * sent after them. Returns false if the fd can't be duplicated.
+     */
+    bool sendFd(int fd, const QByteArray& data);
+    /*
+     * Takes the next received descriptor, the caller owns it. Returns -1 if
+     * there's none. A descriptor is here once the first byte sent with it
+     * has been received. io_uring sockets can't receive descriptors, the
+     * kernel closes them.
+     */
+    int receiveFd();
+    bool hasPendingFds() const { return !m_receivedFds.isEmpty(); }
+
+    /* highWater 0 leaves the write queue unbounded, the default. lowWater -1 is half of highWater */
+    void setWriteBufferLimits(qint64 highWater, qint64 lowWater = -1);
+    qint64 highWaterMark() const { return m_highWaterMark; }
+    qint64 lowWaterMark() const { return m_lowWaterMark; }
+    void setOverflowPolicy(OverflowPolicy policy) { m_overflowPolicy = policy; }
+    OverflowPolicy overflowPolicy() const { return m_overflowPolicy; }
+    /* Between highWaterMarkReached() and lowWaterMarkReached() */
+    bool isWriteBufferFull() const { return m_writeBufferFull; }
+
+    /*
+     * Stops reading the socket until it's enabled again, so the peer gets
+     * blocked by the kernel. What's already received stays readable.
+     */
+    void setReadEnabled(bool enabled);
+    bool isReadEnabled() const { return m_readEnabled; }
+    /*
+     * Hands reading the fd over to the caller, e.g. a SpliceRelay. Same as
+     * setReadEnabled(false), except that what a reactor thread has already
+     * received is moved to the read buffer right away, so nothing read from
+     * the fd shows up later. Fails for io_uring sockets, their receive
+     * can't be stopped synchronously.
+     */
+    bool stopReading();
+    int socketDescriptor() const { return m_sockfd; }
+
     int error() const { return m_err; }
+
+    /* Counted for the socket's whole life, across reconnects */
+    SocketStatistics statistics() const;
 signals:
     void connected();
 
     void disconnected(); 
     void errorOccurred(int error);
+
+    void highWaterMarkReached();
+    void lowWaterMarkReached();
+protected:
+    qint64 readLineData(char *data, qint64 maxSize) override;
+    qint64 skipData(qint64 maxSize) override;
 private:
-    static int makeSocket(const QString& path, struct sockaddr** addrp);
+    static int makeSocket(const QString& path, struct sockaddr** addrp, SocketType type = Stream);
 
     static bool setBlocking(int fd, bool block);
     bool setBlocking(bool block);
@@ -41,21 +200,83 @@ private:
     static bool isBlocking(int fd);
     bool isBlocking();
 
-    bool setFd(int fd);
+    /* nonBlocking tells that fd is already non-blocking, e.g. from accept4() */
+    bool setFd(int fd, bool nonBlocking = false);
+    bool waitForEvents(short events, const QDeadlineTimer& deadline);
     void handleReadAvaliable();
+    void handleMessagesAvailable();
+    /* Keeps the message boundaries in step with the bytes read as a stream */
+    void consumeMessages(qint64 size);
     bool handleWriteAvaliable();
+    void handleReactorEvents();
+    void setWriteInterest(bool enabled);
+    /* io_uring keeps one send in flight, submitted from the write queue */
+    bool submitRingSend(bool waitWritable);
+    bool handleRingSent(int result);
+    /*
+     * Fills msg with the queued data up to the next passed descriptor and
+     * attaches the descriptor due now, if any. Returns true if it did.
+     */
+    bool prepareSend(struct msghdr* msg, struct iovec* iov, char* control);
+    /* Frees what a sendmsg() has sent, and the descriptor that went with it */
+    void handleSent(qint64 size, bool fdAttached);
+    /* Apply the overflow policy, false if the socket got closed */
+    bool checkHighWaterMark();
+    void checkLowWaterMark();
     void handleSocketException(int error);
 private:
+    class ReactorChannel;
+
     int m_sockfd = -1;
     struct sockaddr* m_addr = nullptr;
 
     int m_err = 0;
 
-    QByteArray m_readBuffer;
-    QByteArray m_writeBuffer;
+    SocketBuffer m_readBuffer;
+    SocketWriteQueue m_writeQueue;
+
+    SocketType m_socketType = Stream;
+    /* Sizes of the SeqPacket messages in m_readBuffer */
+    QQueue<qint64> m_messageSizes;
+
+    /* Descriptors from sendFd(), position is the stream offset of the byte they go with */
+    struct PendingFd {
+        int fd;
+        qint64 position;
+    };
+    QQueue<PendingFd> m_outgoingFds;
+    /* Bytes sent since the socket was opened */
+    qint64 m_sentTotal = 0;
+    QQueue<int> m_receivedFds;
+
+    qint64 m_highWaterMark = 0;
+    qint64 m_lowWaterMark = 0;
+    OverflowPolicy m_overflowPolicy = Block;
+    bool m_writeBufferFull = false;
+    bool m_readEnabled = true;
+
+    /* eventfd created by the first blocking wait */
+    std::atomic<int> m_interruptFd { -1 };
+    std::atomic<bool> m_waitInterrupted { false };
+
+    Backend m_backend;
+    static std::atomic<Backend> s_defaultBackend;
+
+    /* Relaxed atomics, the reactor and ring threads count the reads */
+    struct Counters {
+        std::atomic<quint64> bytesRead { 0 };
+        std::atomic<quint64> bytesWritten { 0 };
+        std::atomic<quint64> syscalls { 0 };
+        std::atomic<quint64> eagain { 0 };
+        std::atomic<quint64> peakReadBuffer { 0 };
+        std::atomic<quint64> peakWriteQueue { 0 };
+        std::atomic<quint64> droppedBytes { 0 };
+    };
+    Counters m_counters;
 
     QSocketNotifier m_readNotifier = QSocketNotifier(QSocketNotifier::Read, this);
     QSocketNotifier m_writeNotifier = QSocketNotifier(QSocketNotifier::Write, this);
+    ReactorChannel* m_channel = nullptr;
 
     friend class UnixSocketServer;
 };
@@ -5,13 +5,79 @@
 #include <QtCore/QMap>
 #include <QtCore/QMutex>
 #include <QtCore/QVector>
+#include <QtCore/QWaitCondition>
 #include <QtCore/qsystemdetection.h>
 
+#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <sys/un.h>
 
+/* How long accepting pauses when we're out of file descriptors */
+#define ACCEPT_RETRY_MSEC 100
+
 #include "UnixSocket.hpp"
+#include "IoReactor.hpp"
+#include "IoUring.hpp"
+
+/*
+ * Tells the server about waiting connections. With the reactor the accepting
+ * is done on the server's thread, io_uring hands over the accepted fds.
+ */
+class UnixSocketServer::ListenChannel : public IoReactor::Handler, public IoUring::Handler {
+public:
+    ListenChannel(UnixSocketServer* server) : m_server(server) { }
+
+    void reactorEvent(uint32_t events) override;
+    uint32_t reactorEvents() override { return m_pending ? 0 : EPOLLIN; }
+    bool ringCompletion(IoUring::Op op, int result, const char* data) override;
+private:
+    void notifyServer();
+
+    UnixSocketServer* const m_server;
+    quint64 m_token = 0;
+    /* A queued call is on its way, the reactor leaves the fd out of the epoll set until then */
+    std::atomic<bool> m_pending { false };
+
+    QMutex m_mutex;
+    QWaitCondition m_ready;
+    QVector<int> m_accepted;
+    int m_acceptError = 0;
+
+    friend class UnixSocketServer;
+};
+
+void UnixSocketServer::ListenChannel::reactorEvent(uint32_t events) {
+    Q_UNUSED(events);
+    notifyServer();
+}
+
+bool UnixSocketServer::ListenChannel::ringCompletion(IoUring::Op op, int result, const char* data) {
+    Q_UNUSED(op);
+    Q_UNUSED(data);
+
+    QMutexLocker locker(&m_mutex);
+    if(result >= 0)
+        m_accepted.append(result);
+    else
+        m_acceptError = -result;
+    m_ready.wakeAll();
+    locker.unlock();
+
+    notifyServer();
+    // The server decides when to accept again after an error
+    return result >= 0;
+}
+
+void UnixSocketServer::ListenChannel::notifyServer() {
+    if(m_pending.exchange(true))
+        return;
+
+    UnixSocketServer* server = m_server;
+    QMetaObject::invokeMethod(server, [server] { server->handleReactorAccept(); },
+        Qt::QueuedConnection);
+}
 
 UnixSocketServer::UnixSocketServer(QObject *parent) : QObject(parent) { }
 
@@ -37,7 +103,7 @@ bool UnixSocketServer::listen(QString path) {
     m_serverPath = serverPathInfo.absoluteFilePath();
     m_serverName = serverPathInfo.fileName();
 
-    if((m_sockfd = UnixSocket::makeSocket(m_serverPath, &m_addr)) == -1) {
+    if((m_sockfd = UnixSocket::makeSocket(m_serverPath, &m_addr, m_socketType)) == -1) {
         m_errStr = strerror(m_err = errno);
         emit errorOccurred(m_err);
         return false;
@@ -59,7 +125,7 @@ bool UnixSocketServer::listen(QString path) {
         return false;
     }
 
-    if(::listen(m_sockfd, 0) == -1) {
+    if(::listen(m_sockfd, m_backlog < 0 ? SOMAXCONN : m_backlog) == -1) {
         close();
         m_errStr = "listen(): ";
         m_errStr += strerror(m_err = errno);
@@ -75,10 +141,42 @@ bool UnixSocketServer::listen(QString path) {
         return false;
     }
 
-    m_readNotifier = new QSocketNotifier(m_sockfd, QSocketNotifier::Read, this);
-    connect(m_readNotifier, &QSocketNotifier::activated,
-        this, [=]{ waitForNewConnection(0); });
+    m_backend = UnixSocket::defaultBackend();
+    if(m_backend == UnixSocket::Uring && !IoUring::isAvailable())
+        m_backend = UnixSocket::Notifier;
+
+    if(m_backend != UnixSocket::Notifier) {
+        m_channel = new ListenChannel(this);
+        if(m_backend == UnixSocket::Reactor) {
+            m_channel->m_token = IoReactor::instance()->add(m_sockfd, m_channel);
+        }
+        else {
+            m_channel->m_token = IoUring::instance()->add(m_sockfd, m_channel);
+            if(!IoUring::instance()->accept(m_channel->m_token)) {
+                IoUring::instance()->remove(m_channel->m_token);
+                m_channel->m_token = 0;
+            }
+        }
+
+        if(m_channel->m_token == 0) {
+            m_errStr = "Failed to register the socket: ";
+            m_errStr += strerror(m_err = errno ? errno : EIO);
+            delete m_channel;
+            m_channel = nullptr;
+            ::close(m_sockfd);
+            m_sockfd = -1;
+            emit errorOccurred(m_err);
+            return false;
+        }
+    }
+    else {
+        m_readNotifier = new QSocketNotifier(m_sockfd, QSocketNotifier::Read, this);
+        connect(m_readNotifier, &QSocketNotifier::activated,
+            this, [=]{ acceptPending(); });
+    }
 
+    m_stats = AcceptStatistics();
+    m_listenTimer.start();
     m_listening = true;
     return true;
 }
@@ -103,6 +201,18 @@ void UnixSocketServer::close() {
     }
     m_clients.clear();
 
+    if(m_channel) {
+        if(m_backend == UnixSocket::Uring)
+            IoUring::instance()->remove(m_channel->m_token);
+        else
+            IoReactor::instance()->remove(m_channel->m_token);
+        // Accepted by io_uring but never picked up
+        for(int fd : m_channel->m_accepted)
+            ::close(fd);
+        delete m_channel;
+        m_channel = nullptr;
+    }
+
     if(m_readNotifier){
         m_readNotifier->disconnect();
         m_readNotifier->deleteLater();
@@ -121,61 +231,196 @@ void UnixSocketServer::close() {
     ::close(m_sockfd);
     m_sockfd = -1;
     m_listening = false;
+    m_acceptPaused = false;
+}
+
+int UnixSocketServer::acceptPending() {
+    int accepted = 0;
+
+    while(m_listening) {
+        // Already non-blocking and close-on-exec, UnixSocket::setFd() doesn't need fcntl()
+        int fd = ::accept4(m_sockfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd == -1) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            // The connection went away before we got to it
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            handleAcceptError(errno);
+            return accepted > 0 ? accepted : -1;
+        }
+
+        if(addConnection(fd))
+            accepted++;
+    }
+
+    updateStatistics(accepted);
+    return accepted;
+}
+
+bool UnixSocketServer::addConnection(int fd) {
+    UnixSocket *sock = new UnixSocket(this);
+    sock->setBackend(m_backend);
+    sock->setSocketType(m_socketType);
+    if(!sock->setFd(fd, true)){
+        m_stats.failed++;
+        m_err = sock->error();
+        m_errStr = "UnixSocket::setFd(): " + sock->errorString();
+        ::close(fd);
+        emit errorOccurred(m_err);
+        sock->deleteLater();
+        return false;
+    }
+
+    auto removeSock = [this, sock] {
+        sock->disconnect(this, nullptr);
+        m_clients.remove(sock);
+        if(m_pendingConnection.removeAll(sock)) {
+            sock->deleteLater();
+        }
+    };
+
+    connect(sock, &UnixSocket::destroyed, this, removeSock);
+    connect(sock, &UnixSocket::disconnected, this, removeSock);
+
+    m_clients.insert(sock);
+    m_pendingConnection.enqueue(sock);
+
+    emit newConnection();
+    return true;
+}
+
+void UnixSocketServer::handleAcceptError(int error) {
+    m_stats.failed++;
+    m_err = error;
+    m_errStr = "accept(): ";
+    m_errStr += strerror(m_err);
+
+    if((m_err == EMFILE || m_err == ENFILE) && !m_acceptPaused) {
+        // The pending connection keeps the socket readable, don't spin on it
+        m_acceptPaused = true;
+        if(m_readNotifier)
+            m_readNotifier->setEnabled(false);
+        QTimer::singleShot(ACCEPT_RETRY_MSEC, this, &UnixSocketServer::resumeAccepting);
+    }
+    emit errorOccurred(m_err);
+}
+
+void UnixSocketServer::updateStatistics(int accepted) {
+    if(accepted <= 0)
+        return;
+    m_stats.accepted += accepted;
+    m_stats.batches++;
+    m_stats.largestBatch = qMax<quint64>(m_stats.largestBatch, accepted);
+}
+
+int UnixSocketServer::takeRingAccepted() {
+    QMutexLocker locker(&m_channel->m_mutex);
+    QVector<int> fds = std::exchange(m_channel->m_accepted, QVector<int>());
+    int error = std::exchange(m_channel->m_acceptError, 0);
+    locker.unlock();
+
+    int accepted = 0;
+    for(int fd : fds) {
+        // A newConnection() handler may have closed the server
+        if(!m_listening) {
+            ::close(fd);
+            continue;
+        }
+        if(addConnection(fd))
+            accepted++;
+    }
+    updateStatistics(accepted);
+
+    if(error && m_listening) {
+        handleAcceptError(error);
+        // The multishot accept stopped on the error
+        if(m_channel && !m_acceptPaused)
+            IoUring::instance()->accept(m_channel->m_token);
+    }
+    return accepted > 0 || !error ? accepted : -1;
+}
+
+void UnixSocketServer::handleReactorAccept() {
+    if(!m_channel)
+        return;
+
+    if(m_backend == UnixSocket::Uring) {
+        m_channel->m_pending = false;
+        takeRingAccepted();
+        return;
+    }
+
+    acceptPending();
+
+    // Closed by a newConnection() handler, or re-armed by resumeAccepting() later
+    if(!m_channel || m_acceptPaused)
+        return;
+    m_channel->m_pending = false;
+    IoReactor::instance()->update(m_channel->m_token);
+}
+
+void UnixSocketServer::resumeAccepting() {
+    if(!m_acceptPaused)
+        return;
+    m_acceptPaused = false;
+
+    if(m_readNotifier)
+        m_readNotifier->setEnabled(true);
+    if(m_channel && m_backend == UnixSocket::Uring) {
+        IoUring::instance()->accept(m_channel->m_token);
+    }
+    else if(m_channel) {
+        m_channel->m_pending = false;
+        IoReactor::instance()->update(m_channel->m_token);
+    }
 }
 
 bool UnixSocketServer::waitForNewConnection(int msec, bool *timedOut) {
+    if(timedOut)
+        *timedOut = false;
     if(!m_listening)
         return false;
 
     QDeadlineTimer deadline(msec);
 
-    do{
-        int fd = ::accept(m_sockfd, NULL, NULL);
-        
-        if(fd == -1 && errno != EAGAIN){
-            if(timedOut)
-                *timedOut = false;
-            m_err = errno;
-            m_errStr = "accept(): ";
-            m_errStr += strerror(m_err);
-            emit errorOccurred(m_err);
-            return false;
+    forever {
+        // io_uring accepts on its own, the connections are waiting in the channel
+        bool ring = m_backend == UnixSocket::Uring && m_channel;
+        int accepted = ring ? takeRingAccepted() : acceptPending();
+        if(accepted != 0)
+            return accepted > 0;
+        if(!m_listening || deadline.hasExpired())
+            break;
+
+        if(ring) {
+            QMutexLocker locker(&m_channel->m_mutex);
+            if(m_channel->m_accepted.isEmpty() && !m_channel->m_acceptError)
+                m_channel->m_ready.wait(&m_channel->m_mutex, deadline);
+            continue;
         }
 
-        UnixSocket *sock = new UnixSocket(this);
-        if(!sock->setFd(fd)){
-            m_err = sock->error();
-            m_errStr = "UnixSocket::setFd(): " + sock->errorString();
-            ::close(fd);
+        struct pollfd pfd = { .fd = m_sockfd, .events = POLLIN, .revents = 0 };
+        int timeout = deadline.isForever() ? -1 : int(deadline.remainingTime());
+        if(::poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+            m_err = errno;
+            m_errStr = "poll(): ";
+            m_errStr += strerror(m_err);
             emit errorOccurred(m_err);
-            sock->deleteLater();
-            if(timedOut)
-                *timedOut = false;
             return false;
         }
-
-        auto removeSock = [this, sock] {
-            sock->disconnect(this, nullptr);
-            m_clients.remove(sock);
-            if(m_pendingConnection.removeAll(sock)) {
-                sock->deleteLater();
-            }
-        };
-
-        connect(sock, &UnixSocket::destroyed, this, removeSock);
-        connect(sock, &UnixSocket::disconnected, this, removeSock);
-
-        m_clients.insert(sock);
-        m_pendingConnection.enqueue(sock);
-
-        emit newConnection();
-            
-        if(timedOut)
-            *timedOut = false;
-        return true;
-    } while(!deadline.hasExpired()); 
+    }
 
     if(timedOut)
         *timedOut = deadline.hasExpired();
     return false;
 }
+
+UnixSocketServer::AcceptStatistics UnixSocketServer::acceptStatistics() const {
+    AcceptStatistics stats = m_stats;
+    qint64 elapsed = m_listenTimer.isValid() ? m_listenTimer.elapsed() : 0;
+    if(elapsed > 0)
+        stats.acceptRate = stats.accepted * 1000.0 / elapsed;
+    return stats;
+}
\ No newline at end of file
@@ -2,11 +2,12 @@
 #define UNIXSOCKETSERVER_HPP
 
 #include <QtCore/QObject>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QSet>
 #include <QtCore/QQueue>
 #include <QtCore/QSocketNotifier>
 
-class UnixSocket;
+#include "UnixSocket.hpp"
 
 class UnixSocketServer : public QObject {
     Q_OBJECT
@@ -19,6 +20,25 @@ public:
     
     bool waitForNewConnection(int msec = 0, bool *timedOut = nullptr);
 
+    /* Backlog passed to listen(2) by the next listen(), -1 means SOMAXCONN */
+    void setListenBacklogSize(int size) { m_backlog = size; }
+    int listenBacklogSize() const { return m_backlog; }
+
+    /* Type of the listening socket and the accepted ones, set before listen() */
+    void setSocketType(UnixSocket::SocketType type) { m_socketType = type; }
+    UnixSocket::SocketType socketType() const { return m_socketType; }
+
+    struct AcceptStatistics {
+        quint64 accepted = 0;
+        quint64 failed = 0;
+        /* Wakeups that accepted at least one connection */
+        quint64 batches = 0;
+        quint64 largestBatch = 0;
+        /* Accepted connections per second since listen() */
+        double acceptRate = 0;
+    };
+    AcceptStatistics acceptStatistics() const;
+
     bool hasPendingConnections() const { return !m_pendingConnection.isEmpty(); }
     UnixSocket* nextPendingConnection();
 
@@ -32,7 +52,22 @@ signals:
     void errorOccurred(int error);
     void newConnection();
 private:
+    /* Accepts until the queue is drained, returns the number of connections or -1 */
+    int acceptPending();
+    /* Same for the fds io_uring has accepted */
+    int takeRingAccepted();
+    bool addConnection(int fd);
+    void handleAcceptError(int error);
+    void updateStatistics(int accepted);
+    void handleReactorAccept();
+    void resumeAccepting();
+private:
+    class ListenChannel;
+
     bool m_listening = false;
+    bool m_acceptPaused = false;
+    int m_backlog = -1;
+    UnixSocket::SocketType m_socketType = UnixSocket::Stream;
 
     int m_err = 0;
     QString m_errStr = nullptr;
@@ -42,7 +77,13 @@ private:
     
     struct sockaddr* m_addr = nullptr;
     int m_sockfd = -1;
+    /* Accepted sockets use the same backend */
+    UnixSocket::Backend m_backend = UnixSocket::Notifier;
     QSocketNotifier* m_readNotifier = nullptr;
+    ListenChannel* m_channel = nullptr;
+
+    AcceptStatistics m_stats;
+    QElapsedTimer m_listenTimer;
 
     QSet<UnixSocket*> m_clients = QSet<UnixSocket*>();
     QQueue<UnixSocket*> m_pendingConnection = QQueue<UnixSocket*>();
@@ -1,13 +1,25 @@
 #include "VSockUser.hpp"
 
+#include "ShmTransport.hpp"
 #include "UnixSocket.hpp"
+#include "VSockUserMux.hpp"
+
+#include <sys/uio.h>
+
+/* Queued segments handed to the ring per flush round */
+#define SHM_FLUSH_IOV_COUNT 16
 
 void VSockUser::setSock(UnixSocket* sock) {
     sock->setParent(this);
     m_sock = sock;
     setProperty("_unixSocket", QVariant::fromValue<UnixSocket*>(sock));
 
-    connect(m_sock, &UnixSocket::disconnected, this, &VSockUser::close);
+    connect(m_sock, &UnixSocket::disconnected, this, [this]() {
+        // What's left in the ring goes away with the mapping
+        if(m_shm && m_shm->bytesAvailable() > 0)
+            emit readyRead();
+        close();
+    });
     connect(m_sock, &UnixSocket::errorOccurred, this, [this]() {
         setErrorString(m_sock->errorString());
         emit errorOccurred(m_err = m_sock->error());
@@ -16,15 +28,59 @@ void VSockUser::setSock(UnixSocket* sock) {
     connect(m_sock, &UnixSocket::bytesWritten, this, &VSockUser::bytesWritten);
 }
 
+void VSockUser::setShm(ShmTransport* shm) {
+    shm->setParent(this);
+    m_shm = shm;
+
+    connect(m_shm, &ShmTransport::readyRead, this, &VSockUser::readyRead);
+    connect(m_shm, &ShmTransport::spaceAvailable, this, &VSockUser::flushShm);
+}
+
+void VSockUser::setMux(VSockUserMux* mux, uint32_t stream) {
+    m_mux = mux;
+    m_muxStream = stream;
+    QIODevice::open(ReadWrite | Unbuffered);
+}
+
+void VSockUser::flushShm() {
+    qint64 flushed = 0;
+    bool full = false;
+    while(!full && !m_shmWriteQueue.isEmpty()) {
+        struct iovec iov[SHM_FLUSH_IOV_COUNT];
+        int count = m_shmWriteQueue.segments(iov, SHM_FLUSH_IOV_COUNT);
+        qint64 written = 0;
+        for(int i = 0; i < count && !full; i++) {
+            qint64 rc = m_shm->write((const char*)iov[i].iov_base, iov[i].iov_len);
+            written += rc;
+            full = rc < (qint64)iov[i].iov_len;
+        }
+        m_shmWriteQueue.free(written);
+        flushed += written;
+    }
+
+    if(flushed > 0) {
+        m_shmStatistics.bytesWritten += flushed;
+        emit bytesWritten(flushed);
+    }
+}
+
 bool VSockUser::connectToServer(QString serverPath, 
     uint32_t host_cid, uint32_t host_port,
     uint32_t vm_cid, uint32_t vm_port,
-    int timeoutMsec, bool* timeout)
+    int timeoutMsec)
 {
+    if(isOpen() || m_pendingSock) {
+        m_err = EISCONN;
+        setErrorString("Socket already connected or connecting");
+        return false;
+    }
+
     UnixSocket* sock = new UnixSocket(this);
     if(!sock->connectToServer(serverPath)) {
         setErrorString("UnixSocket::connectToServer(): " + sock->errorString());
-        emit errorOccurred(m_err = sock->error());
+        m_err = sock->error();
+        delete sock;
+        emit errorOccurred(m_err);
         return false;
     }
 
@@ -35,29 +91,77 @@ bool VSockUser::connectToServer(QString serverPath,
         .vm_port = vm_port
     };
     sock->writeData((const char*)&connectionData, sizeof(connectionData)); 
+
+    m_pendingSock = sock;
+    connect(sock, &UnixSocket::readyRead, this, &VSockUser::handleConnectReply);
+    // Closed by the server without a reply
+    connect(sock, &UnixSocket::disconnected, this, &VSockUser::handleConnectReply);
+    connect(sock, &UnixSocket::errorOccurred, this, [this, sock]() {
+        failConnect(sock->error(), "UnixSocket: " + sock->errorString());
+    });
+    connect(&m_connectTimer, &QTimer::timeout, this, &VSockUser::handleConnectTimeout, Qt::UniqueConnection);
+    m_connectTimer.setSingleShot(true);
+    m_connectTimer.start(timeoutMsec);
+    return true;
+}
+
+void VSockUser::handleConnectReply() {
+    if(!m_pendingSock)
+        return;
+
     VSockUser::ConnectionReply reply;
-    QDeadlineTimer deadline(timeoutMsec);
-    while(!deadline.hasExpired() && sock->bytesAvailable() < 1) {
-        QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents, 30);
-    }
-    if(sock->readData((char*)&reply, sizeof(reply)) < 1) {
-        setErrorString("UnixSocket::readData(): " + sock->errorString());
-        emit errorOccurred(m_err = sock->error());
-        close();
-        return false;
+    if(m_pendingSock->readData((char*)&reply, sizeof(reply)) < 1) {
+        if(!m_pendingSock->isOpen())
+            failConnect(ECONNRESET, "Connection closed before it was accepted");
+        return;
     }
     if(reply != VSockUser::ConnectionReply::Accept) {
-        m_err = ECONNREFUSED;
-        setErrorString(QString(strerror(m_err)));
-        emit errorOccurred(m_err);
-        close();
-        return false;
+        failConnect(ECONNREFUSED, QString(strerror(ECONNREFUSED)));
+        return;
     }
 
+    m_connectTimer.stop();
+    UnixSocket* sock = std::exchange(m_pendingSock, nullptr);
+    disconnect(sock, nullptr, this, nullptr);
     setSock(sock);
+    // Reads are served from the transport's buffer, QIODevice's would be another copy
+    QIODevice::open(ReadWrite | Unbuffered);
 
     emit connected();
-    return QIODevice::open(ReadWrite);
+    // Sent right behind the reply, readyRead() won't come again for it
+    if(m_sock && m_sock->bytesAvailable() > 0)
+        emit readyRead();
+}
+
+void VSockUser::handleConnectTimeout() {
+    if(m_pendingSock)
+        failConnect(ETIMEDOUT, QString(strerror(ETIMEDOUT)));
+}
+
+void VSockUser::failConnect(int err, const QString& errorString) {
+    abort();
+    m_err = err;
+    setErrorString(errorString);
+    emit errorOccurred(m_err);
+}
+
+bool VSockUser::waitForConnected(int msecs) {
+    QDeadlineTimer deadline(msecs);
+    // The reply is handled from the readyRead() the wait emits
+    while(m_pendingSock) {
+        if(!m_pendingSock->waitForReadyRead(deadline.remainingTime()))
+            break;
+    }
+    return isOpen();
+}
+
+void VSockUser::abort() {
+    m_connectTimer.stop();
+    if(UnixSocket* sock = std::exchange(m_pendingSock, nullptr)) {
+        disconnect(sock, nullptr, this, nullptr);
+        sock->close();
+        sock->deleteLater();
+    }
 }
 
 VSockUser::~VSockUser() {
@@ -65,7 +169,21 @@ VSockUser::~VSockUser() {
 }
 
 void VSockUser::close() {
+    abort();
+    if(VSockUserMux* mux = m_mux) {
+        m_closedStatistics = mux->statistics(m_muxStream);
+        m_mux = nullptr;
+        mux->closeStream(m_muxStream);
+    }
+    if(m_shm) {
+        disconnect(m_shm, nullptr, this, nullptr);
+        m_shm->deleteLater();
+        m_shm = nullptr;
+        m_shmWriteQueue.clear();
+        m_shmWritten = 0;
+    }
     if(m_sock) {
+        m_closedStatistics = m_sock->statistics();
         setProperty("_unixSocket", QVariant::fromValue<UnixSocket*>(nullptr));
         m_sock->deleteLater();
         m_sock = nullptr;
@@ -76,74 +194,227 @@ void VSockUser::close() {
 }
 
 qint64 VSockUser::bytesAvailable() const {
-    if(!m_sock && !m_sock->isOpen() && !isOpen()) {
+    if(m_mux)
+        return QIODevice::bytesAvailable() + m_mux->bytesAvailable(m_muxStream);
+    if(!m_sock || !isOpen()) {
         return 0;
     }
-    return m_sock->bytesAvailable();
+    // What peek() or ungetChar() left in QIODevice's buffer is read first
+    if(m_shm)
+        return QIODevice::bytesAvailable() + m_shm->bytesAvailable();
+    return QIODevice::bytesAvailable() + m_sock->bytesAvailable();
 }
 
 qint64 VSockUser::bytesToWrite() const {
-    if(!m_sock && !m_sock->isOpen() && !isOpen()) {
+    if(m_mux)
+        return m_mux->bytesToWrite(m_muxStream);
+    if(!m_sock || !isOpen()) {
         return 0;
     }
+    if(m_shm)
+        return m_shmWriteQueue.size();
     return m_sock->bytesToWrite();
 }
 
 bool VSockUser::canReadLine() const {
-    if(!m_sock && !m_sock->isOpen() && !isOpen()) {
+    if(m_mux)
+        return m_mux->indexOf(m_muxStream, '\n') >= 0 || QIODevice::canReadLine();
+    if(!m_sock || !isOpen()) {
         return false;
     }
-    return m_sock->canReadLine();
+    if(m_shm)
+        return m_shm->indexOf('\n') >= 0 || QIODevice::canReadLine();
+    return m_sock->canReadLine() || QIODevice::canReadLine();
 }
 
 bool VSockUser::waitForReadyRead(int msecs) {
-    if(!m_sock && !m_sock->isOpen() && !isOpen()) {
+    if(m_mux)
+        return m_mux->waitForReadyRead(m_muxStream, msecs);
+    if(!m_sock || !isOpen()) {
         return false;
     }
+    if(m_shm) {
+        QDeadlineTimer deadline(msecs);
+        while(m_shm->bytesAvailable() == 0) {
+            if(!m_shm->waitForEvent(deadline.remainingTime()))
+                return false;
+            // The event may have been for the other ring
+            flushShm();
+        }
+        emit readyRead();
+        return true;
+    }
     return m_sock->waitForReadyRead(msecs);
 }
 
 bool VSockUser::waitForBytesWritten(int msecs) {
-    if(!m_sock && !m_sock->isOpen() && !isOpen()) {
+    if(m_mux)
+        return m_mux->waitForBytesWritten(m_muxStream, msecs);
+    if(!m_sock || !isOpen()) {
         return false;
     }
+    if(m_shm) {
+        QDeadlineTimer deadline(msecs);
+        qint64 available = m_shm->bytesAvailable();
+        flushShm();
+        while(!m_shmWriteQueue.isEmpty() && m_shm->waitForEvent(deadline.remainingTime()))
+            flushShm();
+        // The events taken here may have been for incoming data too
+        if(m_shm->bytesAvailable() > available)
+            emit readyRead();
+        return m_shmWriteQueue.isEmpty();
+    }
     return m_sock->waitForBytesWritten(msecs);
 }
 
+void VSockUser::interruptWait() {
+    if(m_pendingSock) {
+        m_pendingSock->interruptWait();
+    }
+    if(m_shm) {
+        m_shm->interruptWait();
+    }
+    if(m_mux) {
+        m_mux->interruptWait();
+    }
+    if(m_sock) {
+        m_sock->interruptWait();
+    }
+}
+
 qint64 VSockUser::readData(char *data, qint64 maxSize) {
-    if(!m_sock && !m_sock->isOpen() && !isOpen()) {
+    if(m_mux)
+        return m_mux->read(m_muxStream, data, maxSize);
+    if(!m_sock || !isOpen()) {
         return -1;
     }
+    if(m_shm) {
+        qint64 rc = m_shm->read(data, maxSize);
+        m_shmStatistics.bytesRead += rc;
+        return rc;
+    }
     return m_sock->readData(data, maxSize);
 }
 
+qint64 VSockUser::skipData(qint64 maxSize) {
+    if(m_mux)
+        return m_mux->skip(m_muxStream, maxSize);
+    if(!m_sock || !isOpen()) {
+        return -1;
+    }
+    if(m_shm) {
+        qint64 rc = m_shm->skip(maxSize);
+        m_shmStatistics.bytesRead += rc;
+        return rc;
+    }
+    return m_sock->skip(maxSize);
+}
+
+QByteArray VSockUser::readAll() {
+    // Data already moved to QIODevice's buffer (ungetChar(), transactions) comes first
+    if(QIODevice::bytesAvailable() > 0 || isTransactionStarted() || !isReadable())
+        return QIODevice::readAll();
+    if(m_mux)
+        return m_mux->readAll(m_muxStream);
+    if(m_shm || !m_sock)
+        return QIODevice::readAll();
+    return m_sock->readAll();
+}
+
+qint64 VSockUser::peek(char *data, qint64 maxSize) {
+    if(QIODevice::bytesAvailable() > 0 || !isReadable())
+        return QIODevice::peek(data, maxSize);
+    if(m_mux)
+        return m_mux->peek(m_muxStream, data, maxSize);
+    if(m_shm || !m_sock)
+        return QIODevice::peek(data, maxSize);
+    return m_sock->peek(data, maxSize);
+}
+
+QByteArray VSockUser::peek(qint64 maxSize) {
+    if(QIODevice::bytesAvailable() > 0 || !isReadable())
+        return QIODevice::peek(maxSize);
+    if(m_mux)
+        return m_mux->peek(m_muxStream, maxSize);
+    if(m_shm || !m_sock)
+        return QIODevice::peek(maxSize);
+    return m_sock->peek(maxSize);
+}
+
+QByteArrayView VSockUser::nextDataBlock() const {
+    if(QIODevice::bytesAvailable() > 0 || !isReadable())
+        return QByteArrayView();
+    if(m_mux)
+        return m_mux->nextDataBlock(m_muxStream);
+    if(m_shm)
+        return m_shm->nextDataBlock();
+    if(m_sock)
+        return m_sock->nextDataBlock();
+    return QByteArrayView();
+}
+
 qint64 VSockUser::writeData(const char *data, qint64 maxSize) {
-    if(!m_sock && !m_sock->isOpen() && !isOpen()) {
+    if(m_mux)
+        return m_mux->write(m_muxStream, data, maxSize);
+    if(!m_sock || !isOpen()) {
         return -1;
     }
+    if(m_shm) {
+        qint64 written = m_shmWriteQueue.isEmpty() ? m_shm->write(data, maxSize) : 0;
+        if(written < maxSize)
+            m_shmWriteQueue.append(data + written, maxSize - written);
+        m_shmStatistics.bytesWritten += written;
+        m_shmStatistics.peakWriteQueue = qMax<quint64>(m_shmStatistics.peakWriteQueue, m_shmWriteQueue.size());
+
+        // Announced from the event loop like a socket's, once per batch
+        if(written > 0 && m_shmWritten == 0) {
+            QMetaObject::invokeMethod(this, [this]() {
+                if(m_shmWritten > 0)
+                    emit bytesWritten(std::exchange(m_shmWritten, 0));
+            }, Qt::QueuedConnection);
+        }
+        m_shmWritten += written;
+        return maxSize;
+    }
     return m_sock->writeData(data, maxSize);
 }
 
+qint64 VSockUser::write(const QByteArray& data) {
+    if(m_shm || !m_sock || !m_sock->isOpen() || !isOpen()) {
+        return QIODevice::write(data);
+    }
+    return m_sock->write(data);
+}
+
+SocketStatistics VSockUser::statistics() const {
+    if(m_mux)
+        return m_mux->statistics(m_muxStream);
+    SocketStatistics stats = m_sock ? m_sock->statistics() : m_closedStatistics;
+    stats += m_shmStatistics;
+    stats.queuedBytes += m_shmWriteQueue.size();
+    return stats;
+}
+
 uint32_t VSockUser::hostCid() const {
-    if(m_sock && m_sock->isOpen())
+    if(m_mux || (m_sock && m_sock->isOpen()))
         return connectionData.host_cid;
     return SpecialCIDs::Any;
 }
 
 uint32_t VSockUser::vmCid() const {
-    if(m_sock && m_sock->isOpen())
+    if(m_mux || (m_sock && m_sock->isOpen()))
         return connectionData.vm_cid;
     return -1U;
 }
 
 uint32_t VSockUser::hostPort() const {
-    if(m_sock && m_sock->isOpen())
+    if(m_mux || (m_sock && m_sock->isOpen()))
         return connectionData.host_port;
     return SpecialCIDs::Any;
 }
 
 uint32_t VSockUser::vmPort() const {
-    if(m_sock && m_sock->isOpen())
+    if(m_mux || (m_sock && m_sock->isOpen()))
         return connectionData.vm_port;
     return -1U;
 }
\ No newline at end of file
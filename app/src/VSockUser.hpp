@@ -4,7 +4,11 @@
 #include <QtCore/QtCore>
 #include <QtCore/QSocketNotifier>
 
-class UnixSocket;
+#include "SocketBuffer.hpp"
+#include "UnixSocket.hpp"
+
+class ShmTransport;
+class VSockUserMux;
 class VSockUserServer;
 
 class VSockUser : public QIODevice {
@@ -20,11 +24,21 @@ public:
     VSockUser(QObject *parent = nullptr) : QIODevice(parent) { }
     ~VSockUser();
 
-    /* NOTE: this operation is blocking */
+    /*
+     * Connects the socket and sends the key, the reply is handled from the
+     * event loop: connected() or errorOccurred() follows. Returns false if
+     * the socket couldn't be connected at all. The reply is given msec,
+     * ETIMEDOUT after that.
+     */
     bool connectToServer(QString serverPath, 
         uint32_t host_cid, uint32_t host_port,
         uint32_t vm_cid, uint32_t vm_port,
-        int msec = 1000, bool* timeout = nullptr);
+        int msec = 1000);
+    /* Blocks in poll() until the reply is handled, the event loop doesn't run */
+    bool waitForConnected(int msecs = 1000);
+    bool isConnecting() const { return m_pendingSock != nullptr; }
+    /* Cancels a pending connect, nothing is emitted */
+    void abort();
     void close() override;
 
     qint64 bytesAvailable() const override;
@@ -33,10 +47,30 @@ public:
 
     bool waitForReadyRead(int msecs) override;
     bool waitForBytesWritten(int msecs) override;
+    /* Wakes up a blocking wait, can be called from any thread */
+    void interruptWait();
     
     qint64 readData(char *data, qint64 maxSize) override;
     qint64 writeData(const char *data, qint64 maxSize) override;
 
+    /*
+     * Same as in QIODevice, but forwarded to the socket, the ring or the
+     * stream's buffer, VSockUser doesn't buffer anything itself.
+     */
+    QByteArray readAll();
+    qint64 peek(char *data, qint64 maxSize);
+    QByteArray peek(qint64 maxSize);
+    /*
+     * The contiguous block at the front of what's received, consume it with
+     * skip() without copying. Valid until the next read or return to the
+     * event loop, empty when read() has to be used.
+     */
+    QByteArrayView nextDataBlock() const;
+
+    using QIODevice::write;
+    /* Queues the data on the underlying socket without copying it */
+    qint64 write(const QByteArray& data);
+
     /* Returns SpecialCIDs::Any on error */
     uint32_t hostCid() const;
     /* Returns SpecialCIDs::Any on error */
@@ -47,13 +81,32 @@ public:
     uint32_t vmPort() const;
 
     int error() const { return m_err; }
+
+    /*
+     * True when QEMU offered a shared memory transport and the data goes
+     * through its rings, the socket only carries the connection's state
+     */
+    bool isSharedMemory() const { return m_shm != nullptr; }
+    /* True when the connection is a stream of QEMU's multiplexed socket */
+    bool isMultiplexed() const { return m_mux != nullptr; }
+
+    /* The underlying socket's, kept after close() */
+    SocketStatistics statistics() const;
 signals:
     void connected();
 
     void disconnected(); 
     void errorOccurred(int error);
+protected:
+    qint64 skipData(qint64 maxSize) override;
 private:
     void setSock(UnixSocket* sock);
+    void setShm(ShmTransport* shm);
+    void setMux(VSockUserMux* mux, uint32_t stream);
+    void flushShm();
+    void handleConnectReply();
+    void handleConnectTimeout();
+    void failConnect(int err, const QString& errorString);
 private:
     struct __attribute__((packed)) VSockUserConnectionKey {
         uint64_t host_cid;
@@ -63,18 +116,34 @@ private:
     };
     enum ConnectionReply : uint8_t {
         Reject = 0,
-        Accept = 1
+        Accept = 1,
+        /* Accepted along with the shared memory transport sent with the key */
+        AcceptShm = 2,
+        /* Reply to VSockUserMux's hello, the socket carries frames from then on */
+        AcceptMux = 3
     };
 private:
     UnixSocket* m_sock = nullptr;
     VSockUserConnectionKey connectionData = { 0 };
+    /* Connected, with the key sent, until the reply comes */
+    UnixSocket* m_pendingSock = nullptr;
+    QTimer m_connectTimer;
 
     int m_err = 0;
+    SocketStatistics m_closedStatistics;
+
+    ShmTransport* m_shm = nullptr;
+    /* What didn't fit in the ring */
+    SocketWriteQueue m_shmWriteQueue;
+    /* Written to the ring, not yet announced with bytesWritten() */
+    qint64 m_shmWritten = 0;
+    SocketStatistics m_shmStatistics;
 
-    QByteArray m_writeBuffor;
-    QByteArray m_readBuffor;
+    QPointer<VSockUserMux> m_mux;
+    uint32_t m_muxStream = 0;
 
     friend class VSockUserServer;
+    friend class VSockUserMux;
 };
 
 #endif // VSOCKUSER_HPP
\ No newline at end of file
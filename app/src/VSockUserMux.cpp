@@ -0,0 +1,367 @@
+#include "VSockUserMux.hpp"
+
+#include <QtCore/QDebug>
+#include <QtCore/QDeadlineTimer>
+
+#include "VSockUser.hpp"
+#include "VSockUserServer.hpp"
+
+#include <cstring>
+#include <utility>
+
+#include <sys/uio.h>
+
+/* Read of a stream before it's credited, so that not every read() sends a frame */
+#define MUX_CREDIT_THRESHOLD (VSOCK_USER_MUX_WINDOW / 4)
+/* Queued segments gathered into a frame */
+#define MUX_FRAME_IOV_COUNT 16
+
+VSockUserMux::VSockUserMux(UnixSocket* sock, VSockUserServer* server)
+    : QObject(server), m_sock(sock), m_server(server)
+{
+    sock->setParent(this);
+    connect(m_sock, &UnixSocket::readyRead, this, &VSockUserMux::handleReadyRead);
+    connect(m_sock, &UnixSocket::disconnected, this, &VSockUserMux::handleClosed);
+    connect(m_sock, &UnixSocket::errorOccurred, this, [this]() {
+        qWarning() << "VSockUserMux:" << m_sock->errorString();
+        m_sock->close();
+    });
+
+    // Frames that came right behind the hello
+    if(m_sock->bytesAvailable() > 0)
+        QMetaObject::invokeMethod(this, &VSockUserMux::handleReadyRead, Qt::QueuedConnection);
+}
+
+VSockUserMux::~VSockUserMux() {
+    m_closed = true;
+    // Closing a user removes its stream
+    for(uint32_t id : m_streams.keys()) {
+        Stream* stream = m_streams.value(id);
+        if(stream && stream->user)
+            stream->user->close();
+    }
+    qDeleteAll(m_streams);
+}
+
+void VSockUserMux::handleReadyRead() {
+    QList<uint32_t> readable;
+
+    while(!m_closed) {
+        if(!m_haveHeader) {
+            if(m_sock->bytesAvailable() < (qint64)sizeof(Header))
+                break;
+            m_sock->read((char*)&m_header, sizeof(Header));
+            m_haveHeader = true;
+            if(m_header.len > VSOCK_USER_MUX_FRAME_SZ) {
+                qWarning() << "VSockUserMux: frame of" << m_header.len << "bytes, closing";
+                m_sock->close();
+                return;
+            }
+        }
+        if(m_sock->bytesAvailable() < m_header.len)
+            break;
+        m_haveHeader = false;
+
+        if(m_header.op == Data && m_streams.contains(m_header.stream) && !readable.contains(m_header.stream))
+            readable.append(m_header.stream);
+        bool valid = m_header.op == Data ? handleData(m_header) : handleFrame(m_header, m_sock->read(m_header.len));
+        if(!valid) {
+            qWarning() << "VSockUserMux: invalid frame" << m_header.op << "on stream" << m_header.stream << ", closing";
+            m_sock->close();
+            return;
+        }
+    }
+
+    // Once per batch, a user may close its stream from the slot
+    for(uint32_t id : readable) {
+        Stream* stream = m_streams.value(id);
+        if(stream && stream->user && !stream->readBuffer.isEmpty())
+            emit stream->user->readyRead();
+    }
+}
+
+bool VSockUserMux::handleFrame(const Header& header, const QByteArray& payload) {
+    Stream* stream = m_streams.value(header.stream);
+
+    switch(header.op) {
+    case Open:
+        handleOpen(header.stream, payload);
+        return true;
+    case Credit:
+        if(payload.size() != sizeof(uint32_t))
+            return false;
+        if(stream) {
+            memcpy(&stream->peerConsumed, payload.constData(), sizeof(uint32_t));
+            flush(header.stream, stream);
+        }
+        return true;
+    case Close:
+        if(stream) {
+            stream->peerClosed = true;
+            // Like a socket's disconnected(), after what's left to read
+            if(stream->user && !stream->readBuffer.isEmpty())
+                emit stream->user->readyRead();
+            if((stream = m_streams.value(header.stream)) && stream->user)
+                stream->user->close();
+            else
+                closeStream(header.stream);
+        }
+        return true;
+    default:
+        // Accept and Reject only go to QEMU, it opens the streams
+        return false;
+    }
+}
+
+bool VSockUserMux::handleData(const Header& header) {
+    Stream* stream = m_streams.value(header.stream);
+    // Closed by us while it was on its way
+    if(!stream) {
+        m_sock->skip(header.len);
+        return true;
+    }
+    // The peer only has as much credit
+    if(stream->readBuffer.size() + header.len > VSOCK_USER_MUX_WINDOW)
+        return false;
+
+    qint64 left = header.len;
+    while(left > 0) {
+        QByteArrayView block = m_sock->nextDataBlock();
+        if(block.isEmpty()) {
+            // Held in QIODevice's buffer
+            QByteArray rest = m_sock->read(left);
+            stream->readBuffer.append(rest.constData(), rest.size());
+            break;
+        }
+        qint64 size = qMin<qint64>(block.size(), left);
+        stream->readBuffer.append(block.data(), size);
+        m_sock->skip(size);
+        left -= size;
+    }
+    stream->statistics.bytesRead += header.len;
+    stream->statistics.peakReadBuffer = qMax<quint64>(stream->statistics.peakReadBuffer, stream->readBuffer.size());
+    return true;
+}
+
+void VSockUserMux::handleOpen(uint32_t id, const QByteArray& key) {
+    VSockUser::VSockUserConnectionKey connectionData;
+    if(key.size() != sizeof(connectionData) || m_streams.contains(id) || !m_server) {
+        sendFrame(id, Reject);
+        return;
+    }
+    memcpy(&connectionData, key.constData(), sizeof(connectionData));
+    if(!m_server->acceptsKey(connectionData)) {
+        sendFrame(id, Reject);
+        return;
+    }
+
+    VSockUser* user = new VSockUser(m_server);
+    user->connectionData = connectionData;
+    Stream* stream = new Stream;
+    stream->user = user;
+    m_streams.insert(id, stream);
+    user->setMux(this, id);
+
+    sendFrame(id, Accept);
+    m_server->addPendingConnection(user);
+}
+
+void VSockUserMux::handleClosed() {
+    if(m_closed)
+        return;
+    m_closed = true;
+
+    for(uint32_t id : m_streams.keys()) {
+        Stream* stream = m_streams.value(id);
+        if(!stream)
+            continue;
+        stream->peerClosed = true;
+        if(stream->user && !stream->readBuffer.isEmpty())
+            emit stream->user->readyRead();
+        if((stream = m_streams.value(id)) && stream->user)
+            stream->user->close();
+        else
+            closeStream(id);
+    }
+    deleteLater();
+}
+
+void VSockUserMux::sendFrame(uint32_t stream, Op op, const char* payload, qint64 len) {
+    Header header = { stream, op, (uint32_t)len };
+    QByteArray frame(sizeof(header) + len, Qt::Uninitialized);
+    memcpy(frame.data(), &header, sizeof(header));
+    if(len > 0)
+        memcpy(frame.data() + sizeof(header), payload, len);
+    m_sock->write(frame);
+}
+
+void VSockUserMux::flush(uint32_t id, Stream* stream) {
+    qint64 flushed = 0;
+    forever {
+        // A bogus credit from the peer only stops the stream
+        qint64 inFlight = (uint32_t)(stream->sent - stream->peerConsumed);
+        qint64 size = qMin<qint64>(VSOCK_USER_MUX_WINDOW - inFlight,
+            qMin<qint64>(stream->writeQueue.size(), VSOCK_USER_MUX_FRAME_SZ));
+        if(size <= 0)
+            break;
+
+        QByteArray frame(sizeof(Header) + size, Qt::Uninitialized);
+        struct iovec iov[MUX_FRAME_IOV_COUNT];
+        int count = stream->writeQueue.segments(iov, MUX_FRAME_IOV_COUNT);
+        qint64 copied = 0;
+        for(int i = 0; i < count && copied < size; i++) {
+            qint64 len = qMin<qint64>(iov[i].iov_len, size - copied);
+            memcpy(frame.data() + sizeof(Header) + copied, iov[i].iov_base, len);
+            copied += len;
+        }
+        Header header = { id, Data, (uint32_t)copied };
+        memcpy(frame.data(), &header, sizeof(header));
+        frame.truncate(sizeof(Header) + copied);
+
+        stream->writeQueue.free(copied);
+        stream->sent += copied;
+        flushed += copied;
+        m_sock->write(frame);
+    }
+
+    if(flushed > 0) {
+        stream->statistics.bytesWritten += flushed;
+        // Announced from the event loop like a socket's, once per batch
+        if(stream->written == 0)
+            QMetaObject::invokeMethod(this, [this, id]() { announceWritten(id); }, Qt::QueuedConnection);
+        stream->written += flushed;
+    }
+}
+
+void VSockUserMux::creditPeer(uint32_t id, Stream* stream, qint64 size) {
+    stream->consumed += size;
+    if((uint32_t)(stream->consumed - stream->consumedCredited) < MUX_CREDIT_THRESHOLD)
+        return;
+    stream->consumedCredited = stream->consumed;
+    sendFrame(id, Credit, (const char*)&stream->consumed, sizeof(stream->consumed));
+}
+
+void VSockUserMux::announceWritten(uint32_t id) {
+    Stream* stream = m_streams.value(id);
+    if(stream && stream->user && stream->written > 0)
+        emit stream->user->bytesWritten(std::exchange(stream->written, 0));
+}
+
+qint64 VSockUserMux::bytesAvailable(uint32_t id) const {
+    Stream* stream = m_streams.value(id);
+    return stream ? stream->readBuffer.size() : 0;
+}
+
+qint64 VSockUserMux::bytesToWrite(uint32_t id) const {
+    Stream* stream = m_streams.value(id);
+    return stream ? stream->writeQueue.size() : 0;
+}
+
+qint64 VSockUserMux::indexOf(uint32_t id, char c) const {
+    Stream* stream = m_streams.value(id);
+    return stream ? stream->readBuffer.indexOf(c) : -1;
+}
+
+qint64 VSockUserMux::read(uint32_t id, char* data, qint64 maxSize) {
+    Stream* stream = m_streams.value(id);
+    if(!stream)
+        return -1;
+    qint64 rc = stream->readBuffer.read(data, maxSize);
+    creditPeer(id, stream, rc);
+    return rc;
+}
+
+QByteArray VSockUserMux::readAll(uint32_t id) {
+    Stream* stream = m_streams.value(id);
+    if(!stream)
+        return QByteArray();
+    QByteArray data = stream->readBuffer.readAll();
+    creditPeer(id, stream, data.size());
+    return data;
+}
+
+qint64 VSockUserMux::peek(uint32_t id, char* data, qint64 maxSize) const {
+    Stream* stream = m_streams.value(id);
+    return stream ? stream->readBuffer.peek(data, maxSize) : -1;
+}
+
+QByteArray VSockUserMux::peek(uint32_t id, qint64 maxSize) const {
+    Stream* stream = m_streams.value(id);
+    return stream ? stream->readBuffer.peek(maxSize) : QByteArray();
+}
+
+QByteArrayView VSockUserMux::nextDataBlock(uint32_t id) const {
+    Stream* stream = m_streams.value(id);
+    if(!stream)
+        return QByteArrayView();
+    return QByteArrayView(stream->readBuffer.readPointer(), stream->readBuffer.nextDataBlockSize());
+}
+
+qint64 VSockUserMux::skip(uint32_t id, qint64 maxSize) {
+    Stream* stream = m_streams.value(id);
+    if(!stream)
+        return -1;
+    qint64 rc = stream->readBuffer.skip(maxSize);
+    creditPeer(id, stream, rc);
+    return rc;
+}
+
+qint64 VSockUserMux::write(uint32_t id, const char* data, qint64 size) {
+    Stream* stream = m_streams.value(id);
+    if(!stream || m_closed)
+        return -1;
+    stream->writeQueue.append(data, size);
+    stream->statistics.peakWriteQueue = qMax<quint64>(stream->statistics.peakWriteQueue, stream->writeQueue.size());
+    flush(id, stream);
+    return size;
+}
+
+bool VSockUserMux::waitForReadyRead(uint32_t id, int msecs) {
+    QDeadlineTimer deadline(msecs);
+    Stream* stream = m_streams.value(id);
+    if(!stream)
+        return false;
+
+    // The frames go to every stream, wait until some are for this one
+    quint64 received = stream->statistics.bytesRead;
+    while((stream = m_streams.value(id)) && stream->statistics.bytesRead == received) {
+        if(m_closed || !m_sock->waitForReadyRead(deadline.remainingTime()))
+            return false;
+    }
+    return stream != nullptr;
+}
+
+bool VSockUserMux::waitForBytesWritten(uint32_t id, int msecs) {
+    QDeadlineTimer deadline(msecs);
+    Stream* stream;
+    // Waits for QEMU's credit first
+    while((stream = m_streams.value(id)) && !stream->writeQueue.isEmpty()) {
+        if(m_closed || !m_sock->waitForReadyRead(deadline.remainingTime()))
+            return false;
+    }
+    if(!stream)
+        return false;
+    if(m_sock->bytesToWrite() > 0 && !m_sock->waitForBytesWritten(deadline.remainingTime()))
+        return false;
+    announceWritten(id);
+    return true;
+}
+
+SocketStatistics VSockUserMux::statistics(uint32_t id) const {
+    Stream* stream = m_streams.value(id);
+    if(!stream)
+        return SocketStatistics();
+    SocketStatistics stats = stream->statistics;
+    stats.queuedBytes = stream->writeQueue.size();
+    return stats;
+}
+
+void VSockUserMux::closeStream(uint32_t id) {
+    Stream* stream = m_streams.take(id);
+    if(!stream)
+        return;
+    // What's still queued is dropped, like a closed socket's
+    if(!stream->peerClosed && !m_closed)
+        sendFrame(id, Close);
+    delete stream;
+}
@@ -0,0 +1,118 @@
+#ifndef VSOCKUSERMUX_HPP
+#define VSOCKUSERMUX_HPP
+
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QPointer>
+
+#include "SocketBuffer.hpp"
+#include "UnixSocket.hpp"
+
+class VSockUser;
+class VSockUserServer;
+
+/* host_cid of the key that opens a multiplexed connection instead of a stream, "VSUSRMUX" */
+#define VSOCK_USER_MUX_HELLO_CID 0x58554d5253555356ULL
+#define VSOCK_USER_MUX_VERSION 1
+/* Bytes a side may send on a stream before the other one credits them */
+#define VSOCK_USER_MUX_WINDOW (256 * 1024)
+/* Largest payload of a frame */
+#define VSOCK_USER_MUX_FRAME_SZ (64 * 1024)
+
+/*
+ * Every guest initiated stream of a VM over one socket. QEMU sends a key
+ * with VSOCK_USER_MUX_HELLO_CID once, and after the AcceptMux reply both
+ * sides exchange frames: a VSockUserMuxHeader and len bytes of payload.
+ * QEMU opens streams with the connection key as the payload, the host
+ * replies Accept or Reject. Each side credits what it has consumed of a
+ * stream, so a stream that isn't read can't stall the others.
+ *
+ * The framing is shared with qemu/virtio-vsock.h.
+ */
+class VSockUserMux : public QObject
+{
+    Q_OBJECT
+public:
+    enum Op : uint32_t {
+        Open = 0,
+        Accept,
+        Reject,
+        Data,
+        /* The payload is the sender's free-running count of bytes consumed */
+        Credit,
+        Close
+    };
+
+    struct __attribute__((packed)) Header {
+        uint32_t stream;
+        uint32_t op;
+        uint32_t len;
+    };
+
+    /* Takes over the socket the hello came on, streams are accepted by server */
+    VSockUserMux(UnixSocket* sock, VSockUserServer* server);
+    /* Closes the streams that are left */
+    ~VSockUserMux();
+
+    int streamCount() const { return m_streams.size(); }
+    /* The shared socket's, framing included */
+    SocketStatistics statistics() const { return m_sock->statistics(); }
+private:
+    struct Stream {
+        QPointer<VSockUser> user;
+        SocketBuffer readBuffer;
+        SocketWriteQueue writeQueue;
+        /* Free-running, as in virtio-vsock */
+        uint32_t sent = 0;
+        uint32_t peerConsumed = 0;
+        uint32_t consumed = 0;
+        uint32_t consumedCredited = 0;
+        /* Sent, not yet announced with bytesWritten() */
+        qint64 written = 0;
+        bool peerClosed = false;
+        SocketStatistics statistics;
+    };
+
+    void handleReadyRead();
+    bool handleFrame(const Header& header, const QByteArray& payload);
+    /* Moves a Data frame's payload from the socket's buffer to the stream's */
+    bool handleData(const Header& header);
+    void handleOpen(uint32_t id, const QByteArray& key);
+    void handleClosed();
+
+    void sendFrame(uint32_t stream, Op op, const char* payload = nullptr, qint64 len = 0);
+    void flush(uint32_t id, Stream* stream);
+    /* After size bytes of the stream were read */
+    void creditPeer(uint32_t id, Stream* stream, qint64 size);
+    void announceWritten(uint32_t id);
+
+    /* Used by VSockUser for its stream */
+    qint64 bytesAvailable(uint32_t id) const;
+    qint64 bytesToWrite(uint32_t id) const;
+    qint64 indexOf(uint32_t id, char c) const;
+    qint64 read(uint32_t id, char* data, qint64 maxSize);
+    QByteArray readAll(uint32_t id);
+    qint64 peek(uint32_t id, char* data, qint64 maxSize) const;
+    QByteArray peek(uint32_t id, qint64 maxSize) const;
+    QByteArrayView nextDataBlock(uint32_t id) const;
+    qint64 skip(uint32_t id, qint64 maxSize);
+    qint64 write(uint32_t id, const char* data, qint64 size);
+    bool waitForReadyRead(uint32_t id, int msecs);
+    bool waitForBytesWritten(uint32_t id, int msecs);
+    void interruptWait() { m_sock->interruptWait(); }
+    SocketStatistics statistics(uint32_t id) const;
+    void closeStream(uint32_t id);
+private:
+    UnixSocket* m_sock;
+    QPointer<VSockUserServer> m_server;
+    QHash<uint32_t, Stream*> m_streams;
+    bool m_closed = false;
+
+    /* Of the frame whose payload hasn't fully arrived yet */
+    Header m_header;
+    bool m_haveHeader = false;
+
+    friend class VSockUser;
+};
+
+#endif // VSOCKUSERMUX_HPP
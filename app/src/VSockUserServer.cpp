@@ -1,26 +1,39 @@
 #include "VSockUserServer.hpp"
 
+#include "ShmTransport.hpp"
 #include "UnixSocketServer.hpp"
 #include "UnixSocket.hpp"
 #include "VSockUser.hpp"
+#include "VSockUserMux.hpp"
+
+#include <unistd.h>
+
+/* How long a rejected client gets to take the reply, it's a single byte */
+#define REJECT_TIMEOUT_MSEC 1000
 
 bool VSockUserServer::listen(const QString &path, uint32_t cid, uint32_t port) {
+    // The previous server, e.g. after a listening error
+    close();
     m_cid = cid;
     m_port = port;
 
     m_server = new UnixSocketServer(this);
     if(!m_server->listen(path)) {
+        m_errStr = m_server->errorString();
+        m_err = m_server->error();
         close();
         return false;
     }
     setProperty("_unixSocketServer", QVariant::fromValue<UnixSocketServer*>(m_server));
 
     connect(m_server, &UnixSocketServer::errorOccurred, this, [this]() {
+        // close() lets go of the server
+        m_errStr = m_server->errorString();
+        m_err = m_server->error();
         if(!m_server->isListening()) {
             close();
         }
-        m_errStr = m_server->errorString();
-        emit errorOccurred(m_err = m_server->error());
+        emit errorOccurred(m_err);
     });
     connect(m_server, &UnixSocketServer::newConnection, this, [this]() {
         UnixSocket* sock = m_server->nextPendingConnection();
@@ -33,25 +46,59 @@ bool VSockUserServer::listen(const QString &path, uint32_t cid, uint32_t port) {
             if(sock->bytesAvailable() < connectionDataSize) {
                 return;
             }
-            VSockUser* vsock = new VSockUser(this);
-            sock->readData((char*)&vsock->connectionData, connectionDataSize);
-            vsock->open(QIODevice::ReadWrite);
+            VSockUser::VSockUserConnectionKey key;
+            sock->readData((char*)&key, connectionDataSize);
+
+            // A shared memory transport comes as descriptors sent with the key
+            int fds[SHM_TRANSPORT_FD_COUNT];
+            int fdCount = 0;
+            while(sock->hasPendingFds()) {
+                int fd = sock->receiveFd();
+                if(fdCount < SHM_TRANSPORT_FD_COUNT)
+                    fds[fdCount++] = fd;
+                else
+                    ::close(fd);
+            }
             
             VSockUser::ConnectionReply reply;
-            if(!(m_cid == SpecialCIDs::Any || m_cid == vsock->connectionData.host_cid) || m_port != vsock->connectionData.host_port) {
+            // QEMU's multiplexed connection, the streams come as frames on it
+            if(key.host_cid == VSOCK_USER_MUX_HELLO_CID && key.host_port == VSOCK_USER_MUX_VERSION) {
+                for(int i = 0; i < fdCount; i++)
+                    ::close(fds[i]);
+                reply = VSockUser::ConnectionReply::AcceptMux;
+                sock->writeData((const char*)&reply, sizeof(reply));
+                disconnect(sock, nullptr, this, nullptr);
+                new VSockUserMux(sock, this);
+                return;
+            }
+            if(!acceptsKey(key)) {
+                for(int i = 0; i < fdCount; i++)
+                    ::close(fds[i]);
                 reply = VSockUser::ConnectionReply::Reject;
                 sock->writeData((const char*)&reply, sizeof(reply));
-                sock->waitForBytesWritten(-1);
-                vsock->deleteLater();
+                sock->waitForBytesWritten(REJECT_TIMEOUT_MSEC);
                 sock->deleteLater();
                 return;
             }
-            reply = VSockUser::ConnectionReply::Accept;
+            VSockUser* vsock = new VSockUser(this);
+            vsock->connectionData = key;
+            vsock->open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+
+            ShmTransport* shm = nullptr;
+            if(m_sharedMemory && fdCount == SHM_TRANSPORT_FD_COUNT) {
+                shm = ShmTransport::attach(ShmTransport::Acceptor, fds);
+            }
+            else {
+                for(int i = 0; i < fdCount; i++)
+                    ::close(fds[i]);
+            }
+            reply = shm ? VSockUser::ConnectionReply::AcceptShm : VSockUser::ConnectionReply::Accept;
             sock->writeData((const char*)&reply, sizeof(reply));
             vsock->setSock(sock);
-            m_pendingConnection.enqueue(vsock);
+            if(shm)
+                vsock->setShm(shm);
             disconnect(sock, nullptr, this, nullptr);
-            emit newConnection();
+            addPendingConnection(vsock);
         });
     });
 
@@ -62,6 +109,8 @@ bool VSockUserServer::listen(const QString &path, uint32_t cid, uint32_t port) {
 void VSockUserServer::close() {
     // unix server will close any remaining connections
     m_pendingConnection.clear();
+    // The multiplexed ones aren't its anymore
+    qDeleteAll(findChildren<VSockUserMux*>(Qt::FindDirectChildrenOnly));
 
     if(m_server) {
         m_server->close();
@@ -69,10 +118,22 @@ void VSockUserServer::close() {
         m_server = nullptr;
         setProperty("_unixSocketServer", QVariant::fromValue<UnixSocketServer*>(nullptr));
     }
+    m_listening = false;
     m_cid = 0;
     m_port = 0;
 }
 
+bool VSockUserServer::acceptsKey(const VSockUser::VSockUserConnectionKey& key) const {
+    if(!(m_cid == SpecialCIDs::Any || m_cid == key.host_cid) || !(m_port == SpecialCIDs::Any || m_port == key.host_port))
+        return false;
+    return !m_filter || m_filter(key.host_cid, key.host_port, key.vm_cid, key.vm_port);
+}
+
+void VSockUserServer::addPendingConnection(VSockUser* vsock) {
+    m_pendingConnection.enqueue(vsock);
+    emit newConnection();
+}
+
 QString VSockUserServer::serverName() const {
     if(m_server)
         return m_server->serverName();
@@ -86,5 +147,5 @@ QString VSockUserServer::fullServerName() const {
 }
 
 bool VSockUserServer::isListening() const {
-    return m_listening && m_server->isListening();
+    return m_listening && m_server && m_server->isListening();
 }
@@ -4,7 +4,10 @@
 #include <QtCore/QObject>
 #include <QtCore/QQueue>
 
-class VSockUser;
+#include <functional>
+
+#include "VSockUser.hpp"
+
 class UnixSocketServer;
 
 class VSockUserServer : public QObject {
@@ -20,6 +23,7 @@ public:
     VSockUserServer(QObject *parent = nullptr) : QObject(parent) { }
     ~VSockUserServer() { close(); }
 
+    /* cid and port can be Any */
     bool listen(const QString &path, uint32_t cid, uint32_t port);
     void close();
     
@@ -32,15 +36,34 @@ public:
     QString serverName() const;
     QString fullServerName() const;
 
+    /*
+     * Whether shared memory transports offered by connecting clients are
+     * taken, on by default. Refused ones fall back to the socket.
+     */
+    void setSharedMemoryEnabled(bool enabled) { m_sharedMemory = enabled; }
+    bool isSharedMemoryEnabled() const { return m_sharedMemory; }
+
+    /*
+     * Decides on the keys that match cid and port, the connections it
+     * returns false for are rejected before they are accepted
+     */
+    using ConnectionFilter = std::function<bool(uint32_t hostCid, uint32_t hostPort, uint32_t vmCid, uint32_t vmPort)>;
+    void setConnectionFilter(ConnectionFilter filter) { m_filter = filter; }
+
     QString errorString() const { return m_errStr; }
     int error() const { return m_err; }
 signals:
     void errorOccurred(int error);
     void newConnection();
+private:
+    bool acceptsKey(const VSockUser::VSockUserConnectionKey& key) const;
+    void addPendingConnection(VSockUser* vsock);
 private:
     UnixSocketServer* m_server = nullptr;
 
     bool m_listening = false;
+    bool m_sharedMemory = true;
+    ConnectionFilter m_filter;
 
     int m_err = 0;
     QString m_errStr = nullptr;
@@ -49,6 +72,8 @@ private:
     uint32_t m_port = 0;
     
     QQueue<VSockUser*> m_pendingConnection = QQueue<VSockUser*>();
+
+    friend class VSockUserMux;
 };
 
 #endif // VSOCKUSERSERVER_HPP
\ No newline at end of file
@@ -1,43 +1,106 @@
 #include "VirtualMachine.hpp"
 
 #include <QtCore/QDebug>
+#include <QtCore/QLocale>
 #include <QtCore/QRegularExpression>
-#include <QtCore/QTemporaryFile>
+#include <QtCore/QDir>
 #include <QtCore/QUuid>
 #include <QtCore/QThread>
 #include <QtWidgets/QMessageBox>
 #include <QtCore/qprocessordetection.h>
 
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "Application.hpp"
 #include "Network.hpp"
 #include "GuestBridge.hpp"
+#include "GuestBridgeServer.hpp"
 #include "VSockUserServer.hpp"
 #include "VSockUser.hpp"
+#include "SpliceRelay.hpp"
 
 using namespace nlohmann;
 
 static uint32_t cidCounter = 1e6;
 
+/* A relay's source is the console or a terminal, its sinks are the other side */
+static void addRelayStatistics(VirtualMachine::IoStatistics& stats, const SpliceRelay* relay, bool fromConsole) {
+    (fromConsole ? stats.console : stats.terminals) += relay->sourceStatistics();
+    (fromConsole ? stats.terminals : stats.console) += relay->sinkStatistics();
+}
+
 #define KERNEL_MICROVM_OPTIONS "acpi=off reboot=t panic=-1 "
 #define KERNEL_AUX_OPTIONS "console=ttyS0 TERM=xterm-256color selinux=0 "
 #define KERNEL_DEFAULT_CMD KERNEL_MICROVM_OPTIONS KERNEL_AUX_OPTIONS "root=/dev/vda rw init=/sbin/vs_init "
 #define KERNEL_QUIET_CMD "quiet " KERNEL_DEFAULT_CMD 
 #define KERNEL_EARLYPRINTK_CMD "earlyprintk=ttyS0 " KERNEL_DEFAULT_CMD
 
+#define PAYLOAD_CHUNK_SZ (64 * 1024) // Payload file read size
+#define IMAGE_COPY_CHUNK_SZ (1024 * 1024) // Disk image copy size
+
+Payload Payload::fromData(const std::string& data) {
+    Payload payload;
+    payload.m_data = QByteArray::fromStdString(data);
+    return payload;
+}
+
+Payload Payload::fromFile(const QString& path) {
+    Payload payload;
+    payload.m_path = path;
+    return payload;
+}
+
+bool PayloadReader::next(QByteArrayView* chunk, QString* error) {
+    *chunk = QByteArrayView();
+    if(m_done)
+        return true;
+
+    if(!m_payload.isFile()) {
+        m_done = true;
+        *chunk = m_payload.m_data;
+        return true;
+    }
+
+    if(!m_file.isOpen()) {
+        m_file.setFileName(m_payload.m_path);
+        if(!m_file.open(QIODevice::ReadOnly)) {
+            if(error)
+                *error = m_file.errorString();
+            return false;
+        }
+        m_buffer.resize(PAYLOAD_CHUNK_SZ);
+    }
+
+    qint64 length = m_file.read(m_buffer.data(), m_buffer.size());
+    if(length < 0) {
+        if(error)
+            *error = m_file.errorString();
+        return false;
+    }
+    if(length == 0) {
+        m_done = true;
+        m_file.close();
+        return true;
+    }
+    *chunk = QByteArrayView(m_buffer.constData(), length);
+    return true;
+}
+
 InstallFile::InstallFile(nlohmann::json installFileObject, Presentation* pres){
     if(installFileObject.contains("content")) {
         std::string content = installFileObject["content"];
-        this->content = std::vector<uint8_t>(content.begin(), content.end());
+        this->content = Payload::fromData(content);
     }
     else if(installFileObject.contains("contentPath")) {
         QString contentPath = QString::fromStdString(installFileObject["contentPath"]); 
-        QFile file = QFile(pres->getFilePath(contentPath));
-        if(file.open(QIODevice::ReadOnly)) {
-            QByteArray ba = file.readAll();
-            content = std::vector<uint8_t>(ba.begin(), ba.end());
-        }
-        else
+        if(!pres->isFileValid(contentPath))
             throw VirtualMachineException("Failed to open installFile " + contentPath.toStdString());
+        content = Payload::fromFile(pres->getFilePath(contentPath));
     }
     else
         throw VirtualMachineException("installFile object is defined, but neither contentPath nor content strings exist");
@@ -64,17 +127,13 @@ InstallFile::InstallFile(nlohmann::json installFileObject, Presentation* pres){
 InitScript::InitScript(json initScriptObject, Presentation* pres){
     if(initScriptObject.contains("script")){
         std::string script = initScriptObject["script"];
-        this->content = std::vector<uint8_t>(script.begin(), script.end());
+        this->content = Payload::fromData(script);
     }
     else if(initScriptObject.contains("scriptPath")) {
         QString scriptPath = QString::fromStdString(initScriptObject["scriptPath"]); 
-        QFile file = QFile(pres->getFilePath(scriptPath));
-        if(file.open(QIODevice::ReadOnly)){
-            QByteArray ba = file.readAll();
-            content = std::vector<uint8_t>(ba.begin(), ba.end());
-        }
-        else
+        if(!pres->isFileValid(scriptPath))
             throw VirtualMachineException("Failed to open script " + scriptPath.toStdString());
+        content = Payload::fromFile(pres->getFilePath(scriptPath));
     }
     else
         throw VirtualMachineException("initScript object is defined, but neither scriptPath nor script strings exist");
@@ -223,7 +282,9 @@ Task::~Task() {
     taskPaths.clear();
 }
 
-VirtualMachine::VirtualMachine(json &vmObject, Presentation* pres) : m_presentation(pres), m_cid(cidCounter++) {
+VirtualMachine::VirtualMachine(json &vmObject, Presentation* pres)
+    : m_definition(vmObject), m_presentation(pres), m_cid(cidCounter++)
+{
     m_id = QString::fromStdString(vmObject["id"]);
     m_image = QString::fromStdString(vmObject["image"]);
     
@@ -248,13 +309,12 @@ VirtualMachine::VirtualMachine(json &vmObject, Presentation* pres) : m_presentat
         m_tasks[task->id] = task;
     }
     
-    m_vsockUserHostServerPath = QFileInfo(QDir::tempPath() + "/" + QUuid::createUuid().toString(QUuid::WithoutBraces)).absoluteFilePath();
     m_vsockUserVmServerPath = QFileInfo(QDir::tempPath() + "/" + QUuid::createUuid().toString(QUuid::WithoutBraces)).absoluteFilePath();
     
     m_guestBridge = new GuestBridge(this);
     m_guestBridge->start();
     
-    createImageFile();
+    findDiskImage();
 }
 
 VirtualMachine::VirtualMachine(QString id, Network* net, bool hasWan, QString image, Presentation* pres)
@@ -262,40 +322,146 @@ VirtualMachine::VirtualMachine(QString id, Network* net, bool hasWan, QString im
     m_netId(net->id()), m_wan(hasWan), m_image(image),
     m_macAddress(m_net->generateNewMacAddress()), m_hostname(m_id)
 {
-    m_guestBridge->start();
-
-    m_vsockUserHostServerPath = QFileInfo(QDir::tempPath() + "/" + QUuid::createUuid().toString(QUuid::WithoutBraces)).absoluteFilePath();
     m_vsockUserVmServerPath = QFileInfo(QDir::tempPath() + "/" + QUuid::createUuid().toString(QUuid::WithoutBraces)).absoluteFilePath();
     m_guestBridge = new GuestBridge(this);
+    m_guestBridge->start();
 
-    createImageFile();
+    findDiskImage();
 }
 
-void VirtualMachine::createImageFile(){
+void VirtualMachine::findDiskImage(){
     m_diskImage = Config::getDiskImage(m_image);
     if(m_diskImage == nullptr){
         QString exceptionStr = "Could not create vm \"" + m_id + "\": image \"" + m_image + "\" does not exist";
         throw VirtualMachineException(exceptionStr.toStdString());
     }
+}
 
-    if(m_imageFile.open() == false){
-        QString exceptionStr = "Could not create temporary file: " + m_imageFile.errorString();
+void VirtualMachine::prepareImage(){
+    // Plain fds only, this runs in the loader's worker thread
+    int srcFd = ::open(QFile::encodeName(m_diskImage->path).constData(), O_RDONLY | O_CLOEXEC);
+    if(srcFd < 0){
+        QString exceptionStr = "Could not open disk image \"" + m_diskImage->path + "\": ";
+        exceptionStr += strerror(errno);
         throw VirtualMachineException(exceptionStr.toStdString());
     }
 
-    QFile orginalDiskFile(m_diskImage->path);
-    if(orginalDiskFile.open(QIODevice::ReadOnly) == false){
-        QString exceptionStr = "Could not open disk image \"" + m_diskImage->path + "\": ";
-        exceptionStr += orginalDiskFile.errorString();
+    int dstFd;
+    if(m_imagePath.isEmpty()){
+        QByteArray pathTemplate = QFile::encodeName(QDir::tempPath() + "/vs-image-XXXXXX");
+        dstFd = mkostemp(pathTemplate.data(), O_CLOEXEC);
+        if(dstFd >= 0)
+            m_imagePath = QFile::decodeName(pathTemplate);
+    }
+    else {
+        // A stale copy is overwritten in place, QEMU isn't running at this point
+        dstFd = ::open(QFile::encodeName(m_imagePath).constData(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+    }
+    if(dstFd < 0){
+        int err = errno;
+        ::close(srcFd);
+        QString exceptionStr = "Could not create temporary file: ";
+        exceptionStr += strerror(err);
         throw VirtualMachineException(exceptionStr.toStdString());
     }
-    
-    m_imageFile.write(orginalDiskFile.readAll());
-    orginalDiskFile.close();
-    m_imageFile.close();
+
+    QByteArray buffer(IMAGE_COPY_CHUNK_SZ, Qt::Uninitialized);
+    int err = 0;
+    while(err == 0){
+        ssize_t n = ::read(srcFd, buffer.data(), buffer.size());
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0){
+            err = n < 0 ? errno : 0;
+            break;
+        }
+
+        for(ssize_t written = 0; written < n;){
+            ssize_t w = ::write(dstFd, buffer.constData() + written, n - written);
+            if(w < 0 && errno == EINTR)
+                continue;
+            if(w < 0){
+                err = errno;
+                break;
+            }
+            written += w;
+        }
+    }
+    ::close(srcFd);
+    if(::close(dstFd) < 0 && err == 0)
+        err = errno;
+
+    if(err != 0){
+        QString exceptionStr = "Could not copy disk image \"" + m_diskImage->path + "\": ";
+        exceptionStr += strerror(err);
+        throw VirtualMachineException(exceptionStr.toStdString());
+    }
+}
+
+bool VirtualMachine::updateDefinition(json &vmObject, bool payloadsChanged){
+    if(m_definition.is_null())
+        return false;
+
+    QString image = QString::fromStdString(vmObject["image"]);
+    QString netId = vmObject.contains("netId") ? QString::fromStdString(vmObject["netId"]) : nullptr;
+    if(image != m_image || netId != m_netId)
+        return false;
+
+    QString hostname = vmObject.contains("hostname") ? QString::fromStdString(vmObject["hostname"]) : m_id;
+
+    QList<InstallFile> installFiles;
+    for(auto installFileObj : vmObject["installFiles"])
+        installFiles += InstallFile(installFileObj, m_presentation);
+
+    QList<InitScript> initScripts;
+    for(auto initScriptObj : vmObject["initScripts"])
+        initScripts += InitScript(initScriptObj, m_presentation);
+
+    QMap<std::string, Task*> tasks;
+    for(auto taskObj : vmObject["tasks"]){
+        Task* task = new Task(taskObj);
+        tasks[task->id] = task;
+    }
+
+    // Tasks are requested by the guest whenever they're needed
+    for(auto task : m_tasks)
+        delete task;
+    m_tasks = tasks;
+
+    // The rest is applied by the guest on its first boot only
+    bool firstBootChanged = payloadsChanged || hostname != m_hostname
+        || vmObject["installFiles"] != m_definition["installFiles"]
+        || vmObject["initScripts"] != m_definition["initScripts"];
+
+    m_hostname = hostname;
+    m_installFiles = installFiles;
+    m_initScripts = initScripts;
+    m_definition = vmObject;
+
+    if(firstBootChanged) {
+        if(m_isRunning)
+            m_imageStale = true;
+        else if(m_imageReady)
+            prepareImage();
+    }
+
+    return true;
+}
+
+void VirtualMachine::setImageReady(){
+    m_imageReady = true;
+
+    if(m_startPending) {
+        m_startPending = false;
+        start();
+    }
 }
 
 QStringList VirtualMachine::getArgs(){
+    // Checked by start()
+    GuestBridgeServer* bridgeServer = GuestBridgeServer::instance();
+    QString hostUdsPath = bridgeServer ? bridgeServer->fullServerName() : QString();
+
     QStringList ret;
     ret << "-machine" << "microvm,acpi=off";
     if(Config::getKvmEnabled())
@@ -310,9 +476,11 @@ QStringList VirtualMachine::getArgs(){
         << "-device" << "virtio-serial-device"
         << "-chardev" << "socket,id=char0,path=" + m_consoleServer->fullServerName()
         << "-serial" << "chardev:char0"
-        << "-drive" << "id=root,file=" + m_imageFile.fileName() + ",format=qcow2,if=none"
+        << "-drive" << "id=root,file=" + m_imagePath + ",format=qcow2,if=none"
         << "-device" << "virtio-blk-device,drive=root"
-        << "-device" << "virtio-vsock-device,guest-uds-path=" + m_vsockUserVmServerPath +",host-uds-path=" + m_vsockUserHostServerPath + ",cid=" + QString::number(m_cid);
+        << "-device" << "virtio-vsock-device,guest-uds-path=" + m_vsockUserVmServerPath +",host-uds-path=" + hostUdsPath + ",cid=" + QString::number(m_cid)
+            + ",shm=" + (Config::getVsockSharedMemory() ? "on" : "off")
+            + ",mux=" + (Config::getVsockMultiplex() ? "on" : "off");
     if(m_net && !m_macAddress.isEmpty())
         ret << "-netdev" << "socket,id=eth0,localaddr=127.0.0.1,mcast=" VNET_MCAST_ADDR ":" + QString::number(m_net->mcastPort())
             << "-device" << "virtio-net-device,netdev=eth0,mac=" + m_macAddress;
@@ -336,24 +504,73 @@ void VirtualMachine::setNet(Network* net){
 
 void VirtualMachine::handleNewConsoleSocketConnection() {
     UnixSocket* conn = m_consoleServer->nextPendingConnection();
+    // A stalled reader on either side can't make the other one queue without a limit
+    conn->setWriteBufferLimits(Config::getConsoleBufferSize());
+    connect(conn, &UnixSocket::highWaterMarkReached, this, &VirtualMachine::updateConsoleFlow);
+    connect(conn, &UnixSocket::lowWaterMarkReached, this, &VirtualMachine::updateConsoleFlow);
+
     if(m_consoleSocket){
+        conn->setOverflowPolicy(Config::getTerminalOverflowPolicy());
         m_terminalSockets.append(conn);
-        connect(conn, &UnixSocket::readyRead, this, [this, conn]{ handleClientConsoleSockReadReady(conn); });
-        connect(conn, &UnixSocket::errorOccurred, this, [this, conn] {
+        connect(conn, &UnixSocket::errorOccurred, this, [conn] {
             qDebug() << conn->errorString();
             conn->close();
-            conn->deleteLater();
-            m_terminalSockets.removeAll(conn);
         });
+        connect(conn, &UnixSocket::disconnected, this, [this, conn] {
+            if(m_terminalSockets.removeAll(conn)) {
+                m_closedIoStatistics.terminals += conn->statistics();
+                if(SpliceRelay* input = m_terminalRelays.take(conn)) {
+                    addRelayStatistics(m_closedIoStatistics, input, false);
+                    input->deleteLater();
+                }
+                conn->deleteLater();
+                updateConsoleFlow();
+            }
+        });
+
+        if(m_consoleRelay) {
+            // Sockets of one server share the backend, only running out of fds fails here
+            SpliceRelay* input = new SpliceRelay(conn, this);
+            if(!input->isValid() || !input->addSink(m_consoleSocket) || !m_consoleRelay->addSink(conn)) {
+                qDebug() << "Failed to relay a terminal:" << strerror(errno);
+                delete input;
+                conn->close();
+                return;
+            }
+            m_terminalRelays.insert(conn, input);
+            // Typed before the relay took over, the relay waits for it to be sent
+            m_consoleSocket->write(conn->readAll());
+        }
+        else {
+            conn->setReadEnabled(!m_consoleSocket->isWriteBufferFull());
+            connect(conn, &UnixSocket::readyRead, this, [this, conn]{ handleClientConsoleSockReadReady(conn); });
+        }
     }
     else {
+        // QEMU is never dropped, the terminals wait for it instead
         m_consoleSocket = conn;
-        connect(m_consoleSocket, SIGNAL(readyRead()), this, SLOT(handleConsoleSockReadReady()));
+        if(Config::getConsoleSplice() && SpliceRelay::canRelay(conn)) {
+            m_consoleRelay = new SpliceRelay(conn, this);
+            if(m_consoleRelay->isValid()) {
+                // Nobody to show it to yet
+                conn->readAll();
+            }
+            else {
+                delete m_consoleRelay;
+                m_consoleRelay = nullptr;
+            }
+        }
+        if(!m_consoleRelay)
+            connect(m_consoleSocket, SIGNAL(readyRead()), this, SLOT(handleConsoleSockReadReady()));
         connect(conn, &UnixSocket::errorOccurred, this, [this, conn] {
             qDebug() << conn->errorString();
+            if(m_consoleSocket == conn) {
+                closeConsoleRelays();
+                m_closedIoStatistics.console += conn->statistics();
+                m_consoleSocket = nullptr;
+            }
             conn->close();
             conn->deleteLater();
-            m_consoleSocket = nullptr;
         });
         emit vmStarted();
     }
@@ -363,8 +580,40 @@ void VirtualMachine::start() {
     if(m_isRunning)
         return;
 
+    // The disk image is still being copied, start as soon as it's ready
+    if(!m_imageReady) {
+        m_startPending = true;
+        return;
+    }
+
+    // The definition changed while running, the guest has to boot from a fresh image
+    if(m_imageStale) {
+        try {
+            prepareImage();
+        }
+        catch(VirtualMachineException &e) {
+            QMessageBox::critical(qApp->activeWindow(),
+                "Fatal error",
+                "Failed to start VM: " + QString(e.what())
+            );
+            return;
+        }
+        m_imageStale = false;
+    }
+
     if(m_guestBridge && !m_guestBridge->isListening())
         m_guestBridge->start();
+
+    // QEMU's virtio-vsock device has to be given its path
+    GuestBridgeServer* bridgeServer = GuestBridgeServer::instance();
+    if(!bridgeServer || !bridgeServer->isListening()) {
+        QMessageBox::critical(qApp->activeWindow(),
+            "Fatal error",
+            "Failed to start VM: the guest bridge isn't listening"
+            + (bridgeServer ? " (" + bridgeServer->errorString() + ")" : QString())
+        );
+        return;
+    }
     
     m_consoleServer = new UnixSocketServer();
     QString serverNameUuid = QUuid::createUuid().toString(QUuid::WithoutBraces);
@@ -400,21 +649,35 @@ void VirtualMachine::start() {
 
     m_vmProcess->start();
     m_isRunning = true;
+
+    if(Config::getIoStatsInterval() > 0) {
+        connect(&m_ioStatsTimer, &QTimer::timeout,
+            this, &VirtualMachine::dumpIoStatistics, Qt::UniqueConnection);
+        m_ioStatsTimer.start(Config::getIoStatsInterval() * 1000);
+    }
 }
 
 void VirtualMachine::handleVmProcessFinished(int exitCode) {
+    if(m_ioStatsTimer.isActive()) {
+        m_ioStatsTimer.stop();
+        dumpIoStatistics();
+    }
+
+    closeConsoleRelays();
     if(m_consoleSocket){
+        m_closedIoStatistics.console += m_consoleSocket->statistics();
         m_consoleSocket->close();
         m_consoleSocket->deleteLater();
     }
     m_consoleSocket = nullptr;
     
 
-    for (auto termSock : m_terminalSockets) {
+    // Taken out first, closing a terminal removes it from the list
+    for (auto termSock : std::exchange(m_terminalSockets, {})) {
+        m_closedIoStatistics.terminals += termSock->statistics();
         termSock->close();
         termSock->deleteLater();
     }
-    m_terminalSockets.clear();
 
     if(m_consoleServer){
         m_consoleServer->close();
@@ -458,6 +721,8 @@ void VirtualMachine::handleVmProcessFinished(int exitCode) {
 }
 
 void VirtualMachine::stop() {
+    m_startPending = false;
+
     if(!m_isRunning || !m_vmProcess)
         return;
 
@@ -478,14 +743,43 @@ void VirtualMachine::handleClientConsoleSockReadReady(UnixSocket* sock) {
 void VirtualMachine::handleConsoleSockReadReady() {
     QByteArray data = m_consoleSocket->readAll();
 
-    for (auto term : m_terminalSockets) {
+    // A terminal can be closed by its overflow policy while writing
+    for (auto term : QList<UnixSocket*>(m_terminalSockets)) {
         term->write(data);
     }
 }
 
+void VirtualMachine::updateConsoleFlow() {
+    // The relays only read when there's room in the pipes
+    if(!m_consoleSocket || m_consoleRelay)
+        return;
+
+    bool terminalsFull = false;
+    for(auto term : m_terminalSockets)
+        terminalsFull = terminalsFull || term->isWriteBufferFull();
+    m_consoleSocket->setReadEnabled(!terminalsFull);
+
+    bool consoleFull = m_consoleSocket->isWriteBufferFull();
+    for(auto term : m_terminalSockets)
+        term->setReadEnabled(!consoleFull);
+}
+
+void VirtualMachine::closeConsoleRelays() {
+    for(SpliceRelay* input : std::exchange(m_terminalRelays, {})) {
+        addRelayStatistics(m_closedIoStatistics, input, false);
+        delete input;
+    }
+    if(m_consoleRelay) {
+        addRelayStatistics(m_closedIoStatistics, m_consoleRelay, true);
+        delete m_consoleRelay;
+    }
+    m_consoleRelay = nullptr;
+}
+
 VirtualMachine::~VirtualMachine() {
     stop();
-    m_imageFile.close();
+    if(!m_imagePath.isEmpty())
+        QFile::remove(m_imagePath);
     if(m_guestBridge){
         m_guestBridge->stop();
         m_guestBridge->deleteLater();
@@ -511,4 +805,45 @@ void VirtualMachine::registerWidget(VirtualMachineWidget* w, QSize size) {
     }
 
     m_minimumWidgetSize = QSize(minW, minH);
+}
+
+VirtualMachine::IoStatistics VirtualMachine::ioStatistics() const {
+    IoStatistics stats = m_closedIoStatistics;
+    if(m_consoleSocket)
+        stats.console += m_consoleSocket->statistics();
+    for(auto termSock : m_terminalSockets)
+        stats.terminals += termSock->statistics();
+    if(m_consoleRelay)
+        addRelayStatistics(stats, m_consoleRelay, true);
+    for(auto input : m_terminalRelays)
+        addRelayStatistics(stats, input, false);
+    if(m_guestBridge)
+        stats.bridge += m_guestBridge->statistics();
+    return stats;
+}
+
+static QString formatSocketStatistics(const QString& name, const SocketStatistics& stats) {
+    QLocale locale = QLocale::c();
+    return QString("%1: in %2, out %3, %4 syscalls, %5 EAGAIN, peak buffers %6 read / %7 write, %8 queued, %9 dropped")
+        .arg(name)
+        .arg(locale.formattedDataSize(stats.bytesRead))
+        .arg(locale.formattedDataSize(stats.bytesWritten))
+        .arg(stats.syscalls)
+        .arg(stats.eagain)
+        .arg(locale.formattedDataSize(stats.peakReadBuffer))
+        .arg(locale.formattedDataSize(stats.peakWriteQueue))
+        .arg(locale.formattedDataSize(stats.queuedBytes))
+        .arg(locale.formattedDataSize(stats.droppedBytes));
+}
+
+QString VirtualMachine::ioStatisticsText() const {
+    IoStatistics stats = ioStatistics();
+    return formatSocketStatistics("console", stats.console) + "\n"
+        + formatSocketStatistics("bridge", stats.bridge) + "\n"
+        + formatSocketStatistics("terminals", stats.terminals);
+}
+
+void VirtualMachine::dumpIoStatistics() {
+    for(const QString& line : ioStatisticsText().split('\n'))
+        qInfo().noquote() << "[" + m_id + "]" << line;
 }
\ No newline at end of file
@@ -4,7 +4,11 @@
 #include <QtCore/QObject>
 #include <QtCore/QString>
 #include <QtCore/QList>
-#include <QtCore/QTemporaryFile>
+#include <QtCore/QHash>
+#include <QtCore/QByteArray>
+#include <QtCore/QByteArrayView>
+#include <QtCore/QFile>
+#include <QtCore/QTimer>
 #include <QtCore/QProcess>
 #include <QtCore/QUuid>
 
@@ -19,6 +23,7 @@
 class Network;
 class GuestBridge;
 class Presentation;
+class SpliceRelay;
 class VirtualMachineWidget;
 
 class VirtualMachineException : public std::exception
@@ -30,12 +35,50 @@ private:
     std::string m_what;
 };
 
+/*
+ * Content of an install file or an init script. Inline content is held in a
+ * shared buffer, content from the archive is referenced by the extracted
+ * file's path and only read when the guest requests it.
+ */
+class Payload
+{
+public:
+    static Payload fromData(const std::string& data);
+    static Payload fromFile(const QString& path);
+
+    bool isFile() const { return !m_path.isNull(); }
+    QString path() const { return m_path; }
+private:
+    QByteArray m_data;
+    QString m_path;
+
+    friend class PayloadReader;
+};
+
+/* Reads a payload chunk by chunk, so that a file is never read whole */
+class PayloadReader
+{
+public:
+    PayloadReader(const Payload& payload) : m_payload(payload) { }
+
+    /*
+     * Sets chunk to the next part of the content, valid until the next call,
+     * or to an empty view at the end. Returns false if the file can't be read.
+     */
+    bool next(QByteArrayView* chunk, QString* error = nullptr);
+private:
+    Payload m_payload;
+    QFile m_file;
+    QByteArray m_buffer;
+    bool m_done = false;
+};
+
 struct InstallFile
 {
     InstallFile(nlohmann::json installFileObject, Presentation* pres);
     QString vmPath;
 
-    std::vector<uint8_t> content;
+    Payload content;
 
     mode_t perm = 0640;
     uid_t owner = 0;
@@ -46,7 +89,7 @@ struct InitScript
 {
     InitScript(nlohmann::json initScriptObject, Presentation* pres);
     
-    std::vector<uint8_t> content;
+    Payload content;
 };
 
 struct Subtask
@@ -113,11 +156,37 @@ public:
     void setNet(Network* net);
 
     void registerWidget(VirtualMachineWidget *w, QSize size);
+
+    /* I/O of the VM's host side sockets since it was created */
+    struct IoStatistics {
+        SocketStatistics console;
+        SocketStatistics bridge;
+        /* The connectors of the terminal widgets */
+        SocketStatistics terminals;
+    };
+    IoStatistics ioStatistics() const;
+    /* One line per socket group, as shown by the overlay and the periodic dump */
+    QString ioStatisticsText() const;
 private:
     VirtualMachine(nlohmann::json &vmObject, Presentation* pres);
     VirtualMachine(QString id, Network* net, bool wan, QString image, Presentation* pres);
 
-    void createImageFile();
+    void findDiskImage();
+    /*
+     * Copies the disk image with plain fds. Only reads m_diskImage and writes
+     * m_imagePath, so it may be run in a worker thread
+     */
+    void prepareImage();
+    /* Marks the image as prepared and starts the VM if start() was called before */
+    void setImageReady();
+    /*
+     * Applies a changed definition from virt-env.jsonc in place. Returns false
+     * if it can't be applied to this instance (a different image or network).
+     * Changed tasks are served to the guest right away. Install files, init
+     * scripts and hostname are only applied on the first boot, so a running
+     * VM boots from a fresh image copy on its next start.
+     */
+    bool updateDefinition(nlohmann::json &vmObject, bool payloadsChanged);
     QString m_id;
     QString m_netId;
     Network* m_net = nullptr;
@@ -135,7 +204,13 @@ private:
 
     QMap<std::string, Task*> m_tasks;
 
-    QTemporaryFile m_imageFile;
+    /* As found in virt-env.jsonc, null for routers */
+    nlohmann::json m_definition;
+
+    QString m_imagePath; /* Copy of the disk image QEMU boots from, removed with the VM */
+    bool m_imageReady = false;
+    bool m_imageStale = false;
+    bool m_startPending = false;
 
     QStringList getArgs();
     bool m_isRunning = false;
@@ -147,9 +222,14 @@ private:
     UnixSocketServer* m_consoleServer = nullptr;
     UnixSocket* m_consoleSocket = nullptr;
     QList<UnixSocket*> m_terminalSockets;
+    /* Console to terminals, and each terminal to the console, when spliced */
+    SpliceRelay* m_consoleRelay = nullptr;
+    QHash<UnixSocket*, SpliceRelay*> m_terminalRelays;
+    /* Counters of the console and terminal sockets that are gone */
+    IoStatistics m_closedIoStatistics;
+    QTimer m_ioStatsTimer;
 
     GuestBridge* m_guestBridge = nullptr;
-    QString m_vsockUserHostServerPath;
     QString m_vsockUserVmServerPath;
     uint32_t m_cid;
 
@@ -166,8 +246,13 @@ private slots:
     void handleNewConsoleSocketConnection();
     void handleConsoleSockReadReady();
     void handleClientConsoleSockReadReady(UnixSocket* sock);
+    /* Pauses reading whichever side of the console relay is ahead of the other */
+    void updateConsoleFlow();
+    /* Before the console is closed, gives reading back to the sockets */
+    void closeConsoleRelays();
     
     void handleVmProcessFinished(int);
+    void dumpIoStatistics();
 public slots:
     void start();
     void stop();
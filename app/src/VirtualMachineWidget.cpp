@@ -1,6 +1,7 @@
 #include "VirtualMachineWidget.hpp"
 
 #include <QtCore/QDebug>
+#include <QtGui/QFontDatabase>
 
 #include "Application.hpp"
 #include "Network.hpp"
@@ -39,24 +40,30 @@ void VirtualMachineWidget::initTerm(bool shouldStart) {
     m_terminalZoomInAction = new QAction("Zoom In");
     m_terminalZoomOutAction = new QAction("Zoom Out");
     m_terminalSearchAction = new QAction("Find");
+    m_terminalIoStatsAction = new QAction("I/O Statistics");
+    m_terminalIoStatsAction->setCheckable(true);
+    m_terminalIoStatsAction->setChecked(m_ioStatsLabel->isVisible());
 
     m_terminalCopyAction->setShortcut(QKeySequence("Ctrl+Shift+C"));
     m_terminalPasteAction->setShortcut(QKeySequence("Ctrl+Shift+V"));
     m_terminalZoomInAction->setShortcut(QKeySequence("Ctrl++"));
     m_terminalZoomOutAction->setShortcut(QKeySequence("Ctrl+-"));
     m_terminalSearchAction->setShortcut(QKeySequence("Ctrl+F"));
+    m_terminalIoStatsAction->setShortcut(QKeySequence("Ctrl+Shift+I"));
 
     m_terminalZoomInAction->setShortcutContext(Qt::WidgetWithChildrenShortcut);
     m_terminalZoomOutAction->setShortcutContext(Qt::WidgetWithChildrenShortcut);
     m_terminalCopyAction->setShortcutContext(Qt::WidgetWithChildrenShortcut);
     m_terminalPasteAction->setShortcutContext(Qt::WidgetWithChildrenShortcut);
     m_terminalSearchAction->setShortcutContext(Qt::WidgetWithChildrenShortcut);
+    m_terminalIoStatsAction->setShortcutContext(Qt::WidgetWithChildrenShortcut);
 
     m_terminal->addAction(m_terminalCopyAction);
     m_terminal->addAction(m_terminalPasteAction);
     m_terminal->addAction(m_terminalSearchAction);
     m_terminal->addAction(m_terminalZoomInAction);
     m_terminal->addAction(m_terminalZoomOutAction);
+    m_terminal->addAction(m_terminalIoStatsAction);
 
     connect(m_terminalCopyAction, &QAction::triggered,
         m_terminal, &QTermWidget::copyClipboard
@@ -78,6 +85,9 @@ void VirtualMachineWidget::initTerm(bool shouldStart) {
         }
     );
 
+    connect(m_terminalIoStatsAction, &QAction::toggled,
+        this, &VirtualMachineWidget::toggleIoStatistics
+    );
     connect(m_terminalSearchAction, &QAction::triggered,
         m_terminal, &QTermWidget::toggleShowSearchBar
     );
@@ -97,6 +107,7 @@ void VirtualMachineWidget::initTerm(bool shouldStart) {
     m_termEventFilter = new TerminalEventFilter(this, m_terminal);
     m_terminal->installEventFilter(m_termEventFilter);
     m_layout->addWidget(m_terminal, 1, 0, 1, 6);
+    m_ioStatsLabel->raise();
 
     registerSize();
 }
@@ -134,6 +145,24 @@ void VirtualMachineWidget::destoryTerm() {
         m_terminalSearchAction->deleteLater();
         m_terminalSearchAction = nullptr;
     }
+    if(m_terminalIoStatsAction) {
+        m_terminalIoStatsAction->deleteLater();
+        m_terminalIoStatsAction = nullptr;
+    }
+}
+
+void VirtualMachineWidget::toggleIoStatistics(bool show) {
+    m_ioStatsLabel->setVisible(show);
+    if(show) {
+        updateIoStatistics();
+        m_ioStatsTimer.start(1000);
+    }
+    else
+        m_ioStatsTimer.stop();
+}
+
+void VirtualMachineWidget::updateIoStatistics() {
+    m_ioStatsLabel->setText(m_vm->ioStatisticsText());
 }
 
 VirtualMachineWidget::VirtualMachineWidget(VirtualMachine* vm, QWidget* parent)
@@ -165,6 +194,15 @@ VirtualMachineWidget::VirtualMachineWidget(VirtualMachine* vm, QWidget* parent)
     m_layout->addWidget(m_stopButton, 0, 4);
     m_layout->addWidget(m_tasksButton, 0, 5);
 
+    // Overlays the top right corner of the terminal
+    m_ioStatsLabel->setVisible(false);
+    m_ioStatsLabel->setAttribute(Qt::WA_TransparentForMouseEvents);
+    m_ioStatsLabel->setStyleSheet("background-color: rgba(0, 0, 0, 160); color: white; padding: 4px;");
+    m_ioStatsLabel->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    m_layout->addWidget(m_ioStatsLabel, 1, 0, 1, 6, Qt::AlignTop | Qt::AlignRight);
+    connect(&m_ioStatsTimer, &QTimer::timeout,
+        this, &VirtualMachineWidget::updateIoStatistics);
+
     initTerm(false);
     m_tasksButton->setMaximumWidth(m_tasksButton->height());
 
@@ -1,6 +1,7 @@
 #ifndef VIRTUALMACHINEWIDGET_HPP
 #define VIRTUALMACHINEWIDGET_HPP
 
+#include <QtCore/QTimer>
 #include <QtWidgets/QWidget>
 #include <QtWidgets/QLabel>
 #include <QtWidgets/QPushButton>
@@ -52,6 +53,10 @@ private:
 
     QAction* m_terminalSearchAction = nullptr;
 
+    QAction* m_terminalIoStatsAction = nullptr;
+    QLabel* m_ioStatsLabel = new QLabel(this);
+    QTimer m_ioStatsTimer;
+
     VmTaskList* m_vmTaskList = nullptr;
     TerminalEventFilter* m_termEventFilter = nullptr;
 private slots:
@@ -59,6 +64,8 @@ private slots:
     void handleVmStopped();
     void handleVmStarted();
     void displayTaskList();
+    void toggleIoStatistics(bool show);
+    void updateIoStatistics();
     
     void initTerm(bool shouldStart);
     void destoryTerm();
@@ -3,12 +3,38 @@
 
 #include "Presentation.hpp"
 
+#include <QtCore/QDebug>
+
+#include <cstring>
+
+/* Parses the presentation and stores its compiled index inside the archive */
+static int embedIndex(QString path) {
+    try {
+        Presentation presentation;
+        presentation.decompressArchive(path);
+        presentation.parseVirtEnvJsonc();
+        presentation.parseRootXml();
+        presentation.embedIndex(path);
+    }
+    catch(PresentationException &e) {
+        qCritical().noquote() << e.cause();
+        return 1;
+    }
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     Application* app = Application::Instance(argc, argv);
     
     if(app == nullptr || argc <= 1){
         exit(1);
     }
+
+    if(argc > 2 && strcmp(argv[1], "--embed-index") == 0) {
+        int ret = embedIndex(argv[2]);
+        Application::CleanUp();
+        return ret;
+    }
     
     if(app->addWindow(argv[1]) == nullptr){
         Application::CleanUp();
@@ -0,0 +1,341 @@
+#include <QtTest/QtTest>
+
+#include <QtCore/QBuffer>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QtEndian>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QTemporaryDir>
+#include <QtGui/QImage>
+
+#include <algorithm>
+#include <functional>
+
+#include <zip.h>
+
+#include "../src/Config.hpp"
+#include "../src/Presentation.hpp"
+#include "../src/PresentationWindow.hpp"
+
+/*
+ * Benchmarks of the presentation loading path on synthetic decks.
+ * Every stage is run on a fresh Presentation, the stages before it are not
+ * timed. Every deck is measured both with and without its cached index.
+ * The median of VS_BENCH_ITERATIONS runs (5 by default) is reported.
+ * An additional deck can be defined with
+ * VS_BENCH_DECK="slides,imagesPerSlide,htmlBoxesPerSlide,vms,installFileKiB".
+ * Run with QT_QPA_PLATFORM=offscreen on headless machines.
+ */
+
+#define DECK_SEED 0x5eed
+#define DECK_IMAGE_SIZE 128
+
+struct DeckSpec {
+    int slides;
+    int imagesPerSlide;
+    int htmlBoxesPerSlide;
+    int vms;
+    int installFileSize; // in bytes
+};
+Q_DECLARE_METATYPE(DeckSpec)
+
+class bench_Presentation : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void benchDecompressArchive_data() { addDecks(); }
+    void benchDecompressArchive();
+    void benchParseVirtEnvJsonc_data() { addDecks(); }
+    void benchParseVirtEnvJsonc();
+    void benchParseRootXml_data() { addDecks(); }
+    void benchParseRootXml();
+    void benchFirstSlide_data() { addDecks(); }
+    void benchFirstSlide();
+private:
+    enum Stage {
+        Decompress = 0,
+        ParseVirtEnv,
+        ParseRootXml,
+        FirstSlide
+    };
+
+    void addDecks();
+    QString deckPath(const QString& name, const DeckSpec& spec);
+    QString generateDeck(const QString& path, const DeckSpec& spec);
+    /*
+     * Runs the stages before `stage` untimed, then `timed`, and reports the median.
+     * `timed` returns the window that took ownership of the presentation, if any.
+     */
+    void benchStage(Stage stage,
+        std::function<PresentationWindow*(Presentation*, const QString&)> timed);
+private:
+    QTemporaryDir m_dir;
+    QHash<QString, QString> m_decks;
+    int m_iterations = 5;
+};
+
+void bench_Presentation::initTestCase() {
+    QVERIFY2(m_dir.isValid(), qUtf8Printable(m_dir.errorString()));
+
+    // Keeps cached presentation indexes away from the user's cache
+    QStandardPaths::setTestModeEnabled(true);
+
+    bool ok;
+    int iterations = qEnvironmentVariableIntValue("VS_BENCH_ITERATIONS", &ok);
+    if(ok && iterations > 0)
+        m_iterations = iterations;
+
+    // Config resolves paths relative to the application's directory
+    QDir appDir(QCoreApplication::applicationDirPath());
+    QString imagePath = m_dir.filePath("bench.img");
+    QString kernelPath = m_dir.filePath("bzImage");
+
+    for(auto& path : { imagePath, kernelPath }) {
+        QFile file(path);
+        QVERIFY2(file.open(QIODevice::WriteOnly), qUtf8Printable(file.errorString()));
+        file.write(QByteArray(64 * 1024, '\0'));
+    }
+
+    QFile config(m_dir.filePath("Config.jsonc"));
+    QVERIFY2(config.open(QIODevice::WriteOnly), qUtf8Printable(config.errorString()));
+    config.write(QStringLiteral(
+        "{\n"
+        "    \"images\": [ { \"imageName\": \"bench\", \"path\": \"%1\" } ],\n"
+        "    \"kernelPath\": \"%2\",\n"
+        "    \"kvmEnabled\": false,\n"
+        "    \"slidePrefetchDistance\": 0\n"
+        "}\n"
+    ).arg(appDir.relativeFilePath(imagePath), appDir.relativeFilePath(kernelPath)).toUtf8());
+    config.close();
+
+    try {
+        Config::Initializate(config.fileName());
+    }
+    catch(ConfigException& e) {
+        QFAIL(e.what());
+    }
+}
+
+void bench_Presentation::cleanupTestCase() {
+    Config::CleanUp();
+}
+
+void bench_Presentation::addDecks() {
+    QTest::addColumn<QString>("deck");
+    QTest::addColumn<DeckSpec>("spec");
+    QTest::addColumn<bool>("indexed");
+
+    QList<QPair<QString, DeckSpec>> decks = {
+        { "small", DeckSpec { 5, 1, 1, 1, 4 * 1024 } },
+        { "medium", DeckSpec { 25, 2, 2, 2, 256 * 1024 } },
+        { "large", DeckSpec { 100, 4, 4, 4, 4 * 1024 * 1024 } }
+    };
+
+    QStringList custom = qEnvironmentVariable("VS_BENCH_DECK").split(',', Qt::SkipEmptyParts);
+    if(custom.size() == 5) {
+        DeckSpec spec { custom[0].toInt(), custom[1].toInt(), custom[2].toInt(),
+            custom[3].toInt(), custom[4].toInt() * 1024 };
+        if(spec.slides > 0)
+            decks.append({ "custom", spec });
+    }
+
+    // Every deck is opened from the text sources and from the cached index
+    for(auto &deck : decks) {
+        QTest::addRow("%s", qPrintable(deck.first)) << deck.first << deck.second << false;
+        QTest::addRow("%s-indexed", qPrintable(deck.first)) << deck.first << deck.second << true;
+    }
+}
+
+QString bench_Presentation::deckPath(const QString& name, const DeckSpec& spec) {
+    if(!m_decks.contains(name))
+        m_decks[name] = generateDeck(m_dir.filePath(name + ".vslides"), spec);
+    return m_decks[name];
+}
+
+QString bench_Presentation::generateDeck(const QString& path, const DeckSpec& spec) {
+    // Same seed, same deck, so results are comparable between runs
+    QRandomGenerator rng(DECK_SEED);
+    QList<QPair<QString, QByteArray>> files;
+
+    auto randomBytes = [&rng](int size) {
+        QByteArray data(size, Qt::Uninitialized);
+        for(int i = 0; i + 4 <= size; i += 4)
+            qToUnaligned(rng.generate(), data.data() + i);
+        for(int i = size - size % 4; i < size; ++i)
+            data[i] = char(rng.bounded(256));
+        return data;
+    };
+
+    QString rootXml = "<Presentation title=\"Benchmark\">\n";
+    for(int s = 0; s < spec.slides; ++s) {
+        rootXml += QString("<Slide bg=\"%1\">\n").arg(s % 2 ? "white" : "lightgray");
+
+        for(int i = 0; i < spec.imagesPerSlide; ++i) {
+            QImage image(DECK_IMAGE_SIZE, DECK_IMAGE_SIZE, QImage::Format_RGB32);
+            for(int y = 0; y < image.height(); ++y) {
+                QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+                for(int x = 0; x < image.width(); ++x)
+                    line[x] = rng.generate() | 0xff000000;
+            }
+
+            QByteArray png;
+            QBuffer buffer(&png);
+            buffer.open(QIODevice::WriteOnly);
+            image.save(&buffer, "PNG");
+
+            QString name = QString("img/%1-%2.png").arg(s).arg(i);
+            files.append({ name, png });
+            rootXml += QString("<Image src=\"%1\" x=\"%2\" y=\"25\" width=\"20\" height=\"20\"/>\n")
+                .arg(name).arg(10 + 20 * (i % 5));
+        }
+
+        for(int i = 0; i < spec.htmlBoxesPerSlide; ++i) {
+            rootXml += QString("<Box x=\"%1\" y=\"70\" width=\"20\" height=\"20\"><html>"
+                "<h2>Slide %2, box %3</h2><p>Lorem <b>ipsum</b> dolor sit amet, "
+                "<i>consectetur</i> adipiscing elit.</p><ul><li>one</li><li>two</li></ul>"
+                "</html></Box>\n").arg(10 + 20 * (i % 5)).arg(s).arg(i);
+        }
+
+        rootXml += "</Slide>\n";
+    }
+    rootXml += "</Presentation>\n";
+    files.append({ "root.xml", rootXml.toUtf8() });
+
+    // VM widgets start a terminal, so the virtual machines are not placed on slides
+    QString virtEnv = "{\n    \"virtualMachines\": [\n";
+    for(int v = 0; v < spec.vms; ++v) {
+        QString fileName = QString("files/vm%1.bin").arg(v);
+        files.append({ fileName, randomBytes(spec.installFileSize) });
+
+        virtEnv += QString("        { \"id\": \"vm%1\", \"image\": \"bench\", "
+            "\"installFiles\": [ { \"path\": \"/root/payload.bin\", \"contentPath\": \"%2\" } ], "
+            "\"initScripts\": [ { \"script\": \"echo vm%1\" } ] }%3\n")
+            .arg(v).arg(fileName).arg(v + 1 < spec.vms ? "," : "");
+    }
+    virtEnv += "    ]\n}\n";
+    files.append({ "virt-env.jsonc", virtEnv.toUtf8() });
+
+    int zipErrorCode = 0;
+    zip_t* zipArchive = zip_open(path.toUtf8().data(), ZIP_CREATE | ZIP_TRUNCATE, &zipErrorCode);
+    if(zipArchive == nullptr)
+        qFatal("Failed to create %s: libzip error %d", qPrintable(path), zipErrorCode);
+
+    // libzip reads the buffers in zip_close()
+    for(auto& file : files) {
+        zip_source_t* source = zip_source_buffer(zipArchive, file.second.constData(), file.second.size(), 0);
+        if(source == nullptr || zip_file_add(zipArchive, file.first.toUtf8().data(), source, ZIP_FL_OVERWRITE) < 0) {
+            zip_source_free(source);
+            qFatal("Failed to add %s to %s: %s", qPrintable(file.first), qPrintable(path),
+                zip_strerror(zipArchive));
+        }
+    }
+    if(zip_close(zipArchive) < 0)
+        qFatal("Failed to write %s: %s", qPrintable(path), zip_strerror(zipArchive));
+
+    return path;
+}
+
+void bench_Presentation::benchStage(Stage stage,
+    std::function<PresentationWindow*(Presentation*, const QString&)> timed)
+{
+    QFETCH(QString, deck);
+    QFETCH(DeckSpec, spec);
+    QFETCH(bool, indexed);
+    QString path = deckPath(deck, spec);
+    QDir indexCache(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/indexes");
+
+    if(indexed) {
+        // Opening the deck once caches its index
+        indexCache.removeRecursively();
+        try {
+            Presentation presentation;
+            presentation.decompressArchive(path);
+            presentation.parseVirtEnvJsonc();
+            presentation.parseRootXml();
+        }
+        catch(std::exception& e) {
+            QFAIL(e.what());
+        }
+        QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+    }
+
+    QList<qint64> samples;
+    for(int i = 0; i < m_iterations; ++i) {
+        if(!indexed)
+            indexCache.removeRecursively();
+
+        Presentation* presentation = new Presentation();
+        PresentationWindow* window = nullptr;
+        QElapsedTimer timer;
+
+        try {
+            if(stage > Decompress)
+                presentation->decompressArchive(path);
+            if(stage > ParseVirtEnv)
+                presentation->parseVirtEnvJsonc();
+            if(stage > ParseRootXml)
+                presentation->parseRootXml();
+
+            timer.start();
+            window = timed(presentation, path);
+            samples.append(timer.nsecsElapsed());
+        }
+        catch(std::exception& e) {
+            delete presentation;
+            QFAIL(e.what());
+        }
+
+        if(window)
+            delete window;
+        else
+            delete presentation;
+
+        // Lets the virtual machines and their bridges be deleted
+        QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+    }
+
+    std::sort(samples.begin(), samples.end());
+    QTest::setBenchmarkResult(samples[samples.size() / 2], QTest::WalltimeNanoseconds);
+}
+
+void bench_Presentation::benchDecompressArchive() {
+    benchStage(Decompress, [](Presentation* presentation, const QString& path) {
+        presentation->decompressArchive(path);
+        return nullptr;
+    });
+}
+
+void bench_Presentation::benchParseVirtEnvJsonc() {
+    benchStage(ParseVirtEnv, [](Presentation* presentation, const QString&) {
+        presentation->parseVirtEnvJsonc();
+        return nullptr;
+    });
+}
+
+void bench_Presentation::benchParseRootXml() {
+    benchStage(ParseRootXml, [](Presentation* presentation, const QString&) {
+        presentation->parseRootXml();
+        return nullptr;
+    });
+}
+
+void bench_Presentation::benchFirstSlide() {
+    benchStage(FirstSlide, [](Presentation* presentation, const QString&) {
+        presentation->buildNextSlide();
+
+        PresentationWindow* window = new PresentationWindow(presentation);
+        window->resize(1280, 720);
+        window->show();
+        // Renders the first slide
+        window->grab();
+
+        return window;
+    });
+}
+
+QTEST_MAIN(bench_Presentation)
+
+#include "bench_presentation.moc"
@@ -0,0 +1,903 @@
+#include <QtTest/QtTest>
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtCore/QUuid>
+
+#include <atomic>
+
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#include "../src/UnixSocket.hpp"
+#include "../src/UnixSocketServer.hpp"
+#include "../src/VSockUser.hpp"
+#include "../src/VSockUserServer.hpp"
+
+/*
+ * Benchmarks of the UnixSocket paths.
+ * benchIdleWait checks that blocking waits sleep instead of spinning,
+ * the CPU time spent in a wait is printed next to its wall time.
+ * benchConsoleFlood has FLOOD_VMS guests write console output at full
+ * speed and prints the GUI thread's CPU time and its worst timer delay
+ * for each backend.
+ * benchThroughput moves THROUGHPUT_BYTES each way between a socket and a
+ * plain fd, and prints MiB/s and the syscalls per MiB made by the threads
+ * of the socket side, when the raw_syscalls tracepoint can be opened.
+ * benchVSockUserRead receives as much through an accepted VSockUser with
+ * read(), readAll() and nextDataBlock(), and prints MiB/s and the share
+ * of the bytes the read path copied.
+ * benchRoundTrip bounces messages off an echoing fd and prints the median
+ * and 99th percentile round trip, benchConnectRate the connections set up
+ * per second by UnixSocket and by the VSockUser handshake, one at a time
+ * and CONNECT_BATCH in flight, with the handshake's latency, and benchFanOut
+ * the cost of writing the same console output to many readers.
+ *
+ * The numbers are also collected by BenchResults. BENCH_SOCKETS_OUTPUT
+ * names a JSON file they're written to, BENCH_SOCKETS_BASELINE such a file
+ * from an earlier run (e.g. before a change to the I/O path) to compare
+ * with. A metric worse than the baseline by more than
+ * BENCH_SOCKETS_TOLERANCE percent fails its test.
+ */
+
+#define FLOOD_VMS 50
+#define FLOOD_BYTES_PER_VM (2 * 1024 * 1024)
+#define FLOOD_WRITE_SZ 4096
+#define FLOOD_TICK_MSEC 5
+#define THROUGHPUT_BYTES (32 * 1024 * 1024)
+#define ROUND_TRIPS 5000
+#define CONNECT_COUNT 500
+#define CONNECT_PORT 1024
+/* Handshakes in flight at once */
+#define CONNECT_BATCH 64
+/* Console lines of the VSockUser read benchmark */
+#define VSOCK_READ_LINE_SZ 64
+#define FANOUT_BYTES (4 * 1024 * 1024)
+#define FANOUT_WRITE_SZ 4096
+/* Per reader, the writer waits for the readers past it */
+#define FANOUT_QUEUE_LIMIT (256 * 1024)
+#define DEFAULT_TOLERANCE_PERCENT 25
+
+static QString SERVER_PATH = QUuid::createUuid().toString();
+
+static qint64 threadCpuNsecs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/* Connects a plain blocking socket, the side whose syscalls aren't counted */
+static int connectRaw(const QByteArray& path) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return -1;
+
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.constData(), qMin<size_t>(path.size(), sizeof(addr.sun_path) - 1));
+    if(::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Counts the syscalls of the threads that exist when it's created */
+class SyscallCounter {
+public:
+    SyscallCounter() {
+        QFile idFile("/sys/kernel/tracing/events/raw_syscalls/sys_enter/id");
+        if(!idFile.open(QIODevice::ReadOnly)) {
+            idFile.setFileName("/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id");
+            if(!idFile.open(QIODevice::ReadOnly))
+                return;
+        }
+        bool ok;
+        quint64 id = idFile.readAll().trimmed().toULongLong(&ok);
+        if(!ok)
+            return;
+
+        struct perf_event_attr attr = {};
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.size = sizeof(attr);
+        attr.config = id;
+
+        for(const QString& task : QDir("/proc/self/task").entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+            int fd = syscall(SYS_perf_event_open, &attr, task.toInt(), -1, -1, PERF_FLAG_FD_CLOEXEC);
+            if(fd < 0) {
+                // Most likely perf_event_paranoid, counting only some threads would be misleading
+                for(int counter : m_fds)
+                    ::close(counter);
+                m_fds.clear();
+                return;
+            }
+            m_fds.append(fd);
+        }
+    }
+    ~SyscallCounter() {
+        for(int fd : m_fds)
+            ::close(fd);
+    }
+
+    bool isValid() const { return !m_fds.isEmpty(); }
+    qint64 count() const {
+        qint64 total = 0;
+        for(int fd : m_fds) {
+            quint64 value = 0;
+            if(::read(fd, &value, sizeof(value)) == sizeof(value))
+                total += value;
+        }
+        return total;
+    }
+private:
+    QList<int> m_fds;
+};
+
+/* "64 B", "4 KiB", ... for the row names */
+static QByteArray sizeName(int size) {
+    if(size >= 1024 * 1024)
+        return QByteArray::number(size / (1024 * 1024)) + " MiB";
+    if(size >= 1024)
+        return QByteArray::number(size / 1024) + " KiB";
+    return QByteArray::number(size) + " B";
+}
+
+static const QList<QPair<const char*, UnixSocket::Backend>> BACKENDS = {
+    { "notifier", UnixSocket::Notifier },
+    { "reactor", UnixSocket::Reactor },
+    { "io_uring", UnixSocket::Uring },
+};
+
+/* The metrics of a run, keyed by test function, data tag and name */
+class BenchResults {
+public:
+    BenchResults() {
+        bool ok;
+        m_tolerance = qEnvironmentVariableIntValue("BENCH_SOCKETS_TOLERANCE", &ok);
+        if(!ok)
+            m_tolerance = DEFAULT_TOLERANCE_PERCENT;
+
+        QString baselinePath = qEnvironmentVariable("BENCH_SOCKETS_BASELINE");
+        if(baselinePath.isEmpty())
+            return;
+        QFile baseline(baselinePath);
+        if(!baseline.open(QIODevice::ReadOnly)) {
+            qWarning("Can't open the baseline %s: %s", qUtf8Printable(baselinePath),
+                qUtf8Printable(baseline.errorString()));
+            return;
+        }
+        m_baseline = QJsonDocument::fromJson(baseline.readAll()).object().value("metrics").toObject();
+    }
+
+    /* lowerIsBetter for times and costs, rates are the other way round */
+    void record(const char* name, double value, const char* unit, bool lowerIsBetter) {
+        const char* tag = QTest::currentDataTag();
+        QString key = QString("%1/%2/%3").arg(QString::fromUtf8(QTest::currentTestFunction()),
+            QString::fromUtf8(tag ? tag : ""), QString::fromUtf8(name));
+        m_metrics.insert(key, QJsonObject {
+            { "value", value },
+            { "unit", unit },
+            { "lowerIsBetter", lowerIsBetter }
+        });
+
+        double base = m_baseline.value(key).toObject().value("value").toDouble();
+        if(base <= 0)
+            return;
+        double change = 100.0 * (value - base) / base;
+        qInfo("  %s: %.2f %s, baseline %.2f (%+.1f%%)", qUtf8Printable(key), value, unit, base, change);
+        if((lowerIsBetter ? change : -change) > m_tolerance)
+            m_regressions.append(QString("%1 changed by %2%").arg(key).arg(change, 0, 'f', 1));
+    }
+
+    QStringList takeRegressions() { return std::exchange(m_regressions, {}); }
+
+    bool save() const {
+        QString path = qEnvironmentVariable("BENCH_SOCKETS_OUTPUT");
+        if(path.isEmpty())
+            return true;
+        QFile output(path);
+        if(!output.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            return false;
+        QJsonObject root { { "metrics", m_metrics } };
+        return output.write(QJsonDocument(root).toJson()) > 0;
+    }
+private:
+    int m_tolerance;
+    QJsonObject m_baseline;
+    QJsonObject m_metrics;
+    QStringList m_regressions;
+};
+
+class bench_Sockets : public QObject
+{
+    Q_OBJECT
+private slots:
+    void init();
+    void cleanup();
+    void cleanupTestCase();
+
+    void benchIdleWait_data();
+    void benchIdleWait();
+    void benchInterruptLatency();
+    void benchConsoleFlood_data();
+    void benchConsoleFlood();
+    void benchThroughput_data();
+    void benchThroughput();
+    void benchVSockUserRead_data();
+    void benchVSockUserRead();
+    void benchRoundTrip_data();
+    void benchRoundTrip();
+    void benchConnectRate_data();
+    void benchConnectRate();
+    void benchFanOut_data();
+    void benchFanOut();
+private:
+    UnixSocketServer* m_server = nullptr;
+    UnixSocket* m_client = nullptr;
+    UnixSocket* m_peer = nullptr;
+
+    BenchResults m_results;
+};
+
+void bench_Sockets::init() {
+    m_server = new UnixSocketServer();
+    QVERIFY2(m_server->listen(SERVER_PATH), qUtf8Printable(m_server->errorString()));
+
+    m_client = new UnixSocket();
+    QVERIFY2(m_client->connectToServer(m_server->fullServerName()), qUtf8Printable(m_client->errorString()));
+    QVERIFY(m_server->waitForNewConnection(3000));
+    m_peer = m_server->nextPendingConnection();
+    QVERIFY(m_peer);
+}
+
+void bench_Sockets::cleanup() {
+    delete m_client;
+    m_client = nullptr;
+    // The server owns its connections
+    delete m_server;
+    m_server = nullptr;
+    m_peer = nullptr;
+
+    QStringList regressions = m_results.takeRegressions();
+    QVERIFY2(regressions.isEmpty(), qUtf8Printable("Worse than the baseline: " + regressions.join(", ")));
+}
+
+void bench_Sockets::cleanupTestCase() {
+    QVERIFY2(m_results.save(), "Can't write BENCH_SOCKETS_OUTPUT");
+}
+
+void bench_Sockets::benchIdleWait_data() {
+    QTest::addColumn<int>("msecs");
+
+    QTest::newRow("readyRead 100 ms") << 100;
+    QTest::newRow("readyRead 500 ms") << 500;
+}
+
+void bench_Sockets::benchIdleWait() {
+    QFETCH(int, msecs);
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 cpuStart = threadCpuNsecs();
+
+    QVERIFY(!m_client->waitForReadyRead(msecs));
+
+    qint64 cpu = threadCpuNsecs() - cpuStart;
+    qint64 wall = timer.nsecsElapsed();
+
+    qInfo("idle wait: %.2f ms wall, %.3f ms cpu (%.2f%%)",
+        wall / 1000000.0, cpu / 1000000.0, 100.0 * cpu / wall);
+    // A busy loop would use the whole wait
+    QVERIFY2(cpu < wall / 10, "waitForReadyRead() is spinning");
+    m_results.record("cpu", cpu / 1e6, "ms", true);
+
+    QTest::setBenchmarkResult(wall, QTest::WalltimeNanoseconds);
+}
+
+void bench_Sockets::benchInterruptLatency() {
+    std::atomic<qint64> interruptedAt { 0 };
+    QElapsedTimer timer;
+    timer.start();
+
+    QThread* interrupter = QThread::create([&] {
+        QThread::msleep(50);
+        interruptedAt = timer.nsecsElapsed();
+        m_client->interruptWait();
+    });
+    interrupter->start();
+
+    QVERIFY(!m_client->waitForReadyRead(5000));
+    qint64 latency = timer.nsecsElapsed() - interruptedAt;
+
+    interrupter->wait();
+    delete interrupter;
+
+    m_results.record("latency", latency / 1e3, "us", true);
+    QTest::setBenchmarkResult(latency, QTest::WalltimeNanoseconds);
+}
+
+void bench_Sockets::benchConsoleFlood_data() {
+    QTest::addColumn<UnixSocket::Backend>("backend");
+
+    QTest::newRow("notifier") << UnixSocket::Notifier;
+    QTest::newRow("reactor") << UnixSocket::Reactor;
+}
+
+void bench_Sockets::benchConsoleFlood() {
+    QFETCH(UnixSocket::Backend, backend);
+
+    UnixSocket::setDefaultBackend(backend);
+    auto restoreBackend = qScopeGuard([] { UnixSocket::setDefaultBackend(UnixSocket::Notifier); });
+
+    UnixSocketServer server;
+    QVERIFY2(server.listen(SERVER_PATH + "-flood"), qUtf8Printable(server.errorString()));
+
+    qint64 received = 0;
+    connect(&server, &UnixSocketServer::newConnection, this, [&] {
+        while(UnixSocket* sock = server.nextPendingConnection()) {
+            connect(sock, &UnixSocket::readyRead, sock, [&received, sock] {
+                received += sock->readAll().size();
+            });
+        }
+    });
+
+    // Stands in for the GUI, measures how late its timers fire
+    QElapsedTimer tick;
+    qint64 worstDelay = 0;
+    QTimer ticker;
+    ticker.setTimerType(Qt::PreciseTimer);
+    ticker.setInterval(FLOOD_TICK_MSEC);
+    connect(&ticker, &QTimer::timeout, this, [&] {
+        qint64 delay = tick.nsecsElapsed() - FLOOD_TICK_MSEC * 1000000LL;
+        worstDelay = qMax(worstDelay, delay);
+        tick.restart();
+    });
+
+    // The guests, QEMU writes the console output from its own threads
+    QByteArray path = server.fullServerName().toUtf8();
+    std::atomic<qint64> sent { 0 };
+    std::atomic<int> failed { 0 };
+    QList<QThread*> vms;
+    for(int i = 0; i < FLOOD_VMS; i++) {
+        vms.append(QThread::create([path, &sent, &failed] {
+            int fd = connectRaw(path);
+            if(fd < 0) {
+                failed++;
+                return;
+            }
+
+            char buf[FLOOD_WRITE_SZ];
+            memset(buf, 'x', sizeof(buf));
+            qint64 total = 0;
+            while(total < FLOOD_BYTES_PER_VM) {
+                ssize_t rc = ::write(fd, buf, sizeof(buf));
+                if(rc < 0) {
+                    if(errno == EINTR)
+                        continue;
+                    failed++;
+                    break;
+                }
+                total += rc;
+            }
+            sent += total;
+            ::close(fd);
+        }));
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 cpuStart = threadCpuNsecs();
+    tick.start();
+    ticker.start();
+    for(QThread* vm : vms)
+        vm->start();
+
+    auto done = [&] {
+        for(QThread* vm : vms) {
+            if(!vm->isFinished())
+                return false;
+        }
+        return received == sent;
+    };
+    QDeadlineTimer deadline(60000);
+    while(!done() && !deadline.hasExpired())
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+
+    qint64 wall = timer.nsecsElapsed();
+    qint64 cpu = threadCpuNsecs() - cpuStart;
+    ticker.stop();
+
+    for(QThread* vm : vms) {
+        vm->wait();
+        delete vm;
+    }
+    QCOMPARE(failed.load(), 0);
+    QCOMPARE(received, sent.load());
+
+    qInfo("%s: %.1f MiB/s, GUI thread cpu %.1f ms, worst timer delay %.2f ms",
+        QTest::currentDataTag(), received / (1024.0 * 1024.0) / (wall / 1e9),
+        cpu / 1e6, worstDelay / 1e6);
+    m_results.record("throughput", received / (1024.0 * 1024.0) / (wall / 1e9), "MiB/s", false);
+    m_results.record("gui cpu", cpu / 1e6, "ms", true);
+    m_results.record("worst timer delay", worstDelay / 1e6, "ms", true);
+    QTest::setBenchmarkResult(wall, QTest::WalltimeNanoseconds);
+}
+
+void bench_Sockets::benchThroughput_data() {
+    QTest::addColumn<UnixSocket::Backend>("backend");
+    QTest::addColumn<int>("messageSize");
+
+    for(const auto& backend : BACKENDS) {
+        // Console output and bridge messages are small, file transfers aren't
+        for(int size : { 64, 256, 4 * 1024, 64 * 1024, 1024 * 1024 })
+            QTest::addRow("%s %s", backend.first, sizeName(size).constData()) << backend.second << size;
+    }
+}
+
+void bench_Sockets::benchThroughput() {
+    QFETCH(UnixSocket::Backend, backend);
+    QFETCH(int, messageSize);
+
+    UnixSocket::setDefaultBackend(backend);
+    auto restoreBackend = qScopeGuard([] { UnixSocket::setDefaultBackend(UnixSocket::Notifier); });
+
+    UnixSocketServer server;
+    QVERIFY2(server.listen(SERVER_PATH + "-throughput"), qUtf8Printable(server.errorString()));
+    int peer = connectRaw(server.fullServerName().toUtf8());
+    QVERIFY(peer >= 0);
+    auto closePeer = qScopeGuard([peer] { ::close(peer); });
+    QVERIFY(server.waitForNewConnection(3000));
+    UnixSocket* sock = server.nextPendingConnection();
+    QVERIFY(sock);
+    if(sock->backend() != backend)
+        QSKIP("The backend isn't available here");
+
+    // The reactor and ring threads exist by now and are counted
+    SyscallCounter syscalls;
+    QByteArray message(messageSize, 'x');
+
+    // Receiving
+    qint64 received = 0;
+    connect(sock, &UnixSocket::readyRead, sock, [&received, sock] {
+        received += sock->readAll().size();
+    });
+    QThread* writer = QThread::create([peer, &message] {
+        for(qint64 total = 0; total < THROUGHPUT_BYTES; ) {
+            ssize_t rc = ::write(peer, message.constData(),
+                qMin<qint64>(message.size(), THROUGHPUT_BYTES - total));
+            if(rc < 0 && errno != EINTR)
+                return;
+            total += qMax<ssize_t>(rc, 0);
+        }
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 syscallsStart = syscalls.count();
+    writer->start();
+    QDeadlineTimer deadline(60000);
+    while(received < THROUGHPUT_BYTES && !deadline.hasExpired())
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    qint64 recvWall = timer.nsecsElapsed();
+    qint64 recvSyscalls = syscalls.count() - syscallsStart;
+    writer->wait();
+    delete writer;
+    QCOMPARE(received, qint64(THROUGHPUT_BYTES));
+
+    // Sending
+    std::atomic<qint64> drained { 0 };
+    QThread* reader = QThread::create([peer, &drained] {
+        QByteArray buf(256 * 1024, Qt::Uninitialized);
+        while(drained < THROUGHPUT_BYTES) {
+            ssize_t rc = ::read(peer, buf.data(), buf.size());
+            if(rc == 0 || (rc < 0 && errno != EINTR))
+                return;
+            drained += qMax<ssize_t>(rc, 0);
+        }
+    });
+    reader->start();
+
+    timer.restart();
+    syscallsStart = syscalls.count();
+    for(qint64 total = 0; total < THROUGHPUT_BYTES; total += message.size()) {
+        sock->write(message);
+        // Let the backend run like it would between the GUI's writes
+        if(total % (1024 * 1024) == 0)
+            QCoreApplication::processEvents();
+    }
+    deadline.setRemainingTime(60000);
+    while(drained < THROUGHPUT_BYTES && !deadline.hasExpired())
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    qint64 sendWall = timer.nsecsElapsed();
+    qint64 sendSyscalls = syscalls.count() - syscallsStart;
+    reader->wait();
+    delete reader;
+    QCOMPARE(drained.load(), qint64(THROUGHPUT_BYTES));
+
+    const double mib = THROUGHPUT_BYTES / (1024.0 * 1024.0);
+    auto perMib = [&](qint64 count) {
+        return syscalls.isValid() ? QByteArray::number(count / mib, 'f', 1) : QByteArray("n/a");
+    };
+    qInfo("%s: recv %.1f MiB/s %s syscalls/MiB, send %.1f MiB/s %s syscalls/MiB",
+        QTest::currentDataTag(), mib / (recvWall / 1e9), perMib(recvSyscalls).constData(),
+        mib / (sendWall / 1e9), perMib(sendSyscalls).constData());
+    m_results.record("recv", mib / (recvWall / 1e9), "MiB/s", false);
+    m_results.record("send", mib / (sendWall / 1e9), "MiB/s", false);
+    if(syscalls.isValid()) {
+        m_results.record("recv syscalls", recvSyscalls / mib, "1/MiB", true);
+        m_results.record("send syscalls", sendSyscalls / mib, "1/MiB", true);
+    }
+    QTest::setBenchmarkResult(recvWall + sendWall, QTest::WalltimeNanoseconds);
+}
+
+enum VSockReadMode {
+    /* Into the caller's buffer */
+    ReadCopy,
+    /* The received chunks, handed over when they're whole */
+    ReadChunks,
+    /* In place, then skipped */
+    ReadInPlace
+};
+
+void bench_Sockets::benchVSockUserRead_data() {
+    QTest::addColumn<int>("mode");
+    QTest::newRow("read") << int(ReadCopy);
+    QTest::newRow("readAll") << int(ReadChunks);
+    QTest::newRow("nextDataBlock") << int(ReadInPlace);
+}
+
+void bench_Sockets::benchVSockUserRead() {
+    QFETCH(int, mode);
+
+    VSockUserServer server;
+    QVERIFY2(server.listen(SERVER_PATH + "-vsock-read", VSockUserServer::Local, CONNECT_PORT),
+        qUtf8Printable(server.errorString()));
+    int peer = connectRaw(server.fullServerName().toUtf8());
+    QVERIFY(peer >= 0);
+    auto closePeer = qScopeGuard([peer] { ::close(peer); });
+
+    // What VSockUser::connectToServer() sends, QEMU's side of the connection
+    struct __attribute__((packed)) {
+        uint64_t hostCid;
+        uint64_t vmCid;
+        uint32_t hostPort;
+        uint32_t vmPort;
+    } key = { VSockUserServer::Local, VSockUserServer::Local, CONNECT_PORT, -2U };
+    QCOMPARE(::write(peer, &key, sizeof(key)), ssize_t(sizeof(key)));
+    QDeadlineTimer deadline(3000);
+    while(!server.hasPendingConnections() && !deadline.hasExpired())
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    VSockUser* sock = server.nextPendingConnection();
+    QVERIFY(sock);
+    auto deleteSock = qScopeGuard([sock] { delete sock; });
+
+    QByteArray message(4 * 1024, 'x');
+    for(int i = VSOCK_READ_LINE_SZ - 1; i < message.size(); i += VSOCK_READ_LINE_SZ)
+        message[i] = '\n';
+
+    // The lines are counted like the bridge looks for its separator, so each mode touches the data once
+    qint64 received = 0;
+    qint64 copied = 0;
+    qint64 lines = 0;
+    auto countLines = [&lines](const char* data, qint64 size) {
+        lines += std::count(data, data + size, '\n');
+    };
+    QByteArray buf(256 * 1024, Qt::Uninitialized);
+    connect(sock, &VSockUser::readyRead, sock, [&] {
+        switch(mode) {
+        case ReadCopy:
+            for(qint64 rc; (rc = sock->read(buf.data(), buf.size())) > 0; ) {
+                countLines(buf.constData(), rc);
+                received += rc;
+                copied += rc;
+            }
+            break;
+        case ReadChunks: {
+            const char* front = sock->nextDataBlock().data();
+            QByteArray data = sock->readAll();
+            countLines(data.constData(), data.size());
+            received += data.size();
+            if(data.constData() != front)
+                copied += data.size();
+            break;
+        }
+        case ReadInPlace:
+            for(QByteArrayView block; !(block = sock->nextDataBlock()).isEmpty(); ) {
+                countLines(block.data(), block.size());
+                received += sock->skip(block.size());
+            }
+            break;
+        }
+    });
+    QThread* writer = QThread::create([peer, &message] {
+        char reply;
+        if(::read(peer, &reply, sizeof(reply)) != (ssize_t)sizeof(reply))
+            return;
+        for(qint64 total = 0; total < THROUGHPUT_BYTES; ) {
+            ssize_t rc = ::write(peer, message.constData(),
+                qMin<qint64>(message.size(), THROUGHPUT_BYTES - total));
+            if(rc < 0 && errno != EINTR)
+                return;
+            total += qMax<ssize_t>(rc, 0);
+        }
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+    writer->start();
+    deadline.setRemainingTime(60000);
+    while(received < THROUGHPUT_BYTES && !deadline.hasExpired())
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    qint64 wall = timer.nsecsElapsed();
+    writer->wait();
+    delete writer;
+    QCOMPARE(received, qint64(THROUGHPUT_BYTES));
+    // Short writes split messages, the lines still add up
+    QCOMPARE(lines, qint64(THROUGHPUT_BYTES / VSOCK_READ_LINE_SZ));
+
+    const double mib = THROUGHPUT_BYTES / (1024.0 * 1024.0);
+    double copiedShare = double(copied) / received;
+    qInfo("%s: %.1f MiB/s, %.2f of the bytes copied", QTest::currentDataTag(), mib / (wall / 1e9), copiedShare);
+    m_results.record("recv", mib / (wall / 1e9), "MiB/s", false);
+    m_results.record("copied", copiedShare, "1/B", true);
+    QTest::setBenchmarkResult(wall, QTest::WalltimeNanoseconds);
+}
+
+void bench_Sockets::benchRoundTrip_data() {
+    QTest::addColumn<UnixSocket::Backend>("backend");
+    QTest::addColumn<int>("messageSize");
+
+    for(const auto& backend : BACKENDS) {
+        for(int size : { 64, 4 * 1024 })
+            QTest::addRow("%s %s", backend.first, sizeName(size).constData()) << backend.second << size;
+    }
+}
+
+void bench_Sockets::benchRoundTrip() {
+    QFETCH(UnixSocket::Backend, backend);
+    QFETCH(int, messageSize);
+
+    UnixSocket::setDefaultBackend(backend);
+    auto restoreBackend = qScopeGuard([] { UnixSocket::setDefaultBackend(UnixSocket::Notifier); });
+
+    UnixSocketServer server;
+    QVERIFY2(server.listen(SERVER_PATH + "-roundtrip"), qUtf8Printable(server.errorString()));
+    int peer = connectRaw(server.fullServerName().toUtf8());
+    QVERIFY(peer >= 0);
+    auto closePeer = qScopeGuard([peer] { ::close(peer); });
+    QVERIFY(server.waitForNewConnection(3000));
+    UnixSocket* sock = server.nextPendingConnection();
+    QVERIFY(sock);
+    if(sock->backend() != backend)
+        QSKIP("The backend isn't available here");
+
+    // Echoes every message back as soon as it's complete
+    QThread* echo = QThread::create([peer, messageSize] {
+        QByteArray buf(messageSize, Qt::Uninitialized);
+        for(int i = 0; i < ROUND_TRIPS; i++) {
+            for(qint64 got = 0; got < messageSize; ) {
+                ssize_t rc = ::read(peer, buf.data() + got, messageSize - got);
+                if(rc == 0 || (rc < 0 && errno != EINTR))
+                    return;
+                got += qMax<ssize_t>(rc, 0);
+            }
+            for(qint64 sent = 0; sent < messageSize; ) {
+                ssize_t rc = ::write(peer, buf.constData() + sent, messageSize - sent);
+                if(rc < 0 && errno != EINTR)
+                    return;
+                sent += qMax<ssize_t>(rc, 0);
+            }
+        }
+    });
+    echo->start();
+
+    QByteArray message(messageSize, 'x');
+    QList<qint64> latencies;
+    latencies.reserve(ROUND_TRIPS);
+    QElapsedTimer timer;
+    for(int i = 0; i < ROUND_TRIPS; i++) {
+        timer.start();
+        sock->write(message);
+        qint64 got = 0;
+        while(got < messageSize) {
+            if(sock->bytesAvailable() == 0 && !sock->waitForReadyRead(3000))
+                break;
+            got += sock->readAll().size();
+        }
+        if(got < messageSize)
+            break;
+        latencies.append(timer.nsecsElapsed());
+    }
+    echo->wait();
+    delete echo;
+    QCOMPARE(latencies.size(), ROUND_TRIPS);
+
+    std::sort(latencies.begin(), latencies.end());
+    qint64 median = latencies[latencies.size() / 2];
+    qint64 p99 = latencies[latencies.size() * 99 / 100];
+    qInfo("%s: median %.1f us, p99 %.1f us", QTest::currentDataTag(), median / 1e3, p99 / 1e3);
+    m_results.record("median", median / 1e3, "us", true);
+    m_results.record("p99", p99 / 1e3, "us", true);
+    QTest::setBenchmarkResult(median, QTest::WalltimeNanoseconds);
+}
+
+void bench_Sockets::benchConnectRate_data() {
+    QTest::addColumn<UnixSocket::Backend>("backend");
+    QTest::addColumn<bool>("handshake");
+    QTest::addColumn<int>("batch");
+
+    for(const auto& backend : BACKENDS)
+        QTest::addRow("%s", backend.first) << backend.second << false << 1;
+    // The guest bridge's connections, a UnixSocket plus the vsock-user key exchange
+    QTest::newRow("vsockuser handshake") << UnixSocket::Notifier << true << 1;
+    QTest::addRow("vsockuser handshake x%d", CONNECT_BATCH) << UnixSocket::Notifier << true << CONNECT_BATCH;
+}
+
+void bench_Sockets::benchConnectRate() {
+    QFETCH(UnixSocket::Backend, backend);
+    QFETCH(bool, handshake);
+    QFETCH(int, batch);
+
+    UnixSocket::setDefaultBackend(backend);
+    auto restoreBackend = qScopeGuard([] { UnixSocket::setDefaultBackend(UnixSocket::Notifier); });
+
+    QElapsedTimer timer;
+    if(handshake) {
+        VSockUserServer server;
+        QVERIFY2(server.listen(SERVER_PATH + "-vsock", VSockUserServer::Local, CONNECT_PORT),
+            qUtf8Printable(server.errorString()));
+
+        QList<qint64> latencies;
+        latencies.reserve(CONNECT_COUNT);
+        QElapsedTimer batchTimer;
+        timer.start();
+        for(int i = 0; i < CONNECT_COUNT; i += batch) {
+            QList<VSockUser*> clients;
+            auto deleteClients = qScopeGuard([&clients] { qDeleteAll(clients); });
+            int count = qMin(batch, CONNECT_COUNT - i);
+            batchTimer.start();
+            for(int j = 0; j < count; j++) {
+                VSockUser* client = new VSockUser();
+                clients.append(client);
+                connect(client, &VSockUser::connected, client, [&latencies, &batchTimer] {
+                    latencies.append(batchTimer.nsecsElapsed());
+                });
+                QVERIFY2(client->connectToServer(server.fullServerName(),
+                    VSockUserServer::Local, CONNECT_PORT, VSockUserServer::Local, -2U),
+                    qUtf8Printable(client->errorString()));
+            }
+
+            // The server, running on this thread too, replies from the event loop
+            QDeadlineTimer deadline(3000);
+            while(latencies.size() < i + count && !deadline.hasExpired())
+                QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+            QCOMPARE(latencies.size(), qsizetype(i + count));
+            while(server.hasPendingConnections())
+                delete server.nextPendingConnection();
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+        qint64 median = latencies[latencies.size() / 2];
+        qint64 p99 = latencies[latencies.size() * 99 / 100];
+        qInfo("%s: handshake median %.1f us, p99 %.1f us", QTest::currentDataTag(), median / 1e3, p99 / 1e3);
+        m_results.record("median", median / 1e3, "us", true);
+        m_results.record("p99", p99 / 1e3, "us", true);
+    }
+    else {
+        UnixSocketServer server;
+        server.setListenBacklogSize(CONNECT_COUNT);
+        QVERIFY2(server.listen(SERVER_PATH + "-connect"), qUtf8Printable(server.errorString()));
+
+        timer.start();
+        for(int i = 0; i < CONNECT_COUNT; i++) {
+            UnixSocket client;
+            QVERIFY2(client.connectToServer(server.fullServerName()), qUtf8Printable(client.errorString()));
+            QVERIFY(server.waitForNewConnection(3000));
+            UnixSocket* peer = server.nextPendingConnection();
+            QVERIFY(peer);
+            if(peer->backend() != backend)
+                QSKIP("The backend isn't available here");
+            peer->close();
+            // Lets the deferred deletes of the closed connections run
+            QCoreApplication::processEvents();
+        }
+    }
+    qint64 wall = timer.nsecsElapsed();
+
+    double rate = CONNECT_COUNT / (wall / 1e9);
+    qInfo("%s: %.0f connections/s", QTest::currentDataTag(), rate);
+    m_results.record("rate", rate, "1/s", false);
+    QTest::setBenchmarkResult(wall / CONNECT_COUNT, QTest::WalltimeNanoseconds);
+}
+
+void bench_Sockets::benchFanOut_data() {
+    QTest::addColumn<UnixSocket::Backend>("backend");
+    QTest::addColumn<int>("readers");
+
+    for(const auto& backend : BACKENDS) {
+        // Terminals attached to one VM's console
+        for(int readers : { 1, 8, 64 })
+            QTest::addRow("%s %d readers", backend.first, readers) << backend.second << readers;
+    }
+}
+
+void bench_Sockets::benchFanOut() {
+    QFETCH(UnixSocket::Backend, backend);
+    QFETCH(int, readers);
+
+    UnixSocket::setDefaultBackend(backend);
+    auto restoreBackend = qScopeGuard([] { UnixSocket::setDefaultBackend(UnixSocket::Notifier); });
+
+    UnixSocketServer server;
+    server.setListenBacklogSize(readers);
+    QVERIFY2(server.listen(SERVER_PATH + "-fanout"), qUtf8Printable(server.errorString()));
+
+    qint64 received = 0;
+    QList<UnixSocket*> clients;
+    auto deleteClients = qScopeGuard([&clients] { qDeleteAll(clients); });
+    for(int i = 0; i < readers; i++) {
+        UnixSocket* client = new UnixSocket();
+        QVERIFY2(client->connectToServer(server.fullServerName()), qUtf8Printable(client->errorString()));
+        connect(client, &UnixSocket::readyRead, client, [&received, client] {
+            received += client->readAll().size();
+        });
+        clients.append(client);
+    }
+
+    QList<UnixSocket*> peers;
+    QDeadlineTimer deadline(3000);
+    while(peers.size() < readers && server.waitForNewConnection(deadline.remainingTime())) {
+        while(server.hasPendingConnections())
+            peers.append(server.nextPendingConnection());
+    }
+    QCOMPARE(peers.size(), readers);
+    if(peers.first()->backend() != backend)
+        QSKIP("The backend isn't available here");
+
+    // Same as the console relay, one buffer shared by every reader's queue
+    QByteArray chunk(FANOUT_WRITE_SZ, 'x');
+    const qint64 expected = qint64(FANOUT_BYTES) * readers;
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 cpuStart = threadCpuNsecs();
+    for(qint64 total = 0; total < FANOUT_BYTES; total += chunk.size()) {
+        for(UnixSocket* peer : peers)
+            peer->write(chunk);
+
+        auto behind = [&peers] {
+            for(UnixSocket* peer : peers) {
+                if(peer->bytesToWrite() > FANOUT_QUEUE_LIMIT)
+                    return true;
+            }
+            return false;
+        };
+        while(behind())
+            QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    deadline.setRemainingTime(60000);
+    while(received < expected && !deadline.hasExpired())
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    qint64 wall = timer.nsecsElapsed();
+    qint64 cpu = threadCpuNsecs() - cpuStart;
+    QCOMPARE(received, expected);
+
+    // The readers share the thread, the cost per delivered MiB covers both sides
+    double mib = expected / (1024.0 * 1024.0);
+    qInfo("%s: %.1f MiB/s delivered, %.2f ms cpu per MiB", QTest::currentDataTag(),
+        mib / (wall / 1e9), cpu / 1e6 / mib);
+    m_results.record("delivered", mib / (wall / 1e9), "MiB/s", false);
+    m_results.record("cpu", cpu / 1e6 / mib, "ms/MiB", true);
+    QTest::setBenchmarkResult(wall, QTest::WalltimeNanoseconds);
+}
+
+QTEST_MAIN(bench_Sockets)
+
+#include "bench_sockets.moc"
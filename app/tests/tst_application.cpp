@@ -0,0 +1,114 @@
+#include <QtTest/QtTest>
+
+#include <QtCore/QStandardPaths>
+#include <QtCore/QTemporaryDir>
+
+#include "../src/Application.hpp"
+#include "../src/PresentationLoader.hpp"
+#include "../src/PresentationWindow.hpp"
+
+/*
+ * Opens presentations through Application::addWindow() like main() does.
+ * Application reads Config.jsonc from the application's directory, so it is
+ * written next to the test binary before the application is created.
+ * Run with QT_QPA_PLATFORM=offscreen on headless machines.
+ */
+
+class tst_Application : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testOpenDirectory();
+};
+
+void tst_Application::testOpenDirectory() {
+    QTemporaryDir deck;
+    QVERIFY2(deck.isValid(), qUtf8Printable(deck.errorString()));
+
+    QFile rootXml(deck.filePath("root.xml"));
+    QVERIFY2(rootXml.open(QIODevice::WriteOnly), qUtf8Printable(rootXml.errorString()));
+    rootXml.write(
+        "<Presentation title=\"Unpacked\">\n"
+        "<Slide bg=\"white\">\n"
+        "<Box x=\"10\" y=\"10\" width=\"80\" height=\"20\"><html><h2>Unpacked</h2></html></Box>\n"
+        "</Slide>\n"
+        "</Presentation>\n"
+    );
+    rootXml.close();
+
+    PresentationLoader* loader = Application::Instance()->addWindow(deck.path());
+    QVERIFY(loader != nullptr);
+
+    QSignalSpy firstSlideReady(loader, &PresentationLoader::firstSlideReady);
+    QSignalSpy failed(loader, &PresentationLoader::failed);
+    QTRY_VERIFY(firstSlideReady.count() == 1 || failed.count() == 1);
+    if(!failed.isEmpty())
+        QFAIL(qUtf8Printable(failed.first().first().toString()));
+
+    PresentationWindow* win = nullptr;
+    for(QWidget* widget : QApplication::topLevelWidgets()) {
+        if(auto w = qobject_cast<PresentationWindow*>(widget))
+            win = w;
+    }
+    QVERIFY(win != nullptr);
+
+    QPointer<PresentationWindow> guard(win);
+    win->close();
+    QTRY_VERIFY(guard.isNull());
+}
+
+int main(int argc, char* argv[]) {
+    // Keeps cached presentation indexes away from the user's cache
+    QStandardPaths::setTestModeEnabled(true);
+
+    QTemporaryDir dir;
+    if(!dir.isValid()) {
+        qCritical("%s", qUtf8Printable(dir.errorString()));
+        return 1;
+    }
+
+    // Config resolves paths relative to the application's directory
+    QDir appDir(QFileInfo(QString::fromLocal8Bit(argv[0])).canonicalPath());
+    QString imagePath = dir.filePath("test.img");
+    QString kernelPath = dir.filePath("bzImage");
+
+    for(auto& path : { imagePath, kernelPath }) {
+        QFile file(path);
+        if(!file.open(QIODevice::WriteOnly)) {
+            qCritical("%s", qUtf8Printable(file.errorString()));
+            return 1;
+        }
+        file.write(QByteArray(64 * 1024, '\0'));
+    }
+
+    QFile config(appDir.filePath("Config.jsonc"));
+    if(!config.open(QIODevice::WriteOnly)) {
+        qCritical("%s", qUtf8Printable(config.errorString()));
+        return 1;
+    }
+    config.write(QStringLiteral(
+        "{\n"
+        "    \"images\": [ { \"imageName\": \"test\", \"path\": \"%1\" } ],\n"
+        "    \"kernelPath\": \"%2\",\n"
+        "    \"kvmEnabled\": false,\n"
+        "    \"slidePrefetchDistance\": 0\n"
+        "}\n"
+    ).arg(appDir.relativeFilePath(imagePath), appDir.relativeFilePath(kernelPath)).toUtf8());
+    config.close();
+
+    Application* app = Application::Instance(argc, argv);
+    if(app == nullptr) {
+        config.remove();
+        return 1;
+    }
+    app->setQuitOnLastWindowClosed(false);
+
+    tst_Application tc;
+    int ret = QTest::qExec(&tc, argc, argv);
+
+    Application::CleanUp();
+    config.remove();
+    return ret;
+}
+
+#include "tst_application.moc"
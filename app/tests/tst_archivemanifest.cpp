@@ -0,0 +1,66 @@
+#include <QtTest/QtTest>
+
+#include "../src/ArchiveManifest.hpp"
+
+class tst_ArchiveManifest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testNormalizePath_data();
+    void testNormalizePath();
+    void testLookup();
+};
+
+void tst_ArchiveManifest::testNormalizePath_data() {
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<QString>("expected");
+
+    QTest::newRow("plain") << "root.xml" << "root.xml";
+    QTest::newRow("nested") << "img/bg.png" << "img/bg.png";
+    QTest::newRow("dot") << "./img/bg.png" << "img/bg.png";
+    QTest::newRow("directory") << "img/" << "img";
+    QTest::newRow("inner parent") << "img/../root.xml" << "root.xml";
+    QTest::newRow("empty") << "" << QString();
+    QTest::newRow("current") << "." << QString();
+    QTest::newRow("parent") << ".." << QString();
+    QTest::newRow("escape") << "../root.xml" << QString();
+    QTest::newRow("nested escape") << "img/../../root.xml" << QString();
+    QTest::newRow("absolute") << "/etc/passwd" << QString();
+}
+
+void tst_ArchiveManifest::testNormalizePath() {
+    QFETCH(QString, path);
+    QFETCH(QString, expected);
+
+    QCOMPARE(ArchiveManifest::normalizePath(path), expected);
+}
+
+void tst_ArchiveManifest::testLookup() {
+    ArchiveManifest manifest;
+
+    ArchiveEntry entry;
+    entry.index = 3;
+    entry.size = 42;
+    QVERIFY(manifest.insert("slides/img/bg.png", entry));
+    QVERIFY(!manifest.insert("../evil.sh", entry));
+
+    QVERIFY(manifest.contains("slides/img/bg.png"));
+    QVERIFY(manifest.contains("./slides/img/../img/bg.png"));
+    QVERIFY(!manifest.contains("bg.png"));
+    QVERIFY(!manifest.contains("../evil.sh"));
+
+    const ArchiveEntry* found = manifest.entry("slides/img/bg.png");
+    QVERIFY(found != nullptr);
+    QCOMPARE(found->index, quint64(3));
+    QCOMPARE(found->size, qint64(42));
+    QCOMPARE(found->isDir, false);
+
+    // Parent directories are implicit
+    QVERIFY(manifest.contains("slides"));
+    QVERIFY(manifest.entry("slides/img")->isDir);
+    QCOMPARE(manifest.count(), qsizetype(3));
+}
+
+QTEST_MAIN(tst_ArchiveManifest)
+
+#include "tst_archivemanifest.moc"
@@ -0,0 +1,186 @@
+#include <QtTest/QtTest>
+
+#include <sys/uio.h>
+
+#include "../src/SocketBuffer.hpp"
+
+class tst_SocketBuffer : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testAppendRead();
+    void testReserveCommit();
+    void testIndexOf();
+    void testReadAll();
+    void testAppendBuffer();
+    void testWriteQueue();
+    void testWriteQueueDiscard();
+};
+
+static QByteArray pattern(qint64 size) {
+    QByteArray data(size, Qt::Uninitialized);
+    for(qint64 i = 0; i < size; i++)
+        data[i] = char('a' + i % 26);
+    return data;
+}
+
+void tst_SocketBuffer::testAppendRead() {
+    SocketBuffer buffer(16);
+    QByteArray data = pattern(100);
+
+    buffer.append(data.constData(), 40);
+    buffer.append(data.constData() + 40, 60);
+    QCOMPARE(buffer.size(), qint64(100));
+    QCOMPARE(buffer.nextDataBlockSize(), qint64(16));
+    QCOMPARE(buffer.peek(100), data);
+
+    char out[100];
+    QCOMPARE(buffer.read(out, 30), qint64(30));
+    QCOMPARE(QByteArray(out, 30), data.left(30));
+    QCOMPARE(buffer.skip(10), qint64(10));
+    QCOMPARE(buffer.read(out, 100), qint64(60));
+    QCOMPARE(QByteArray(out, 60), data.mid(40));
+    QVERIFY(buffer.isEmpty());
+    QVERIFY(buffer.readPointer() == nullptr);
+
+    // Drained chunks are reused
+    buffer.append(data.constData(), 20);
+    QCOMPARE(buffer.readAll(), data.left(20));
+}
+
+void tst_SocketBuffer::testReserveCommit() {
+    SocketBuffer buffer(16);
+    QByteArray data = pattern(40);
+
+    struct iovec iov[2];
+    buffer.append(data.constData(), 10);
+    QCOMPARE(buffer.reserve(iov, 2), 2);
+    QCOMPARE(qint64(iov[0].iov_len), qint64(6));
+    QCOMPARE(qint64(iov[1].iov_len), qint64(16));
+
+    memcpy(iov[0].iov_base, data.constData() + 10, 6);
+    memcpy(iov[1].iov_base, data.constData() + 16, 4);
+    buffer.commit(10);
+    QCOMPARE(buffer.size(), qint64(20));
+
+    // The partially written chunk is continued
+    QCOMPARE(buffer.reserve(iov, 1), 1);
+    QCOMPARE(qint64(iov[0].iov_len), qint64(12));
+    memcpy(iov[0].iov_base, data.constData() + 20, 12);
+    buffer.commit(12);
+
+    buffer.append(data.constData() + 32, 8);
+    QCOMPARE(buffer.peek(40), data);
+}
+
+void tst_SocketBuffer::testIndexOf() {
+    SocketBuffer buffer(8);
+    QByteArray data = "first line\nsecond line\n";
+    buffer.append(data.constData(), data.size());
+
+    QCOMPARE(buffer.indexOf('\n'), qint64(data.indexOf('\n')));
+    QCOMPARE(buffer.indexOf('\n', 11), qint64(data.indexOf('\n', 11)));
+    QCOMPARE(buffer.indexOf('x'), qint64(-1));
+    QCOMPARE(buffer.indexOf('\n', data.size()), qint64(-1));
+
+    buffer.skip(11);
+    QCOMPARE(buffer.indexOf('s'), qint64(0));
+    QCOMPARE(buffer.indexOf('\n'), qint64(11));
+}
+
+void tst_SocketBuffer::testReadAll() {
+    SocketBuffer buffer(16);
+    QByteArray data = pattern(50);
+
+    // Fills a whole chunk, handed over without copying
+    buffer.append(data.constData(), 16);
+    const char* chunk = buffer.readPointer();
+    QByteArray all = buffer.readAll();
+    QCOMPARE(all, data.left(16));
+    QVERIFY(all.constData() == chunk);
+    QVERIFY(buffer.isEmpty());
+
+    buffer.append(data.constData(), 50);
+    buffer.skip(5);
+    QCOMPARE(buffer.readAll(), data.mid(5));
+    QVERIFY(buffer.isEmpty());
+    QCOMPARE(buffer.readAll(), QByteArray());
+}
+
+void tst_SocketBuffer::testAppendBuffer() {
+    SocketBuffer buffer(16);
+    SocketBuffer incoming(16);
+    QByteArray data = pattern(60);
+
+    buffer.append(data.constData(), 10);
+    incoming.append(data.constData() + 10, 40);
+    const char* moved = incoming.readPointer();
+
+    buffer.append(std::move(incoming));
+    QVERIFY(incoming.isEmpty());
+    QCOMPARE(buffer.size(), qint64(50));
+
+    // Writing continues after the moved data
+    buffer.append(data.constData() + 50, 10);
+    QCOMPARE(buffer.skip(10), qint64(10));
+    QVERIFY(buffer.readPointer() == moved);
+    QCOMPARE(buffer.readAll(), data.mid(10));
+}
+
+void tst_SocketBuffer::testWriteQueue() {
+    SocketWriteQueue queue;
+    QByteArray large = pattern(SOCKET_WRITE_COALESCE_SZ * 2);
+
+    queue.append("ab", 2);
+    queue.append(QByteArray("cd"));
+    queue.append(large);
+    queue.append("ef", 2);
+    QCOMPARE(queue.size(), qint64(6 + large.size()));
+
+    struct iovec iov[8];
+    QCOMPARE(queue.segments(iov, 8), 3);
+    // Small writes are coalesced, large ones are shared
+    QCOMPARE(QByteArray((const char*)iov[0].iov_base, iov[0].iov_len), QByteArray("abcd"));
+    QVERIFY(iov[1].iov_base == large.constData());
+    QCOMPARE(QByteArray((const char*)iov[2].iov_base, iov[2].iov_len), QByteArray("ef"));
+
+    queue.free(3);
+    QCOMPARE(queue.segments(iov, 1), 1);
+    QCOMPARE(QByteArray((const char*)iov[0].iov_base, iov[0].iov_len), QByteArray("d"));
+
+    queue.free(1 + large.size() - 10);
+    QCOMPARE(queue.segments(iov, 8), 2);
+    QCOMPARE(QByteArray((const char*)iov[0].iov_base, iov[0].iov_len), large.right(10));
+
+    queue.free(12);
+    QVERIFY(queue.isEmpty());
+    QCOMPARE(queue.segments(iov, 8), 0);
+}
+
+void tst_SocketBuffer::testWriteQueueDiscard() {
+    SocketWriteQueue queue;
+    QByteArray large = pattern(SOCKET_WRITE_COALESCE_SZ * 2);
+
+    for(int i = 0; i < 4; i++)
+        queue.append(large);
+    struct iovec iov[8];
+
+    // Whole segments go, the ones being sent stay
+    QCOMPARE(queue.discard(1, 1), qint64(large.size()));
+    QCOMPARE(queue.size(), qint64(3 * large.size()));
+    QCOMPARE(queue.segments(iov, 8), 3);
+
+    // So does the rest of a partially sent one
+    queue.free(10);
+    QCOMPARE(queue.discard(large.size() + 1), qint64(2 * large.size()));
+    QCOMPARE(queue.segments(iov, 8), 1);
+    QCOMPARE(QByteArray((const char*)iov[0].iov_base, iov[0].iov_len), large.mid(10));
+
+    QCOMPARE(queue.discard(large.size()), qint64(0));
+    queue.free(large.size() - 10);
+    QVERIFY(queue.isEmpty());
+}
+
+QTEST_MAIN(tst_SocketBuffer)
+
+#include "tst_socketbuffer.moc"
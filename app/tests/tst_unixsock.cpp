@@ -3,6 +3,13 @@
 #include <QtCore/QThread>
 #include <QtCore/QUuid>
 
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../src/IoUring.hpp"
+#include "../src/SpliceRelay.hpp"
 #include "../src/UnixSocket.hpp"
 #include "../src/UnixSocketServer.hpp"
 
@@ -15,6 +22,21 @@ private slots:
     void testGeneral();
     void testClose();
     void testEchoServer();
+    void testLargeTransfer();
+    void testWaitTimeout();
+    void testInterruptWait();
+    void testBatchedAccept();
+    void testStatistics();
+    void testWaterMarks();
+    void testOverflowPolicy_data();
+    void testOverflowPolicy();
+    void testSeqPacket();
+    void testPassFd_data();
+    void testPassFd();
+    void testBackend_data();
+    void testBackend();
+    void testSpliceRelay_data();
+    void testSpliceRelay();
 };
 
 void tst_UnixSocket::testClose() {
@@ -115,6 +137,582 @@ void tst_UnixSocket::testEchoServer() {
     server.close();
 }
 
+void tst_UnixSocket::testLargeTransfer() {
+    UnixSocketServer server;
+    QVERIFY2(server.listen(SERVER_PATH), qUtf8Printable(server.errorString()));
+
+    UnixSocket socket;
+    QVERIFY2(socket.connectToServer(server.fullServerName()), qUtf8Printable(socket.errorString()));
+    QVERIFY(server.waitForNewConnection(3000));
+    UnixSocket *serverSocket = server.nextPendingConnection();
+    QVERIFY(serverSocket);
+
+    QByteArray data(4 * 1024 * 1024, Qt::Uninitialized);
+    for (qsizetype i = 0; i < data.size(); ++i)
+        data[i] = char(i % 251);
+    serverSocket->write(data);
+
+    QByteArray received;
+    QDeadlineTimer deadline(10000);
+    while (received.size() < data.size() && !deadline.hasExpired()) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        if (socket.bytesAvailable() >= 4) {
+            QByteArray head = socket.peek(4);
+            QCOMPARE(head, data.mid(received.size(), 4));
+        }
+        received += socket.readAll();
+    }
+
+    QCOMPARE(received.size(), data.size());
+    QVERIFY(received == data);
+
+    // And back, the socket's queue drains while the other side reads
+    QSignalSpy spyBytesWritten(&socket, &UnixSocket::bytesWritten);
+    socket.write(data);
+    received.clear();
+    deadline.setRemainingTime(10000);
+    while (received.size() < data.size() && !deadline.hasExpired()) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        received += serverSocket->readAll();
+    }
+    QCOMPARE(received.size(), data.size());
+    QVERIFY(received == data);
+    QVERIFY(socket.waitForBytesWritten(1000));
+    QCOMPARE(socket.bytesToWrite(), qint64(0));
+    QVERIFY(!spyBytesWritten.isEmpty());
+
+    serverSocket->close();
+    server.close();
+}
+
+void tst_UnixSocket::testWaitTimeout() {
+    UnixSocketServer server;
+    QVERIFY2(server.listen(SERVER_PATH), qUtf8Printable(server.errorString()));
+
+    UnixSocket socket;
+    QVERIFY2(socket.connectToServer(server.fullServerName()), qUtf8Printable(socket.errorString()));
+    QVERIFY(server.waitForNewConnection(3000));
+    UnixSocket *serverSocket = server.nextPendingConnection();
+    QVERIFY(serverSocket);
+
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(!socket.waitForReadyRead(100));
+    QVERIFY(timer.elapsed() >= 100);
+    QVERIFY(socket.isOpen());
+
+    serverSocket->write("ping\n");
+    QVERIFY(serverSocket->waitForBytesWritten(1000));
+    QVERIFY(socket.waitForReadyRead(1000));
+    QCOMPARE(socket.readAll(), QByteArray("ping\n"));
+
+    serverSocket->close();
+    server.close();
+}
+
+void tst_UnixSocket::testInterruptWait() {
+    UnixSocketServer server;
+    QVERIFY2(server.listen(SERVER_PATH), qUtf8Printable(server.errorString()));
+
+    UnixSocket socket;
+    QVERIFY2(socket.connectToServer(server.fullServerName()), qUtf8Printable(socket.errorString()));
+    QVERIFY(server.waitForNewConnection(3000));
+
+    QThread* interrupter = QThread::create([&socket] {
+        QThread::msleep(50);
+        socket.interruptWait();
+    });
+    interrupter->start();
+
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(!socket.waitForReadyRead(5000));
+    QVERIFY(timer.elapsed() < 5000);
+    QVERIFY(socket.isOpen());
+
+    interrupter->wait();
+    delete interrupter;
+
+    // The interrupt is consumed by the wait it woke up
+    QVERIFY(!socket.waitForReadyRead(10));
+
+    server.close();
+}
+
+void tst_UnixSocket::testBatchedAccept() {
+    const int clientCount = 32;
+
+    UnixSocketServer server;
+    server.setListenBacklogSize(clientCount);
+    QCOMPARE(server.listenBacklogSize(), clientCount);
+    QVERIFY2(server.listen(SERVER_PATH), qUtf8Printable(server.errorString()));
+
+    QSignalSpy spyNewConnection(&server, &UnixSocketServer::newConnection);
+    QList<UnixSocket*> clients;
+    for (int i = 0; i < clientCount; ++i) {
+        UnixSocket* client = new UnixSocket(this);
+        QVERIFY2(client->connectToServer(server.fullServerName()), qUtf8Printable(client->errorString()));
+        clients.append(client);
+    }
+
+    // Every queued connection is taken in one go
+    QVERIFY(server.waitForNewConnection(3000));
+    QCOMPARE(spyNewConnection.size(), clientCount);
+
+    int pending = 0;
+    while (server.hasPendingConnections()) {
+        QVERIFY(server.nextPendingConnection()->isOpen());
+        pending++;
+    }
+    QCOMPARE(pending, clientCount);
+
+    UnixSocketServer::AcceptStatistics stats = server.acceptStatistics();
+    QCOMPARE(stats.accepted, quint64(clientCount));
+    QCOMPARE(stats.failed, quint64(0));
+    QCOMPARE(stats.batches, quint64(1));
+    QCOMPARE(stats.largestBatch, quint64(clientCount));
+
+    // Nothing left, the wait times out
+    bool timedOut = false;
+    QVERIFY(!server.waitForNewConnection(10, &timedOut));
+    QVERIFY(timedOut);
+
+    qDeleteAll(clients);
+    server.close();
+}
+
+void tst_UnixSocket::testStatistics() {
+    UnixSocketServer server;
+    QVERIFY2(server.listen(SERVER_PATH), qUtf8Printable(server.errorString()));
+
+    UnixSocket socket;
+    QVERIFY2(socket.connectToServer(server.fullServerName()), qUtf8Printable(socket.errorString()));
+    QVERIFY(server.waitForNewConnection(3000));
+    UnixSocket *serverSocket = server.nextPendingConnection();
+    QVERIFY(serverSocket);
+
+    QByteArray data(64 * 1024, 'x');
+    serverSocket->write(data);
+    QVERIFY(serverSocket->waitForBytesWritten(1000));
+
+    QByteArray received;
+    QDeadlineTimer deadline(3000);
+    while (received.size() < data.size() && socket.waitForReadyRead(deadline.remainingTime()))
+        received += socket.readAll();
+    QCOMPARE(received.size(), data.size());
+
+    SocketStatistics written = serverSocket->statistics();
+    QCOMPARE(written.bytesWritten, quint64(data.size()));
+    QCOMPARE(written.bytesRead, quint64(0));
+    QCOMPARE(written.queuedBytes, quint64(0));
+    QVERIFY(written.peakWriteQueue > 0);
+    QVERIFY(written.syscalls > 0);
+
+    SocketStatistics read = socket.statistics();
+    QCOMPARE(read.bytesRead, quint64(data.size()));
+    QCOMPARE(read.bytesWritten, quint64(0));
+    QVERIFY(read.peakReadBuffer > 0);
+    QVERIFY(read.syscalls > 0);
+
+    SocketStatistics sum = written;
+    sum += read;
+    QCOMPARE(sum.bytesRead + sum.bytesWritten, quint64(2 * data.size()));
+    QCOMPARE(sum.syscalls, written.syscalls + read.syscalls);
+    QCOMPARE(sum.peakWriteQueue, written.peakWriteQueue);
+
+    serverSocket->close();
+    server.close();
+}
+
+void tst_UnixSocket::testWaterMarks() {
+    UnixSocketServer server;
+    QVERIFY2(server.listen(SERVER_PATH), qUtf8Printable(server.errorString()));
+
+    UnixSocket socket;
+    QVERIFY2(socket.connectToServer(server.fullServerName()), qUtf8Printable(socket.errorString()));
+    QVERIFY(server.waitForNewConnection(3000));
+    UnixSocket *serverSocket = server.nextPendingConnection();
+    QVERIFY(serverSocket);
+
+    serverSocket->setWriteBufferLimits(256 * 1024);
+    QCOMPARE(serverSocket->lowWaterMark(), qint64(128 * 1024));
+    QSignalSpy spyHigh(serverSocket, &UnixSocket::highWaterMarkReached);
+    QSignalSpy spyLow(serverSocket, &UnixSocket::lowWaterMarkReached);
+
+    // Nobody reads, the queue fills up past the kernel's buffer
+    QByteArray data(16 * 1024, 'x');
+    qint64 written = 0;
+    while (!serverSocket->isWriteBufferFull() && written < 16 * 1024 * 1024) {
+        QCOMPARE(serverSocket->write(data), qint64(data.size()));
+        written += data.size();
+    }
+    QVERIFY(serverSocket->isWriteBufferFull());
+    QCOMPARE(spyHigh.size(), 1);
+    // Block keeps the data
+    QCOMPARE(serverSocket->statistics().droppedBytes, quint64(0));
+
+    // Reading the other end drains it below the low water mark
+    qint64 received = 0;
+    QDeadlineTimer deadline(10000);
+    while (spyLow.isEmpty() && !deadline.hasExpired()) {
+        if (socket.waitForReadyRead(10))
+            received += socket.readAll().size();
+        QCoreApplication::processEvents();
+    }
+    QCOMPARE(spyLow.size(), 1);
+    QVERIFY(!serverSocket->isWriteBufferFull());
+    QVERIFY(serverSocket->bytesToWrite() <= serverSocket->lowWaterMark());
+    QVERIFY(received > 0);
+
+    serverSocket->close();
+    server.close();
+}
+
+void tst_UnixSocket::testOverflowPolicy_data() {
+    QTest::addColumn<UnixSocket::OverflowPolicy>("policy");
+
+    QTest::newRow("drop oldest") << UnixSocket::DropOldest;
+    QTest::newRow("disconnect") << UnixSocket::Disconnect;
+}
+
+void tst_UnixSocket::testOverflowPolicy() {
+    QFETCH(UnixSocket::OverflowPolicy, policy);
+
+    UnixSocketServer server;
+    QVERIFY2(server.listen(SERVER_PATH), qUtf8Printable(server.errorString()));
+
+    UnixSocket socket;
+    QVERIFY2(socket.connectToServer(server.fullServerName()), qUtf8Printable(socket.errorString()));
+    QVERIFY(server.waitForNewConnection(3000));
+    UnixSocket *serverSocket = server.nextPendingConnection();
+    QVERIFY(serverSocket);
+
+    const qint64 highWater = 64 * 1024;
+    serverSocket->setWriteBufferLimits(highWater);
+    serverSocket->setOverflowPolicy(policy);
+    QSignalSpy spyHigh(serverSocket, &UnixSocket::highWaterMarkReached);
+    QSignalSpy spyError(serverSocket, &UnixSocket::errorOccurred);
+
+    QByteArray data(16 * 1024, 'x');
+    for (int i = 0; i < 256 && serverSocket->isOpen(); ++i) {
+        serverSocket->write(data);
+        // Bounded whatever the reader does
+        QVERIFY(serverSocket->bytesToWrite() <= highWater);
+    }
+    // Only Block signals it
+    QCOMPARE(spyHigh.size(), 0);
+
+    if (policy == UnixSocket::DropOldest) {
+        QVERIFY(serverSocket->isOpen());
+        QVERIFY(serverSocket->statistics().droppedBytes > 0);
+        QCOMPARE(spyError.size(), 0);
+    }
+    else {
+        QVERIFY(!serverSocket->isOpen());
+        QCOMPARE(spyError.size(), 1);
+        QCOMPARE(serverSocket->error(), ENOBUFS);
+    }
+
+    serverSocket->close();
+    server.close();
+}
+
+void tst_UnixSocket::testSeqPacket() {
+    // Message boundaries can't survive the reactor, it must be left for the notifier
+    UnixSocket::setDefaultBackend(UnixSocket::Reactor);
+    auto restoreBackend = qScopeGuard([] { UnixSocket::setDefaultBackend(UnixSocket::Notifier); });
+
+    UnixSocketServer server;
+    server.setSocketType(UnixSocket::SeqPacket);
+    QVERIFY2(server.listen(SERVER_PATH), qUtf8Printable(server.errorString()));
+
+    UnixSocket socket;
+    socket.setSocketType(UnixSocket::SeqPacket);
+    QVERIFY2(socket.connectToServer(server.fullServerName()), qUtf8Printable(socket.errorString()));
+    QCOMPARE(socket.backend(), UnixSocket::Notifier);
+    QSignalSpy spyNewConnection(&server, &UnixSocketServer::newConnection);
+    QVERIFY(spyNewConnection.wait(3000));
+    UnixSocket *serverSocket = server.nextPendingConnection();
+    QVERIFY(serverSocket);
+    QCOMPARE(serverSocket->socketType(), UnixSocket::SeqPacket);
+
+    QList<QByteArray> messages = {
+        "a",
+        QByteArray(1000, 'b'),
+        QByteArray(SEQPACKET_MAX_MESSAGE_SZ, 'c'),
+        "d\x1e"
+    };
+    for (const QByteArray& message : messages)
+        QCOMPARE(socket.write(message), qint64(message.size()));
+    QVERIFY(socket.waitForBytesWritten(3000));
+
+    QDeadlineTimer deadline(3000);
+    while (serverSocket->bytesAvailable() < SEQPACKET_MAX_MESSAGE_SZ + 1003 && !deadline.hasExpired())
+        serverSocket->waitForReadyRead(10);
+
+    for (const QByteArray& message : messages) {
+        QCOMPARE(serverSocket->pendingMessageSize(), qint64(message.size()));
+        QVERIFY(serverSocket->readMessage() == message);
+    }
+    QVERIFY(!serverSocket->hasPendingMessages());
+    QCOMPARE(serverSocket->readMessage(), QByteArray());
+
+    // A partial stream read leaves the rest of the message
+    serverSocket->write("hello");
+    serverSocket->write("world");
+    QVERIFY(socket.waitForReadyRead(3000));
+    while (socket.bytesAvailable() < 10 && socket.waitForReadyRead(1000));
+    char head[3];
+    QCOMPARE(socket.read(head, 3), qint64(3));
+    QCOMPARE(socket.readMessage(), QByteArray("lo"));
+    QCOMPARE(socket.readMessage(), QByteArray("world"));
+
+    // Too large to be a single message
+    QCOMPARE(socket.writeMessage(QByteArray(SEQPACKET_MAX_MESSAGE_SZ + 1, 'x')), qint64(-1));
+    QCOMPARE(socket.error(), EMSGSIZE);
+    QVERIFY(socket.isOpen());
+
+    serverSocket->close();
+    server.close();
+}
+
+void tst_UnixSocket::testPassFd_data() {
+    QTest::addColumn<UnixSocket::Backend>("backend");
+    QTest::addColumn<UnixSocket::SocketType>("type");
+
+    QTest::newRow("notifier") << UnixSocket::Notifier << UnixSocket::Stream;
+    QTest::newRow("reactor") << UnixSocket::Reactor << UnixSocket::Stream;
+    QTest::newRow("seqpacket") << UnixSocket::Notifier << UnixSocket::SeqPacket;
+}
+
+static int makeMemfd(const QByteArray& content) {
+    int fd = memfd_create("tst_unixsock", MFD_CLOEXEC);
+    if (fd >= 0 && ::write(fd, content.constData(), content.size()) != content.size()) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static QByteArray readMemfd(int fd) {
+    QByteArray content(64, Qt::Uninitialized);
+    ssize_t rc = ::pread(fd, content.data(), content.size(), 0);
+    content.truncate(qMax<ssize_t>(rc, 0));
+    return content;
+}
+
+void tst_UnixSocket::testPassFd() {
+    QFETCH(UnixSocket::Backend, backend);
+    QFETCH(UnixSocket::SocketType, type);
+
+    UnixSocket::setDefaultBackend(backend);
+    auto restoreBackend = qScopeGuard([] { UnixSocket::setDefaultBackend(UnixSocket::Notifier); });
+
+    UnixSocketServer server;
+    server.setSocketType(type);
+    QVERIFY2(server.listen(SERVER_PATH), qUtf8Printable(server.errorString()));
+
+    UnixSocket socket;
+    socket.setSocketType(type);
+    QVERIFY2(socket.connectToServer(server.fullServerName()), qUtf8Printable(socket.errorString()));
+    QSignalSpy spyNewConnection(&server, &UnixSocketServer::newConnection);
+    QVERIFY(spyNewConnection.wait(3000));
+    UnixSocket *serverSocket = server.nextPendingConnection();
+    QVERIFY(serverSocket);
+
+    int first = makeMemfd("first payload");
+    int second = makeMemfd("second payload");
+    QVERIFY(first >= 0 && second >= 0);
+
+    // Plain data before, between and after the descriptors
+    serverSocket->write("head");
+    QVERIFY(serverSocket->sendFd(first, "1"));
+    serverSocket->write("middle");
+    QVERIFY(serverSocket->sendFd(second, "2"));
+    serverSocket->write("tail");
+    // The socket has its own duplicates
+    ::close(first);
+    ::close(second);
+    // Nothing to carry it
+    QVERIFY(!serverSocket->sendFd(0, QByteArray()));
+    QVERIFY(serverSocket->waitForBytesWritten(3000));
+
+    const QByteArray expected = "head1middle2tail";
+    QByteArray received;
+    QList<int> fds;
+    QDeadlineTimer deadline(3000);
+    while (received.size() < expected.size() && !deadline.hasExpired()) {
+        if (socket.bytesAvailable() == 0)
+            socket.waitForReadyRead(10);
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        received += socket.readAll();
+        // Every descriptor is there by the time its byte is
+        if (received.contains('1'))
+            QVERIFY(socket.hasPendingFds() || !fds.isEmpty());
+        while (socket.hasPendingFds())
+            fds.append(socket.receiveFd());
+    }
+    QCOMPARE(received, expected);
+    QCOMPARE(fds.size(), 2);
+    QCOMPARE(readMemfd(fds[0]), QByteArray("first payload"));
+    QCOMPARE(readMemfd(fds[1]), QByteArray("second payload"));
+    QCOMPARE(socket.receiveFd(), -1);
+
+    for (int fd : fds)
+        ::close(fd);
+    serverSocket->close();
+    server.close();
+}
+
+void tst_UnixSocket::testBackend_data() {
+    QTest::addColumn<UnixSocket::Backend>("backend");
+    QTest::addColumn<UnixSocket::Backend>("expected");
+
+    QTest::newRow("reactor") << UnixSocket::Reactor << UnixSocket::Reactor;
+    // Falls back to the notifier without io_uring
+    QTest::newRow("io_uring") << UnixSocket::Uring
+        << (IoUring::isAvailable() ? UnixSocket::Uring : UnixSocket::Notifier);
+}
+
+void tst_UnixSocket::testBackend() {
+    QFETCH(UnixSocket::Backend, backend);
+    QFETCH(UnixSocket::Backend, expected);
+
+    UnixSocket::setDefaultBackend(backend);
+    auto restoreBackend = qScopeGuard([] { UnixSocket::setDefaultBackend(UnixSocket::Notifier); });
+
+    UnixSocketServer server;
+    QVERIFY2(server.listen(SERVER_PATH), qUtf8Printable(server.errorString()));
+
+    UnixSocket socket;
+    QCOMPARE(socket.backend(), backend);
+    QSignalSpy spyDisconnected(&socket, &UnixSocket::disconnected);
+    QVERIFY2(socket.connectToServer(server.fullServerName()), qUtf8Printable(socket.errorString()));
+    QCOMPARE(socket.backend(), expected);
+
+    // Accepting through the backend
+    QSignalSpy spyNewConnection(&server, &UnixSocketServer::newConnection);
+    QVERIFY(spyNewConnection.wait(3000));
+    UnixSocket *serverSocket = server.nextPendingConnection();
+    QVERIFY(serverSocket);
+    QCOMPARE(serverSocket->backend(), expected);
+
+    QByteArray data(4 * 1024 * 1024, Qt::Uninitialized);
+    for (qsizetype i = 0; i < data.size(); ++i)
+        data[i] = char(i % 251);
+    serverSocket->write(data);
+
+    QByteArray received;
+    QDeadlineTimer deadline(10000);
+    while (received.size() < data.size() && !deadline.hasExpired()) {
+        // Blocking waits work too, the data is handed over by the reactor thread
+        if (socket.bytesAvailable() == 0)
+            socket.waitForReadyRead(10);
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        received += socket.readAll();
+    }
+    QCOMPARE(received.size(), data.size());
+    QVERIFY(received == data);
+
+    // And back, the socket's queue drains while the other side reads
+    QSignalSpy spyBytesWritten(&socket, &UnixSocket::bytesWritten);
+    socket.write(data);
+    received.clear();
+    deadline.setRemainingTime(10000);
+    while (received.size() < data.size() && !deadline.hasExpired()) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        received += serverSocket->readAll();
+    }
+    QCOMPARE(received.size(), data.size());
+    QVERIFY(received == data);
+    QVERIFY(socket.waitForBytesWritten(1000));
+    QCOMPARE(socket.bytesToWrite(), qint64(0));
+    QVERIFY(!spyBytesWritten.isEmpty());
+
+    serverSocket->close();
+    QVERIFY(spyDisconnected.size() == 1 || spyDisconnected.wait(1000));
+    QVERIFY(!socket.isOpen());
+
+    server.close();
+}
+
+void tst_UnixSocket::testSpliceRelay_data() {
+    QTest::addColumn<int>("sinkCount");
+
+    QTest::newRow("splice") << 1;
+    QTest::newRow("tee") << 3;
+}
+
+void tst_UnixSocket::testSpliceRelay() {
+    QFETCH(int, sinkCount);
+
+    UnixSocketServer server;
+    QVERIFY2(server.listen(SERVER_PATH), qUtf8Printable(server.errorString()));
+
+    // The client writes into the source, the sinks' clients read
+    QList<UnixSocket*> clients;
+    QList<UnixSocket*> accepted;
+    auto cleanup = qScopeGuard([&] { qDeleteAll(clients); });
+    for (int i = 0; i <= sinkCount; ++i) {
+        UnixSocket *client = new UnixSocket;
+        clients.append(client);
+        QVERIFY2(client->connectToServer(server.fullServerName()), qUtf8Printable(client->errorString()));
+        QVERIFY(server.waitForNewConnection(3000));
+        accepted.append(server.nextPendingConnection());
+        QVERIFY(accepted.last());
+    }
+
+    QVERIFY(SpliceRelay::canRelay(accepted[0]));
+    clients[0]->write("early");
+    QVERIFY(clients[0]->waitForBytesWritten(1000));
+    QVERIFY(accepted[0]->waitForReadyRead(1000));
+
+    SpliceRelay relay(accepted[0]);
+    QVERIFY(relay.isValid());
+    // Already read by the socket, the relay leaves it there
+    QCOMPARE(accepted[0]->readAll(), QByteArray("early"));
+    for (int i = 1; i <= sinkCount; ++i)
+        QVERIFY(relay.addSink(accepted[i]));
+    QCOMPARE(relay.sinkCount(), sinkCount);
+
+    QByteArray data(4 * 1024 * 1024, Qt::Uninitialized);
+    for (qsizetype i = 0; i < data.size(); ++i)
+        data[i] = char(i % 251);
+    clients[0]->write(data);
+
+    QList<QByteArray> received(sinkCount);
+    QDeadlineTimer deadline(10000);
+    auto done = [&] {
+        for (const QByteArray &r : received) {
+            if (r.size() < data.size())
+                return false;
+        }
+        return true;
+    };
+    while (!done() && !deadline.hasExpired()) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        for (int i = 0; i < sinkCount; ++i)
+            received[i] += clients[i + 1]->readAll();
+    }
+    // Block policy, every sink gets all of it in order
+    for (const QByteArray &r : received)
+        QVERIFY(r == data);
+    // Nothing went through the sockets' own buffers
+    QCOMPARE(accepted[0]->bytesAvailable(), qint64(0));
+    QCOMPARE(relay.sourceStatistics().bytesRead, quint64(data.size()));
+    QCOMPARE(relay.sinkStatistics().bytesWritten, quint64(data.size()) * sinkCount);
+    QCOMPARE(relay.sinkStatistics().droppedBytes, quint64(0));
+
+    // A sink that disconnects is removed, the source's EOF closes it
+    QSignalSpy spySourceClosed(accepted[0], &UnixSocket::disconnected);
+    accepted[sinkCount]->close();
+    QCOMPARE(relay.sinkCount(), sinkCount - 1);
+    clients[0]->close();
+    QVERIFY(spySourceClosed.wait(3000));
+
+    server.close();
+}
+
 QTEST_MAIN(tst_UnixSocket)
 
 #include "tst_unixsock.moc"
\ No newline at end of file
@@ -4,8 +4,13 @@
 
 #include <chrono>
 
+#include <unistd.h>
+
+#include "../src/ShmTransport.hpp"
 #include "../src/UnixSocket.hpp"
+#include "../src/UnixSocketServer.hpp"
 #include "../src/VSockUser.hpp"
+#include "../src/VSockUserMux.hpp"
 #include "../src/VSockUserServer.hpp"
 
 using namespace std::chrono;
@@ -24,6 +29,13 @@ private slots:
     void testGeneral();
     void testClose();
     void testEchoServer();
+    void testSharedMemory_data();
+    void testSharedMemory();
+    void testConnectAsync();
+    void testWaitForConnected();
+    void testMultiplex();
+    void testConnectionFilter();
+    void testUnbufferedRead();
 };
 
 void tst_VSockUser::testClose() {
@@ -128,6 +140,392 @@ void tst_VSockUser::testEchoServer() {
     server.close();
 }
 
+void tst_VSockUser::testSharedMemory_data() {
+    QTest::addColumn<bool>("enabled");
+
+    QTest::newRow("accepted") << true;
+    QTest::newRow("fallback") << false;
+}
+
+void tst_VSockUser::testSharedMemory() {
+    QFETCH(bool, enabled);
+
+    VSockUserServer server;
+    QSignalSpy spyNewConnection(&server, &VSockUserServer::newConnection);
+    server.setSharedMemoryEnabled(enabled);
+    QVERIFY2(server.listen(SERVER_PATH, SERVER_CID, SERVER_PORT), qUtf8Printable(server.errorString()));
+
+    // Plays QEMU's part, the transport's descriptors go with the key
+    struct __attribute__((packed)) {
+        uint64_t host_cid;
+        uint64_t vm_cid;
+        uint32_t host_port;
+        uint32_t vm_port;
+    } key = { SERVER_CID, CLIENT_CID, SERVER_PORT, CLIENT_PORT };
+    QByteArray keyData((const char*)&key, sizeof(key));
+
+    int fds[SHM_TRANSPORT_FD_COUNT];
+    QVERIFY(ShmTransport::createFds(fds));
+    UnixSocket client;
+    QVERIFY2(client.connectToServer(server.fullServerName()), qUtf8Printable(client.errorString()));
+    for (int i = 0; i < SHM_TRANSPORT_FD_COUNT; ++i)
+        QVERIFY(client.sendFd(fds[i], keyData.mid(i, 1)));
+    QVERIFY(client.write(keyData.mid(SHM_TRANSPORT_FD_COUNT)) > 0);
+
+    QVERIFY(client.bytesAvailable() > 0 || client.waitForReadyRead(3000));
+    char reply = 0;
+    QCOMPARE(client.read(&reply, 1), (qint64)1);
+    QCOMPARE((int)reply, enabled ? 2 : 1);
+    QVERIFY(spyNewConnection.size() == 1 || spyNewConnection.wait(3000));
+    VSockUser* peer = server.nextPendingConnection();
+    QVERIFY(peer);
+    QCOMPARE(peer->isSharedMemory(), enabled);
+    QSignalSpy spyReadyRead(peer, &VSockUser::readyRead);
+    QSignalSpy spyDisconnected(peer, &VSockUser::disconnected);
+
+    if (!enabled) {
+        for (int i = 0; i < SHM_TRANSPORT_FD_COUNT; ++i)
+            ::close(fds[i]);
+        QVERIFY(client.write(QByteArray("stream")) > 0);
+        QVERIFY(spyReadyRead.wait(3000));
+        QCOMPARE(peer->readAll(), QByteArray("stream"));
+        client.close();
+        QVERIFY(spyDisconnected.size() == 1 || spyDisconnected.wait(3000));
+        return;
+    }
+
+    ShmTransport* shm = ShmTransport::attach(ShmTransport::Creator, fds);
+    QVERIFY(shm);
+    QByteArray data(3 * SHM_TRANSPORT_RING_SZ + 123, Qt::Uninitialized);
+    for (int i = 0; i < data.size(); ++i)
+        data[i] = char(i * 7);
+
+    // Guest to host, the first write rings the peer
+    qint64 sent = shm->write(data.constData(), data.size());
+    QCOMPARE(sent, (qint64)SHM_TRANSPORT_RING_SZ);
+    QVERIFY(spyReadyRead.wait(3000));
+    QByteArray received;
+    QDeadlineTimer deadline(5000);
+    while (received.size() < data.size() && !deadline.hasExpired()) {
+        received += peer->readAll();
+        sent += shm->write(data.constData() + sent, data.size() - sent);
+    }
+    QCOMPARE(received, data);
+
+    // Host to guest, what doesn't fit is queued until the guest reads
+    QCOMPARE(peer->write(data), (qint64)data.size());
+    QVERIFY(peer->bytesToWrite() > 0);
+    QByteArray echoed;
+    char buf[16 * 1024];
+    while (echoed.size() < data.size() && !deadline.hasExpired()) {
+        qint64 n = shm->read(buf, sizeof(buf));
+        if (n > 0)
+            echoed.append(buf, n);
+        else
+            peer->waitForBytesWritten(100);
+    }
+    QCOMPARE(echoed, data);
+    QCOMPARE(peer->bytesToWrite(), (qint64)0);
+
+    // The socket only carried the key and the reply
+    SocketStatistics stats = peer->statistics();
+    QCOMPARE(stats.bytesRead, (quint64)(data.size() + keyData.size()));
+    QCOMPARE(stats.bytesWritten, (quint64)(data.size() + 1));
+
+    delete shm;
+    client.close();
+    QVERIFY(spyDisconnected.size() == 1 || spyDisconnected.wait(3000));
+    QVERIFY(!peer->isSharedMemory());
+    server.close();
+}
+
+void tst_VSockUser::testConnectAsync() {
+    VSockUserServer server;
+    QSignalSpy spyNewConnection(&server, &VSockUserServer::newConnection);
+    QVERIFY2(server.listen(SERVER_PATH, SERVER_CID, SERVER_PORT), qUtf8Printable(server.errorString()));
+
+    VSockUser socket;
+    QSignalSpy spyConnected(&socket, &VSockUser::connected);
+    QSignalSpy spyError(&socket, &VSockUser::errorOccurred);
+
+    // Returns before the server had a chance to reply
+    QVERIFY(socket.connectToServer(server.fullServerName(), SERVER_CID, SERVER_PORT, CLIENT_CID, CLIENT_PORT));
+    QVERIFY(socket.isConnecting());
+    QVERIFY(!socket.isOpen());
+    QCOMPARE(spyConnected.size(), 0);
+    QVERIFY(spyConnected.wait(3000));
+    QVERIFY(!socket.isConnecting());
+    QVERIFY(socket.isOpen());
+    QVERIFY(spyNewConnection.size() == 1 || spyNewConnection.wait(3000));
+    delete server.nextPendingConnection();
+    socket.close();
+
+    // Cancelled, nothing is emitted
+    QVERIFY(socket.connectToServer(server.fullServerName(), SERVER_CID, SERVER_PORT, CLIENT_CID, CLIENT_PORT));
+    socket.abort();
+    QVERIFY(!socket.isConnecting());
+    QTest::qWait(100);
+    QCOMPARE(spyConnected.size(), 1);
+    QCOMPARE(spyError.size(), 0);
+    QVERIFY(!socket.isOpen());
+
+    // Rejected by the server
+    QVERIFY(socket.connectToServer(server.fullServerName(), SERVER_CID, SERVER_PORT + 1, CLIENT_CID, CLIENT_PORT));
+    QVERIFY(spyError.wait(3000));
+    QCOMPARE(socket.error(), ECONNREFUSED);
+    QVERIFY(!socket.isConnecting());
+    QVERIFY(!socket.isOpen());
+    QCOMPARE(spyConnected.size(), 1);
+
+    server.close();
+}
+
+void tst_VSockUser::testWaitForConnected() {
+    // Replies by hand, the client's wait mustn't need the event loop
+    UnixSocketServer server;
+    QVERIFY2(server.listen(SERVER_PATH), qUtf8Printable(server.errorString()));
+
+    VSockUser socket;
+    QSignalSpy spyConnected(&socket, &VSockUser::connected);
+    QSignalSpy spyError(&socket, &VSockUser::errorOccurred);
+    QVERIFY(socket.connectToServer(server.fullServerName(), SERVER_CID, SERVER_PORT, CLIENT_CID, CLIENT_PORT, 200));
+    QVERIFY(server.waitForNewConnection(3000));
+    UnixSocket *peer = server.nextPendingConnection();
+    QVERIFY(peer);
+
+    // No reply yet
+    QVERIFY(!socket.waitForConnected(50));
+    QVERIFY(socket.isConnecting());
+
+    const char accept = 1;
+    QCOMPARE(peer->write(&accept, 1), (qint64)1);
+    QVERIFY(peer->waitForBytesWritten(1000));
+    QVERIFY(socket.waitForConnected(3000));
+    QCOMPARE(spyConnected.size(), 1);
+    QVERIFY(socket.isOpen());
+    socket.close();
+    peer->close();
+
+    // Nobody replies, the pending connect times out
+    QVERIFY(socket.connectToServer(server.fullServerName(), SERVER_CID, SERVER_PORT, CLIENT_CID, CLIENT_PORT, 200));
+    QVERIFY(spyError.wait(3000));
+    QCOMPARE(socket.error(), ETIMEDOUT);
+    QVERIFY(!socket.isConnecting());
+    QCOMPARE(spyConnected.size(), 1);
+
+    server.close();
+}
+
+void tst_VSockUser::testMultiplex() {
+    VSockUserServer server;
+    QSignalSpy spyNewConnection(&server, &VSockUserServer::newConnection);
+    QVERIFY2(server.listen(SERVER_PATH, SERVER_CID, SERVER_PORT), qUtf8Printable(server.errorString()));
+
+    // Plays QEMU's part: the hello, then frames
+    struct __attribute__((packed)) Key {
+        uint64_t host_cid;
+        uint64_t vm_cid;
+        uint32_t host_port;
+        uint32_t vm_port;
+    };
+    Key hello = { VSOCK_USER_MUX_HELLO_CID, CLIENT_CID, VSOCK_USER_MUX_VERSION, 0 };
+    UnixSocket client;
+    QVERIFY2(client.connectToServer(server.fullServerName()), qUtf8Printable(client.errorString()));
+    QVERIFY(client.write((const char*)&hello, sizeof(hello)) > 0);
+    QVERIFY(client.bytesAvailable() > 0 || client.waitForReadyRead(3000));
+    char reply = 0;
+    QCOMPARE(client.read(&reply, 1), (qint64)1);
+    QCOMPARE((int)reply, 3);
+
+    auto sendFrame = [&client](uint32_t stream, uint32_t op, const QByteArray& payload = QByteArray()) {
+        VSockUserMux::Header header = { stream, op, (uint32_t)payload.size() };
+        client.write((const char*)&header, sizeof(header));
+        if (!payload.isEmpty())
+            client.write(payload);
+    };
+    // The host's side flushes from the event loop
+    auto waitForBytes = [&client](qint64 size) {
+        QDeadlineTimer deadline(3000);
+        while (client.bytesAvailable() < size) {
+            QCoreApplication::processEvents();
+            if (client.bytesAvailable() < size && !client.waitForReadyRead(10) && deadline.hasExpired())
+                return false;
+        }
+        return true;
+    };
+    auto readFrame = [&client, &waitForBytes](VSockUserMux::Header* header, QByteArray* payload) {
+        if (!waitForBytes(sizeof(*header)))
+            return false;
+        client.read((char*)header, sizeof(*header));
+        if (!waitForBytes(header->len))
+            return false;
+        *payload = client.read(header->len);
+        return true;
+    };
+
+    // Opened on the shared socket, accepted like a connection of its own
+    Key key = { SERVER_CID, CLIENT_CID, SERVER_PORT, CLIENT_PORT };
+    sendFrame(1, VSockUserMux::Open, QByteArray((const char*)&key, sizeof(key)));
+    VSockUserMux::Header header;
+    QByteArray payload;
+    QVERIFY(readFrame(&header, &payload));
+    QCOMPARE(header.stream, 1u);
+    QCOMPARE(header.op, (uint32_t)VSockUserMux::Accept);
+    QVERIFY(spyNewConnection.size() == 1 || spyNewConnection.wait(3000));
+    VSockUser* peer = server.nextPendingConnection();
+    QVERIFY(peer);
+    QVERIFY(peer->isMultiplexed());
+    QCOMPARE(peer->vmPort(), CLIENT_PORT);
+    QSignalSpy spyReadyRead(peer, &VSockUser::readyRead);
+    QSignalSpy spyDisconnected(peer, &VSockUser::disconnected);
+
+    // The wrong port is rejected, the stream that's open isn't affected
+    key.host_port = SERVER_PORT + 1;
+    sendFrame(2, VSockUserMux::Open, QByteArray((const char*)&key, sizeof(key)));
+    QVERIFY(readFrame(&header, &payload));
+    QCOMPARE(header.stream, 2u);
+    QCOMPARE(header.op, (uint32_t)VSockUserMux::Reject);
+
+    sendFrame(1, VSockUserMux::Data, QByteArray("stream"));
+    QVERIFY(spyReadyRead.wait(3000));
+    QCOMPARE(peer->readAll(), QByteArray("stream"));
+
+    // The host sends a window's worth, the rest waits for QEMU's credit
+    QByteArray data(VSOCK_USER_MUX_WINDOW + 1000, Qt::Uninitialized);
+    for (int i = 0; i < data.size(); ++i)
+        data[i] = char(i * 7);
+    QCOMPARE(peer->write(data), (qint64)data.size());
+    QByteArray received;
+    while (received.size() < VSOCK_USER_MUX_WINDOW) {
+        QVERIFY(readFrame(&header, &payload));
+        QCOMPARE(header.op, (uint32_t)VSockUserMux::Data);
+        QVERIFY(header.len <= VSOCK_USER_MUX_FRAME_SZ);
+        received += payload;
+    }
+    QCOMPARE(received.size(), (qsizetype)VSOCK_USER_MUX_WINDOW);
+    QCOMPARE(peer->bytesToWrite(), (qint64)1000);
+    uint32_t consumed = received.size();
+    sendFrame(1, VSockUserMux::Credit, QByteArray((const char*)&consumed, sizeof(consumed)));
+    QVERIFY(peer->waitForBytesWritten(3000));
+    QVERIFY(readFrame(&header, &payload));
+    received += payload;
+    QCOMPARE(received, data);
+
+    // Closed by the host
+    peer->close();
+    QVERIFY(readFrame(&header, &payload));
+    QCOMPARE(header.stream, 1u);
+    QCOMPARE(header.op, (uint32_t)VSockUserMux::Close);
+    QCOMPARE(spyDisconnected.size(), 1);
+
+    // Closed by QEMU, with data left to read
+    key.host_port = SERVER_PORT;
+    sendFrame(3, VSockUserMux::Open, QByteArray((const char*)&key, sizeof(key)));
+    QVERIFY(readFrame(&header, &payload));
+    QCOMPARE(header.op, (uint32_t)VSockUserMux::Accept);
+    QVERIFY(spyNewConnection.size() == 2 || spyNewConnection.wait(3000));
+    peer = server.nextPendingConnection();
+    QVERIFY(peer);
+    QByteArray left;
+    connect(peer, &VSockUser::readyRead, this, [peer, &left]() { left += peer->readAll(); });
+    QSignalSpy spyDisconnected2(peer, &VSockUser::disconnected);
+    sendFrame(3, VSockUserMux::Data, QByteArray("last"));
+    sendFrame(3, VSockUserMux::Close);
+    QVERIFY(spyDisconnected2.wait(3000));
+    QCOMPARE(left, QByteArray("last"));
+
+    // The streams go with the shared socket
+    sendFrame(4, VSockUserMux::Open, QByteArray((const char*)&key, sizeof(key)));
+    QVERIFY(readFrame(&header, &payload));
+    QVERIFY(spyNewConnection.size() == 3 || spyNewConnection.wait(3000));
+    peer = server.nextPendingConnection();
+    QVERIFY(peer);
+    QSignalSpy spyDisconnected3(peer, &VSockUser::disconnected);
+    client.close();
+    QVERIFY(spyDisconnected3.wait(3000));
+    QVERIFY(!peer->isMultiplexed());
+
+    server.close();
+}
+
+void tst_VSockUser::testConnectionFilter() {
+    // One listener for every VM, each guest on the port of its own cid
+    VSockUserServer server;
+    QSignalSpy spyNewConnection(&server, &VSockUserServer::newConnection);
+    QSet<uint32_t> registered = { 3, 4 };
+    server.setConnectionFilter([&registered](uint32_t, uint32_t hostPort, uint32_t vmCid, uint32_t) {
+        return hostPort == vmCid && registered.contains(vmCid);
+    });
+    QVERIFY2(server.listen(SERVER_PATH, VSockUserServer::Host, VSockUserServer::Any), qUtf8Printable(server.errorString()));
+
+    for (uint32_t cid : { 3u, 4u }) {
+        VSockUser socket;
+        QSignalSpy spyConnected(&socket, &VSockUser::connected);
+        QVERIFY(socket.connectToServer(server.fullServerName(), VSockUserServer::Host, cid, cid, CLIENT_PORT));
+        QVERIFY(spyConnected.wait(3000));
+        QVERIFY(spyNewConnection.size() == 1 || spyNewConnection.wait(3000));
+        spyNewConnection.clear();
+        VSockUser* peer = server.nextPendingConnection();
+        QVERIFY(peer);
+        QCOMPARE(peer->vmCid(), cid);
+        QCOMPARE(peer->hostPort(), cid);
+        delete peer;
+    }
+
+    // Another VM's port, and a VM that isn't registered
+    VSockUser socket;
+    QSignalSpy spyError(&socket, &VSockUser::errorOccurred);
+    QVERIFY(socket.connectToServer(server.fullServerName(), VSockUserServer::Host, 4, 3, CLIENT_PORT));
+    QVERIFY(spyError.wait(3000));
+    QCOMPARE(socket.error(), ECONNREFUSED);
+    QVERIFY(socket.connectToServer(server.fullServerName(), VSockUserServer::Host, 5, 5, CLIENT_PORT));
+    QVERIFY(spyError.wait(3000));
+    QCOMPARE(socket.error(), ECONNREFUSED);
+    QCOMPARE(spyNewConnection.size(), 0);
+
+    server.close();
+}
+
+void tst_VSockUser::testUnbufferedRead() {
+    VSockUserServer server;
+    QSignalSpy spyNewConnection(&server, &VSockUserServer::newConnection);
+    QVERIFY2(server.listen(SERVER_PATH, SERVER_CID, SERVER_PORT), qUtf8Printable(server.errorString()));
+
+    VSockUser socket;
+    QSignalSpy spyConnected(&socket, &VSockUser::connected);
+    QVERIFY(socket.connectToServer(server.fullServerName(), SERVER_CID, SERVER_PORT, CLIENT_CID, CLIENT_PORT));
+    QVERIFY(spyConnected.wait(3000));
+    QVERIFY(spyNewConnection.size() == 1 || spyNewConnection.wait(3000));
+    VSockUser* peer = server.nextPendingConnection();
+    QVERIFY(peer);
+    QSignalSpy spyReadyRead(peer, &VSockUser::readyRead);
+
+    socket.write("hello\nworld\n");
+    while (peer->bytesAvailable() < 12)
+        QVERIFY(spyReadyRead.wait(3000));
+
+    // Served from the socket's buffer, nothing is consumed or copied into VSockUser
+    QCOMPARE(peer->peek(5), QByteArray("hello"));
+    QCOMPARE(peer->nextDataBlock().toByteArray(), QByteArray("hello\nworld\n"));
+    QCOMPARE(peer->skip(6), qint64(6));
+    QVERIFY(peer->canReadLine());
+    QCOMPARE(peer->readLine(), QByteArray("world\n"));
+    QCOMPARE(peer->bytesAvailable(), qint64(0));
+    QVERIFY(peer->nextDataBlock().isEmpty());
+
+    // What ungetChar() put back comes first, read() has to get it
+    socket.write("abc");
+    while (peer->bytesAvailable() < 3)
+        QVERIFY(spyReadyRead.wait(3000));
+    peer->ungetChar('x');
+    QVERIFY(peer->nextDataBlock().isEmpty());
+    QCOMPARE(peer->bytesAvailable(), qint64(4));
+    QCOMPARE(peer->readAll(), QByteArray("xabc"));
+
+    delete peer;
+    server.close();
+}
+
 QTEST_MAIN(tst_VSockUser)
 
 #include "tst_vsockuser.moc"
\ No newline at end of file
@@ -12,6 +12,7 @@
 #include "qemu/iov.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
+#include "qemu/memfd.h"
 #include "hw/virtio/virtio-vsock.h"
 #include "standard-headers/linux/virtio_ids.h"
 #include "standard-headers/linux/virtio_vsock.h"
@@ -22,6 +23,17 @@
 
 #define BUF_ALLOC (256 * 1024) // 256 KiB
 #define VSOCK_HDR_LEN (sizeof(struct virtio_vsock_hdr))
+/* The rings hold as much as the guest is given credit for */
+#define SHM_RING_SZ BUF_ALLOC
+#define SHM_SEALS (F_SEAL_SHRINK | F_SEAL_GROW)
+
+QEMU_BUILD_BUG_ON(sizeof(VSockUserShmHeader) > VSOCK_USER_SHM_HEADER_SZ);
+QEMU_BUILD_BUG_ON(SHM_RING_SZ & (SHM_RING_SZ - 1));
+/* Read of a stream's data by the guest before the host is credited */
+#define MUX_CREDIT_THRESHOLD (BUF_ALLOC / 4)
+
+static void virtio_vsock_mux_send(VSockUserMux* mux, uint32_t stream, uint32_t op,
+                                  const void* payload, uint32_t len);
 
 
 static gboolean cht_key_cmp(gconstpointer opaque1, gconstpointer opaque2)
@@ -39,6 +51,63 @@ static guint32 cht_key_hash(gconstpointer opaque)
     return qemu_xxhash6(key->host_cid, key->vm_cid, key->host_port, key->vm_port);
 }
 
+static VSockUserShm* virtio_vsock_shm_new(VSockUserConnection* conn, Error** errp)
+{
+    VSockUserShm* shm = g_new0(VSockUserShm, 1);
+    uint8_t* map = NULL;
+    int ret = 0;
+
+    shm->conn = conn;
+    shm->map_size = VSOCK_USER_SHM_HEADER_SZ + 2 * SHM_RING_SZ;
+    shm->memfd = qemu_memfd_create("vsock-user-shm", shm->map_size,
+                                   false, 0, SHM_SEALS, errp);
+    if(shm->memfd < 0) {
+        g_free(shm);
+        return NULL;
+    }
+
+    map = mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               shm->memfd, 0);
+    if(map == MAP_FAILED) {
+        error_setg_errno(errp, errno, "failed to map the shared memory");
+        close(shm->memfd);
+        g_free(shm);
+        return NULL;
+    }
+    shm->hdr = (VSockUserShmHeader*)map;
+    shm->hdr->magic = VSOCK_USER_SHM_MAGIC;
+    shm->hdr->version = VSOCK_USER_SHM_VERSION;
+    shm->hdr->ring_size = SHM_RING_SZ;
+    shm->data[VSOCK_USER_SHM_RING_QEMU] = map + VSOCK_USER_SHM_HEADER_SZ;
+    shm->data[VSOCK_USER_SHM_RING_HOST] = map + VSOCK_USER_SHM_HEADER_SZ + SHM_RING_SZ;
+
+    if((ret = event_notifier_init(&shm->qemu_notifier, 0)) < 0
+        || (ret = event_notifier_init(&shm->host_notifier, 0)) < 0)
+    {
+        error_setg_errno(errp, -ret, "failed to create an eventfd");
+        event_notifier_cleanup(&shm->qemu_notifier);
+        close(shm->memfd);
+        munmap(shm->hdr, shm->map_size);
+        g_free(shm);
+        return NULL;
+    }
+    return shm;
+}
+
+static void virtio_vsock_shm_free(VSockUserShm* shm)
+{
+    AioContext* aio_ctx = iothread_get_aio_context(shm->conn->vsock->io_thread);
+
+    aio_set_event_notifier(aio_ctx, &shm->qemu_notifier, NULL, NULL, NULL);
+    event_notifier_cleanup(&shm->qemu_notifier);
+    event_notifier_cleanup(&shm->host_notifier);
+    if(shm->memfd >= 0) {
+        close(shm->memfd);
+    }
+    munmap(shm->hdr, shm->map_size);
+    g_free(shm);
+}
+
 static void cht_destroy_conn(gpointer data) {
     VSockUserConnection* conn = data;
     VirtIOVSock* vsock = conn->vsock;
@@ -48,6 +117,19 @@ static void cht_destroy_conn(gpointer data) {
         conn->key = NULL;
     }
     fifo8_destroy(&conn->host_buf);
+    if(conn->mux) {
+        // the host hasn't closed the stream itself
+        if(g_hash_table_remove(conn->mux->streams, GUINT_TO_POINTER(conn->mux_stream))) {
+            virtio_vsock_mux_send(conn->mux, conn->mux_stream,
+                VSOCK_USER_MUX_OP_CLOSE, NULL, 0);
+        }
+        fifo8_destroy(&conn->vm_buf);
+        conn->mux = NULL;
+    }
+    if(conn->shm) {
+        virtio_vsock_shm_free(conn->shm);
+        conn->shm = NULL;
+    }
     if(conn->close_handler_watch_source_id) {
         g_source_remove(conn->close_handler_watch_source_id);
         conn->close_handler_watch_source_id = 0;
@@ -63,6 +145,16 @@ static void cht_destroy_conn(gpointer data) {
     free(conn);
 }
 
+/* With shared memory the host's reads are counted by the ring */
+static inline uint32_t virtio_vsock_host_fwd_cnt(VSockUserConnection* conn)
+{
+    if(conn->shm) {
+        return qatomic_load_acquire(
+            &conn->shm->hdr->rings[VSOCK_USER_SHM_RING_QEMU].tail);
+    }
+    return conn->host_fwd_cnt;
+}
+
 static inline void virtio_vsock_init_rsp_hdr(struct virtio_vsock_hdr *hdr,
                                              VSockUserConnection* conn)
 {
@@ -73,7 +165,7 @@ static inline void virtio_vsock_init_rsp_hdr(struct virtio_vsock_hdr *hdr,
     hdr->type = cpu_to_le16(VIRTIO_VSOCK_TYPE_STREAM);
     hdr->op = cpu_to_le16(VIRTIO_VSOCK_OP_INVALID);
     hdr->buf_alloc = cpu_to_le32(BUF_ALLOC);
-    hdr->fwd_cnt = cpu_to_le32(conn->host_fwd_cnt);
+    hdr->fwd_cnt = cpu_to_le32(virtio_vsock_host_fwd_cnt(conn));
     hdr->len = cpu_to_le32(0);
     hdr->flags = cpu_to_le32(0);
 }
@@ -129,6 +221,11 @@ static void virtio_vsock_conn_rst(VSockUserConnection* conn)
         qio_channel_set_aio_fd_handler(QIO_CHANNEL(conn->sioc), aio_ctx,
             NULL, aio_ctx, NULL, NULL); // remove io handlers
     }
+    if(conn->shm) {
+        AioContext* aio_ctx = iothread_get_aio_context(vsock->io_thread);
+        aio_set_event_notifier(aio_ctx, &conn->shm->qemu_notifier,
+            NULL, NULL, NULL);
+    }
     g_free(elem);
     g_hash_table_remove(conn->vsock->connection_hash_table, conn->key);
 }
@@ -182,15 +279,75 @@ static gboolean virtio_vsock_sock_closed(QIOChannel *ioc,
     return false;
 }
 
-static void virtio_vsock_sock_recv_connected(VSockUserConnection* conn)
+/* Passes the host's data to the guest, len is within the guest's credit */
+static void virtio_vsock_conn_send_to_vm(VSockUserConnection* conn,
+                                         const uint8_t* buf, size_t len)
 {
     VirtIOVSock* vsock = conn->vsock;
     QEMU_UNINITIALIZED VirtQueueElement *elems[VIRTQUEUE_MAX_SIZE];
     QEMU_UNINITIALIZED size_t lens[VIRTQUEUE_MAX_SIZE];
-    uint32_t vm_free = 0;
-    ssize_t bytes_read = 0;
     size_t elems_len = 0;
     size_t data_sent = 0;
+
+    for(elems_len = 0; data_sent < len; ++elems_len) {
+        VirtQueueElement* elem = NULL;
+
+        elem = virtqueue_pop(vsock->rx_vq, sizeof(VirtQueueElement));
+        if(!elem) {
+            virtio_error(VIRTIO_DEVICE(vsock),
+                "virtio-vsock: rx VirtQueue contains no elements");
+            goto err;
+        }
+        if(elem->in_num < 1) {
+            virtio_error(VIRTIO_DEVICE(vsock),
+                "virtio-vsock: rx VirtQueueElement contains no in buffers");
+            goto err;
+        }
+        if(elems_len == VIRTQUEUE_MAX_SIZE) {
+            virtio_error(VIRTIO_DEVICE(vsock),
+                "virtio-vsock: rx VirtQueue is too short");
+            goto err;
+        }
+        lens[elems_len] = iov_from_buf(elem->in_sg, elem->in_num, 
+            VSOCK_HDR_LEN, buf + data_sent, len - data_sent);
+        if(lens[elems_len] < 1) {
+            virtio_error(VIRTIO_DEVICE(vsock),
+                "virtio-vsock: rx VirtQueue in buffer is too small");
+            goto err;
+        }
+        conn->host_tx_cnt += lens[elems_len];
+        data_sent += lens[elems_len];
+        
+        struct virtio_vsock_hdr hdr;
+        virtio_vsock_init_rsp_hdr(&hdr, conn);
+        hdr.op = cpu_to_le16(VIRTIO_VSOCK_OP_RW);
+        hdr.len = cpu_to_le32(lens[elems_len]);
+        lens[elems_len] += iov_from_buf(elem->in_sg, elem->in_num, 0, &hdr, VSOCK_HDR_LEN);
+
+        elems[elems_len] = elem;
+    }
+    g_assert(len == data_sent);
+    
+    for (int i = 0; i < elems_len; ++i) {
+        virtqueue_fill(vsock->rx_vq, elems[i], lens[i], i);
+        g_free(elems[i]);
+    }
+
+    virtqueue_flush(vsock->rx_vq, elems_len);
+    virtio_notify(VIRTIO_DEVICE(vsock), vsock->rx_vq);
+    return;
+
+    err:
+    for (int i = 0; i < elems_len; ++i) {
+        virtqueue_detach_element(vsock->rx_vq, elems[i], lens[i]);
+        g_free(elems[i]);
+    }
+}
+
+static void virtio_vsock_sock_recv_connected(VSockUserConnection* conn)
+{
+    uint32_t vm_free = 0;
+    ssize_t bytes_read = 0;
     Error* err = NULL;
 
     g_assert(conn->state & VSOCK_USER_CONNECTION_STATE_CONNECTED);
@@ -218,8 +375,38 @@ static void virtio_vsock_sock_recv_connected(VSockUserConnection* conn)
         return;
     }
 
-    for(elems_len = 0; data_sent < bytes_read; ++elems_len) {
+    virtio_vsock_conn_send_to_vm(conn, buf, bytes_read);
+}
+
+/* Same as virtio_vsock_sock_recv_connected(), copying straight from the host's ring */
+static void virtio_vsock_shm_recv_connected(VSockUserConnection* conn)
+{
+    VirtIOVSock* vsock = conn->vsock;
+    VSockUserShm* shm = conn->shm;
+    VSockUserShmRing* ring = &shm->hdr->rings[VSOCK_USER_SHM_RING_HOST];
+    const uint8_t* data = shm->data[VSOCK_USER_SHM_RING_HOST];
+    QEMU_UNINITIALIZED VirtQueueElement *elems[VIRTQUEUE_MAX_SIZE];
+    QEMU_UNINITIALIZED size_t lens[VIRTQUEUE_MAX_SIZE];
+    uint32_t tail = ring->tail;
+    uint32_t available = 0;
+    uint32_t vm_free = 0;
+    uint32_t len = 0;
+    size_t elems_len = 0;
+    size_t data_sent = 0;
+
+    g_assert(conn->state & VSOCK_USER_CONNECTION_STATE_CONNECTED);
+
+    vm_free = conn->vm_buf_alloc - (conn->host_tx_cnt - conn->vm_fwd_cnt);
+    // the host's index isn't trusted
+    available = MIN(qatomic_load_acquire(&ring->head) - tail, SHM_RING_SZ);
+    len = MIN(available, vm_free);
+    if(len == 0) {
+        return;
+    }
+
+    for(elems_len = 0; data_sent < len; ++elems_len) {
         VirtQueueElement* elem = NULL;
+        size_t offset = (tail + data_sent) & (SHM_RING_SZ - 1);
 
         elem = virtqueue_pop(vsock->rx_vq, sizeof(VirtQueueElement));
         if(!elem) {
@@ -237,8 +424,9 @@ static void virtio_vsock_sock_recv_connected(VSockUserConnection* conn)
                 "virtio-vsock: rx VirtQueue is too short");
             goto err;
         }
-        lens[elems_len] = iov_from_buf(elem->in_sg, elem->in_num, 
-            VSOCK_HDR_LEN, buf + data_sent, bytes_read - data_sent);
+        // an element ends where the ring wraps around
+        lens[elems_len] = iov_from_buf(elem->in_sg, elem->in_num, VSOCK_HDR_LEN,
+            data + offset, MIN(len - data_sent, SHM_RING_SZ - offset));
         if(lens[elems_len] < 1) {
             virtio_error(VIRTIO_DEVICE(vsock),
                 "virtio-vsock: rx VirtQueue in buffer is too small");
@@ -246,7 +434,7 @@ static void virtio_vsock_sock_recv_connected(VSockUserConnection* conn)
         }
         conn->host_tx_cnt += lens[elems_len];
         data_sent += lens[elems_len];
-        
+
         struct virtio_vsock_hdr hdr;
         virtio_vsock_init_rsp_hdr(&hdr, conn);
         hdr.op = cpu_to_le16(VIRTIO_VSOCK_OP_RW);
@@ -255,15 +443,25 @@ static void virtio_vsock_sock_recv_connected(VSockUserConnection* conn)
 
         elems[elems_len] = elem;
     }
-    g_assert(bytes_read == data_sent);
-    
+
     for (int i = 0; i < elems_len; ++i) {
         virtqueue_fill(vsock->rx_vq, elems[i], lens[i], i);
         g_free(elems[i]);
     }
-
     virtqueue_flush(vsock->rx_vq, elems_len);
     virtio_notify(VIRTIO_DEVICE(vsock), vsock->rx_vq);
+
+    qatomic_store_release(&ring->tail, tail + data_sent);
+    // pairs with the host's fence, either we see the flag or it sees the space
+    smp_mb();
+    if(qatomic_read(&ring->producer_waiting)) {
+        qatomic_set(&ring->producer_waiting, 0);
+        event_notifier_set(&shm->host_notifier);
+    }
+    // the host doesn't ring again while the ring isn't empty
+    if(available > len && vm_free > len) {
+        event_notifier_set(&shm->qemu_notifier);
+    }
     return;
 
     err:
@@ -273,34 +471,70 @@ static void virtio_vsock_sock_recv_connected(VSockUserConnection* conn)
     }
 }
 
-static void virtio_vsock_host_recv_connecting(VSockUserConnection* conn)
+/* With shared memory the socket only reports the host's side closing */
+static void virtio_vsock_shm_sock_recv(VSockUserConnection* conn)
 {
-    VirtIOVSock* vsock = conn->vsock;
-    VirtQueueElement* elem = NULL;
-    struct virtio_vsock_hdr hdr;
     ssize_t bytes_read = 0;
-    uint8_t connection_response = 0;
+    uint8_t byte = 0;
     Error* err = NULL;
-    
-    bytes_read = qio_channel_read(QIO_CHANNEL(conn->sioc), &connection_response,
-        sizeof(uint8_t), &err);
-    if(bytes_read == QIO_CHANNEL_ERR_BLOCK || bytes_read == 0) {
+
+    bytes_read = qio_channel_read(QIO_CHANNEL(conn->sioc), &byte, sizeof(byte), &err);
+    if(bytes_read == QIO_CHANNEL_ERR_BLOCK) {
         return;
     }
+    else if(bytes_read == 0) {
+        // pass on what the host wrote before closing
+        virtio_vsock_shm_recv_connected(conn);
+    }
     else if(bytes_read < 0) {
         error_report("virtio-vsock: "
             "an error occurred on a socket during read(): %s. "
             "Connection will be closed.", error_get_pretty(err));
         error_free(err);
-        virtio_vsock_conn_rst(conn);
-        return;
     }
+    else {
+        error_report("virtio-vsock: "
+            "the host sent data on a shared memory connection. "
+            "Connection will be closed.");
+    }
+    virtio_vsock_conn_rst(conn);
+}
 
-    if(connection_response != VSOCK_USER_CONNECTION_ACCEPTED) {
-        virtio_vsock_conn_rst(conn);
+static void virtio_vsock_do_shm_notified(gpointer opaque)
+{
+    VSockUserConnection* conn = opaque;
+    VSockUserShm* shm = conn->shm;
+
+    if(!shm || (conn->state & ~(VSOCK_USER_CONNECTION_STATE_SHUTDOWN_SEND))
+        != VSOCK_USER_CONNECTION_STATE_CONNECTED)
+    {
         return;
     }
 
+    virtio_vsock_shm_recv_connected(conn);
+    // the host has read some of what the guest sent
+    if(shm->credit_wanted) {
+        shm->credit_wanted = false;
+        virtio_vsock_conn_credit_update(conn);
+    }
+}
+
+static void virtio_vsock_shm_notified(EventNotifier* notifier)
+{
+    VSockUserShm* shm = container_of(notifier, VSockUserShm, qemu_notifier);
+
+    event_notifier_test_and_clear(notifier);
+    aio_bh_schedule_oneshot(qemu_get_aio_context(),
+        virtio_vsock_do_shm_notified, shm->conn);
+}
+
+/* The host accepted the guest's connection */
+static void virtio_vsock_conn_accepted(VSockUserConnection* conn)
+{
+    VirtIOVSock* vsock = conn->vsock;
+    VirtQueueElement* elem = NULL;
+    struct virtio_vsock_hdr hdr;
+
     conn->state = VSOCK_USER_CONNECTION_STATE_CONNECTED;
     virtio_vsock_init_rsp_hdr(&hdr, conn);
     hdr.op = cpu_to_le16(VIRTIO_VSOCK_OP_RESPONSE);
@@ -330,6 +564,47 @@ static void virtio_vsock_host_recv_connecting(VSockUserConnection* conn)
     g_free(elem);
 }
 
+static void virtio_vsock_host_recv_connecting(VSockUserConnection* conn)
+{
+    VirtIOVSock* vsock = conn->vsock;
+    ssize_t bytes_read = 0;
+    uint8_t connection_response = 0;
+    Error* err = NULL;
+    
+    bytes_read = qio_channel_read(QIO_CHANNEL(conn->sioc), &connection_response,
+        sizeof(uint8_t), &err);
+    if(bytes_read == QIO_CHANNEL_ERR_BLOCK || bytes_read == 0) {
+        return;
+    }
+    else if(bytes_read < 0) {
+        error_report("virtio-vsock: "
+            "an error occurred on a socket during read(): %s. "
+            "Connection will be closed.", error_get_pretty(err));
+        error_free(err);
+        virtio_vsock_conn_rst(conn);
+        return;
+    }
+
+    if(connection_response == VSOCK_USER_CONNECTION_ACCEPTED_SHM && conn->shm) {
+        AioContext* aio_ctx = iothread_get_aio_context(vsock->io_thread);
+        aio_set_event_notifier(aio_ctx, &conn->shm->qemu_notifier,
+            virtio_vsock_shm_notified, NULL, NULL);
+    }
+    else if(connection_response == VSOCK_USER_CONNECTION_ACCEPTED) {
+        // the host didn't take the shared memory, stay on the socket
+        if(conn->shm) {
+            virtio_vsock_shm_free(conn->shm);
+            conn->shm = NULL;
+        }
+    }
+    else {
+        virtio_vsock_conn_rst(conn);
+        return;
+    }
+
+    virtio_vsock_conn_accepted(conn);
+}
+
 static void virtio_vsock_guest_receive_connecting(VSockUserConnection* conn)
 {
     VirtIOVSock* vsock = conn->vsock;
@@ -400,7 +675,12 @@ static void virtio_vsock_do_sock_read_aval(gpointer opaque)
     switch (conn->state & ~(VSOCK_USER_CONNECTION_STATE_SHUTDOWN_SEND)) {
     case VSOCK_USER_CONNECTION_STATE_CONNECTED:
     {
-        virtio_vsock_sock_recv_connected(conn);
+        if(conn->shm) {
+            virtio_vsock_shm_sock_recv(conn);
+        }
+        else {
+            virtio_vsock_sock_recv_connected(conn);
+        }
     }
     break;
     case VSOCK_USER_CONNECTION_STATE_CONNECTED_VM:
@@ -505,6 +785,9 @@ static void virtio_vsock_host_new_connection(QIOTask *task, gpointer opaque)
     VSockUserConnection* conn = opaque;
     IOThread* io_thread = conn->vsock->io_thread;
     AioContext* aio_ctx = iothread_get_aio_context(io_thread);
+    struct iovec iov = { .iov_base = conn->key, .iov_len = sizeof(VSockUserConnectionKey) };
+    int fds[3] = { -1, -1, -1 };
+    size_t nfds = 0;
     ssize_t bytes_written = -1;
     Error* err = NULL;
 
@@ -514,8 +797,31 @@ static void virtio_vsock_host_new_connection(QIOTask *task, gpointer opaque)
         return;
     }
 
-    bytes_written = qio_channel_write(QIO_CHANNEL(conn->sioc),
-        (void*)conn->key, sizeof(VSockUserConnectionKey), &err); 
+    // the shared memory is offered with the key, a host that can't use it just replies ACCEPTED
+    if(conn->vsock->conf.shm) {
+        conn->shm = virtio_vsock_shm_new(conn, &err);
+        if(conn->shm) {
+            fds[0] = conn->shm->memfd;
+            fds[1] = event_notifier_get_fd(&conn->shm->qemu_notifier);
+            fds[2] = event_notifier_get_fd(&conn->shm->host_notifier);
+            nfds = 3;
+        }
+        else {
+            warn_report_once("virtio-vsock: "
+                "shared memory is unavailable, connections will use the socket. %s",
+                error_get_pretty(err));
+            error_free(err);
+            err = NULL;
+        }
+    }
+
+    bytes_written = qio_channel_writev_full(QIO_CHANNEL(conn->sioc), &iov, 1,
+        nfds ? fds : NULL, nfds, 0, &err);
+    if(conn->shm) {
+        // the host has its own copy, the mapping keeps the memory
+        close(conn->shm->memfd);
+        conn->shm->memfd = -1;
+    }
     if(bytes_written != sizeof(VSockUserConnectionKey)) {
         error_report("virtio-vsock: "
             "Failed to send VSockUser connection request to the host. %s",
@@ -542,6 +848,365 @@ static void virtio_vsock_host_new_connection(QIOTask *task, gpointer opaque)
         G_IO_HUP, virtio_vsock_sock_closed, conn, NULL);
 }
 
+static void virtio_vsock_mux_read_avaliable(gpointer opaque);
+
+static void virtio_vsock_mux_write_avaliable(gpointer opaque)
+{
+    VSockUserMux* mux = opaque;
+    AioContext* aio_ctx = iothread_get_aio_context(mux->vsock->io_thread);
+    ssize_t bytes_written = 0;
+    Error* err = NULL;
+
+    qemu_mutex_lock(&mux->out_lock);
+
+    bytes_written = qio_channel_write(QIO_CHANNEL(mux->sioc),
+        (const char*)mux->out->data, mux->out->len, &err);
+    if(bytes_written > 0) {
+        g_byte_array_remove_range(mux->out, 0, bytes_written);
+    }
+    if(mux->out->len == 0 || (bytes_written < 0 && bytes_written != QIO_CHANNEL_ERR_BLOCK)) {
+        // remove write handler
+        qio_channel_set_aio_fd_handler(QIO_CHANNEL(mux->sioc), aio_ctx,
+            virtio_vsock_mux_read_avaliable, aio_ctx, NULL, mux);
+    }
+    qemu_mutex_unlock(&mux->out_lock);
+
+    // the read side sees the socket closing and fails the mux
+    if(bytes_written < 0 && bytes_written != QIO_CHANNEL_ERR_BLOCK) {
+        error_report("virtio-vsock: "
+            "an error occurred on the multiplexed socket during write(): %s",
+            error_get_pretty(err));
+        error_free(err);
+    }
+}
+
+static void virtio_vsock_mux_send(VSockUserMux* mux, uint32_t stream, uint32_t op,
+                                  const void* payload, uint32_t len)
+{
+    VSockUserMuxHeader hdr = { .stream = stream, .op = op, .len = len };
+    AioContext* aio_ctx = NULL;
+
+    if(mux->state != VSOCK_USER_MUX_STATE_READY) {
+        return;
+    }
+    aio_ctx = iothread_get_aio_context(mux->vsock->io_thread);
+
+    qemu_mutex_lock(&mux->out_lock);
+    g_byte_array_append(mux->out, (const guint8*)&hdr, sizeof(hdr));
+    if(len > 0) {
+        g_byte_array_append(mux->out, payload, len);
+    }
+    // add write handler
+    qio_channel_set_aio_fd_handler(QIO_CHANNEL(mux->sioc), aio_ctx,
+        virtio_vsock_mux_read_avaliable, aio_ctx, virtio_vsock_mux_write_avaliable,
+        mux);
+    qemu_mutex_unlock(&mux->out_lock);
+}
+
+/* Resets every stream, new connections get a socket each */
+static void virtio_vsock_mux_fail(VSockUserMux* mux)
+{
+    AioContext* aio_ctx = iothread_get_aio_context(mux->vsock->io_thread);
+    GList* conns = NULL;
+
+    if(mux->state == VSOCK_USER_MUX_STATE_FAILED) {
+        return;
+    }
+    mux->state = VSOCK_USER_MUX_STATE_FAILED;
+
+    qio_channel_set_aio_fd_handler(QIO_CHANNEL(mux->sioc), aio_ctx,
+        NULL, aio_ctx, NULL, NULL); // remove io handlers
+    if(mux->close_handler_watch_source_id) {
+        g_source_remove(mux->close_handler_watch_source_id);
+        mux->close_handler_watch_source_id = 0;
+    }
+    qio_channel_close(QIO_CHANNEL(mux->sioc), NULL);
+
+    // the streams are gone with the socket, nothing is sent for them
+    conns = g_hash_table_get_values(mux->streams);
+    g_hash_table_remove_all(mux->streams);
+    for(GList* it = conns; it; it = it->next) {
+        virtio_vsock_conn_rst(it->data);
+    }
+    g_list_free(conns);
+}
+
+/* Passes what the guest has credit for, the host gets credit back as it goes */
+static void virtio_vsock_mux_recv_connected(VSockUserConnection* conn)
+{
+    uint8_t buf[BUF_ALLOC];
+    uint32_t vm_free = 0;
+    uint32_t len = 0;
+    uint32_t credit = 0;
+
+    vm_free = conn->vm_buf_alloc - (conn->host_tx_cnt - conn->vm_fwd_cnt);
+    len = MIN(fifo8_num_used(&conn->vm_buf), vm_free);
+    if(len == 0) {
+        return;
+    }
+    len = fifo8_pop_buf(&conn->vm_buf, buf, len);
+    virtio_vsock_conn_send_to_vm(conn, buf, len);
+
+    // a drained buffer is always credited, the host may be waiting for it
+    if(conn->host_tx_cnt - conn->mux_credited >= MUX_CREDIT_THRESHOLD
+        || fifo8_is_empty(&conn->vm_buf))
+    {
+        conn->mux_credited = credit = conn->host_tx_cnt;
+        virtio_vsock_mux_send(conn->mux, conn->mux_stream,
+            VSOCK_USER_MUX_OP_CREDIT, &credit, sizeof(credit));
+    }
+}
+
+/* Returns false if the host broke the protocol */
+static bool virtio_vsock_mux_handle_frame(VSockUserMux* mux,
+                                          const VSockUserMuxHeader* hdr,
+                                          const uint8_t* payload)
+{
+    VSockUserConnection* conn = NULL;
+    bool connected = false;
+
+    conn = g_hash_table_lookup(mux->streams, GUINT_TO_POINTER(hdr->stream));
+    if(conn == NULL) {
+        // closed by us while the frame was on its way
+        return hdr->op != VSOCK_USER_MUX_OP_OPEN;
+    }
+    connected = (conn->state & ~(VSOCK_USER_CONNECTION_STATE_SHUTDOWN_SEND))
+        == VSOCK_USER_CONNECTION_STATE_CONNECTED;
+
+    switch(hdr->op) {
+    case VSOCK_USER_MUX_OP_ACCEPT:
+        if(conn->state == VSOCK_USER_CONNECTION_STATE_CONNECTED_VM) {
+            virtio_vsock_conn_accepted(conn);
+        }
+        break;
+    case VSOCK_USER_MUX_OP_REJECT:
+    case VSOCK_USER_MUX_OP_CLOSE:
+        g_hash_table_remove(mux->streams, GUINT_TO_POINTER(hdr->stream));
+        // pass on what the host wrote before closing
+        if(connected) {
+            virtio_vsock_mux_recv_connected(conn);
+        }
+        virtio_vsock_conn_rst(conn);
+        break;
+    case VSOCK_USER_MUX_OP_DATA:
+        if(fifo8_num_free(&conn->vm_buf) < hdr->len) {
+            return false;
+        }
+        // the guest won't receive anymore
+        if(!connected) {
+            break;
+        }
+        fifo8_push_all(&conn->vm_buf, payload, hdr->len);
+        virtio_vsock_mux_recv_connected(conn);
+        break;
+    case VSOCK_USER_MUX_OP_CREDIT:
+        if(hdr->len != sizeof(uint32_t)) {
+            return false;
+        }
+        memcpy(&conn->host_fwd_cnt, payload, sizeof(uint32_t));
+        if(connected) {
+            virtio_vsock_conn_credit_update(conn);
+        }
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+static void virtio_vsock_mux_recv_hello_reply(VSockUserMux* mux)
+{
+    ssize_t bytes_read = 0;
+    uint8_t connection_response = 0;
+    Error* err = NULL;
+
+    bytes_read = qio_channel_read(QIO_CHANNEL(mux->sioc), &connection_response,
+        sizeof(uint8_t), &err);
+    if(bytes_read == QIO_CHANNEL_ERR_BLOCK) {
+        return;
+    }
+    if(bytes_read < 0) {
+        error_free(err);
+    }
+    if(bytes_read == 1 && connection_response == VSOCK_USER_CONNECTION_ACCEPTED_MUX) {
+        mux->state = VSOCK_USER_MUX_STATE_READY;
+        return;
+    }
+
+    // an older host, it doesn't know the hello
+    warn_report("virtio-vsock: "
+        "the host refused the multiplexed connection, "
+        "connections will use a socket each");
+    virtio_vsock_mux_fail(mux);
+}
+
+static void virtio_vsock_do_mux_read_aval(gpointer opaque)
+{
+    VSockUserMux* mux = opaque;
+    VSockUserMuxHeader hdr;
+    uint8_t buf[VSOCK_USER_MUX_FRAME_SZ];
+    ssize_t bytes_read = 0;
+    size_t offset = 0;
+    Error* err = NULL;
+
+    switch(mux->state) {
+    case VSOCK_USER_MUX_STATE_CONNECTING:
+        virtio_vsock_mux_recv_hello_reply(mux);
+        return;
+    case VSOCK_USER_MUX_STATE_FAILED:
+        return;
+    }
+
+    while((bytes_read = qio_channel_read(QIO_CHANNEL(mux->sioc),
+                                         buf, sizeof(buf), &err)) > 0)
+    {
+        g_byte_array_append(mux->in, buf, bytes_read);
+    }
+
+    while(mux->state == VSOCK_USER_MUX_STATE_READY
+        && mux->in->len - offset >= sizeof(hdr))
+    {
+        memcpy(&hdr, mux->in->data + offset, sizeof(hdr));
+        if(hdr.len > VSOCK_USER_MUX_FRAME_SZ) {
+            error_report("virtio-vsock: "
+                "the host sent a frame of %u bytes on the multiplexed socket", hdr.len);
+            virtio_vsock_mux_fail(mux);
+            return;
+        }
+        if(mux->in->len - offset - sizeof(hdr) < hdr.len) {
+            break;
+        }
+        if(!virtio_vsock_mux_handle_frame(mux, &hdr, mux->in->data + offset + sizeof(hdr))) {
+            error_report("virtio-vsock: "
+                "the host sent an invalid frame (op %u) on the multiplexed socket", hdr.op);
+            virtio_vsock_mux_fail(mux);
+            return;
+        }
+        offset += sizeof(hdr) + hdr.len;
+    }
+    g_byte_array_remove_range(mux->in, 0, offset);
+
+    if(bytes_read == 0) {
+        warn_report("virtio-vsock: "
+            "the host closed the multiplexed connection, "
+            "connections will use a socket each");
+        virtio_vsock_mux_fail(mux);
+    }
+    else if(bytes_read != QIO_CHANNEL_ERR_BLOCK) {
+        error_report("virtio-vsock: "
+            "an error occurred on the multiplexed socket during read(): %s",
+            error_get_pretty(err));
+        error_free(err);
+        virtio_vsock_mux_fail(mux);
+    }
+}
+
+static void virtio_vsock_mux_read_avaliable(gpointer opaque)
+{
+    aio_bh_schedule_oneshot(qemu_get_aio_context(), 
+        virtio_vsock_do_mux_read_aval, opaque);
+}
+
+static gboolean virtio_vsock_mux_closed(QIOChannel *ioc,
+                                        GIOCondition condition, gpointer data)
+{
+    VSockUserMux* mux = data;
+
+    mux->close_handler_watch_source_id = 0;
+    if(mux->state != VSOCK_USER_MUX_STATE_FAILED) {
+        warn_report("virtio-vsock: "
+            "the host closed the multiplexed connection, "
+            "connections will use a socket each");
+    }
+    virtio_vsock_mux_fail(mux);
+    return false;
+}
+
+static void virtio_vsock_mux_connected(QIOTask *task, gpointer opaque)
+{
+    VSockUserMux* mux = opaque;
+    AioContext* aio_ctx = iothread_get_aio_context(mux->vsock->io_thread);
+    VSockUserConnectionKey hello = {
+        .host_cid = VSOCK_USER_MUX_HELLO_CID,
+        .vm_cid = mux->vsock->conf.cid,
+        .host_port = VSOCK_USER_MUX_VERSION,
+        .vm_port = 0
+    };
+    Error* err = NULL;
+
+    if(qio_task_propagate_error(task, &err)
+        || qio_channel_write_all(QIO_CHANNEL(mux->sioc), (const char*)&hello,
+                                 sizeof(hello), &err) < 0
+        || !qio_channel_set_blocking(QIO_CHANNEL(mux->sioc), false, &err))
+    {
+        warn_report("virtio-vsock: "
+            "failed to open the multiplexed connection to the host, "
+            "connections will use a socket each. %s", error_get_pretty(err));
+        error_free(err);
+        mux->state = VSOCK_USER_MUX_STATE_FAILED;
+        return;
+    }
+
+    qio_channel_set_aio_fd_handler(QIO_CHANNEL(mux->sioc), aio_ctx,
+        virtio_vsock_mux_read_avaliable, aio_ctx, NULL, mux);
+    mux->close_handler_watch_source_id = qio_channel_add_watch(QIO_CHANNEL(mux->sioc),
+        G_IO_HUP, virtio_vsock_mux_closed, mux, NULL);
+}
+
+static VSockUserMux* virtio_vsock_mux_new(VirtIOVSock* vsock)
+{
+    VSockUserMux* mux = g_new0(VSockUserMux, 1);
+
+    mux->vsock = vsock;
+    mux->out = g_byte_array_new();
+    mux->in = g_byte_array_new();
+    mux->streams = g_hash_table_new(g_direct_hash, g_direct_equal);
+    mux->next_stream = 1;
+    mux->state = VSOCK_USER_MUX_STATE_CONNECTING;
+    qemu_mutex_init(&mux->out_lock);
+    mux->sioc = qio_channel_socket_new();
+
+    // connections made until the host replies use a socket each
+    qio_channel_socket_connect_async(mux->sioc, &vsock->host_uds_addr,
+        virtio_vsock_mux_connected, mux, NULL, NULL);
+    return mux;
+}
+
+/* After the streams' connections are destroyed */
+static void virtio_vsock_mux_free(VSockUserMux* mux)
+{
+    AioContext* aio_ctx = iothread_get_aio_context(mux->vsock->io_thread);
+
+    qio_channel_set_aio_fd_handler(QIO_CHANNEL(mux->sioc), aio_ctx,
+        NULL, aio_ctx, NULL, NULL); // remove io handlers
+    if(mux->close_handler_watch_source_id) {
+        g_source_remove(mux->close_handler_watch_source_id);
+    }
+    object_unref(OBJECT(mux->sioc));
+    g_hash_table_destroy(mux->streams);
+    g_byte_array_free(mux->out, true);
+    g_byte_array_free(mux->in, true);
+    qemu_mutex_destroy(&mux->out_lock);
+    g_free(mux);
+}
+
+/* Opens the guest's connection as a stream, the host replies with a frame */
+static void virtio_vsock_mux_vm_connection_request(VSockUserConnection* conn)
+{
+    VSockUserMux* mux = conn->vsock->mux;
+
+    do {
+        conn->mux_stream = mux->next_stream++;
+    } while(conn->mux_stream == 0
+        || g_hash_table_contains(mux->streams, GUINT_TO_POINTER(conn->mux_stream)));
+
+    conn->mux = mux;
+    fifo8_create(&conn->vm_buf, BUF_ALLOC);
+    g_hash_table_insert(mux->streams, GUINT_TO_POINTER(conn->mux_stream), conn);
+    virtio_vsock_mux_send(mux, conn->mux_stream, VSOCK_USER_MUX_OP_OPEN,
+        conn->key, sizeof(VSockUserConnectionKey));
+}
+
 static void virtio_vsock_vm_connection_request(VirtIOVSock *vsock, struct virtio_vsock_hdr *hdr)
 {
     VSockUserConnectionKey* key = g_malloc0(sizeof(VSockUserConnectionKey));
@@ -553,21 +1218,114 @@ static void virtio_vsock_vm_connection_request(VirtIOVSock *vsock, struct virtio
     conn->vm_fwd_cnt = le32_to_cpu(hdr->fwd_cnt);
     conn->vm_buf_alloc = le32_to_cpu(hdr->buf_alloc);
     conn->state = VSOCK_USER_CONNECTION_STATE_CONNECTED_VM;
+    qemu_mutex_init(&conn->host_buf_lock);
+
+    if(vsock->mux && vsock->mux->state == VSOCK_USER_MUX_STATE_READY) {
+        g_hash_table_insert(vsock->connection_hash_table, key, conn);
+        virtio_vsock_mux_vm_connection_request(conn);
+        return;
+    }
+
     fifo8_create(&conn->host_buf, BUF_ALLOC);
     QIOChannelSocket* sioc = conn->sioc = qio_channel_socket_new();
-    qemu_mutex_init(&conn->host_buf_lock);
 
     qio_channel_socket_connect_async(sioc, &vsock->host_uds_addr,
         virtio_vsock_host_new_connection, conn, NULL, NULL);
     g_hash_table_insert(vsock->connection_hash_table, key, conn);
 }
 
+/* Copies the guest's data straight into qemu's ring */
+static void virtio_vsock_shm_vm_receive(VSockUserConnection* conn,
+                                        VirtQueueElement *tx_elem, uint32_t len)
+{
+    VirtIOVSock* vsock = conn->vsock;
+    VSockUserShm* shm = conn->shm;
+    VSockUserShmRing* ring = &shm->hdr->rings[VSOCK_USER_SHM_RING_QEMU];
+    uint8_t* data = shm->data[VSOCK_USER_SHM_RING_QEMU];
+    uint32_t head = ring->head;
+    uint32_t used = head - qatomic_load_acquire(&ring->tail);
+    size_t offset = head & (SHM_RING_SZ - 1);
+    size_t first = MIN(len, SHM_RING_SZ - offset);
+
+    if(used > SHM_RING_SZ || SHM_RING_SZ - used < len) {
+        virtio_error(VIRTIO_DEVICE(vsock),
+            "virtio-vsock: guest pushed too much data for us to handle");
+        return;
+    }
+    if(iov_to_buf(tx_elem->out_sg, tx_elem->out_num, VSOCK_HDR_LEN,
+                  data + offset, first) != first
+        || iov_to_buf(tx_elem->out_sg, tx_elem->out_num, VSOCK_HDR_LEN + first,
+                      data, len - first) != len - first)
+    {
+        virtio_error(VIRTIO_DEVICE(vsock),
+            "virtio-vsock: tx VirtQueueElement's out buffer is too small!");
+        // element is pushed back and freed in virtio_vsock_handle_tx_vq()
+        return;
+    }
+
+    qatomic_store_release(&ring->head, head + len);
+    smp_mb();
+    // the host had read everything, it may be asleep
+    if(qatomic_read(&ring->tail) == head) {
+        event_notifier_set(&shm->host_notifier);
+    }
+
+    // past half of the credit, have the host ring us when it reads so the guest gets it back
+    if(used + len > SHM_RING_SZ / 2 && !shm->credit_wanted) {
+        shm->credit_wanted = true;
+        qatomic_set(&ring->producer_waiting, 1);
+        smp_mb();
+        // it may have read before seeing the flag
+        if(qatomic_read(&ring->tail) != head - used) {
+            event_notifier_set(&shm->qemu_notifier);
+        }
+    }
+}
+
+/* Frames the guest's data, within the credit the host gave */
+static void virtio_vsock_mux_vm_receive(VSockUserConnection* conn,
+                                        VirtQueueElement *tx_elem, uint32_t len)
+{
+    VirtIOVSock* vsock = conn->vsock;
+    uint8_t buf[BUF_ALLOC];
+    uint32_t sent = 0;
+
+    if(len > BUF_ALLOC - (conn->mux_tx_cnt - conn->host_fwd_cnt)) {
+        virtio_error(VIRTIO_DEVICE(vsock),
+            "virtio-vsock: guest pushed too much data for us to handle");
+        return;
+    }
+    if(iov_to_buf(tx_elem->out_sg, tx_elem->out_num, VSOCK_HDR_LEN, &buf, len) != len) {
+        virtio_error(VIRTIO_DEVICE(vsock),
+            "virtio-vsock: tx VirtQueueElement's out buffer is too small!");
+        // element is pushed back and freed in virtio_vsock_handle_tx_vq()
+        return;
+    }
+
+    while(sent < len) {
+        uint32_t chunk = MIN(len - sent, VSOCK_USER_MUX_FRAME_SZ);
+        virtio_vsock_mux_send(conn->mux, conn->mux_stream,
+            VSOCK_USER_MUX_OP_DATA, buf + sent, chunk);
+        sent += chunk;
+    }
+    conn->mux_tx_cnt += len;
+}
+
 static void virtio_vsock_vm_receive(VSockUserConnection* conn,
                                VirtQueueElement *tx_elem, uint32_t len)
 {
     VirtIOVSock* vsock = conn->vsock;
     uint8_t buf[BUF_ALLOC];
 
+    if(conn->shm) {
+        virtio_vsock_shm_vm_receive(conn, tx_elem, len);
+        return;
+    }
+    if(conn->mux) {
+        virtio_vsock_mux_vm_receive(conn, tx_elem, len);
+        return;
+    }
+
     qemu_mutex_lock(&conn->host_buf_lock);
 
     if(fifo8_num_free(&conn->host_buf) < len) {
@@ -641,6 +1399,12 @@ static void virtio_vsock_do_handle_tx_vq(VirtIODevice *vdev, VirtQueue *vq)
     }
 
     virtio_vsock_init_conn_key(&key, &hdr);
+    // the host routes connections by the guest's cid, it can't be anyone else's
+    if(key.vm_cid != vsock->conf.cid) {
+        error_report_once("virtio-vsock: "
+            "guest sent a packet from cid %" PRIu64 " instead of its own", key.vm_cid);
+        goto out;
+    }
     conn = g_hash_table_lookup(vsock->connection_hash_table, &key);
     if(conn == NULL && hdr.op != VIRTIO_VSOCK_OP_REQUEST) {
         VSockUserConnection fake_conn = { 0 };
@@ -675,6 +1439,18 @@ static void virtio_vsock_do_handle_tx_vq(VirtIODevice *vdev, VirtQueue *vq)
     case VIRTIO_VSOCK_OP_CREDIT_UPDATE:
         conn->vm_buf_alloc = hdr.buf_alloc;
         conn->vm_fwd_cnt = hdr.fwd_cnt;
+        // the shared memory isn't polled, resume what the guest had no room for
+        if(conn->shm && (conn->state & ~(VSOCK_USER_CONNECTION_STATE_SHUTDOWN_SEND))
+            == VSOCK_USER_CONNECTION_STATE_CONNECTED)
+        {
+            virtio_vsock_shm_recv_connected(conn);
+        }
+        // nor is what the host sent on the multiplexed socket
+        if(conn->mux && (conn->state & ~(VSOCK_USER_CONNECTION_STATE_SHUTDOWN_SEND))
+            == VSOCK_USER_CONNECTION_STATE_CONNECTED)
+        {
+            virtio_vsock_mux_recv_connected(conn);
+        }
         break;
     case VIRTIO_VSOCK_OP_CREDIT_REQUEST:
         virtio_vsock_conn_credit_update(conn);
@@ -752,6 +1528,10 @@ static void virtio_vsock_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if(vsock->conf.mux) {
+        vsock->mux = virtio_vsock_mux_new(vsock);
+    }
+
     virtio_init(vdev, VIRTIO_ID_VSOCK, sizeof(struct virtio_vsock_config));
     vsock->rx_vq = virtio_add_queue(vdev, 128, NULL);
     vsock->tx_vq = virtio_add_queue(vdev, 128, virtio_vsock_handle_tx_vq);
@@ -770,7 +1550,15 @@ static void virtio_vsock_device_unrealize(DeviceState *dev)
 
     qio_net_listener_disconnect(vsock->guest_socket_listener);
     iothread_stop(vsock->io_thread);
+    if(vsock->mux) {
+        // nothing is sent for the streams destroyed with the table
+        vsock->mux->state = VSOCK_USER_MUX_STATE_FAILED;
+    }
     g_hash_table_destroy(vsock->connection_hash_table);
+    if(vsock->mux) {
+        virtio_vsock_mux_free(vsock->mux);
+        vsock->mux = NULL;
+    }
     g_free(vsock->guest_socket_listener);
     g_free(vsock->io_thread);
 
@@ -784,6 +1572,8 @@ static const Property virtio_vsock_properties[] = {
     DEFINE_PROP_UNSIGNED_NODEFAULT("cid", VirtIOVSock, conf.cid, qdev_prop_uint32, uint32_t),
     DEFINE_PROP_STRING("host-uds-path", VirtIOVSock, conf.host_uds_path),
     DEFINE_PROP_STRING("guest-uds-path", VirtIOVSock, conf.guest_uds_path),
+    DEFINE_PROP_BOOL("shm", VirtIOVSock, conf.shm, true),
+    DEFINE_PROP_BOOL("mux", VirtIOVSock, conf.mux, false),
 };
 
 static void virtio_vsock_class_init(ObjectClass *klass, const void *data)
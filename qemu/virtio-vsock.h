@@ -14,6 +14,7 @@
 #include "qemu/osdep.h"
 #include "qemu/module.h"
 #include "qemu/fifo8.h"
+#include "qemu/event_notifier.h"
 #include "qom/object.h"
 #include "hw/virtio/virtio.h"
 #include "hw/qdev-properties.h"
@@ -28,6 +29,10 @@ OBJECT_DECLARE_SIMPLE_TYPE(VirtIOVSock, VIRTIO_VSOCK)
 
 #define VSOCK_USER_CONNECTION_REJECTED 0
 #define VSOCK_USER_CONNECTION_ACCEPTED 1
+/* Accepted along with the shared memory offered with the connection key */
+#define VSOCK_USER_CONNECTION_ACCEPTED_SHM 2
+/* Reply to the multiplexed connection's hello */
+#define VSOCK_USER_CONNECTION_ACCEPTED_MUX 3
 
 /* Socket is connected on the vm side only */
 #define VSOCK_USER_CONNECTION_STATE_CONNECTED_VM (1 << 0)
@@ -50,7 +55,98 @@ typedef struct VSockUserConnectionKey {
     uint32_t vm_port;
 } QEMU_PACKED VSockUserConnectionKey;
 
-typedef struct VSockUserConnection {
+/*
+ * Optional shared memory transport of a connection to the host. A sealed
+ * memfd holding a ring per direction, qemu's eventfd and the host's
+ * eventfd are passed with the connection key (SCM_RIGHTS). Once the host
+ * replies VSOCK_USER_CONNECTION_ACCEPTED_SHM the data goes through the
+ * rings and the socket only carries the connection's state.
+ * The layout is shared with the host's app/src/ShmTransport.cpp.
+ */
+#define VSOCK_USER_SHM_MAGIC 0x52485356 /* "VSHR" */
+#define VSOCK_USER_SHM_VERSION 1
+#define VSOCK_USER_SHM_HEADER_SZ 4096
+/* Rings, by producer */
+#define VSOCK_USER_SHM_RING_QEMU 0
+#define VSOCK_USER_SHM_RING_HOST 1
+
+typedef struct VSockUserShmRing {
+    uint32_t head; // free-running, written by the producer
+    uint8_t pad0[60];
+    uint32_t tail; // free-running, written by the consumer
+    /* Set by the producer, the consumer rings it after reading */
+    uint32_t producer_waiting;
+    uint8_t pad1[56];
+} VSockUserShmRing;
+
+typedef struct VSockUserShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size;
+    uint8_t pad[52];
+    VSockUserShmRing rings[2];
+} VSockUserShmHeader;
+
+/*
+ * Optional multiplexed connection to the host: a single socket opened with
+ * a key whose host_cid is VSOCK_USER_MUX_HELLO_CID and host_port the
+ * version. Once the host replies VSOCK_USER_CONNECTION_ACCEPTED_MUX, the
+ * guest's connections are opened on it as streams instead of connecting a
+ * socket each. Every frame is a VSockUserMuxHeader followed by len bytes.
+ * A host that doesn't know the hello rejects it, connections then use a
+ * socket each. Shared with the host's app/src/VSockUserMux.hpp.
+ */
+#define VSOCK_USER_MUX_HELLO_CID 0x58554d5253555356ULL /* "VSUSRMUX" */
+#define VSOCK_USER_MUX_VERSION 1
+/* Largest payload of a frame */
+#define VSOCK_USER_MUX_FRAME_SZ (64 * 1024)
+
+/* Stream is opened by us, the payload is the connection key */
+#define VSOCK_USER_MUX_OP_OPEN 0
+#define VSOCK_USER_MUX_OP_ACCEPT 1
+#define VSOCK_USER_MUX_OP_REJECT 2
+#define VSOCK_USER_MUX_OP_DATA 3
+/* The payload is the sender's free-running count of bytes consumed */
+#define VSOCK_USER_MUX_OP_CREDIT 4
+#define VSOCK_USER_MUX_OP_CLOSE 5
+
+#define VSOCK_USER_MUX_STATE_CONNECTING 0
+#define VSOCK_USER_MUX_STATE_READY 1
+/* Rejected or lost, connections use a socket each */
+#define VSOCK_USER_MUX_STATE_FAILED 2
+
+typedef struct VSockUserMuxHeader {
+    uint32_t stream;
+    uint32_t op;
+    uint32_t len;
+} QEMU_PACKED VSockUserMuxHeader;
+
+typedef struct VSockUserConnection VSockUserConnection;
+
+typedef struct VSockUserMux {
+    VirtIOVSock* vsock;
+    QIOChannelSocket* sioc;
+    GByteArray* out; // frames for the host, written on the io thread
+    QemuMutex out_lock;
+    GByteArray* in; // what's read of a frame that isn't complete
+    GHashTable* streams; // stream id -> VSockUserConnection
+    uint32_t next_stream;
+    guint close_handler_watch_source_id;
+    uint8_t state;
+} VSockUserMux;
+
+typedef struct VSockUserShm {
+    VSockUserConnection* conn;
+    VSockUserShmHeader* hdr;
+    uint8_t* data[2];
+    size_t map_size;
+    int memfd; // only until it's sent
+    EventNotifier qemu_notifier; // rung by the host
+    EventNotifier host_notifier; // rung by us
+    bool credit_wanted;
+} VSockUserShm;
+
+struct VSockUserConnection {
     VirtIOVSock* vsock;
     VSockUserConnectionKey* key;
     QIOChannelSocket* sioc;
@@ -61,13 +157,21 @@ typedef struct VSockUserConnection {
     uint32_t host_fwd_cnt; // free-running counter
     uint32_t host_tx_cnt; // free-running counter
     guint close_handler_watch_source_id;
+    VSockUserShm* shm;
+    VSockUserMux* mux; // the connection is a stream on it
+    uint32_t mux_stream;
+    Fifo8 vm_buf; // host's data the guest has no credit for yet
+    uint32_t mux_tx_cnt; // free-running counter
+    uint32_t mux_credited; // host_tx_cnt last sent to the host
     uint8_t state;
-} QEMU_ALIGNED(8) VSockUserConnection;
+} QEMU_ALIGNED(8);
 
 typedef struct VirtIOVSockConf {
     uint32_t cid;
     char* guest_uds_path;
     char* host_uds_path;
+    bool shm;
+    bool mux;
 } VirtIOVSockConf;
 
 struct VirtIOVSock {
@@ -82,6 +186,7 @@ struct VirtIOVSock {
     SocketAddress guest_uds_addr;
     SocketAddress host_uds_addr;
     QIONetListener *guest_socket_listener;
+    VSockUserMux* mux;
 
     VirtIOVSockConf conf;
 };